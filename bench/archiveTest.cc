@@ -0,0 +1,399 @@
+/* Archive Round Trip Test
+ *
+ * Codes columns chosen to hit the corners of the delta and XOR coding in
+ * src/archive.cc into an archive file, opens it again and checks that every
+ * timestamp and every byte of every sample comes back as it went in: NaNs with
+ * their payloads, -0.0, integers whose differences wrap around, runs that end
+ * right at the end of an element's series or whose length needs one more byte
+ * of varint, columns with no samples or no elements, and char and logical
+ * (uint8 0 or 1, as Simulink booleans arrive) columns.
+ *
+ *     cd src && make archiveTest && ../archiveTest
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "columns.h"
+#include "archive.h"
+#include "signalLogger.h"
+
+#define MAX_TEST_COLUMNS 32
+
+/// PRIVATE DECLARATIONS
+SignalColumn* addTestColumn(const char* name, uint8_t dataTypeId, uint8_t nDims,
+        uint16_t dim0, uint16_t dim1, uint32_t nSamples);
+void setTestElement(SignalColumn* pcol, uint32_t i, uint32_t e, uint64_t value);
+void setTestDouble(SignalColumn* pcol, uint32_t i, uint32_t e, double value);
+void setTestSingle(SignalColumn* pcol, uint32_t i, uint32_t e, float value);
+void setCountingTimestamps(SignalColumn* pcol, uint32_t first, uint32_t stride);
+void buildNaNColumns();
+void buildNegativeZeroColumns();
+void buildWrapColumns();
+void buildRunColumns();
+void buildEmptyColumns();
+void buildCharAndLogicalColumns();
+bool checkColumn(const SignalArchive* parc, const SignalColumn* pcol);
+
+///////////// GLOBALS /////////////
+
+SignalColumn testColumns[MAX_TEST_COLUMNS];
+int nTestColumns;
+
+// coded timestamps no longer than this for columns that are one long run
+uint32_t maxRunTimestampBytes = 8;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    buildNaNColumns();
+    buildNegativeZeroColumns();
+    buildWrapColumns();
+    buildRunColumns();
+    buildEmptyColumns();
+    buildCharAndLogicalColumns();
+
+    MatBuffer mb;
+    initMatBuffer(&mb);
+    writeArchiveHeader(&mb, nTestColumns);
+    for(int c = 0; c < nTestColumns; c++)
+        encodeArchiveColumn(&mb, testColumns + c);
+
+    char fileName[] = "/tmp/archiveTest.XXXXXX";
+    int fd = mkstemp(fileName);
+    if(fd == -1)
+        diep("Error creating archive file");
+    if(write(fd, mb.data, mb.nBytes) != (ssize_t)mb.nBytes)
+        diep("Error writing archive file");
+    close(fd);
+
+    SignalArchive arc;
+    bool ok = openSignalArchive(fileName, &arc);
+    unlink(fileName);
+    if(!ok) {
+        printf("archive of %d columns would not open\n", nTestColumns);
+        return 1;
+    }
+    ok = arc.nColumns == (uint32_t)nTestColumns;
+
+    for(int c = 0; c < nTestColumns; c++) {
+        bool colOk = checkColumn(&arc, testColumns + c);
+        printf("  %-20s %7u samples : %s\n", testColumns[c].name, testColumns[c].nSamples,
+                colOk ? "ok" : "FAILED");
+        ok = colOk && ok;
+    }
+    printf("%d columns, %zu bytes coded\n%s\n", nTestColumns, mb.nBytes, ok ? "ok" : "FAILED");
+
+    closeSignalArchive(&arc);
+    freeMatBuffer(&mb);
+    for(int c = 0; c < nTestColumns; c++) {
+        free(testColumns[c].timestamps);
+        free(testColumns[c].data);
+    }
+    return ok ? EXIT_SUCCESS : 1;
+}
+
+// a column of nSamples zeroed samples one ms apart, dim0 x dim1
+SignalColumn* addTestColumn(const char* name, uint8_t dataTypeId, uint8_t nDims,
+        uint16_t dim0, uint16_t dim1, uint32_t nSamples)
+{
+    if(nTestColumns == MAX_TEST_COLUMNS)
+        diep("Too many test columns");
+    SignalColumn* pcol = testColumns + nTestColumns++;
+    memset(pcol, 0, sizeof(SignalColumn));
+    pcol->name = (char*)name;
+    pcol->lenName = strlen(name);
+    pcol->dataTypeId = dataTypeId;
+    pcol->nDims = nDims;
+    pcol->dims[0] = dim0;
+    pcol->dims[1] = dim1;
+    pcol->nBytesPerSample = getSizeOfDataTypeId(dataTypeId) * dim0 * (nDims > 1 ? dim1 : 1);
+    pcol->nSamples = nSamples;
+    pcol->capacitySamples = nSamples;
+
+    // malloc(0) may return NULL, which is fine for an empty column
+    pcol->timestamps = (uint32_t*)calloc(nSamples ? nSamples : 1, sizeof(uint32_t));
+    pcol->data = (uint8_t*)calloc(nSamples ? nSamples : 1,
+            pcol->nBytesPerSample ? pcol->nBytesPerSample : 1);
+    if(pcol->timestamps == NULL || pcol->data == NULL)
+        diep("Error allocating test column");
+    setCountingTimestamps(pcol, 1000, 1);
+    return pcol;
+}
+
+void setTestElement(SignalColumn* pcol, uint32_t i, uint32_t e, uint64_t value)
+{
+    int elemBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    uint8_t* p = pcol->data + (size_t)i * pcol->nBytesPerSample + e * elemBytes;
+    for(int b = 0; b < elemBytes; b++)
+        p[b] = (uint8_t)(value >> (8 * b));
+}
+
+void setTestDouble(SignalColumn* pcol, uint32_t i, uint32_t e, double value)
+{
+    memcpy(pcol->data + (size_t)i * pcol->nBytesPerSample + e * sizeof(double),
+            &value, sizeof(double));
+}
+
+void setTestSingle(SignalColumn* pcol, uint32_t i, uint32_t e, float value)
+{
+    memcpy(pcol->data + (size_t)i * pcol->nBytesPerSample + e * sizeof(float),
+            &value, sizeof(float));
+}
+
+void setCountingTimestamps(SignalColumn* pcol, uint32_t first, uint32_t stride)
+{
+    for(uint32_t i = 0; i < pcol->nSamples; i++)
+        pcol->timestamps[i] = first + i * stride;
+}
+
+/////// COLUMNS /////////
+
+// NaNs must come back bit for bit, payload, sign and quiet bit included,
+// whether they repeat, follow each other or sit between ordinary values
+void buildNaNColumns()
+{
+    SignalColumn* pcol = addTestColumn("nanDouble", DTID_DOUBLE, 2, 1, 4, 1000);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, 0x7ff8000000000000ull + i);         // payloads
+        setTestElement(pcol, i, 1, i % 3 == 0 ? 0x7ff0000000000001ull  // signaling
+                : i % 3 == 1 ? 0xfff8000000000000ull : 0x7ff8000000000000ull);
+        if(i % 5 == 0)
+            setTestElement(pcol, i, 2, 0x7ffc0000deadbeefull);
+        else
+            setTestDouble(pcol, i, 2, i * 0.25);
+        setTestElement(pcol, i, 3, 0x7fffffffffffffffull);             // all the same
+    }
+
+    pcol = addTestColumn("nanSingle", DTID_SINGLE, 2, 1, 3, 1000);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, 0x7fc00000u + i);
+        setTestElement(pcol, i, 1, i % 2 ? 0x7f800001u : 0xffc00000u);
+        if(i % 7 == 0)
+            setTestElement(pcol, i, 2, 0x7fc0beefu);
+        else
+            setTestSingle(pcol, i, 2, i * 0.5f);
+    }
+}
+
+// -0.0 only differs from 0.0 in its sign bit, which the XOR coding must keep
+void buildNegativeZeroColumns()
+{
+    SignalColumn* pcol = addTestColumn("negZeroDouble", DTID_DOUBLE, 2, 1, 3, 500);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestDouble(pcol, i, 0, i % 2 ? -0.0 : 0.0);
+        setTestDouble(pcol, i, 1, -0.0);
+        setTestDouble(pcol, i, 2, i % 50 < 25 ? -0.0 : -1e-300);
+    }
+
+    pcol = addTestColumn("negZeroSingle", DTID_SINGLE, 2, 1, 2, 500);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestSingle(pcol, i, 0, i % 3 ? -0.0f : 0.0f);
+        setTestSingle(pcol, i, 1, -0.0f);
+    }
+}
+
+// differences that only fit once wrapped at the type's width, and timestamps
+// that wrap past 2^32 or go backwards
+void buildWrapColumns()
+{
+    SignalColumn* pcol = addTestColumn("wrapInt8", DTID_INT8, 2, 1, 2, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, (uint64_t)(120 + i));      // counts through 127 to -128
+        setTestElement(pcol, i, 1, i % 2 ? 0x80 : 0x7f);      // -128, 127, ...
+    }
+    setCountingTimestamps(pcol, 0xffffff00u, 1);
+
+    pcol = addTestColumn("wrapUint8", DTID_UINT8, 2, 1, 2, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, i % 2 ? 255 : 0);
+        setTestElement(pcol, i, 1, (uint64_t)(250 + 3 * i));
+    }
+    for(uint32_t i = 0; i < pcol->nSamples; i++)
+        pcol->timestamps[i] = i % 2 ? 0 : 0xffffffffu;
+
+    pcol = addTestColumn("wrapInt16", DTID_INT16, 2, 1, 2, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, i % 2 ? 0x8000 : 0x7fff);
+        setTestElement(pcol, i, 1, (uint64_t)(0x7ff0 + 97 * i));
+    }
+    setCountingTimestamps(pcol, 5000000, (uint32_t)-1);
+
+    pcol = addTestColumn("wrapUint16", DTID_UINT16, 2, 1, 1, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++)
+        setTestElement(pcol, i, 0, i % 3 == 0 ? 0xffff : i % 3 == 1 ? 0 : 0x8000);
+
+    pcol = addTestColumn("wrapInt32", DTID_INT32, 2, 1, 2, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, i % 2 ? 0x80000000u : 0x7fffffffu);
+        setTestElement(pcol, i, 1, (uint64_t)(0x7fffff00u + 0x1000001u * i));
+    }
+
+    pcol = addTestColumn("wrapUint32", DTID_UINT32, 2, 1, 2, 600);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, i % 2 ? 0xffffffffu : 0);
+        setTestElement(pcol, i, 1, (uint32_t)(0xfffffff0u + 0x9e3779b9u * i));
+    }
+    for(uint32_t i = 0; i < pcol->nSamples; i++)
+        pcol->timestamps[i] = 0x9e3779b9u * i;
+}
+
+// runs ending exactly at the end of an element's series, so the next series
+// must start afresh rather than carry the run or its difference on, and runs
+// whose length takes one more byte of varint than the run one shorter
+void buildRunColumns()
+{
+    const uint32_t runLengths[] = { 1, 2, 63, 64, 65, 8191, 8192, 8193 };
+    const int nRunLengths = sizeof(runLengths) / sizeof(runLengths[0]);
+    uint32_t nSamples = 0;
+    for(int r = 0; r < nRunLengths; r++)
+        nSamples += runLengths[r] + 1;
+
+    SignalColumn* pcol = addTestColumn("runs", DTID_UINT16, 2, 1, 4, nSamples);
+    uint32_t i = 0;
+    uint16_t value = 0;
+    for(int r = 0; r < nRunLengths; r++) {
+        // a difference of 3 repeated runLengths[r] times, then a jump to end it
+        for(uint32_t k = 0; k < runLengths[r]; k++, i++)
+            setTestElement(pcol, i, 0, value += 3);
+        setTestElement(pcol, i++, 0, value += 1000);
+    }
+    for(i = 0; i < nSamples; i++) {
+        // counts up by 3 to the very end, then the next element starts with
+        // the same difference
+        setTestElement(pcol, i, 1, 3 * i);
+        setTestElement(pcol, i, 2, 3 + 3 * i);
+        // constant then a single change at the last sample
+        setTestElement(pcol, i, 3, i == nSamples - 1 ? 7 : 0);
+    }
+
+    // timestamps one long run
+    pcol = addTestColumn("runTimestamps", DTID_UINT8, 2, 1, 1, 100000);
+    setCountingTimestamps(pcol, 0, 1);
+
+    pcol = addTestColumn("oneSample", DTID_INT32, 2, 1, 2, 1);
+    setTestElement(pcol, 0, 0, 0x80000000u);
+    setTestElement(pcol, 0, 1, 5);
+
+    pcol = addTestColumn("twoSamples", DTID_DOUBLE, 2, 1, 1, 2);
+    setTestDouble(pcol, 0, 0, 1.5);
+    setTestDouble(pcol, 1, 0, 1.5);
+}
+
+// a signal with no samples, and samples with no elements
+void buildEmptyColumns()
+{
+    addTestColumn("noSamples", DTID_DOUBLE, 2, 3, 2, 0);
+    addTestColumn("noSamplesInt", DTID_INT16, 2, 1, 1, 0);
+    addTestColumn("noElements", DTID_SINGLE, 2, 0, 3, 50);
+    addTestColumn("noElementsChar", DTID_CHAR, 2, 1, 0, 50);
+}
+
+// char strings that change now and then, and a logical toggling in bursts
+void buildCharAndLogicalColumns()
+{
+    const char* words[] = { "idle    ", "reach   ", "hold    ", "\xc3\xbf\x01\x7f~   " };
+    SignalColumn* pcol = addTestColumn("state", DTID_CHAR, 2, 1, 8, 2000);
+    for(uint32_t i = 0; i < pcol->nSamples; i++)
+        memcpy(pcol->data + (size_t)i * pcol->nBytesPerSample, words[(i / 37) % 4], 8);
+
+    pcol = addTestColumn("emptyString", DTID_CHAR, 2, 1, 1, 300);
+
+    pcol = addTestColumn("logical", DTID_UINT8, 2, 1, 3, 2000);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        setTestElement(pcol, i, 0, (i / 11) % 2);
+        setTestElement(pcol, i, 1, i % 2);
+        setTestElement(pcol, i, 2, 1);
+    }
+}
+
+/////// CHECKING /////////
+
+// find pcol's column in the archive and check that it decodes to what was coded
+bool checkColumn(const SignalArchive* parc, const SignalColumn* pcol)
+{
+    int c = findArchiveColumn(parc, pcol->name, pcol->lenName, 0);
+    if(c == -1) {
+        printf("    column not found\n");
+        return 0;
+    }
+
+    const ArchiveColumnHeader* ph = parc->columns[c];
+    bool ok = ph->nSamples == pcol->nSamples && ph->dataTypeId == pcol->dataTypeId &&
+        ph->nDims == pcol->nDims && getArchiveSampleBytes(ph) == pcol->nBytesPerSample;
+    if(!ok) {
+        printf("    header doesn't match\n");
+        return 0;
+    }
+
+    if(pcol->nSamples > 0) {
+        uint32_t minTimestamp = pcol->timestamps[0];
+        uint32_t maxTimestamp = pcol->timestamps[0];
+        for(uint32_t i = 1; i < pcol->nSamples; i++) {
+            if(pcol->timestamps[i] < minTimestamp)
+                minTimestamp = pcol->timestamps[i];
+            if(pcol->timestamps[i] > maxTimestamp)
+                maxTimestamp = pcol->timestamps[i];
+        }
+        if(ph->minTimestamp != minTimestamp || ph->maxTimestamp != maxTimestamp) {
+            printf("    timestamp range %u to %u, should be %u to %u\n",
+                    ph->minTimestamp, ph->maxTimestamp, minTimestamp, maxTimestamp);
+            ok = 0;
+        }
+    }
+
+    // a counter's timestamps are a difference and a run
+    if(strcmp(pcol->name, "runTimestamps") == 0 && ph->nTimestampBytes > maxRunTimestampBytes) {
+        printf("    %u bytes of timestamps for a counter\n", ph->nTimestampBytes);
+        ok = 0;
+    }
+
+    // one extra sample each so that writing past the end shows up
+    size_t dataBytes = (size_t)pcol->nSamples * pcol->nBytesPerSample;
+    uint32_t* timestamps = (uint32_t*)malloc((pcol->nSamples + 1) * sizeof(uint32_t));
+    uint8_t* data = (uint8_t*)malloc(dataBytes + pcol->nBytesPerSample + 1);
+    if(timestamps == NULL || data == NULL)
+        diep("Error allocating decoded column");
+    memset(timestamps, 0xa5, (pcol->nSamples + 1) * sizeof(uint32_t));
+    memset(data, 0xa5, dataBytes + pcol->nBytesPerSample + 1);
+
+    if(!decodeArchiveColumn(ph, timestamps, data)) {
+        printf("    would not decode\n");
+        ok = 0;
+    } else {
+        for(uint32_t i = 0; i < pcol->nSamples; i++) {
+            if(timestamps[i] != pcol->timestamps[i]) {
+                printf("    timestamp %u is %u, should be %u\n", i, timestamps[i],
+                        pcol->timestamps[i]);
+                ok = 0;
+                break;
+            }
+        }
+        for(size_t b = 0; b < dataBytes; b++) {
+            if(data[b] != pcol->data[b]) {
+                printf("    sample %zu byte %zu is 0x%02x, should be 0x%02x\n",
+                        b / pcol->nBytesPerSample, b % pcol->nBytesPerSample, data[b],
+                        pcol->data[b]);
+                ok = 0;
+                break;
+            }
+        }
+        if(timestamps[pcol->nSamples] != 0xa5a5a5a5u || data[dataBytes] != 0xa5) {
+            printf("    decoded past the end of the column\n");
+            ok = 0;
+        }
+    }
+
+    free(timestamps);
+    free(data);
+    return ok;
+}
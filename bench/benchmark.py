@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""End to end benchmark of signalLogger over loopback.
+
+Starts a signalLogger with -j stats on a spare port, then drives it with
+signalGenerator at increasing tick rates, each for a few seconds. After each
+run it waits for the writer to catch up and compares what the logger wrote
+with what the generator sent. It reports, for each rate:
+- the tick rate the generator actually reached
+- the fraction of signals lost, and where (in the kernel, in ticks that never
+  completed, or in the signal buffer)
+- the receive-to-write latency percentiles from the logger's histogram
+
+The highest rate that loses no more than --max-loss of its signals is
+reported as the maximum sustainable tick rate. Everything the logger writes
+goes to a temporary directory that's removed afterwards.
+
+    cd src && make && cd ..
+    bench/benchmark.py --signals 100 --type mixed --dims 4x4
+    bench/benchmark.py --rates 1000,5000,20000 -- -w 2 -R 50
+    bench/benchmark.py --compare-batch --packets 4
+
+With --compare-batch the sweep is run twice, first with signalLogger -b 1,
+receiving one packet per call into the kernel as it did before recvmmsg, then
+with the default batch size, and the packets/sec each reached are compared.
+
+Arguments after -- are passed to signalLogger. Only the Python standard
+library is needed. The generator and logger share the machine, so on a small
+box the generator may not reach the higher rates itself; those runs are
+marked "gen" and stop the sweep.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# the logger rewrites its stats file this often, in seconds
+STATS_INTERVAL_SEC = 1
+
+# a run counts as reaching its rate if the generator kept within this of it
+MIN_RATE_FRACTION = 0.95
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Benchmark signalLogger over loopback with signalGenerator")
+    parser.add_argument("--logger", default=os.path.join(REPO_DIR, "signalLogger"))
+    parser.add_argument("--generator", default=os.path.join(REPO_DIR, "signalGenerator"))
+    parser.add_argument("--port", type=int, default=25900)
+    parser.add_argument("--signals", type=int, default=10, help="signals per tick")
+    parser.add_argument("--type", default="double", help="signal data type, or mixed")
+    parser.add_argument("--dims", default="1", help="signal dims, like 3x2")
+    parser.add_argument("--packets", type=int, default=1,
+                        help="split each tick over at least this many packets")
+    parser.add_argument("--ids", action="store_true",
+                        help="send signal ids with a dictionary rather than headers")
+    parser.add_argument("--loss", type=float, default=0,
+                        help="percentage of packets the generator loses on purpose")
+    parser.add_argument("--reorder", type=float, default=0,
+                        help="percentage of packets the generator sends late")
+    parser.add_argument("--duration", type=float, default=5, help="seconds per rate")
+    parser.add_argument("--rates", help="comma separated tick rates, rather than doubling "
+                        "from --start-rate until signals are lost")
+    parser.add_argument("--start-rate", type=float, default=1000)
+    parser.add_argument("--max-rate", type=float, default=1024000)
+    parser.add_argument("--max-loss", type=float, default=0.0,
+                        help="largest fraction of signals lost for a rate to count as "
+                        "sustained, besides those the generator lost on purpose")
+    parser.add_argument("--compare-batch", action="store_true",
+                        help="run the sweep with -b 1 and with the default batch size, "
+                        "and compare the packets/sec received")
+    parser.add_argument("--json", help="also write the results to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the logged data")
+    parser.add_argument("logger_args", nargs="*", help="passed on to signalLogger")
+    return parser.parse_args()
+
+
+def read_stats(path, newer_than):
+    """The first stream's stats, once the file's been rewritten after newer_than."""
+    deadline = time.time() + 10 * STATS_INTERVAL_SEC
+    while time.time() < deadline:
+        try:
+            with open(path) as f:
+                stats = json.load(f)
+            if stats["time"] > newer_than:
+                return stats["streams"][0]
+        except (OSError, ValueError):
+            pass
+        time.sleep(0.1)
+    sys.exit("signalLogger stopped writing %s" % path)
+
+
+def wait_for_writer(path, sent_signals, before):
+    """Stats once the writer has written everything it's going to."""
+    written = None
+    while True:
+        stats = read_stats(path, time.time())
+        now = stats["write"]["signals"] - before["write"]["signals"]
+        if now >= sent_signals or now == written:
+            return stats
+        written = now
+
+
+def histogram_delta(after, before):
+    counts = list(after["buckets"])
+    for i, n in enumerate(before["buckets"]):
+        counts[i] -= n
+    return counts
+
+
+def percentile(counts, fraction):
+    """Upper edge in microseconds of the log2 bucket holding this fraction."""
+    total = sum(counts)
+    if total == 0:
+        return 0
+    target = int(fraction * total)
+    seen = 0
+    for i, n in enumerate(counts):
+        seen += n
+        if seen > target:
+            return 0 if i == 0 else (1 << i) - 1
+    return (1 << len(counts)) - 1
+
+
+def run_rate(args, rate, stats_file, before):
+    cmd = [args.generator, "-r", str(rate), "-T", str(args.duration),
+           "-n", str(args.signals), "-y", args.type, "-d", args.dims,
+           "-P", str(args.packets), "-l", str(args.loss), "-o", str(args.reorder)]
+    if args.ids:
+        cmd.append("-i")
+    cmd.append(str(args.port))
+    gen = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         universal_newlines=True, check=True)
+    sent = json.loads(gen.stdout.strip().splitlines()[-1])
+
+    after = wait_for_writer(stats_file, sent["signals"], before)
+    rcv, rcv0 = after["receive"], before["receive"]
+    written = after["write"]["signals"] - before["write"]["signals"]
+    lost = sent["signals"] - written
+    latency = histogram_delta(after["latencyUsec"], before["latencyUsec"])
+
+    result = {
+        "targetTickRate": rate,
+        "tickRate": sent["tickRate"],
+        "ticksSent": sent["ticks"],
+        "signalsSent": sent["signals"],
+        "signalsWritten": written,
+        "lossFraction": lost / sent["signals"] if sent["signals"] else 0,
+        "packetsPerSec": ((rcv["packets"] - rcv0["packets"]) / sent["elapsedSec"]
+                          if sent["elapsedSec"] else 0),
+        "kernelDrops": rcv["kernelDrops"] - rcv0["kernelDrops"],
+        "incompleteTicks": rcv["incompleteTicks"] - rcv0["incompleteTicks"],
+        "droppedSignals": rcv["droppedSignals"] - rcv0["droppedSignals"],
+        "latencyUsec": {"p50": percentile(latency, 0.5), "p90": percentile(latency, 0.9),
+                        "p99": percentile(latency, 0.99)},
+        "mbPerSec": sent["bytes"] / sent["elapsedSec"] / 1e6 if sent["elapsedSec"] else 0,
+    }
+    result["reachedRate"] = sent["tickRate"] >= MIN_RATE_FRACTION * rate
+    result["sustained"] = result["reachedRate"] and result["lossFraction"] <= args.max_loss
+    return result, after
+
+
+def print_result(r):
+    status = "ok" if r["sustained"] else ("gen" if not r["reachedRate"] else "LOSS")
+    lat = r["latencyUsec"]
+    print("%10.0f %10.0f %10.0f %8.2f %9.4f%% %8d %8d %8d %9d %9d %9d  %s" % (
+        r["targetTickRate"], r["tickRate"], r["packetsPerSec"], r["mbPerSec"],
+        100 * r["lossFraction"],
+        r["kernelDrops"], r["incompleteTicks"], r["droppedSignals"],
+        lat["p50"], lat["p90"], lat["p99"], status))
+    sys.stdout.flush()
+
+
+def run_sweep(args, extra_logger_args):
+    """Results at each rate, and the highest rate sustained."""
+    data_dir = tempfile.mkdtemp(prefix="signalLoggerBench.")
+    stats_file = os.path.join(data_dir, "stats.json")
+    logger_cmd = [args.logger, "-D", "-s", "%d,,%s" % (args.port, os.path.join(data_dir, "data")),
+                  "-j", "%s,%d" % (stats_file, STATS_INTERVAL_SEC)] + args.logger_args + \
+        extra_logger_args
+    logger_log = open(os.path.join(data_dir, "logger.log"), "w")
+    logger = subprocess.Popen(logger_cmd, stdout=logger_log, stderr=subprocess.STDOUT)
+
+    results = []
+    try:
+        before = read_stats(stats_file, 0)
+        if args.rates:
+            rates = [float(r) for r in args.rates.split(",")]
+        else:
+            rates = []
+            rate = args.start_rate
+            while rate <= args.max_rate:
+                rates.append(rate)
+                rate *= 2
+
+        print("signalLogger %s" % " ".join(logger_cmd[1:]))
+        print("%d %s signals of dims %s per tick, %d+ packets per tick, %gs per rate\n" % (
+            args.signals, args.type, args.dims, args.packets, args.duration))
+        print("%10s %10s %10s %8s %10s %8s %8s %8s %9s %9s %9s" % (
+            "target/s", "ticks/s", "packets/s", "MB/s", "lost", "kernel", "partial", "dropped",
+            "p50 usec", "p90 usec", "p99 usec"))
+
+        for rate in rates:
+            if logger.poll() is not None:
+                sys.exit("signalLogger exited, see %s" % logger_log.name)
+            result, before = run_rate(args, rate, stats_file, before)
+            results.append(result)
+            print_result(result)
+            # without --rates, stop at the first rate that isn't sustained
+            if not args.rates and not result["sustained"]:
+                break
+    finally:
+        logger.send_signal(signal.SIGINT)
+        try:
+            logger.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            logger.kill()
+        logger_log.close()
+        if not args.keep:
+            shutil.rmtree(data_dir, ignore_errors=True)
+        else:
+            print("\nLogged data kept in %s" % data_dir)
+
+    sustained = [r for r in results if r["sustained"]]
+    best = max(sustained, key=lambda r: r["targetTickRate"]) if sustained else None
+    if best is None:
+        print("\nmax sustainable tick rate: 0 ticks/sec")
+    else:
+        print("\nmax sustainable tick rate: %.0f ticks/sec, %.0f packets/sec" % (
+            best["targetTickRate"], best["packetsPerSec"]))
+    return {"loggerArgs": logger_cmd[1:],
+            "maxSustainableTickRate": best["targetTickRate"] if best else 0,
+            "maxSustainablePacketRate": best["packetsPerSec"] if best else 0,
+            "runs": results}
+
+
+def main():
+    args = parse_args()
+    for exe in (args.logger, args.generator):
+        if not os.access(exe, os.X_OK):
+            sys.exit("%s not found, build it with make in src" % exe)
+
+    if not args.compare_batch:
+        output = run_sweep(args, [])
+    else:
+        print("== one packet per receive call (-b 1) ==\n")
+        single = run_sweep(args, ["-b", "1"])
+        print("\n== default receive batch ==\n")
+        batched = run_sweep(args, [])
+        print("\n%-24s %12s %12s" % ("", "ticks/sec", "packets/sec"))
+        for label, r in (("-b 1", single), ("batched", batched)):
+            print("%-24s %12.0f %12.0f" % (label, r["maxSustainableTickRate"],
+                                           r["maxSustainablePacketRate"]))
+        if single["maxSustainablePacketRate"]:
+            print("%-24s %12s %11.1fx" % ("speedup", "", batched["maxSustainablePacketRate"] /
+                                          single["maxSustainablePacketRate"]))
+        output = {"singlePacket": single, "batched": batched}
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(output, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,286 @@
+/* Signal Buffer Stress Test
+ *
+ * Pushes millions of signals through the lock-free SignalRingBuffer in
+ * buffer.cc, from one thread to another, the way the network thread and the
+ * writer's drain thread use it. Signals of many sizes are pushed so that the
+ * producer wraps around the end of the arena over and over, both leaving a wrap
+ * marker and (where there's no room for one) not. The consumer checks that
+ * every signal comes out once, in order, with its timestamp, descriptor and
+ * every byte of its data as pushed.
+ *
+ * First, ticks and dictionaries whose second signal has a malformed header are
+ * decoded, checking that the logger warns and keeps the first signal rather
+ * than exiting or queueing a signal sized from the bad header.
+ *
+ *     cd src && make bufferStress && ../bufferStress
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "signal.h"
+#include "buffer.h"
+#include "schema.h"
+#include "signalLogger.h"
+
+#define DEFAULT_STRESS_SIGNALS 4000000
+
+/* signals are uint8 1 x n, with n cycling through these */
+#define STRESS_N_SIZES 12
+const uint16_t stressSizes[STRESS_N_SIZES] = { 1, 3, 8, 9, 17, 24, 100, 255, 1000, 1234, 2001, 4000 };
+
+/// PRIVATE DECLARATIONS
+uint32_t getStressDescIndex(uint32_t seq);
+uint8_t getStressByte(uint32_t seq, uint32_t i);
+void * producerThread(void * arg);
+void * consumerThread(void * arg);
+uint8_t* putStressHeader(uint8_t* p, const char* name, uint8_t dataTypeId, uint8_t nDims,
+        const uint16_t* dims);
+bool checkMalformedTick(const char* what, uint8_t dataTypeId, uint8_t nDims, const uint16_t* dims);
+bool checkMalformedDictionary(const char* what, uint8_t dataTypeId, uint8_t nDims,
+        const uint16_t* dims);
+bool checkMalformedTicks();
+
+///////////// GLOBALS /////////////
+
+uint32_t nSignals = DEFAULT_STRESS_SIGNALS;
+SignalBuffers* pbuf;
+const SignalDescriptor* descs[STRESS_N_SIZES];
+
+// counted by the consumer
+uint32_t nChecked;
+uint32_t nBad;
+uint32_t nWrapsMarked;
+uint32_t nWrapsUnmarked;
+uint64_t nBytesChecked;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: bufferStress [-n signals]\n"
+           "  Pushes signals through the signal buffer from one thread to another and\n"
+           "  checks each one that comes out\n"
+           "  -n signals : how many to push (default %d)\n",
+           DEFAULT_STRESS_SIGNALS);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        switch(opt) {
+            case 'n':
+                nSignals = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    bool ok = checkMalformedTicks();
+
+    pbuf = allocSignalBuffers();
+    for(int i = 0; i < STRESS_N_SIZES; i++) {
+        char name[32];
+        uint16_t dims[2] = { 1, stressSizes[i] };
+        snprintf(name, sizeof(name), "stress%02d", i);
+        descs[i] = addLocalSignalDescriptor(&pbuf->schemas, name, DTID_UINT8, 2, dims);
+        if(descs[i] == NULL)
+            diep("Error adding stress descriptors");
+    }
+
+    pthread_t producer, consumer;
+    if(pthread_create(&consumer, NULL, consumerThread, NULL) != 0 ||
+            pthread_create(&producer, NULL, producerThread, NULL) != 0)
+        diep("Error starting threads");
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    printf("%u signals, %.1f MB checked, arena wrapped %u times with a marker and %u without\n",
+            nChecked, nBytesChecked / 1e6, nWrapsMarked, nWrapsUnmarked);
+
+    ok = ok && nBad == 0 && nChecked == nSignals && getSignalCountInBuffer(pbuf) == 0;
+    if(nSignals * (uint64_t)SIGNAL_RECORD_HEADER_BYTES > 4 * (uint64_t)SIGNAL_BUFFER_BYTES &&
+            (nWrapsMarked == 0 || nWrapsUnmarked == 0)) {
+        printf("both kinds of wrap should have happened\n");
+        ok = 0;
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+
+    freeSignalBuffers(pbuf);
+    return ok ? EXIT_SUCCESS : 1;
+}
+
+// which descriptor signal seq uses, jumping around so neighbouring records
+// differ in size
+uint32_t getStressDescIndex(uint32_t seq)
+{
+    return (seq * 2654435761u >> 16) % STRESS_N_SIZES;
+}
+
+uint8_t getStressByte(uint32_t seq, uint32_t i)
+{
+    return (uint8_t)(seq * 131 + i * 7 + (i >> 8));
+}
+
+void * producerThread(void * arg)
+{
+    static uint8_t data[UINT16_MAX];
+    for(uint32_t seq = 0; seq < nSignals; seq++) {
+        const SignalDescriptor* pdesc = descs[getStressDescIndex(seq)];
+        for(uint32_t i = 0; i < pdesc->nBytes; i++)
+            data[i] = getStressByte(seq, i);
+
+        Signal s;
+        viewSignalDescriptor(pdesc, &s);
+        s.timestamp = seq;
+        s.receivedUsec = ~seq;
+        s.data = data;
+
+        // wait for room, a record and the most that can be skipped at a wrap
+        while(getSignalBytesInBuffer(pbuf) + 2 * getSignalRecordBytes(&s) > SIGNAL_BUFFER_BYTES)
+            sched_yield();
+
+        if(!pushSignalAtHead(pbuf, &s)) {
+            fprintf(stderr, "signal %u not pushed with room for it\n", seq);
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+void * consumerThread(void * arg)
+{
+    Signal s;
+    uint32_t seq = 0;
+    while(seq < nSignals) {
+        // note which way the producer wrapped, before peeking skips over it
+        uint32_t tail = __atomic_load_n(&pbuf->sbuf.tail, __ATOMIC_RELAXED);
+        if(!peekSignalAtTail(pbuf, &s)) {
+            sched_yield();
+            continue;
+        }
+        uint32_t offset = tail & SIGNAL_BUFFER_MASK;
+        if(s.data - SIGNAL_RECORD_HEADER_BYTES != pbuf->sbuf.arena + offset) {
+            if(SIGNAL_BUFFER_BYTES - offset < SIGNAL_RECORD_HEADER_BYTES)
+                nWrapsUnmarked++;
+            else
+                nWrapsMarked++;
+        }
+
+        const SignalDescriptor* pdesc = descs[getStressDescIndex(seq)];
+        bool ok = s.timestamp == seq && s.receivedUsec == ~seq && s.descId == pdesc->descId &&
+            s.nBytes == pdesc->nBytes;
+        for(uint32_t i = 0; ok && i < s.nBytes; i++)
+            ok = s.data[i] == getStressByte(seq, i);
+        if(!ok && nBad++ < 10)
+            fprintf(stderr, "signal %u came out wrong: timestamp %u, descId %u, %u bytes\n",
+                    seq, s.timestamp, s.descId, s.nBytes);
+
+        nBytesChecked += s.nBytes;
+        releaseSignalAtTail(pbuf);
+        nChecked++;
+        seq++;
+    }
+    return NULL;
+}
+
+// a signal header as a little endian sender sends it, returning the byte after
+uint8_t* putStressHeader(uint8_t* p, const char* name, uint8_t dataTypeId, uint8_t nDims,
+        const uint16_t* dims)
+{
+    uint16_t lenName = strlen(name);
+    memcpy(p, &lenName, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    memcpy(p, name, lenName);
+    p += lenName;
+    *p++ = dataTypeId;
+    *p++ = nDims;
+    memcpy(p, dims, nDims * sizeof(uint16_t));
+    return p + nDims * sizeof(uint16_t);
+}
+
+// decode a tick of a good uint8 1x2 signal followed by one with the header
+// given, which only the good one should come out of
+bool checkMalformedTick(const char* what, uint8_t dataTypeId, uint8_t nDims, const uint16_t* dims)
+{
+    SignalBuffers* pb = allocSignalBuffers();
+    uint8_t tick[256];
+    const uint16_t goodDims[2] = { 1, 2 };
+    uint8_t* p = putStressHeader(tick, "good", DTID_UINT8, 2, goodDims);
+    *p++ = 1;
+    *p++ = 2;
+    p = putStressHeader(p, "bad", dataTypeId, nDims, dims);
+    *p++ = 3;
+
+    int nQueued = processData(pb, tick, p - tick, 1, 0);
+    bool ok = nQueued == 1 && getSignalCountInBuffer(pb) == 1 && pb->stats.malformedTicks == 1;
+    printf("malformed header, %s: %s\n", what, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    freeSignalBuffers(pb);
+    return ok;
+}
+
+// decode a dictionary giving id 5 a good uint8 1x2 signal and id 6 the header
+// given, then a tick sending both by id. Id 6 should be left unknown, so only
+// id 5's signal comes out of the tick
+bool checkMalformedDictionary(const char* what, uint8_t dataTypeId, uint8_t nDims,
+        const uint16_t* dims)
+{
+    SignalBuffers* pb = allocSignalBuffers();
+    uint8_t dictionary[256];
+    const uint16_t goodDims[2] = { 1, 2 };
+    uint16_t signalIds[2] = { 5, 6 };
+    uint8_t* p = dictionary;
+    memcpy(p, signalIds, sizeof(uint16_t));
+    p = putStressHeader(p + sizeof(uint16_t), "good", DTID_UINT8, 2, goodDims);
+    memcpy(p, signalIds + 1, sizeof(uint16_t));
+    p = putStressHeader(p + sizeof(uint16_t), "bad", dataTypeId, nDims, dims);
+    processDictionaryData(pb, dictionary, p - dictionary, 1);
+
+    uint8_t tick[16];
+    p = tick;
+    memcpy(p, signalIds, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    *p++ = 1;
+    *p++ = 2;
+    memcpy(p, signalIds + 1, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    *p++ = 3;
+
+    int nQueued = processSignalIdData(pb, tick, p - tick, 2, 0);
+    bool ok = pb->stats.malformedTicks == 1 && nQueued == 1 &&
+        getSignalCountInBuffer(pb) == 1 && pb->stats.unknownSignalIds == 1;
+    printf("malformed dictionary header, %s: %s\n", what, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    freeSignalBuffers(pb);
+    return ok;
+}
+
+bool checkMalformedTicks()
+{
+    const uint16_t dims1[2] = { 1, 1 };
+    const uint16_t dimsOverflow[3] = { 32768, 32768, 4 };
+    const uint16_t dimsTooBig[2] = { 1000, 1000 };
+
+    printf("expect warnings for each malformed tick and dictionary\n");
+    fflush(stdout);
+    bool ok = checkMalformedTick("unknown data type", DTID_CHAR + 1, 2, dims1);
+    ok = checkMalformedTick("dims overflowing 32 bits", DTID_UINT8, 3, dimsOverflow) && ok;
+    ok = checkMalformedTick("bigger than a tick", DTID_DOUBLE, 2, dimsTooBig) && ok;
+    ok = checkMalformedDictionary("unknown data type", DTID_CHAR + 1, 2, dims1) && ok;
+    ok = checkMalformedDictionary("dims overflowing 32 bits", DTID_UINT8, 3, dimsOverflow) && ok;
+    ok = checkMalformedDictionary("bigger than a tick", DTID_DOUBLE, 2, dimsTooBig) && ok;
+    printf("\n");
+    return ok;
+}
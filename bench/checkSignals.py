@@ -0,0 +1,418 @@
+#!/usr/bin/env python3
+"""Check what signalLogger wrote from signalGenerator, value by value.
+
+signalGenerator puts t + j + k, cast to the signal's type, in element k of
+signal j (sigNNNN) in the tick with timestamp t. Given a data root, this reads
+every segment under it and checks three things:
+- every element of every signal holds exactly that value
+- no signal was written twice
+- how many signals and ticks were written
+Structs and columns files can both be read, compressed (-z) or not. Columns
+widened to double (-W) can be read too, as long as --type says what was sent.
+The partial tick signals written with -P are counted rather than checked.
+
+    bench/checkSignals.py /expdata/signals/25000
+
+With --run it starts a signalLogger on a spare port with the arguments after
+--, and sends it --ticks ticks with signalGenerator. It stops the logger with
+SIGINT as soon as the generator is done, then checks that every signal the
+generator sent in a complete tick was written. With --tap, signalTap watches
+the logger's tap meanwhile, and the first value of each signal it prints is
+checked too.
+
+    bench/checkSignals.py --run -- -z 1 -O aio
+    bench/checkSignals.py --run --generator-args="-e big" --tap -- -e big -t 16
+
+With --all it does that for each feature in turn, printing a line for each:
+
+    cd src && make && cd ..
+    bench/checkSignals.py --all
+
+Only the Python standard library is needed. Everything logged goes to a
+temporary directory that's removed afterwards, unless --keep is given.
+"""
+
+import argparse
+import array
+import glob
+import json
+import os
+import shlex
+import shutil
+import signal
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+REPO_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# MAT-file data types and array classes, see src/matfile.h
+MI_TYPECODES = {1: "b", 2: "B", 3: "h", 4: "H", 5: "i", 6: "I", 7: "f", 9: "d"}
+MI_MATRIX = 14
+MI_COMPRESSED = 15
+MX_STRUCT_CLASS = 2
+MX_DOUBLE_CLASS = 6
+
+# signalGenerator -y types in dataTypeId order, which mixed cycles through, and
+# the MAT-file class each is written as
+TYPES = ["double", "single", "int8", "uint8", "int16", "uint16", "int32", "uint32", "char"]
+TYPE_CLASSES = {"double": 6, "single": 7, "int8": 8, "uint8": 9, "int16": 10, "uint16": 11,
+                "int32": 12, "uint32": 13, "char": 4}
+
+PARTIAL_TICK_NAME = "signalLogger.partialTick"
+
+# give up on the logger finishing its last flush after this long
+LOGGER_STOP_TIMEOUT_SEC = 30
+
+# each feature --all runs: its name, then the logger's and generator's arguments
+FEATURES = [
+    ("structs", [], []),
+    ("columns", ["-f", "columns"], []),
+    ("-W", ["-f", "columns", "-W"], []),
+    ("-z", ["-z", "1"], []),
+    ("-z columns", ["-f", "columns", "-z", "6,2"], []),
+    ("-O aio", ["-O", "aio"], []),
+    ("-O direct", ["-O", "direct"], []),
+    ("-w", ["-w", "2"], []),
+    ("-R", ["-R", "20"], ["-o", "5"]),
+    ("-P", ["-P", "20"], ["-l", "1"]),
+    ("-i", [], ["-i"]),
+    ("-i -w", ["-w", "2"], ["-i"]),
+    ("-e big", ["-e", "big"], ["-e", "big"]),
+    ("-e big -W", ["-e", "big", "-f", "columns", "-W"], ["-e", "big"]),
+    ("-t", ["-t", "16"], []),
+    ("-e big -t", ["-e", "big", "-t", "16"], ["-e", "big"]),
+]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Check signalGenerator's signals as logged by signalLogger")
+    parser.add_argument("data_root", nargs="?", help="where signalLogger wrote the signals")
+    parser.add_argument("--run", action="store_true",
+                        help="run the logger and generator first, on a temporary data root")
+    parser.add_argument("--all", action="store_true", help="--run each feature in turn")
+    parser.add_argument("--logger", default=os.path.join(REPO_DIR, "signalLogger"))
+    parser.add_argument("--generator", default=os.path.join(REPO_DIR, "signalGenerator"))
+    parser.add_argument("--tap-reader", default=os.path.join(REPO_DIR, "signalTap"))
+    parser.add_argument("--port", type=int, default=25901)
+    parser.add_argument("--signals", type=int, default=20, help="signals per tick")
+    parser.add_argument("--type", default="mixed", help="signal data type sent, or mixed")
+    parser.add_argument("--dims", default="3x2", help="signal dims, like 3x2")
+    parser.add_argument("--packets", type=int, default=4,
+                        help="split each tick over at least this many packets")
+    parser.add_argument("--ticks", type=int, default=4000)
+    parser.add_argument("--rate", type=float, default=2000, help="ticks/sec")
+    parser.add_argument("--seed", type=int, default=1,
+                        help="for the packets the generator loses or reorders")
+    parser.add_argument("--generator-args", default="",
+                        help="more arguments for signalGenerator, like \"-e big\"")
+    parser.add_argument("--tap", action="store_true", help="check signalTap's output too")
+    parser.add_argument("--keep", action="store_true", help="keep the logged data")
+    parser.epilog = "Arguments after -- are passed on to signalLogger."
+
+    # split off the logger's arguments first, as argparse would take any that
+    # look like its own options, -P among them
+    argv = sys.argv[1:]
+    logger_args = []
+    if "--" in argv:
+        logger_args = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+    args.logger_args = logger_args
+    if args.type != "mixed" and args.type not in TYPES:
+        parser.error("unknown --type %s" % args.type)
+    if not args.run and not args.all and args.data_root is None:
+        parser.error("give a data root, --run or --all")
+    return args
+
+
+# READING MAT-FILES
+
+def read_element(buf, off):
+    """The data type and payload of the element at off, and where the next starts."""
+    tag, = struct.unpack_from("<I", buf, off)
+    if tag >> 16:
+        # small data element format, up to 4 bytes packed in with the tag
+        n = tag >> 16
+        return tag & 0xffff, buf[off + 4:off + 4 + n], off + 8
+    mi, n = struct.unpack_from("<II", buf, off)
+    end = off + 8 + n if mi == MI_COMPRESSED else off + 8 + ((n + 7) & ~7)
+    return mi, buf[off + 8:off + 8 + n], end
+
+
+class MatArray:
+    def __init__(self, mx_class, dims, values):
+        self.mx_class = mx_class
+        self.dims = dims
+        self.values = values
+
+
+def parse_matrix(buf):
+    """A miMATRIX's name and value: a list of dicts for a struct array, a
+    MatArray of its elements in column major order otherwise."""
+    _, flags, off = read_element(buf, 0)
+    mx_class = struct.unpack_from("<I", flags)[0] & 0xff
+    _, dims_bytes, off = read_element(buf, off)
+    dims = struct.unpack("<%di" % (len(dims_bytes) // 4), dims_bytes)
+    _, name, off = read_element(buf, off)
+    count = 1
+    for d in dims:
+        count *= d
+
+    if mx_class == MX_STRUCT_CLASS:
+        _, length_bytes, off = read_element(buf, off)
+        length, = struct.unpack("<i", length_bytes)
+        _, names_bytes, off = read_element(buf, off)
+        fields = [names_bytes[i:i + length].split(b"\0")[0].decode()
+                  for i in range(0, len(names_bytes), length)]
+        elements = []
+        for _ in range(count):
+            element = {}
+            for field in fields:
+                _, payload, off = read_element(buf, off)
+                element[field] = parse_matrix(payload)[1] if payload else None
+            elements.append(element)
+        return name.decode(), elements
+
+    mi, payload, off = read_element(buf, off)
+    values = array.array(MI_TYPECODES[mi])
+    values.frombytes(payload)
+    if sys.byteorder == "big":
+        values.byteswap()
+    return name.decode(), MatArray(mx_class, dims, values)
+
+
+def read_segment(path):
+    """Each variable in a segment, as (name, value)."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[126:128] != b"IM":
+        raise ValueError("%s is not a little endian MAT-file" % path)
+    off = 128
+    while off < len(data):
+        mi, payload, off = read_element(data, off)
+        if mi == MI_COMPRESSED:
+            mi, payload, _ = read_element(zlib.decompress(payload), 0)
+        if mi == MI_MATRIX:
+            yield parse_matrix(payload)
+
+
+# CHECKING
+
+def expected_value(type_name, v):
+    """t + j + k cast to the signal's type, as signalGenerator sends it."""
+    v &= 0xffffffff
+    if type_name == "double":
+        return float(v)
+    if type_name == "single":
+        return struct.unpack("<f", struct.pack("<f", v))[0]
+    bits = {"int8": 8, "uint8": 8, "char": 8, "int16": 16, "uint16": 16,
+            "int32": 32, "uint32": 32}[type_name]
+    v &= (1 << bits) - 1
+    if type_name.startswith("int") and v >> (bits - 1):
+        v -= 1 << bits
+    return v
+
+
+def signal_type(type_sent, j):
+    return TYPES[j % len(TYPES)] if type_sent == "mixed" else type_sent
+
+
+def new_tally():
+    return {"files": 0, "signals": 0, "ticks": 0, "partialTicks": 0, "duplicates": 0,
+            "bad": 0}
+
+
+def report_bad(tally, message):
+    tally["bad"] += 1
+    if tally["bad"] <= 5:
+        print("  bad: " + message)
+
+
+def check_data_root(data_root, type_sent):
+    """Check every segment under data_root, returning what was found."""
+    tally = new_tally()
+    seen = set()
+    for path in sorted(glob.glob(os.path.join(data_root, "*", "signal.*.mat"))):
+        tally["files"] += 1
+        for var_name, value in read_segment(path):
+            if not var_name.startswith("signals"):
+                continue
+            for element in value:
+                check_signal(element, type_sent, seen, tally)
+    tally["ticks"] = len(set(t for t, j in seen))
+    return tally
+
+
+def check_signal(element, type_sent, seen, tally):
+    """Check one element of a signals variable, one sample of a signal in
+    structs files or all of a signal's samples in columns files."""
+    name = "".join(chr(c) for c in element["name"].values)
+    timestamps = element["timestamp"].values
+    n = len(timestamps)
+    if name == PARTIAL_TICK_NAME:
+        tally["partialTicks"] += n
+        return
+    if not name.startswith("sig"):
+        report_bad(tally, "unexpected signal %s" % name)
+        return
+
+    j = int(name[3:])
+    type_name = signal_type(type_sent, j)
+    data = element["data"]
+    if data.mx_class not in (TYPE_CLASSES[type_name], MX_DOUBLE_CLASS):
+        report_bad(tally, "%s is %s, written as class %d" % (name, type_name, data.mx_class))
+        return
+    n_elements = len(data.values) // n if n else 0
+    if n_elements * n != len(data.values):
+        report_bad(tally, "%s has %d values for %d samples" % (name, len(data.values), n))
+        return
+
+    # in columns files data is nSamples x dims, so sample i's element k is at
+    # i + n * k, and in structs files n is 1
+    for i, t in enumerate(timestamps):
+        if (t, j) in seen:
+            tally["duplicates"] += 1
+        seen.add((t, j))
+        tally["signals"] += 1
+        for k in range(n_elements):
+            got = data.values[i + n * k]
+            want = expected_value(type_name, t + j + k)
+            if got != want:
+                report_bad(tally, "%s at %d element %d is %r, should be %r" % (
+                    name, t, k, got, want))
+                break
+
+
+def check_tap_output(path, type_sent):
+    """The signals signalTap printed, and how many had the wrong first value."""
+    n = 0
+    bad = 0
+    with open(path) as f:
+        for line in f:
+            parts = line.rstrip("\n").split(" : ")
+            if len(parts) != 3 or not parts[1].startswith("sig"):
+                continue
+            n += 1
+            t = int(parts[0])
+            j = int(parts[1].split(" ")[0][3:])
+            if float(parts[2]) != float(expected_value(signal_type(type_sent, j), t + j)):
+                bad += 1
+                if bad <= 5:
+                    print("  bad on the tap: " + line.rstrip("\n"))
+    return n, bad
+
+
+# RUNNING
+
+def run_logger(args, logger_args, generator_args, tap):
+    """Log --ticks ticks from the generator and check them. Returns what the
+    generator sent, what was found and whether it all checked out."""
+    data_dir = tempfile.mkdtemp(prefix="signalLoggerCheck.")
+    data_root = os.path.join(data_dir, "data")
+    logger_cmd = [args.logger, "-s", "%d,,%s" % (args.port, data_root)] + logger_args
+    logger_log = open(os.path.join(data_dir, "logger.log"), "w")
+    logger = subprocess.Popen(logger_cmd, stdout=logger_log, stderr=subprocess.STDOUT)
+    tap_path = os.path.join(data_dir, "tap.txt")
+    tap_reader = None
+
+    try:
+        # give it time to bind its sockets
+        time.sleep(0.5)
+        if logger.poll() is not None:
+            sys.exit("signalLogger %s exited, see %s" % (" ".join(logger_cmd[1:]),
+                                                         logger_log.name))
+        if tap:
+            tap_out = open(tap_path, "w")
+            tap_reader = subprocess.Popen([args.tap_reader, str(args.port)], stdout=tap_out,
+                                          stderr=subprocess.STDOUT)
+            tap_out.close()
+            time.sleep(0.2)
+
+        gen_cmd = [args.generator, "-n", str(args.signals), "-y", args.type, "-d", args.dims,
+                   "-r", str(args.rate), "-c", str(args.ticks), "-P", str(args.packets),
+                   "-x", str(args.seed)] + generator_args + [str(args.port)]
+        gen = subprocess.run(gen_cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                             universal_newlines=True, check=True)
+        sent = json.loads(gen.stdout.strip().splitlines()[-1])
+    finally:
+        if tap_reader is not None:
+            # let it read the last tick before the tap goes away with the logger
+            time.sleep(0.5)
+            tap_reader.send_signal(signal.SIGINT)
+            tap_reader.wait()
+        logger.send_signal(signal.SIGINT)
+        try:
+            logger.wait(timeout=LOGGER_STOP_TIMEOUT_SEC)
+        except subprocess.TimeoutExpired:
+            logger.kill()
+            print("  signalLogger didn't stop, see %s" % logger_log.name)
+        logger_log.close()
+
+    tally = check_data_root(data_root, args.type)
+    # with packets lost on purpose, partial ticks may add to the complete ones
+    lossy = sent["packetsLost"] > 0
+    ok = tally["bad"] == 0 and tally["duplicates"] == 0 and (
+        tally["signals"] >= sent["signals"] if lossy else tally["signals"] == sent["signals"])
+    if tap:
+        tally["tapSignals"], tally["tapBad"] = check_tap_output(tap_path, args.type)
+        ok = ok and tally["tapBad"] == 0 and tally["tapSignals"] == sent["signals"]
+
+    if args.keep:
+        print("  logged data kept in %s" % data_dir)
+    else:
+        shutil.rmtree(data_dir, ignore_errors=True)
+    return sent, tally, ok
+
+
+def print_tally(tally):
+    print("%d segments, %d signals in %d ticks, %d partial ticks, %d written twice, %d bad" % (
+        tally["files"], tally["signals"], tally["ticks"], tally["partialTicks"],
+        tally["duplicates"], tally["bad"]))
+    if "tapSignals" in tally:
+        print("%d signals on the tap, %d bad" % (tally["tapSignals"], tally["tapBad"]))
+
+
+def main():
+    args = parse_args()
+    generator_args = shlex.split(args.generator_args)
+
+    if args.all:
+        print("%d %s signals of dims %s per tick, %d ticks at %g/s, %d+ packets per tick\n" % (
+            args.signals, args.type, args.dims, args.ticks, args.rate, args.packets))
+        print("%-10s %-34s %8s %8s %8s %5s %5s %8s  %s" % (
+            "feature", "signalLogger", "sent", "written", "partial", "twice", "bad", "tap",
+            "result"))
+        all_ok = True
+        for name, logger_args, feature_generator_args in FEATURES:
+            tap = "-t" in logger_args
+            gen_args = generator_args + feature_generator_args
+            sent, tally, ok = run_logger(args, args.logger_args + logger_args, gen_args, tap)
+            print("%-10s %-34s %8d %8d %8d %5d %5d %8s  %s" % (
+                name, " ".join(logger_args + (["(sent %s)" % " ".join(feature_generator_args)]
+                                              if feature_generator_args else [])),
+                sent["signals"], tally["signals"], tally["partialTicks"], tally["duplicates"],
+                tally["bad"], tally.get("tapSignals", ""), "ok" if ok else "FAILED"))
+            sys.stdout.flush()
+            all_ok = all_ok and ok
+        sys.exit(0 if all_ok else 1)
+
+    if args.run:
+        sent, tally, ok = run_logger(args, args.logger_args, generator_args, args.tap)
+        print("%d signals sent in complete ticks, %d ticks, %d packets lost" % (
+            sent["signals"], sent["ticks"], sent["packetsLost"]))
+        print_tally(tally)
+        print("ok" if ok else "FAILED")
+        sys.exit(0 if ok else 1)
+
+    tally = check_data_root(args.data_root, args.type)
+    print_tally(tally)
+    sys.exit(0 if tally["bad"] == 0 and tally["duplicates"] == 0 else 1)
+
+
+if __name__ == "__main__":
+    main()
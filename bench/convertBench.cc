@@ -0,0 +1,256 @@
+/* Convert Benchmark
+ *
+ * Times the byte swapping and widening to double in src/convert.cc against a
+ * plain loop over the STORE_* macros in signal.h, one element at a time, on
+ * the largest matrix signal of each type that fits in a tick. Each level of
+ * convert.cc the cpu supports is timed, and checked against the loop.
+ *
+ *     cd src && make convertBench && ../convertBench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "signal.h"
+#include "convert.h"
+#include "signalLogger.h"
+
+/* room left in the tick for the signal's header */
+#define BENCH_HEADER_BYTES 64
+#define BENCH_MAX_ELEMENTS (MAX_DATA_SIZE_PER_TICK - BENCH_HEADER_BYTES)
+#define DEFAULT_BENCH_SECONDS 0.2
+
+/// PRIVATE DECLARATIONS
+double getMonotonicSec();
+void fillInput(uint8_t* data, uint32_t nBytes);
+void swapWithMacros(uint8_t* data, uint32_t nElements, uint8_t dataTypeId);
+void widenWithMacros(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+double timeSwap(int level, uint8_t* data, uint32_t nElements, uint8_t dataTypeId);
+double timeWiden(int level, double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+
+///////////// GLOBALS /////////////
+
+// how long each measurement runs for
+double benchSeconds = DEFAULT_BENCH_SECONDS;
+
+// a level below the first of convert.cc's, for the macro loop
+#define LEVEL_MACROS -1
+
+uint8_t input[MAX_DATA_SIZE_PER_TICK];
+uint8_t swapped[MAX_DATA_SIZE_PER_TICK];
+uint8_t swappedByMacros[MAX_DATA_SIZE_PER_TICK];
+double widened[BENCH_MAX_ELEMENTS];
+double widenedByMacros[BENCH_MAX_ELEMENTS];
+
+// keeps the results from being optimized away
+volatile uint8_t sink;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: convertBench [-t secs]\n"
+           "  Times byte swapping and widening to double of signal data\n"
+           "  -t secs : how long to time each one for (default %g)\n",
+           DEFAULT_BENCH_SECONDS);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = getopt(argc, argv, "t:")) != -1) {
+        switch(opt) {
+            case 't':
+                benchSeconds = atof(optarg);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    int bestLevel = getBestConvertLevel();
+    printf("largest matrix signal of each type in a %d byte tick, GB/s of signal data\n\n",
+            MAX_DATA_SIZE_PER_TICK);
+    printf("%-8s %-6s %8s %9s", "type", "op", "elements", "macros");
+    for(int level = CONVERT_PORTABLE; level <= bestLevel; level++)
+        printf(" %9s", getConvertLevelName(level));
+    printf(" %9s\n", "speedup");
+
+    bool allMatch = 1;
+    for(uint8_t dtid = DTID_DOUBLE; dtid <= DTID_UINT32; dtid++) {
+        int elemBytes = getSizeOfDataTypeId(dtid);
+        uint32_t nElements = BENCH_MAX_ELEMENTS / elemBytes;
+        uint32_t nBytes = nElements * elemBytes;
+        fillInput(input, nBytes);
+
+        for(int op = 0; op < 2; op++) {
+            // swapping single bytes and widening doubles do nothing
+            if((op == 0 && elemBytes == 1) || (op == 1 && dtid == DTID_DOUBLE))
+                continue;
+
+            printf("%-8s %-6s %8u", getDataTypeIdName(dtid), op == 0 ? "swap" : "widen", nElements);
+            double baseline = 0;
+            double best = 0;
+            for(int level = LEVEL_MACROS; level <= bestLevel; level++) {
+                double sec;
+                bool match;
+                if(op == 0) {
+                    sec = timeSwap(level, swapped, nElements, dtid);
+                    if(level == LEVEL_MACROS)
+                        memcpy(swappedByMacros, swapped, nBytes);
+                    match = memcmp(swapped, swappedByMacros, nBytes) == 0;
+                } else {
+                    sec = timeWiden(level, widened, input, nElements, dtid);
+                    if(level == LEVEL_MACROS)
+                        memcpy(widenedByMacros, widened, nElements * sizeof(double));
+                    match = memcmp(widened, widenedByMacros, nElements * sizeof(double)) == 0;
+                }
+
+                double gbPerSec = nBytes / sec / 1e9;
+                if(level == LEVEL_MACROS)
+                    baseline = gbPerSec;
+                else if(gbPerSec > best)
+                    best = gbPerSec;
+                printf(" %8.2f%s", gbPerSec, match ? " " : "!");
+                allMatch = allMatch && match;
+            }
+            printf(" %8.1fx\n", best / baseline);
+        }
+    }
+
+    if(!allMatch) {
+        printf("\nresults marked ! differ from the macro loop's\n");
+        return 1;
+    }
+    return(EXIT_SUCCESS);
+}
+
+double getMonotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fillInput(uint8_t* data, uint32_t nBytes)
+{
+    srand(1);
+    for(uint32_t i = 0; i < nBytes; i++)
+        data[i] = rand();
+}
+
+#define SWAP_WITH_MACROS(type, bswap, data, nElements) { \
+    const uint8_t* pBuf = data; \
+    for(uint32_t i = 0; i < nElements; i++) { \
+        type v; \
+        STORE_TYPE(type, pBuf, v); \
+        v = bswap(v); \
+        memcpy(data + i * sizeof(type), &v, sizeof(type)); \
+    } }
+
+void swapWithMacros(uint8_t* data, uint32_t nElements, uint8_t dataTypeId)
+{
+    int elemBytes = getSizeOfDataTypeId(dataTypeId);
+    if(elemBytes == 2)
+        SWAP_WITH_MACROS(uint16_t, __builtin_bswap16, data, nElements)
+    else if(elemBytes == 4)
+        SWAP_WITH_MACROS(uint32_t, __builtin_bswap32, data, nElements)
+    else if(elemBytes == 8)
+        SWAP_WITH_MACROS(uint64_t, __builtin_bswap64, data, nElements)
+}
+
+#define WIDEN_WITH_MACROS(STORE, type, out, in, nElements) { \
+    const uint8_t* pBuf = in; \
+    for(uint32_t i = 0; i < nElements; i++) { \
+        type v; \
+        STORE(pBuf, v); \
+        out[i] = v; \
+    } }
+
+void widenWithMacros(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    switch(dataTypeId) {
+        case DTID_SINGLE:
+            WIDEN_WITH_MACROS(STORE_SINGLE, single_t, out, in, nElements);
+            break;
+        case DTID_INT8:
+            WIDEN_WITH_MACROS(STORE_INT8, int8_t, out, in, nElements);
+            break;
+        case DTID_UINT8:
+            WIDEN_WITH_MACROS(STORE_UINT8, uint8_t, out, in, nElements);
+            break;
+        case DTID_INT16:
+            WIDEN_WITH_MACROS(STORE_INT16, int16_t, out, in, nElements);
+            break;
+        case DTID_UINT16:
+            WIDEN_WITH_MACROS(STORE_UINT16, uint16_t, out, in, nElements);
+            break;
+        case DTID_INT32:
+            WIDEN_WITH_MACROS(STORE_INT32, int32_t, out, in, nElements);
+            break;
+        case DTID_UINT32:
+            WIDEN_WITH_MACROS(STORE_UINT32, uint32_t, out, in, nElements);
+            break;
+    }
+}
+
+// seconds per call, swapping data back and forth in place, then leaving it
+// holding input swapped once
+double timeSwap(int level, uint8_t* data, uint32_t nElements, uint8_t dataTypeId)
+{
+    uint32_t nBytes = nElements * getSizeOfDataTypeId(dataTypeId);
+    if(level != LEVEL_MACROS)
+        setConvertLevel(level);
+
+    uint64_t nCalls = 0;
+    double start = getMonotonicSec();
+    double elapsed;
+    do {
+        for(int i = 0; i < 100; i++) {
+            if(level == LEVEL_MACROS)
+                swapWithMacros(data, nElements, dataTypeId);
+            else
+                swapElementBytes(data, nElements, getSizeOfDataTypeId(dataTypeId));
+            sink = data[nBytes - 1];
+        }
+        nCalls += 100;
+        elapsed = getMonotonicSec() - start;
+    } while(elapsed < benchSeconds);
+
+    memcpy(data, input, nBytes);
+    if(level == LEVEL_MACROS)
+        swapWithMacros(data, nElements, dataTypeId);
+    else
+        swapElementBytes(data, nElements, getSizeOfDataTypeId(dataTypeId));
+    return elapsed / nCalls;
+}
+
+double timeWiden(int level, double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    if(level != LEVEL_MACROS)
+        setConvertLevel(level);
+
+    uint64_t nCalls = 0;
+    double start = getMonotonicSec();
+    double elapsed;
+    do {
+        for(int i = 0; i < 100; i++) {
+            if(level == LEVEL_MACROS)
+                widenWithMacros(out, in, nElements, dataTypeId);
+            else
+                widenElementsToDouble(out, in, nElements, dataTypeId);
+            sink = (uint8_t)out[nElements - 1];
+        }
+        nCalls += 100;
+        elapsed = getMonotonicSec() - start;
+    } while(elapsed < benchSeconds);
+    return elapsed / nCalls;
+}
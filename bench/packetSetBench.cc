@@ -0,0 +1,269 @@
+/* PacketSet Lookup Benchmark
+ *
+ * Times finding a tick's PacketSet by timestamp through the open addressing
+ * index in buffer.cc, against the number of PacketSets in flight, with a plain
+ * scan of every slot (how they used to be found) alongside for comparison.
+ * Both hits and misses (a new tick's first packet) are timed. Then ticks are
+ * started and finished with a steady number in flight, which deletes from the
+ * index with its backward shift, and finally started without ever finishing so
+ * the oldest keep expiring as the ring wraps. After each phase every PacketSet
+ * in the ring is checked to be found in the index, and every one removed not to
+ * be.
+ *
+ *     cd src && make packetSetBench && ../packetSetBench
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "signal.h"
+#include "buffer.h"
+#include "signalLogger.h"
+
+#define DEFAULT_BENCH_LOOKUPS 2000000
+
+/* how many PacketSets are in flight at each step */
+#define BENCH_N_IN_FLIGHT 7
+const int inFlightCounts[BENCH_N_IN_FLIGHT] = { 1, 2, 4, 8, 16, 32, PACKETSET_BUFFER_SIZE };
+
+/// PRIVATE DECLARATIONS
+double getMonotonicSec();
+uint32_t getBenchTimestamp(uint32_t i);
+void startTick(SignalBuffers* pbuf, uint32_t timestamp);
+PacketSet* scanForPacketSet(SignalBuffers* pbuf, uint32_t timestamp);
+double timeLookups(SignalBuffers* pbuf, int nInFlight, uint32_t firstTick, bool hit, bool scan);
+double timeChurn(SignalBuffers* pbuf, int nInFlight, uint32_t* pNextTick);
+double timeExpiring(SignalBuffers* pbuf, uint32_t* pNextTick);
+bool checkIndex(SignalBuffers* pbuf, uint32_t firstRemoved, uint32_t endRemoved);
+
+///////////// GLOBALS /////////////
+
+uint32_t nLookups = DEFAULT_BENCH_LOOKUPS;
+
+// spread the timestamps out like a sender counting in ms or us rather than ticks
+uint32_t timestampStride = 1;
+
+// keeps the results from being optimized away
+volatile uintptr_t sink;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: packetSetBench [-n lookups] [-s stride]\n"
+           "  Times PacketSet lookups by timestamp against the number in flight\n"
+           "  -n lookups : how many lookups to time at each step (default %d)\n"
+           "  -s stride  : gap between consecutive ticks' timestamps (default 1)\n",
+           DEFAULT_BENCH_LOOKUPS);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch(opt) {
+            case 'n':
+                nLookups = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                timestampStride = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if(nLookups == 0 || timestampStride == 0) {
+        usage();
+        exit(1);
+    }
+
+    SignalBuffers* pbuf = allocSignalBuffers();
+    uint32_t nextTick = 0;
+    bool ok = 1;
+
+    printf("ns per lookup, timestamps %u apart, %d slots, index of %d\n\n",
+            timestampStride, PACKETSET_BUFFER_SIZE, PACKETSET_INDEX_SIZE);
+    printf("%9s %9s %9s %9s %9s %12s\n", "in flight", "index hit", "miss", "scan hit", "miss",
+            "start+finish");
+    for(int k = 0; k < BENCH_N_IN_FLIGHT; k++) {
+        int nInFlight = inFlightCounts[k];
+
+        // begin with nInFlight ticks started in a fresh ring
+        freeSignalBuffers(pbuf);
+        pbuf = allocSignalBuffers();
+        uint32_t firstTick = nextTick;
+        for(int i = 0; i < nInFlight; i++)
+            startTick(pbuf, getBenchTimestamp(nextTick++));
+
+        printf("%9d", nInFlight);
+        for(int scan = 0; scan < 2; scan++)
+            for(int hit = 1; hit >= 0; hit--)
+                printf(" %9.1f", 1e9 * timeLookups(pbuf, nInFlight, firstTick, hit, scan));
+
+        printf(" %12.1f\n", 1e9 * timeChurn(pbuf, nInFlight, &nextTick));
+        ok = checkIndex(pbuf, firstTick, nextTick - nInFlight) && ok;
+    }
+
+    // the ring full of ticks that never finish, each new one expiring the oldest
+    freeSignalBuffers(pbuf);
+    pbuf = allocSignalBuffers();
+    uint32_t firstTick = nextTick;
+    printf("\nns per tick started while expiring the oldest: %.1f\n",
+            1e9 * timeExpiring(pbuf, &nextTick));
+    ok = checkIndex(pbuf, firstTick, nextTick - PACKETSET_BUFFER_SIZE) && ok;
+
+    printf("%s\n", ok ? "index ok" : "INDEX FAILED");
+    freeSignalBuffers(pbuf);
+    return ok ? EXIT_SUCCESS : 1;
+}
+
+double getMonotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint32_t getBenchTimestamp(uint32_t i)
+{
+    return i * timestampStride;
+}
+
+// a PacketSet for a two packet tick, as if its first packet had arrived
+void startTick(SignalBuffers* pbuf, uint32_t timestamp)
+{
+    Packet p;
+    memset(&p, 0, sizeof(Packet));
+    p.packetVersion = PACKET_VERSION_SIGNAL_NAMES;
+    p.timestamp = timestamp;
+    p.numPackets = 2;
+    createPacketSetForPacket(pbuf, &p);
+}
+
+// look at every slot, as findPacketSetForPacket did before the index
+PacketSet* scanForPacketSet(SignalBuffers* pbuf, uint32_t timestamp)
+{
+    for(int c = 0; c < PACKETSET_BUFFER_SIZE; c++) {
+        int i = (pbuf->psetbuf.head - c + PACKETSET_BUFFER_SIZE) % PACKETSET_BUFFER_SIZE;
+        if(pbuf->psetbuf.occupied[i] && pbuf->psetbuf.buffer[i].timestamp == timestamp)
+            return pbuf->psetbuf.buffer + i;
+    }
+    return NULL;
+}
+
+// seconds per lookup of the in flight ticks, or of ticks not yet started
+double timeLookups(SignalBuffers* pbuf, int nInFlight, uint32_t firstTick, bool hit, bool scan)
+{
+    Packet p;
+    memset(&p, 0, sizeof(Packet));
+    p.packetVersion = PACKET_VERSION_SIGNAL_NAMES;
+
+    uint32_t base = hit ? firstTick : firstTick + nInFlight;
+    double start = getMonotonicSec();
+    for(uint32_t n = 0; n < nLookups; n++) {
+        p.timestamp = getBenchTimestamp(base + n % nInFlight);
+        PacketSet* ppset = scan ? scanForPacketSet(pbuf, p.timestamp) :
+            findPacketSetForPacket(pbuf, &p);
+        if((ppset != NULL) != hit)
+            diep("PacketSet lookup came back wrong");
+        sink = (uintptr_t)ppset;
+    }
+    return (getMonotonicSec() - start) / nLookups;
+}
+
+// seconds per tick, finishing the oldest tick in flight, which takes it back
+// out of the index, and starting a new one
+double timeChurn(SignalBuffers* pbuf, int nInFlight, uint32_t* pNextTick)
+{
+    Packet p;
+    memset(&p, 0, sizeof(Packet));
+    p.packetVersion = PACKET_VERSION_SIGNAL_NAMES;
+
+    uint32_t nTicks = nLookups / 4;
+    double start = getMonotonicSec();
+    for(uint32_t n = 0; n < nTicks; n++) {
+        // the oldest tick finishes, freeing its slot
+        p.timestamp = getBenchTimestamp(*pNextTick - nInFlight);
+        PacketSet* ppset = findPacketSetForPacket(pbuf, &p);
+        if(ppset == NULL)
+            diep("Lost the PacketSet of a tick in flight");
+        removePacketSetFromBuffer(pbuf, ppset);
+
+        // a miss, then a new PacketSet for it
+        p.timestamp = getBenchTimestamp(*pNextTick);
+        if(findPacketSetForPacket(pbuf, &p) != NULL)
+            diep("Found a PacketSet for a tick not started");
+        startTick(pbuf, p.timestamp);
+        (*pNextTick)++;
+    }
+    return (getMonotonicSec() - start) / nTicks;
+}
+
+// seconds per tick started with the ring full, so that each pushes out the
+// oldest as incomplete. Their warnings go to /dev/null meanwhile
+double timeExpiring(SignalBuffers* pbuf, uint32_t* pNextTick)
+{
+    fflush(stderr);
+    int savedStderr = dup(STDERR_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if(savedStderr == -1 || devNull == -1 || dup2(devNull, STDERR_FILENO) == -1)
+        diep("Error redirecting stderr");
+
+    uint32_t nTicks = nLookups / 4;
+    double start = getMonotonicSec();
+    for(uint32_t n = 0; n < nTicks; n++)
+        startTick(pbuf, getBenchTimestamp((*pNextTick)++));
+    double elapsed = getMonotonicSec() - start;
+
+    fflush(stderr);
+    dup2(savedStderr, STDERR_FILENO);
+    close(savedStderr);
+    close(devNull);
+    return elapsed / nTicks;
+}
+
+// every PacketSet in the ring is in the index once and found through it, and
+// no tick in [firstRemoved, endRemoved) is
+bool checkIndex(SignalBuffers* pbuf, uint32_t firstRemoved, uint32_t endRemoved)
+{
+    Packet p;
+    memset(&p, 0, sizeof(Packet));
+    p.packetVersion = PACKET_VERSION_SIGNAL_NAMES;
+
+    int nOccupied = 0;
+    int nIndexed = 0;
+    for(int i = 0; i < PACKETSET_BUFFER_SIZE; i++) {
+        if(!pbuf->psetbuf.occupied[i])
+            continue;
+        nOccupied++;
+        p.timestamp = pbuf->psetbuf.buffer[i].timestamp;
+        if(findPacketSetForPacket(pbuf, &p) != pbuf->psetbuf.buffer + i) {
+            fprintf(stderr, "PacketSet for timestamp %u not found\n", p.timestamp);
+            return 0;
+        }
+    }
+    for(int i = 0; i < PACKETSET_INDEX_SIZE; i++)
+        nIndexed += pbuf->psetbuf.index[i] != 0;
+    if(nIndexed != nOccupied) {
+        fprintf(stderr, "%d PacketSets in the index, %d in the ring\n", nIndexed, nOccupied);
+        return 0;
+    }
+
+    for(uint32_t t = firstRemoved; t < endRemoved; t++) {
+        p.timestamp = getBenchTimestamp(t);
+        if(findPacketSetForPacket(pbuf, &p) != NULL) {
+            fprintf(stderr, "PacketSet for timestamp %u found after removal\n", p.timestamp);
+            return 0;
+        }
+    }
+    return 1;
+}
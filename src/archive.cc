@@ -0,0 +1,523 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "signalLogger.h"
+
+/* how each data type is coded, see archive.h */
+#define ARCHIVE_CODEC_DELTA 0
+#define ARCHIVE_CODEC_XOR 1
+
+/* the longest varint, a uint64 in 7 bit groups */
+#define MAX_VARINT_BYTES 10
+
+// indexed by dataTypeId, in the order of the table in signal.cc
+const uint8_t archiveCodecs[] = {
+    ARCHIVE_CODEC_XOR,   // double
+    ARCHIVE_CODEC_XOR,   // single
+    ARCHIVE_CODEC_DELTA, // int8
+    ARCHIVE_CODEC_DELTA, // uint8
+    ARCHIVE_CODEC_DELTA, // int16
+    ARCHIVE_CODEC_DELTA, // uint16
+    ARCHIVE_CODEC_DELTA, // int32
+    ARCHIVE_CODEC_DELTA, // uint32
+    ARCHIVE_CODEC_DELTA  // char
+};
+
+// bits are written and read most significant first. The writer holds its
+// last nBits < 8 bits in the low bits of bits until a byte is full
+typedef struct BitWriter {
+    MatBuffer* pmb;
+    uint64_t bits;
+    int nBits;
+} BitWriter;
+
+typedef struct BitReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t bits;
+    int nBits;
+    bool overrun; // read past end, the zeros it got instead are meaningless
+} BitReader;
+
+// delta coding state for one series, see archive.h
+typedef struct DeltaEncoder {
+    MatBuffer* pmb;
+    int width;
+    uint64_t prev;
+    uint64_t lastDelta;
+    bool haveDelta;
+    uint64_t nRun;
+} DeltaEncoder;
+
+/// PRIVATE DECLARATIONS
+uint64_t getWidthMask(int width);
+void putVarint(MatBuffer* pmb, uint64_t value);
+bool getVarint(const uint8_t** pp, const uint8_t* end, uint64_t* pValue);
+uint64_t loadElement(const uint8_t* p, int nBytes);
+void storeElement(uint8_t* p, uint64_t value, int nBytes);
+
+void startDeltaSeries(DeltaEncoder* pe, MatBuffer* pmb, int width);
+void putDelta(DeltaEncoder* pe, uint64_t value);
+void endDeltaSeries(DeltaEncoder* pe);
+bool decodeDeltaSeries(const uint8_t** pp, const uint8_t* end, int width, uint32_t n,
+        uint8_t* out, size_t stride);
+
+void putBits(BitWriter* pw, uint64_t value, int nBits);
+void putWideBits(BitWriter* pw, uint64_t value, int nBits);
+void endBits(BitWriter* pw);
+uint64_t getBits(BitReader* pr, int nBits);
+uint64_t getWideBits(BitReader* pr, int nBits);
+void putXorSeries(BitWriter* pw, const uint8_t* data, size_t stride, uint32_t n, int width);
+void decodeXorSeries(BitReader* pr, uint8_t* out, size_t stride, uint32_t n, int width);
+
+/////// CODING PRIMITIVES /////////
+
+uint64_t getWidthMask(int width)
+{
+    return width >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+}
+
+void putVarint(MatBuffer* pmb, uint64_t value)
+{
+    uint8_t buf[MAX_VARINT_BYTES];
+    int n = 0;
+    while(value >= 0x80) {
+        buf[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t)value;
+    appendMatBytes(pmb, buf, n);
+}
+
+bool getVarint(const uint8_t** pp, const uint8_t* end, uint64_t* pValue)
+{
+    uint64_t value = 0;
+    for(int shift = 0; *pp < end && shift < 7 * MAX_VARINT_BYTES; shift += 7) {
+        uint8_t b = *(*pp)++;
+        value |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            *pValue = value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// elements are little endian, like the host
+uint64_t loadElement(const uint8_t* p, int nBytes)
+{
+    uint64_t value = 0;
+    memcpy(&value, p, nBytes);
+    return value;
+}
+
+void storeElement(uint8_t* p, uint64_t value, int nBytes)
+{
+    memcpy(p, &value, nBytes);
+}
+
+/////// DELTA CODING /////////
+
+void startDeltaSeries(DeltaEncoder* pe, MatBuffer* pmb, int width)
+{
+    memset(pe, 0, sizeof(DeltaEncoder));
+    pe->pmb = pmb;
+    pe->width = width;
+}
+
+void putDelta(DeltaEncoder* pe, uint64_t value)
+{
+    uint64_t delta = (value - pe->prev) & getWidthMask(pe->width);
+    pe->prev = value;
+    if(pe->haveDelta && delta == pe->lastDelta) {
+        pe->nRun++;
+        return;
+    }
+    endDeltaSeries(pe);
+
+    // sign extend from the type's width, then zigzag so small negative
+    // differences are small too
+    int64_t signedDelta = (int64_t)(delta << (64 - pe->width)) >> (64 - pe->width);
+    uint64_t zigzag = ((uint64_t)signedDelta << 1) ^ (uint64_t)(signedDelta >> 63);
+    putVarint(pe->pmb, zigzag << 1);
+    pe->lastDelta = delta;
+    pe->haveDelta = 1;
+}
+
+// put out the run in progress, if any
+void endDeltaSeries(DeltaEncoder* pe)
+{
+    if(pe->nRun > 0)
+        putVarint(pe->pmb, pe->nRun << 1 | 1);
+    pe->nRun = 0;
+}
+
+// decode n values of width bits into out, stride bytes apart
+bool decodeDeltaSeries(const uint8_t** pp, const uint8_t* end, int width, uint32_t n,
+        uint8_t* out, size_t stride)
+{
+    uint64_t mask = getWidthMask(width);
+    int nBytes = width / 8;
+    uint64_t prev = 0;
+    uint64_t delta = 0;
+
+    for(uint32_t i = 0; i < n; ) {
+        uint64_t token;
+        if(!getVarint(pp, end, &token))
+            return 0;
+
+        if(token & 1) {
+            uint64_t nRun = token >> 1;
+            if(nRun > n - i)
+                return 0;
+            for(uint64_t r = 0; r < nRun; r++, i++) {
+                prev = (prev + delta) & mask;
+                storeElement(out + i * stride, prev, nBytes);
+            }
+        } else {
+            uint64_t zigzag = token >> 1;
+            delta = (zigzag >> 1) ^ (uint64_t)(-(int64_t)(zigzag & 1));
+            prev = (prev + delta) & mask;
+            storeElement(out + i * stride, prev, nBytes);
+            i++;
+        }
+    }
+    return 1;
+}
+
+/////// XOR CODING /////////
+
+// nBits <= 32
+void putBits(BitWriter* pw, uint64_t value, int nBits)
+{
+    pw->bits = (pw->bits << nBits) | (value & getWidthMask(nBits));
+    pw->nBits += nBits;
+    while(pw->nBits >= 8) {
+        pw->nBits -= 8;
+        uint8_t b = (uint8_t)(pw->bits >> pw->nBits);
+        appendMatBytes(pw->pmb, &b, 1);
+    }
+}
+
+// nBits <= 64
+void putWideBits(BitWriter* pw, uint64_t value, int nBits)
+{
+    if(nBits > 32) {
+        putBits(pw, value >> 32, nBits - 32);
+        nBits = 32;
+    }
+    putBits(pw, value, nBits);
+}
+
+// pad out the last byte with zeros
+void endBits(BitWriter* pw)
+{
+    if(pw->nBits > 0)
+        putBits(pw, 0, 8 - pw->nBits);
+}
+
+// nBits <= 32
+uint64_t getBits(BitReader* pr, int nBits)
+{
+    while(pr->nBits < nBits) {
+        uint8_t b = 0;
+        if(pr->p < pr->end)
+            b = *pr->p++;
+        else
+            pr->overrun = 1;
+        pr->bits = (pr->bits << 8) | b;
+        pr->nBits += 8;
+    }
+    pr->nBits -= nBits;
+    return (pr->bits >> pr->nBits) & getWidthMask(nBits);
+}
+
+// nBits <= 64
+uint64_t getWideBits(BitReader* pr, int nBits)
+{
+    uint64_t high = 0;
+    if(nBits > 32) {
+        high = getBits(pr, nBits - 32) << 32;
+        nBits = 32;
+    }
+    return high | getBits(pr, nBits);
+}
+
+void putXorSeries(BitWriter* pw, const uint8_t* data, size_t stride, uint32_t n, int width)
+{
+    int nBytes = width / 8;
+    int lengthBits = width == 64 ? 6 : 5;
+    if(n == 0)
+        return;
+    uint64_t prev = loadElement(data, nBytes);
+    putWideBits(pw, prev, width);
+
+    int prevLeading = -1;
+    int prevTrailing = 0;
+    for(uint32_t i = 1; i < n; i++) {
+        uint64_t value = loadElement(data + i * stride, nBytes);
+        uint64_t xor_ = value ^ prev;
+        prev = value;
+        if(xor_ == 0) {
+            putBits(pw, 0, 1);
+            continue;
+        }
+
+        int leading = __builtin_clzll(xor_) - (64 - width);
+        int trailing = __builtin_ctzll(xor_);
+        if(leading > 31)
+            leading = 31;
+
+        if(prevLeading >= 0 && leading >= prevLeading && trailing >= prevTrailing) {
+            // fits in the last window
+            putBits(pw, 2, 2);
+            putWideBits(pw, xor_ >> prevTrailing, width - prevLeading - prevTrailing);
+        } else {
+            int nMeaningful = width - leading - trailing;
+            putBits(pw, 3, 2);
+            putBits(pw, leading, 5);
+            putBits(pw, nMeaningful - 1, lengthBits);
+            putWideBits(pw, xor_ >> trailing, nMeaningful);
+            prevLeading = leading;
+            prevTrailing = trailing;
+        }
+    }
+}
+
+void decodeXorSeries(BitReader* pr, uint8_t* out, size_t stride, uint32_t n, int width)
+{
+    int nBytes = width / 8;
+    int lengthBits = width == 64 ? 6 : 5;
+    if(n == 0)
+        return;
+    uint64_t prev = getWideBits(pr, width);
+    storeElement(out, prev, nBytes);
+
+    int leading = 0;
+    int trailing = 0;
+    for(uint32_t i = 1; i < n; i++) {
+        if(getBits(pr, 1)) {
+            if(getBits(pr, 1)) {
+                leading = getBits(pr, 5);
+                int nMeaningful = getBits(pr, lengthBits) + 1;
+                trailing = width - leading - nMeaningful;
+                if(trailing < 0) {
+                    pr->overrun = 1;
+                    return;
+                }
+            }
+            prev ^= getWideBits(pr, width - leading - trailing) << trailing;
+        }
+        storeElement(out + i * stride, prev, nBytes);
+    }
+}
+
+/////// ENCODING /////////
+
+void writeArchiveHeader(MatBuffer* pmb, uint32_t nColumns)
+{
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(ArchiveHeader));
+    memcpy(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH);
+    header.version = ARCHIVE_VERSION;
+    header.nColumns = nColumns;
+    appendMatBytes(pmb, &header, sizeof(ArchiveHeader));
+}
+
+// append a column, which must have at least one sample
+void encodeArchiveColumn(MatBuffer* pmb, const SignalColumn* pcol)
+{
+    size_t start = pmb->nBytes;
+    ArchiveColumnHeader header;
+    memset(&header, 0, sizeof(ArchiveColumnHeader));
+    header.nSamples = pcol->nSamples;
+    header.lenName = pcol->lenName;
+    header.dataTypeId = pcol->dataTypeId;
+    header.nDims = pcol->nDims;
+    memcpy(header.dims, pcol->dims, pcol->nDims * sizeof(uint16_t));
+    reserveMatBytes(pmb, sizeof(ArchiveColumnHeader));
+
+    // the name is NUL terminated so it can be used in place
+    appendMatBytes(pmb, pcol->name, pcol->lenName + 1);
+    padMatBuffer(pmb);
+
+    DeltaEncoder de;
+    header.minTimestamp = header.maxTimestamp = pcol->nSamples ? pcol->timestamps[0] : 0;
+    size_t timestampStart = pmb->nBytes;
+    startDeltaSeries(&de, pmb, 32);
+    for(uint32_t i = 0; i < pcol->nSamples; i++) {
+        putDelta(&de, pcol->timestamps[i]);
+        if(pcol->timestamps[i] < header.minTimestamp)
+            header.minTimestamp = pcol->timestamps[i];
+        if(pcol->timestamps[i] > header.maxTimestamp)
+            header.maxTimestamp = pcol->timestamps[i];
+    }
+    endDeltaSeries(&de);
+    header.nTimestampBytes = pmb->nBytes - timestampStart;
+    padMatBuffer(pmb);
+
+    // each element's series in turn
+    size_t dataStart = pmb->nBytes;
+    int elemBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    uint32_t nElements = pcol->nBytesPerSample / elemBytes;
+    BitWriter bw;
+    memset(&bw, 0, sizeof(BitWriter));
+    bw.pmb = pmb;
+
+    for(uint32_t e = 0; e < nElements; e++) {
+        const uint8_t* pFirst = pcol->data + e * elemBytes;
+        if(archiveCodecs[pcol->dataTypeId] == ARCHIVE_CODEC_XOR) {
+            putXorSeries(&bw, pFirst, pcol->nBytesPerSample, pcol->nSamples, 8 * elemBytes);
+        } else {
+            startDeltaSeries(&de, pmb, 8 * elemBytes);
+            for(uint32_t i = 0; i < pcol->nSamples; i++)
+                putDelta(&de, loadElement(pFirst + (size_t)i * pcol->nBytesPerSample, elemBytes));
+            endDeltaSeries(&de);
+        }
+    }
+    endBits(&bw);
+    header.nDataBytes = pmb->nBytes - dataStart;
+    padMatBuffer(pmb);
+
+    header.nBytes = pmb->nBytes - start;
+    memcpy(pmb->data + start, &header, sizeof(ArchiveColumnHeader));
+}
+
+/////// DECODING /////////
+
+// map an archive file read only and find its columns
+bool openSignalArchive(const char* fileName, SignalArchive* parc)
+{
+    memset(parc, 0, sizeof(SignalArchive));
+    int fd = open(fileName, O_RDONLY);
+    if(fd == -1)
+        return 0;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* pmap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmap == MAP_FAILED)
+        return 0;
+
+    if(!viewSignalArchive((const uint8_t*)pmap, st.st_size, parc)) {
+        munmap(pmap, st.st_size);
+        return 0;
+    }
+    parc->mapped = 1;
+    return 1;
+}
+
+// find the columns of an archive already in memory, checking they all fit.
+// Nothing past the column headers is touched until a column is decoded
+bool viewSignalArchive(const uint8_t* data, size_t nBytes, SignalArchive* parc)
+{
+    memset(parc, 0, sizeof(SignalArchive));
+    parc->data = data;
+    parc->nBytes = nBytes;
+
+    ArchiveHeader header;
+    if(nBytes < sizeof(ArchiveHeader))
+        return 0;
+    memcpy(&header, data, sizeof(ArchiveHeader));
+    if(memcmp(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LENGTH) != 0 ||
+            header.version != ARCHIVE_VERSION)
+        return 0;
+
+    parc->columns = (const ArchiveColumnHeader**)malloc(
+            (header.nColumns ? header.nColumns : 1) * sizeof(ArchiveColumnHeader*));
+    if(parc->columns == NULL)
+        diep("Error allocating archive columns");
+
+    size_t offset = sizeof(ArchiveHeader);
+    for(uint32_t i = 0; i < header.nColumns; i++) {
+        const ArchiveColumnHeader* pcol = (const ArchiveColumnHeader*)(data + offset);
+        if(nBytes - offset < sizeof(ArchiveColumnHeader) || pcol->nBytes > nBytes - offset ||
+                pcol->dataTypeId > DTID_CHAR || pcol->nDims > MAX_SIGNAL_NDIMS ||
+                sizeof(ArchiveColumnHeader) + ALIGN_ARCHIVE(pcol->lenName + 1) +
+                ALIGN_ARCHIVE((size_t)pcol->nTimestampBytes) +
+                ALIGN_ARCHIVE((size_t)pcol->nDataBytes) != pcol->nBytes) {
+            closeSignalArchive(parc);
+            return 0;
+        }
+        parc->columns[i] = pcol;
+        offset += pcol->nBytes;
+    }
+    parc->nColumns = header.nColumns;
+    return 1;
+}
+
+void closeSignalArchive(SignalArchive* parc)
+{
+    if(parc->mapped)
+        munmap((void*)parc->data, parc->nBytes);
+    free(parc->columns);
+    memset(parc, 0, sizeof(SignalArchive));
+}
+
+// the first column at or after iFrom for the signal called name, or -1. A
+// signal that changed type or dims has a column for each
+int findArchiveColumn(const SignalArchive* parc, const char* name, uint32_t lenName, int iFrom)
+{
+    for(uint32_t i = iFrom; i < parc->nColumns; i++)
+        if(parc->columns[i]->lenName == lenName &&
+                memcmp(getArchiveColumnName(parc->columns[i]), name, lenName) == 0)
+            return i;
+    return -1;
+}
+
+const char* getArchiveColumnName(const ArchiveColumnHeader* pcol)
+{
+    return (const char*)(pcol + 1);
+}
+
+uint32_t getArchiveSampleBytes(const ArchiveColumnHeader* pcol)
+{
+    uint32_t nBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    for(int i = 0; i < pcol->nDims; i++)
+        nBytes *= pcol->dims[i];
+    return nBytes;
+}
+
+// decode a column's nSamples timestamps into timestamps and its samples into
+// data, getArchiveSampleBytes each, laid out as in a SignalColumn. Returns
+// false if the column is corrupt
+bool decodeArchiveColumn(const ArchiveColumnHeader* pcol, uint32_t* timestamps, uint8_t* data)
+{
+    const uint8_t* p = (const uint8_t*)(pcol + 1) + ALIGN_ARCHIVE(pcol->lenName + 1);
+    const uint8_t* end = p + pcol->nTimestampBytes;
+    if(!decodeDeltaSeries(&p, end, 32, pcol->nSamples, (uint8_t*)timestamps, sizeof(uint32_t)))
+        return 0;
+
+    p = end + ALIGN_ARCHIVE(pcol->nTimestampBytes) - pcol->nTimestampBytes;
+    end = p + pcol->nDataBytes;
+
+    int elemBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    uint32_t sampleBytes = getArchiveSampleBytes(pcol);
+    uint32_t nElements = sampleBytes / elemBytes;
+    BitReader br;
+    memset(&br, 0, sizeof(BitReader));
+    br.p = p;
+    br.end = end;
+
+    for(uint32_t e = 0; e < nElements; e++) {
+        uint8_t* pFirst = data + e * elemBytes;
+        if(archiveCodecs[pcol->dataTypeId] == ARCHIVE_CODEC_XOR) {
+            decodeXorSeries(&br, pFirst, sampleBytes, pcol->nSamples, 8 * elemBytes);
+            if(br.overrun)
+                return 0;
+        } else if(!decodeDeltaSeries(&p, end, 8 * elemBytes, pcol->nSamples, pFirst, sampleBytes))
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,93 @@
+#ifndef ARCHIVE_H_INCLUDED
+#define ARCHIVE_H_INCLUDED
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "signal.h"
+#include "matfile.h"
+#include "columns.h"
+
+// Archive files (.sarc) hold a segment's samples compactly for long term
+// storage, one column per signal as grouped by columns.h, each coded so that
+// slowly changing values take up next to nothing. signalArchive writes them
+// from segments and reads them back.
+//
+// LAYOUT (all little endian)
+//
+// An ArchiveHeader, then the columns one after another, each an
+// ArchiveColumnHeader, the signal's name, its coded timestamps and its coded
+// data, each of the last three padded to 8 bytes. nBytes in the column header
+// says where the next column starts, so a reader can skip straight to the
+// column it wants.
+//
+// DELTA CODING, for timestamps and integer (and char) data
+//
+// Each value is coded as its difference from the value before it (the first
+// from 0), wrapping at the type's width so that every value round trips. A
+// difference d goes out as the varint zigzag(d) << 1, and a run of n values
+// that each differ from the one before by the same amount as the last one
+// coded goes out as the varint n << 1 | 1. So a constant or a counter takes a
+// few bytes however long it runs. Varints are little endian base 128.
+//
+// XOR CODING, for double and single data, as in Facebook's Gorilla
+//
+// A bit stream, most significant bit first. The first value goes out whole.
+// Each one after is XORed with the one before it: a 0 bit if they're equal;
+// otherwise 10 then the XOR's meaningful bits if they fall inside the previous
+// meaningful bits' window; otherwise 11, the number of leading zeros in 5
+// bits, the number of meaningful bits less 1 (6 bits for double, 5 for single)
+// and the meaningful bits themselves.
+//
+// Data is coded one element at a time: element 0 of every sample, then element
+// 1 of every sample, and so on, each element's series coded on its own, since
+// it's along those that values change slowly. The XOR bit stream runs on from
+// one element's series to the next.
+
+#define ARCHIVE_MAGIC "SIGARC\r\n"
+#define ARCHIVE_MAGIC_LENGTH 8
+#define ARCHIVE_VERSION 1
+
+#define ARCHIVE_ALIGN 8
+#define ALIGN_ARCHIVE(nBytes) (((nBytes) + ARCHIVE_ALIGN - 1) & ~(size_t)(ARCHIVE_ALIGN - 1))
+
+typedef struct ArchiveHeader {
+    char magic[ARCHIVE_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t nColumns;
+} ArchiveHeader;
+
+typedef struct ArchiveColumnHeader {
+    uint32_t nBytes;          // including this header, the name and the padding
+    uint32_t nSamples;
+    uint32_t nTimestampBytes; // coded, before padding
+    uint32_t nDataBytes;      // coded, before padding
+    uint32_t minTimestamp;
+    uint32_t maxTimestamp;
+    uint16_t lenName;
+    uint8_t dataTypeId;
+    uint8_t nDims;
+    uint16_t dims[MAX_SIGNAL_NDIMS];
+} ArchiveColumnHeader;
+
+// an archive read back, mapped or in memory. columns point into data
+typedef struct SignalArchive {
+    const uint8_t* data;
+    size_t nBytes;
+    bool mapped;
+
+    uint32_t nColumns;
+    const ArchiveColumnHeader** columns;
+} SignalArchive;
+
+void writeArchiveHeader(MatBuffer*, uint32_t nColumns);
+void encodeArchiveColumn(MatBuffer*, const SignalColumn* pcol);
+
+bool openSignalArchive(const char* fileName, SignalArchive*);
+bool viewSignalArchive(const uint8_t* data, size_t nBytes, SignalArchive*);
+void closeSignalArchive(SignalArchive*);
+int findArchiveColumn(const SignalArchive*, const char* name, uint32_t lenName, int iFrom);
+const char* getArchiveColumnName(const ArchiveColumnHeader*);
+uint32_t getArchiveSampleBytes(const ArchiveColumnHeader*);
+bool decodeArchiveColumn(const ArchiveColumnHeader*, uint32_t* timestamps, uint8_t* data);
+
+#endif
@@ -1,292 +1,484 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "mat.h"
-#include <pthread.h>
+#include <errno.h>
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "signal.h"
 #include "buffer.h"
+#include "schema.h"
+#include "convert.h"
 #include "signalLogger.h"
 
-pthread_mutex_t signalBufferMutex = PTHREAD_MUTEX_INITIALIZER;
-
-PacketRingBuffer pbuf;
-PacketSetRingBuffer psetbuf;
-SignalRingBuffer sbuf;
-Signal s;
-
-uint8_t packetDataBuffer[MAX_DATA_SIZE_PER_TICK];
-int packetDataBufferBytes;
-uint32_t packetDataTimestamp;
+SignalBuffers* allocSignalBuffers()
+{
+    // the ring's indices are kept on their own cache lines
+    SignalBuffers* pbuf;
+    if(posix_memalign((void**)&pbuf, 64, sizeof(SignalBuffers)) != 0)
+        diep("Error allocating signal buffers");
+
+    memset(pbuf, 0, sizeof(SignalBuffers));
+    pbuf->pLastPacketSet = NULL;
+    pbuf->lastNumPackets = 1;
+    pbuf->pCurrentBatch = NULL;
+    pbuf->pPartialTickDesc = NULL;
+    initSignalSchemas(&pbuf->schemas);
+    pbuf->wakeup.eventFd = -1;
+    return pbuf;
+}
 
-void clearBuffers() 
+void freeSignalBuffers(SignalBuffers* pbuf)
 {
-    memset(&pbuf, 0, sizeof(PacketRingBuffer));
-    memset(&psetbuf, 0, sizeof(PacketSetRingBuffer));
-    memset(&sbuf, 0, sizeof(SignalRingBuffer));
+    if(pbuf->wakeup.eventFd != -1)
+        close(pbuf->wakeup.eventFd);
+    freeSignalSchemas(&pbuf->schemas);
+    freeTickSchema(&pbuf->decodeSchema);
+    free(pbuf);
 }
 
-/////// PACKET BUFFER /////////
+/////// PACKET RECEIVE /////////
 
-Packet * pushPacketAtHead(Packet p)
+// choose where the data for each packet in the next batch should be received: 
+// directly into the tick buffer position the packet is expected to occupy, if
+// nothing there can be overwritten, otherwise into the batch's scratch space. 
+// Packets are expected in order: the rest of the tick we last received a packet
+// for, then new ticks of the same size in the following free slots.
+void getPacketLandings(SignalBuffers* pbuf, PacketBatch* pb)
 {
-    pbuf.head = (pbuf.head + 1) % PACKET_BUFFER_SIZE;
+    PacketSet* ppset = NULL;  // existing PacketSet we expect packets for
+    bool slotFree = 0;        // or a new PacketSet in a free slot 
+    int slot = -1;
+    int numPackets = 0;
+    int idx = 0;
+    int head = pbuf->psetbuf.head;
+    int nNewSets = 0;
+
+    // continue the tick we last received a packet for, if it's still incomplete
+    if(pbuf->pLastPacketSet != NULL && pbuf->psetbuf.occupied[pbuf->pLastPacketSet - pbuf->psetbuf.buffer] &&
+            pbuf->pLastPacketSet->timestamp == pbuf->lastPacketTimestamp) {
+        ppset = pbuf->pLastPacketSet;
+        slot = ppset - pbuf->psetbuf.buffer;
+        numPackets = ppset->numPackets;
+        idx = pbuf->lastIdxPacket;
+    }
 
-    if(pbuf.occupied[pbuf.head]) {
-        // the existing packet will now be lost
-        // find its PacketSet, log an error and complain
-        PacketSet* ppset;
-        ppset = findPacketSetForPacket(&pbuf.buffer[pbuf.head]);
-        if (ppset != NULL) {
-            logIncompletePacketSet(ppset);
-            removePacketSetFromBuffer(ppset);
+    for(int k = 0; k < RECV_BATCH_SIZE; k++) {
+        pb->landing[k] = pb->scratch[k];
+
+        if(slot >= 0 && idx + 1 < numPackets) {
+            // the next packet of the same tick
+            idx++;
+            if(ppset != NULL ? !ppset->packetReceived[idx] : slotFree)
+                pb->landing[k] = pbuf->psetbuf.tickData[slot] + idx * MAX_PACKET_DATA_LENGTH;
+
+        } else {
+            // the first packet of a new tick, which will go in the next slot
+            head = (head + 1) % PACKETSET_BUFFER_SIZE;
+            slot = head;
+            ppset = NULL;
+            numPackets = pbuf->lastNumPackets;
+            idx = 0;
+
+            // don't wrap around onto slots we've already predicted into
+            slotFree = ++nNewSets < PACKETSET_BUFFER_SIZE && !pbuf->psetbuf.occupied[slot];
+            if(slotFree)
+                pb->landing[k] = pbuf->psetbuf.tickData[slot];
         }
     }
+}
 
-    pbuf.buffer[pbuf.head] = p;
-    pbuf.occupied[pbuf.head] = 1;
+// handle each packet in a batch filled in by the receiver, in the order received
+void processPacketBatch(SignalBuffers* pbuf, PacketBatch* pb)
+{
+    pbuf->pCurrentBatch = pb;
+    pbuf->batchReceivedUsec = getMonotonicUsec();
+    STAT_ADD(pbuf->stats.packets, pb->nPackets);
+    for(int k = 0; k < pb->nPackets; k++) {
+        STAT_ADD(pbuf->stats.packetBytes, pb->bytesRead[k]);
+        pbuf->idxCurrentPacket = k;
+        receivePacket(pbuf, pb->header[k], pb->landing[k], pb->bytesRead[k]);
+    }
+    pbuf->pCurrentBatch = NULL;
 
-    // return a pointer to the newly created packet
-    return pbuf.buffer + pbuf.head;
+    if(pbuf->partialTickUsec > 0)
+        giveUpOnExpiredPacketSets(pbuf);
+
+    STAT_MAX(pbuf->stats.signalBufferHighWaterBytes, (uint64_t)getSignalBytesInBuffer(pbuf));
+    wakeSignalWriterIfNeeded(pbuf);
 }
 
-void removePacketFromBuffer(Packet* pp)
+// about to write nBytes of tick data at start, move any packets later in the 
+// current batch that were received there out to their scratch space first
+void protectPacketLandings(SignalBuffers* pbuf, const uint8_t* start, int nBytes)
 {
-    int index = pp - pbuf.buffer;
+    PacketBatch* pb = pbuf->pCurrentBatch;
+    if(pb == NULL)
+        return;
+
+    for(int k = pbuf->idxCurrentPacket + 1; k < pb->nPackets; k++) {
+        int nDataBytes = pb->bytesRead[k] - PACKET_HEADER_LENGTH;
+        if(nDataBytes > 0 && pb->landing[k] < start + nBytes && 
+                pb->landing[k] + nDataBytes > start) {
+            memcpy(pb->scratch[k], pb->landing[k], nDataBytes);
+            pb->landing[k] = pb->scratch[k];
+        }
+    }
+}
+
+// handle a packet whose header was received at rawHeader and whose data was 
+// received at landing, as chosen by getPacketLandings
+void receivePacket(SignalBuffers* pbuf, const uint8_t* rawHeader, uint8_t* landing, int bytesRead)
+{
+    Packet p;
+    if(!parsePacket(rawHeader, landing, bytesRead, pbuf->schemas.swapBytes, &p)) {
+        logInvalidPacket(bytesRead);
+        STAT_ADD(pbuf->stats.invalidPackets, 1);
+        return;
+    }
+    //printPacket(&p);
+
+    PacketSet* pPacketSet;
+    pPacketSet = findPacketSetForPacket(pbuf, &p);
+
+    if(pPacketSet == NULL)
+        pPacketSet = createPacketSetForPacket(pbuf, &p);
 
-    //printf("\tRemoving Packet %d for ts %d at index %d\n", pp->idxPacket, pp->timestamp, index);
+    // store this packet's data inside the packet set
+    addPacketToPacketSet(pbuf, pPacketSet, &p);
 
-    if(index < 0 || index > PACKET_BUFFER_SIZE)
-        diep("Attempt to remove Packet not in PacketRingBuffer");
+    pbuf->pLastPacketSet = pPacketSet;
+    pbuf->lastPacketTimestamp = p.timestamp;
+    pbuf->lastIdxPacket = p.idxPacket;
+    pbuf->lastNumPackets = p.numPackets;
 
-    // clear this packet and mark as unoccupied in buffer
-    memset(pp, 0, sizeof(Packet));
-    pbuf.occupied[index] = 0;
+    // have we received the full group of packets yet?
+    if (checkReceivedAllPackets(pPacketSet)) {
+        // look at the multi-packet data in this set
+        // turn it into signals on the SignalBuffer, and remove the 
+        // packet set from the buffer
+        processPacketSet(pbuf, pPacketSet);
+
+        removePacketSetFromBuffer(pbuf, pPacketSet);
+    }
 }
 
 /////// PACKETSET BUFFER /////////
 
-PacketSet * pushPacketSetAtHead(PacketSet p)
+PacketSet * pushPacketSetAtHead(SignalBuffers* pbuf, PacketSet p)
 {
-    psetbuf.head = (psetbuf.head + 1) % PACKETSET_BUFFER_SIZE;
-    if(psetbuf.occupied[psetbuf.head]) {
-        logIncompletePacketSet(psetbuf.buffer + psetbuf.head);
-        removePacketSetFromBuffer(psetbuf.buffer + psetbuf.head);
-    }
+    pbuf->psetbuf.head = (pbuf->psetbuf.head + 1) % PACKETSET_BUFFER_SIZE;
+    if(pbuf->psetbuf.occupied[pbuf->psetbuf.head])
+        giveUpOnPacketSet(pbuf, pbuf->psetbuf.buffer + pbuf->psetbuf.head);
 
-    memset(&psetbuf.buffer[psetbuf.head], 0, sizeof(PacketSet));
-    psetbuf.buffer[psetbuf.head] = p;
-    psetbuf.occupied[psetbuf.head] = 1;
+    pbuf->psetbuf.buffer[pbuf->psetbuf.head] = p;
+    pbuf->psetbuf.buffer[pbuf->psetbuf.head].data = pbuf->psetbuf.tickData[pbuf->psetbuf.head];
+    pbuf->psetbuf.occupied[pbuf->psetbuf.head] = 1;
+    addPacketSetToIndex(pbuf, pbuf->psetbuf.head);
 
     // return a pointer to the newly created packet
-    return psetbuf.buffer + psetbuf.head;
+    return pbuf->psetbuf.buffer + pbuf->psetbuf.head;
 }
 
-void removePacketSetFromBuffer(PacketSet* ppset)
+void removePacketSetFromBuffer(SignalBuffers* pbuf, PacketSet* ppset)
 {
-    int index = ppset - psetbuf.buffer;
+    int index = ppset - pbuf->psetbuf.buffer;
 
     //printf("Removing PacketSet for ts %d at index %d\n", ppset->timestamp, index);
 
-    if(index < 0 || index > PACKETSET_BUFFER_SIZE)
+    if(index < 0 || index >= PACKETSET_BUFFER_SIZE)
         diep("Attempt to remove PacketSet not in PacketSetRingBuffer");
 
-    // clear the packets that comprise this packet set
-    for(int i = 0; i < ppset->numPackets; i++) 
-    {
-        if(ppset->packetReceived[i])
-            removePacketFromBuffer(ppset->pPackets[i]);
-    }
+    removePacketSetFromIndex(pbuf, index);
 
-    // clear this packet set and mark as unoccupied in buffer
+    // clear this packet set and mark as unoccupied in buffer, the tick data 
+    // needn't be cleared since only received packets are ever read from it
     memset(ppset, 0, sizeof(PacketSet));
-    psetbuf.occupied[index] = 0;
+    pbuf->psetbuf.occupied[index] = 0;
+}
+
+// home position in the index for a timestamp. Fibonacci hashing spreads 
+// consecutive timestamps across the table.
+int hashPacketSetTimestamp(uint32_t timestamp)
+{
+    return (int)((timestamp * 2654435761u) >> (32 - PACKETSET_INDEX_BITS));
+}
+
+void addPacketSetToIndex(SignalBuffers* pbuf, int slot)
+{
+    int i = hashPacketSetTimestamp(pbuf->psetbuf.buffer[slot].timestamp);
+
+    // probe forward to the first empty position, the index is never more than
+    // half full so there always is one
+    while(pbuf->psetbuf.index[i] != 0)
+        i = (i + 1) & PACKETSET_INDEX_MASK;
+
+    pbuf->psetbuf.index[i] = slot + 1;
+}
+
+void removePacketSetFromIndex(SignalBuffers* pbuf, int slot)
+{
+    int i = hashPacketSetTimestamp(pbuf->psetbuf.buffer[slot].timestamp);
+    while(pbuf->psetbuf.index[i] != slot + 1) {
+        if(pbuf->psetbuf.index[i] == 0)
+            diep("PacketSet missing from PacketSet index");
+        i = (i + 1) & PACKETSET_INDEX_MASK;
+    }
+
+    // shift later entries in the probe run back into the hole, so that lookups
+    // never stop early at it and no tombstones are needed
+    int j = i;
+    while(1) {
+        j = (j + 1) & PACKETSET_INDEX_MASK;
+        if(pbuf->psetbuf.index[j] == 0)
+            break;
+
+        // entries whose home lies cyclically in (i, j] can't move before it
+        int home = hashPacketSetTimestamp(pbuf->psetbuf.buffer[pbuf->psetbuf.index[j] - 1].timestamp);
+        if(((j - home) & PACKETSET_INDEX_MASK) < ((j - i) & PACKETSET_INDEX_MASK))
+            continue;
+
+        pbuf->psetbuf.index[i] = pbuf->psetbuf.index[j];
+        i = j;
+    }
+
+    pbuf->psetbuf.index[i] = 0;
 }
   
 /////// SIGNAL BUFFER /////////
 
-Signal* pushSignalAtHead(Signal s)
+// copy the signal viewed by *ps onto the head of the signal buffer, returns false
+// and drops the signal if the writer thread hasn't drained enough room for it
+bool pushSignalAtHead(SignalBuffers* pbuf, const Signal* ps)
 {
-    // lock the signal buffer mutex 
-    pthread_mutex_lock(&signalBufferMutex);
+    uint32_t recordBytes = getSignalRecordBytes(ps);
 
-    if(sbuf.occupied[sbuf.head]) {
+    // only this thread writes head, so a relaxed load of our own index is fine
+    uint32_t head = __atomic_load_n(&pbuf->sbuf.head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&pbuf->sbuf.tail, __ATOMIC_ACQUIRE);
+
+    // records don't straddle the end of the arena, skip to the start if needed
+    uint32_t offset = head & SIGNAL_BUFFER_MASK;
+    uint32_t bytesToEnd = SIGNAL_BUFFER_BYTES - offset;
+    uint32_t skipBytes = recordBytes > bytesToEnd ? bytesToEnd : 0;
+
+    if(head + skipBytes + recordBytes - tail > SIGNAL_BUFFER_BYTES) {
         // signal buffer overflow 
-        logDroppedSignal(&s);
+        logDroppedSignal(ps);
+        STAT_ADD(pbuf->stats.droppedSignals, 1);
+        return 0;
     }
 
-    sbuf.buffer[sbuf.head] = s;
-    sbuf.occupied[sbuf.head] = 1;
+    if(skipBytes) {
+        // leave a wrap marker if there's room, otherwise the reader skips on its own
+        if(bytesToEnd >= SIGNAL_RECORD_HEADER_BYTES)
+            ((SignalRecord*)(pbuf->sbuf.arena + offset))->length = 0;
+        head += skipBytes;
+        offset = 0;
+    }
 
-    // unlock the signal buffer mutex
-    pthread_mutex_unlock(&signalBufferMutex);
+    storeSignalRecord(pbuf->sbuf.arena + offset, ps);
 
-    // return this pointer to the new packet
-    Signal* newPacket = &sbuf.buffer[sbuf.head];
-    
-    //printf("Storing Signal at head %d, (tail=%d)\n", sbuf.head, sbuf.tail);
+    //printf("Storing Signal at head %u, (tail=%u)\n", head, tail);
 
-    // advance the head
-    sbuf.head = (sbuf.head + 1) % PACKET_BUFFER_SIZE;
+    // publish the new signal to the writer thread
+    __atomic_store_n(&pbuf->sbuf.head, head + recordBytes, __ATOMIC_RELEASE);
+    __atomic_store_n(&pbuf->sbuf.nPushed, pbuf->sbuf.nPushed + 1, __ATOMIC_RELEASE);
+    STAT_ADD(pbuf->stats.signals, 1);
 
-    // return a pointer to the newly created signal
-    return newPacket; 
+    return 1;
 }
 
-void removeSignalFromBuffer(Signal* ps)
+// bytes needed to store the signal as a SignalRecord
+uint32_t getSignalRecordBytes(const Signal* ps)
 {
-    // lock the signal buffer mutex 
-    pthread_mutex_lock(&signalBufferMutex);
-
-    int index = ps - sbuf.buffer;
+    return ALIGN_SIGNAL_RECORD(SIGNAL_RECORD_HEADER_BYTES + ps->nBytes);
+}
 
-    if(index < 0 || index > SIGNAL_BUFFER_SIZE)
-        diep("Attempt to remove Signal not in SignalRingBuffer");
+// write the signal viewed by *ps as a SignalRecord at pRecord, which must have
+// getSignalRecordBytes(ps) bytes of room
+void storeSignalRecord(uint8_t* pRecord, const Signal* ps)
+{
+    SignalRecord* prec = (SignalRecord*)pRecord;
+    prec->length = getSignalRecordBytes(ps);
+    prec->timestamp = ps->timestamp;
+    prec->receivedUsec = ps->receivedUsec;
+    prec->descId = ps->descId;
+    memcpy(pRecord + SIGNAL_RECORD_HEADER_BYTES, ps->data, ps->nBytes);
+}
 
-    // clear this signal and mark as unoccupied in buffer
-    memset(ps, 0, sizeof(Signal));
-    sbuf.occupied[index] = 0;
-    
-    // unlock the signal buffer mutex
-    pthread_mutex_unlock(&signalBufferMutex);
+// point ps at the signal stored in a SignalRecord
+void viewSignalRecord(const SignalSchemas* pschemas, const SignalRecord* prec, Signal* ps)
+{
+    viewSignalDescriptor(getSignalDescriptor(pschemas, prec->descId), ps);
+    ps->timestamp = prec->timestamp;
+    ps->receivedUsec = prec->receivedUsec;
+    ps->data = (const uint8_t*)prec + SIGNAL_RECORD_HEADER_BYTES;
 }
 
-int getSignalCountInBuffer()
+int getSignalCountInBuffer(SignalBuffers* pbuf)
 {
-    int i,c, count, tailToHeadDistance;
-	count = 0;
+    return __atomic_load_n(&pbuf->sbuf.nPushed, __ATOMIC_ACQUIRE) - 
+        __atomic_load_n(&pbuf->sbuf.nPopped, __ATOMIC_RELAXED);
+}
 
-    // lock the signal buffer mutex 
-    pthread_mutex_lock(&signalBufferMutex);
-    
-    tailToHeadDistance = (sbuf.head - sbuf.tail);
-    if(tailToHeadDistance < 0)
-        tailToHeadDistance += SIGNAL_BUFFER_SIZE;
+// bytes of the arena in use, including any skipped at a wrap
+uint32_t getSignalBytesInBuffer(SignalBuffers* pbuf)
+{
+    return __atomic_load_n(&pbuf->sbuf.head, __ATOMIC_ACQUIRE) - 
+        __atomic_load_n(&pbuf->sbuf.tail, __ATOMIC_ACQUIRE);
+}
 
-    for(c = 0; c < tailToHeadDistance; c++)
-    {
-        // translate into the circular index from the tail towards the head
-        i = (sbuf.tail + c) % SIGNAL_BUFFER_SIZE;
-        count += sbuf.occupied[i];
+// skip the writer's tail past any wrap to the start of the arena, returns the
+// record at the tail or NULL if the buffer is empty
+SignalRecord* getRecordAtTail(SignalBuffers* pbuf)
+{
+    // only this thread writes tail
+    uint32_t tail = __atomic_load_n(&pbuf->sbuf.tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&pbuf->sbuf.head, __ATOMIC_ACQUIRE);
+
+    if(tail == head)
+        // buffer is empty
+        return NULL;
+
+    uint32_t offset = tail & SIGNAL_BUFFER_MASK;
+    uint32_t bytesToEnd = SIGNAL_BUFFER_BYTES - offset;
+    if(bytesToEnd < SIGNAL_RECORD_HEADER_BYTES || 
+            ((SignalRecord*)(pbuf->sbuf.arena + offset))->length == 0) {
+        // the producer wrapped here, the record is at the start of the arena
+        tail += bytesToEnd;
+        __atomic_store_n(&pbuf->sbuf.tail, tail, __ATOMIC_RELEASE);
+        offset = 0;
     }
 
-    // unlock the signal buffer mutex
-    pthread_mutex_unlock(&signalBufferMutex);
-
-    return count;
+    return (SignalRecord*)(pbuf->sbuf.arena + offset);
 }
 
-// get first signal from the tail onward, store in ps, returns true if one is found
-bool popSignalFromTail(Signal* ps)
+// view the signal at the tail in ps without removing it, returns true if one is 
+// found. ps stays valid until releaseSignalAtTail is called.
+bool peekSignalAtTail(SignalBuffers* pbuf, Signal* ps)
 {
-    int i, c, tailToHeadDistance;
-
-    // lock the signal buffer mutex 
-    pthread_mutex_lock(&signalBufferMutex);
-    
-    // only check from tail to head, don't go past head
-    tailToHeadDistance = (sbuf.head - sbuf.tail);
-    if(tailToHeadDistance < 0)
-        tailToHeadDistance += SIGNAL_BUFFER_SIZE;
-    //printf("TailToHeadDistance = %d\n", tailToHeadDistance);
+    SignalRecord* prec = getRecordAtTail(pbuf);
+    if(prec == NULL)
+        return 0;
 
-    for(c = 0; c < tailToHeadDistance; c++) {
-        // translate into the circular index from the tail towards the head
-        i = (sbuf.tail + c) % SIGNAL_BUFFER_SIZE;
-
-        if(sbuf.occupied[i]) {
-            // copy the signal to the pointer
-            *ps = sbuf.buffer[i];
-          
-            sbuf.tail = (i+1) % SIGNAL_BUFFER_SIZE;
-            // remove from buffer
-            memset(sbuf.buffer + i, 0, sizeof(Signal));
-            sbuf.occupied[i] = 0;
-
-            // unlock the signal buffer mutex
-            pthread_mutex_unlock(&signalBufferMutex);
-            return 1;
-        }
-    }
+    viewSignalRecord(&pbuf->schemas, prec, ps);
+    return 1;
+}
 
-    // unlock the signal buffer mutex
-    pthread_mutex_unlock(&signalBufferMutex);
+// hand the space used by the signal at the tail back to the network thread
+void releaseSignalAtTail(SignalBuffers* pbuf)
+{
+    SignalRecord* prec = getRecordAtTail(pbuf);
+    if(prec == NULL)
+        diep("Attempt to release Signal from empty SignalRingBuffer");
 
-    // not found
-    return 0;
+    uint32_t tail = __atomic_load_n(&pbuf->sbuf.tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&pbuf->sbuf.tail, tail + prec->length, __ATOMIC_RELEASE);
+    __atomic_store_n(&pbuf->sbuf.nPopped, pbuf->sbuf.nPopped + 1, __ATOMIC_RELAXED);
 }
 
-PacketSet* findPacketSetForPacket(Packet* pPacket)
+PacketSet* findPacketSetForPacket(SignalBuffers* pbuf, Packet* pPacket)
 {
     uint32_t ts = pPacket->timestamp;
-    int i;
+    int i = hashPacketSetTimestamp(ts);
 
-    // search backwards through the PacketSetBuffer for a PacketSet with a matching timestamp
-    for(int c = 0; c < PACKETSET_BUFFER_SIZE; c++) {
-        i = (psetbuf.head - c) % PACKETSET_BUFFER_SIZE;
-        if (psetbuf.occupied[i] && psetbuf.buffer[i].timestamp == ts)
+    // probe the index from this timestamp's home until we hit an empty position
+    while(pbuf->psetbuf.index[i] != 0) {
+        PacketSet* ppset = pbuf->psetbuf.buffer + pbuf->psetbuf.index[i] - 1;
+
+        // a dictionary may share its timestamp with a tick
+        if (ppset->timestamp == ts && ppset->packetVersion == pPacket->packetVersion)
             // found it!
-            return psetbuf.buffer + i;
+            return ppset;
+        i = (i + 1) & PACKETSET_INDEX_MASK;
     }
 
     return NULL;
 }
 
-PacketSet* createPacketSetForPacket(Packet* pPacket)
+PacketSet* createPacketSetForPacket(SignalBuffers* pbuf, Packet* pPacket)
 {
     // not found, create one
     PacketSet pset;
 	memset(&pset, 0, sizeof(PacketSet));
+    pset.packetVersion = pPacket->packetVersion;
     pset.timestamp = pPacket->timestamp;
     pset.numPackets = pPacket->numPackets;
-    pset.packetReceived[pPacket->idxPacket] = 1;
-    pset.pPackets[pPacket->idxPacket] = pPacket;
+    pset.firstReceivedUsec = pbuf->batchReceivedUsec;
 
     // add to head of buffer
-    return pushPacketSetAtHead(pset); 
+    return pushPacketSetAtHead(pbuf, pset); 
 }
 
-bool checkReceivedAllPackets(PacketSet* pPacketSet)
+void addPacketToPacketSet(SignalBuffers* pbuf, PacketSet* pPacketSet, const Packet* pPacket)
 {
-    // check whether we've received all the packets for this tick
-    for(int i = 0; i < pPacketSet->numPackets; i++) {
-        if (!pPacketSet->packetReceived[i]) {
-            return 0;
-        }
+    int idx = pPacket->idxPacket;
+
+    // ignore duplicates and packets that disagree about the size of the tick
+    if(pPacket->numPackets != pPacketSet->numPackets || pPacketSet->packetReceived[idx])
+        return;
+
+    // the data only needs moving if it wasn't received at its position already
+    uint8_t* pData = pPacketSet->data + idx * MAX_PACKET_DATA_LENGTH;
+    if(pPacket->rawData != pData) {
+        protectPacketLandings(pbuf, pData, pPacket->rawLength);
+        memcpy(pData, pPacket->rawData, pPacket->rawLength);
     }
 
-    return 1;
+    pPacketSet->packetLength[idx] = pPacket->rawLength;
+    pPacketSet->packetReceived[idx] = 1;
+    pPacketSet->numReceived++;
 }
 
-void processPacketSet(PacketSet* pPacketSet)
+bool checkReceivedAllPackets(PacketSet* pPacketSet)
 {
-    Packet* pPacket;
+    // check whether we've received all the packets for this tick
+    return pPacketSet->numReceived == pPacketSet->numPackets;
+}
 
+void processPacketSet(SignalBuffers* pbuf, PacketSet* pPacketSet)
+{
     //printf("\nProcessing Packet Set for timestamp %d:\n", pPacketSet->timestamp);
     //printPacketSet(pPacketSet);
 
-    // clear buffer to store all packet data
-    memset(packetDataBuffer, 0, MAX_DATA_SIZE_PER_TICK * sizeof(uint8_t));
-
-    // loop over the packets, copying each into the data buffer
+    // each packet was received at a fixed stride in the tick buffer, which is
+    // already contiguous when the sender fills every packet but the last. 
+    // Otherwise close up the gaps in place.
     int bufOffset = 0;
     for(int i = 0; i < pPacketSet->numPackets; i++) {
-        // copy over this packet's data into the data buffer
-        pPacket = pPacketSet->pPackets[i];
-        memcpy(packetDataBuffer + bufOffset, pPacket->rawData, 
-                pPacket->rawLength * sizeof(uint8_t));
+        moveTickPacket(pbuf, pPacketSet, i, bufOffset);
         
         // advance the offset into the data buffer
-        bufOffset += pPacket->rawLength * sizeof(uint8_t);
+        bufOffset += pPacketSet->packetLength[i];
     }
 
-    // store the number of bytes stored
-    packetDataBufferBytes = bufOffset;
-
-    // store the current timestamp
-    packetDataTimestamp = pPacketSet->timestamp;
+    STAT_ADD(pbuf->stats.ticks, 1);
+    if(pbuf->warnSignalIds && pPacketSet->packetVersion != PACKET_VERSION_SIGNAL_NAMES) {
+        fprintf(stderr, "\nWARNING: Ticks sent with signal ids (packetVersion 2 and 3) are all "
+                "received on the first thread, -w will not spread them out\n\n");
+        pbuf->warnSignalIds = 0;
+    }
+    if(pPacketSet->packetVersion == PACKET_VERSION_DICTIONARY)
+        processDictionaryData(pbuf, pPacketSet->data, bufOffset, pPacketSet->timestamp);
+    else if(pPacketSet->packetVersion == PACKET_VERSION_SIGNAL_IDS)
+        processSignalIdData(pbuf, pPacketSet->data, bufOffset, pPacketSet->timestamp, 0);
+    else
+        processData(pbuf, pPacketSet->data, bufOffset, pPacketSet->timestamp, 0);
+}
 
-    processData();
+// move packet idx's data from where it was received to offset in the tick
+// buffer. Packets are moved in order, and never further along
+void moveTickPacket(SignalBuffers* pbuf, PacketSet* ppset, int idx, uint32_t offset)
+{
+    uint8_t* pData = ppset->data + idx * MAX_PACKET_DATA_LENGTH;
+    if(pData != ppset->data + offset) {
+        protectPacketLandings(pbuf, ppset->data + offset, ppset->packetLength[idx]);
+        memmove(ppset->data + offset, pData, ppset->packetLength[idx]);
+    }
 }
 
 void printPacketSet(const PacketSet* ppset)
@@ -296,7 +488,7 @@ void printPacketSet(const PacketSet* ppset)
     for(int i = 0; i < ppset->numPackets; i++)
     {
         if(ppset->packetReceived[i])
-            totalBytes += ppset->pPackets[i]->rawLength;    
+            totalBytes += ppset->packetLength[i];    
     }
 
     printf("PacketSet : [ Timestamp %d, %d bytes received, %d packets (", 
@@ -311,50 +503,299 @@ void printPacketSet(const PacketSet* ppset)
     printf(") ]\n");
 }
 
-void processData()
+// queue the signals in a tick's reassembled data for the writer, returning how
+// many. A tick laid out like one seen before only needs its data pointing at,
+// otherwise its headers are decoded and the layout remembered. The data of a
+// partial tick stops partway through, so it is always decoded, and the signals
+// before where it stops are kept without complaint
+int processData(SignalBuffers* pbuf, uint8_t* data, int nBytes, uint32_t timestamp, bool partial)
+{
+    //printf("Processing %d bytes of data\n", nBytes);
+
+    const TickSchema* pschema = partial ? NULL : findTickSchema(&pbuf->schemas, data, nBytes);
+    if(pschema == NULL) {
+        uint32_t nBytesDecoded;
+        if(decodeTickSchema(&pbuf->schemas, data, nBytes, &pbuf->decodeSchema, &nBytesDecoded) &&
+                !partial)
+            pschema = addTickSchema(&pbuf->schemas, &pbuf->decodeSchema);
+        else {
+            // keep the signals before the problem, but not the layout
+            if(!partial) {
+                logMalformedTick(timestamp, nBytesDecoded);
+                STAT_ADD(pbuf->stats.malformedTicks, 1);
+            }
+            pschema = &pbuf->decodeSchema;
+        }
+    }
+
+    for(uint32_t i = 0; i < pschema->nSignals; i++)
+        queueSignal(pbuf, getSignalDescriptor(&pbuf->schemas, pschema->descIds[i]),
+                data + pschema->dataOffsets[i], timestamp);
+
+    if(pbuf->ptap != NULL)
+        commitTapSignals(pbuf->ptap);
+    return pschema->nSignals;
+}
+
+// queue one signal of a tick for the writer, and publish it to the tap. A big
+// endian sender's data is swapped in place
+void queueSignal(SignalBuffers* pbuf, const SignalDescriptor* pdesc, uint8_t* data, uint32_t timestamp)
 {
-    uint8_t* pBuf = packetDataBuffer;
+    Signal s;
+    viewSignalDescriptor(pdesc, &s);
+    s.timestamp = timestamp;
+    s.receivedUsec = pbuf->batchReceivedUsec;
+    s.data = data;
+    if(pbuf->schemas.swapBytes)
+        swapSignalBytes(data, &s);
+
+    if(pbuf->ptap != NULL)
+        publishTapSignal(pbuf->ptap, pdesc, &s);
+
+    // add to the signal ring buffer to queue it up for the writer thread
+    pushSignalAtHead(pbuf, &s);
+    //printSignal(&s);
+}
 
-    //printf("Processing %d bytes of data\n", packetDataBufferBytes);
+// queue the signals in a tick that gives each signal by its dictionary id,
+// returning how many. As with processData, a partial tick's data may stop
+// partway through a signal
+int processSignalIdData(SignalBuffers* pbuf, uint8_t* data, int nBytes, uint32_t timestamp,
+        bool partial)
+{
+    int nSignals = 0;
+    uint8_t* pBuf = data;
+    const uint8_t* pEnd = data + nBytes;
+
+    while(pEnd - pBuf >= (int)sizeof(uint16_t)) {
+        uint16_t signalId;
+        STORE_UINT16(pBuf, signalId);
+        if(pbuf->schemas.swapBytes)
+            signalId = __builtin_bswap16(signalId);
+
+        // without its dictionary entry there's no telling where the signal ends,
+        // so the rest of the tick is lost
+        const SignalDescriptor* pdesc = findDictionarySignal(&pbuf->schemas, signalId);
+        if(pdesc == NULL) {
+            logUnknownSignalId(timestamp, signalId);
+            STAT_ADD(pbuf->stats.unknownSignalIds, 1);
+            break;
+        }
 
-    while(pBuf - packetDataBuffer < packetDataBufferBytes) {
-        memset(&s, 0, sizeof(Signal));
-       
-        // set the timestamp for the signal
-        s.timestamp = packetDataTimestamp;
+        if((uint32_t)(pEnd - pBuf) < pdesc->nBytes) {
+            pBuf -= sizeof(uint16_t);
+            break;
+        }
 
-        // get the number of bytes in the signal name
-        uint16_t lenName;
-        STORE_UINT16(pBuf, lenName);
+        queueSignal(pbuf, pdesc, pBuf, timestamp);
+        pBuf += pdesc->nBytes;
+        nSignals++;
+    }
 
-        // store the signal name
-        STORE_UINT8_ARRAY(pBuf, s.name, lenName);
+    if(pbuf->ptap != NULL)
+        commitTapSignals(pbuf->ptap);
 
-        // store the data type
-        STORE_UINT8(pBuf, s.dataTypeId);
-       
-        // store the number of dimensions
-        STORE_UINT8(pBuf, s.nDims);
+    if(pBuf != pEnd && !partial && pEnd - pBuf >= (int)sizeof(uint16_t)) {
+        logMalformedTick(timestamp, pBuf - data);
+        STAT_ADD(pbuf->stats.malformedTicks, 1);
+    }
+    return nSignals;
+}
 
-        // store the dimensions
-        STORE_UINT16_ARRAY(pBuf, s.dims, s.nDims); 
-       
-        // compute the number of bytes in the data
-        uint16_t nElements = 1;
-        for(int idim = 0; idim < s.nDims; idim++) {
-            nElements *= s.dims[idim];
+// take on the signal ids given in a dictionary
+void processDictionaryData(SignalBuffers* pbuf, const uint8_t* data, int nBytes, uint32_t timestamp)
+{
+    uint32_t nBytesDecoded;
+    if(!decodeSignalDictionary(&pbuf->schemas, data, nBytes, &nBytesDecoded)) {
+        logMalformedDictionary(timestamp, nBytesDecoded);
+        STAT_ADD(pbuf->stats.malformedTicks, 1);
+    }
+}
+
+/////// PARTIAL TICKS /////////
+
+// stop waiting for the rest of a tick's packets. With -P, the signals in the
+// packets that did arrive are queued rather than dropping the whole tick, along
+// with a PARTIAL_TICK_SIGNAL_NAME signal marking the tick as partial
+void giveUpOnPacketSet(SignalBuffers* pbuf, PacketSet* ppset)
+{
+    STAT_ADD(pbuf->stats.incompleteTicks, 1);
+    if(pbuf->partialTickUsec > 0 && ppset->packetVersion != PACKET_VERSION_DICTIONARY) {
+        int nRecovered = recoverPartialPacketSet(pbuf, ppset);
+        queuePartialTickSignal(pbuf, ppset, nRecovered);
+        if(pbuf->ptap != NULL)
+            commitTapSignals(pbuf->ptap);
+
+        STAT_ADD(pbuf->stats.partialTicks, 1);
+        STAT_ADD(pbuf->stats.recoveredSignals, nRecovered);
+        logPartialPacketSet(ppset, nRecovered);
+    } else {
+        logIncompletePacketSet(ppset);
+    }
+    removePacketSetFromBuffer(pbuf, ppset);
+}
+
+// give up on the ticks whose first packet arrived more than partialTickUsec
+// ago, rather than waiting for the ring to come back round to them. Slots are
+// taken in order, so the oldest tick is the first occupied one after head
+void giveUpOnExpiredPacketSets(SignalBuffers* pbuf)
+{
+    for(int i = 1; i <= PACKETSET_BUFFER_SIZE; i++) {
+        int slot = (pbuf->psetbuf.head + i) % PACKETSET_BUFFER_SIZE;
+        if(!pbuf->psetbuf.occupied[slot])
+            continue;
+
+        PacketSet* ppset = pbuf->psetbuf.buffer + slot;
+        if((uint32_t)(pbuf->batchReceivedUsec - ppset->firstReceivedUsec) < pbuf->partialTickUsec)
+            break;
+        giveUpOnPacketSet(pbuf, ppset);
+    }
+}
+
+// queue what can be made out of an incomplete tick, returning how many signals.
+// The signals before the first missing packet can always be decoded. Past the
+// gap, a tick with signal headers can only be made sense of by a cached layout
+// that fits what did arrive, which needs every packet but the last to be the
+// same length so it's known where each one starts
+int recoverPartialPacketSet(SignalBuffers* pbuf, PacketSet* ppset)
+{
+    int last = ppset->numPackets - 1;
+    uint32_t packetBytes = 0;
+    bool uniform = 1;
+    bool receivedPastGap = 0;
+    bool gap = 0;
+    for(int i = 0; i <= last; i++) {
+        if(!ppset->packetReceived[i]) {
+            gap = 1;
+            continue;
+        }
+        receivedPastGap = receivedPastGap || gap;
+        if(i == last)
+            continue;
+        if(packetBytes == 0)
+            packetBytes = ppset->packetLength[i];
+        else if(ppset->packetLength[i] != packetBytes)
+            uniform = 0;
+    }
+
+    uint32_t prefixBytes = 0;
+    if(ppset->packetVersion == PACKET_VERSION_SIGNAL_NAMES && uniform && packetBytes > 0 && receivedPastGap) {
+        for(int i = 0; i <= last; i++)
+            if(ppset->packetReceived[i])
+                moveTickPacket(pbuf, ppset, i, i * packetBytes);
+
+        int nRecovered = recoverFromTickSchema(pbuf, ppset, packetBytes);
+        if(nRecovered >= 0)
+            return nRecovered;
+
+        // the prefix is already in place
+        for(int i = 0; i <= last && ppset->packetReceived[i]; i++)
+            prefixBytes += ppset->packetLength[i];
+    } else {
+        for(int i = 0; i <= last && ppset->packetReceived[i]; i++) {
+            moveTickPacket(pbuf, ppset, i, prefixBytes);
+            prefixBytes += ppset->packetLength[i];
         }
+    }
 
-        // read the data as uint8, we'll typecast later
-        uint16_t bytesForData = nElements * getSizeOfDataTypeId(s.dataTypeId);
-        STORE_UINT8_ARRAY(pBuf, s.data, bytesForData);
+    if(prefixBytes == 0)
+        return 0;
+    if(ppset->packetVersion == PACKET_VERSION_SIGNAL_IDS)
+        return processSignalIdData(pbuf, ppset->data, prefixBytes, ppset->timestamp, 1);
+    return processData(pbuf, ppset->data, prefixBytes, ppset->timestamp, 1);
+}
 
-        // add to the signal ring buffer to queue it up for the writer thread
-//        Signal* ps;
-        pushSignalAtHead(s);
-        //printSignal(ps);
+// queue the signals of a tick whose packets have been laid out packetBytes
+// apart, using the first cached layout that's the right length and has the
+// same signal header wherever one was received. Returns -1 if none fits
+int recoverFromTickSchema(SignalBuffers* pbuf, PacketSet* ppset, uint32_t packetBytes)
+{
+    SignalSchemas* pschemas = &pbuf->schemas;
+    int last = ppset->numPackets - 1;
+    const TickSchema* pschema = NULL;
+    for(int k = -1; pschema == NULL && k < (int)pschemas->nCached; k++) {
+        // the last layout matched is the likeliest
+        int i = k < 0 ? pschemas->iLastMatched : k;
+        if(i < 0 || (k >= 0 && i == pschemas->iLastMatched))
+            continue;
+
+        const TickSchema* pcandidate = pschemas->cache + i;
+        if(ppset->packetReceived[last] ?
+                pcandidate->nBytes != last * packetBytes + ppset->packetLength[last] :
+                pcandidate->nBytes <= last * packetBytes || pcandidate->nBytes > (last + 1) * packetBytes)
+            continue;
+
+        bool fits = 1;
+        for(uint32_t j = 0; fits && j < pcandidate->nSignals; j++) {
+            const SignalDescriptor* pdesc = getSignalDescriptor(pschemas, pcandidate->descIds[j]);
+            uint32_t start = pcandidate->headerOffsets[j];
+            if(isTickRangeReceived(ppset, packetBytes, start, start + pdesc->nHeaderBytes))
+                fits = memcmp(ppset->data + start, pdesc->header, pdesc->nHeaderBytes) == 0;
+        }
+        if(fits)
+            pschema = pcandidate;
+    }
+    if(pschema == NULL)
+        return -1;
+
+    int nRecovered = 0;
+    for(uint32_t j = 0; j < pschema->nSignals; j++) {
+        const SignalDescriptor* pdesc = getSignalDescriptor(pschemas, pschema->descIds[j]);
+        if(!isTickRangeReceived(ppset, packetBytes, pschema->headerOffsets[j],
+                    pschema->headerOffsets[j] + pdesc->nHeaderBytes) ||
+                !isTickRangeReceived(ppset, packetBytes, pschema->dataOffsets[j],
+                    pschema->dataOffsets[j] + pdesc->nBytes))
+            continue;
+
+        queueSignal(pbuf, pdesc, ppset->data + pschema->dataOffsets[j], ppset->timestamp);
+        nRecovered++;
     }
+    return nRecovered;
+}
 
+// whether bytes start to end of a tick laid out packetBytes apart all arrived
+bool isTickRangeReceived(const PacketSet* ppset, uint32_t packetBytes, uint32_t start, uint32_t end)
+{
+    if(end <= start)
+        return 1;
+
+    uint32_t iFirst = start / packetBytes;
+    uint32_t iLast = (end - 1) / packetBytes;
+    if(iLast >= ppset->numPackets)
+        return 0;
+    for(uint32_t i = iFirst; i <= iLast; i++)
+        if(!ppset->packetReceived[i])
+            return 0;
+    return end <= iLast * packetBytes + ppset->packetLength[iLast];
+}
+
+// queue the signal marking a tick as partial, holding uint16 [packets received,
+// packets in the tick, signals recovered]. It's made up here, so it's always
+// in the host's byte order
+void queuePartialTickSignal(SignalBuffers* pbuf, const PacketSet* ppset, int nRecovered)
+{
+    if(pbuf->pPartialTickDesc == NULL) {
+        uint16_t dims[2] = { 1, 3 };
+        pbuf->pPartialTickDesc = addLocalSignalDescriptor(&pbuf->schemas,
+                PARTIAL_TICK_SIGNAL_NAME, DTID_UINT16, 2, dims);
+        if(pbuf->pPartialTickDesc == NULL)
+            return;
+    }
+
+    uint16_t data[3];
+    data[0] = ppset->numReceived;
+    data[1] = ppset->numPackets;
+    data[2] = nRecovered > UINT16_MAX ? UINT16_MAX : nRecovered;
+
+    Signal s;
+    viewSignalDescriptor(pbuf->pPartialTickDesc, &s);
+    s.timestamp = ppset->timestamp;
+    s.receivedUsec = pbuf->batchReceivedUsec;
+    s.data = (const uint8_t*)data;
+
+    if(pbuf->ptap != NULL)
+        publishTapSignal(pbuf->ptap, pbuf->pPartialTickDesc, &s);
+    pushSignalAtHead(pbuf, &s);
 }
 
 void logIncompletePacketSet(const PacketSet* ppset)
@@ -363,8 +804,205 @@ void logIncompletePacketSet(const PacketSet* ppset)
     fprintf(stderr, "\nWARNING: Incomplete PacketSet for timestamp %d\n\n", ppset->timestamp);
 }
 
+void logPartialPacketSet(const PacketSet* ppset, int nRecovered)
+{
+    // this packet set was given up on before all packets received, but what
+    // could be made of it was kept
+    fprintf(stderr, "\nWARNING: Partial PacketSet for timestamp %d, %d of %d packets, "
+            "%d signals recovered\n\n", ppset->timestamp, ppset->numReceived, 
+            ppset->numPackets, nRecovered);
+}
+
 void logDroppedSignal(const Signal* ps)
 {
     // this packet set was overwritten in the buffer before all packets received
     fprintf(stderr, "\n\n********\nWARNING: Signal buffer overflow: dropping signal\n******\n\n\n");
 }
+
+void logMalformedTick(uint32_t timestamp, int offset)
+{
+    // the signal headers in this tick ran past the data received for it, or one
+    // had an unknown data type or more data than fits in a tick
+    fprintf(stderr, "\nWARNING: Malformed signal data at byte %d for timestamp %d\n\n", 
+            offset, timestamp);
+}
+
+void logMalformedDictionary(uint32_t timestamp, int offset)
+{
+    // the dictionary entries ran past the data received for it, or one's header
+    // had an unknown data type or more data than fits in a tick
+    fprintf(stderr, "\nWARNING: Malformed dictionary at byte %d for timestamp %d\n\n", 
+            offset, timestamp);
+}
+
+void logUnknownSignalId(uint32_t timestamp, uint16_t signalId)
+{
+    // a tick used a signal id before any dictionary gave it a header
+    fprintf(stderr, "\nWARNING: Unknown signal id %d for timestamp %d, dropping rest of tick\n\n", 
+            signalId, timestamp);
+}
+
+void logInvalidPacket(int bytesRead)
+{
+    // this packet's header didn't make sense
+    fprintf(stderr, "\nWARNING: Dropping invalid %d byte packet\n\n", bytesRead);
+}
+
+/////// WRITER WAKEUP /////////
+
+void initSignalBufferWakeup(SignalBuffers* pbuf, uint32_t highWaterSignals, uint32_t highWaterBytes)
+{
+    memset(&pbuf->wakeup, 0, sizeof(SignalBufferWakeup));
+    pbuf->wakeup.highWaterSignals = highWaterSignals;
+    pbuf->wakeup.highWaterBytes = highWaterBytes;
+
+    pbuf->wakeup.eventFd = eventfd(0, EFD_CLOEXEC);
+    if(pbuf->wakeup.eventFd == -1)
+        diep("Error creating writer eventfd");
+}
+
+bool isSignalBufferAboveHighWater(SignalBuffers* pbuf)
+{
+    return (uint32_t)getSignalCountInBuffer(pbuf) >= pbuf->wakeup.highWaterSignals || 
+        getSignalBytesInBuffer(pbuf) >= pbuf->wakeup.highWaterBytes;
+}
+
+// called by the network thread after each batch of packets: wake the writer if 
+// it's asleep on an empty buffer that now has signals, or if the buffer has 
+// filled past the high water mark
+void wakeSignalWriterIfNeeded(SignalBuffers* pbuf)
+{
+    if(getSignalCountInBuffer(pbuf) == 0)
+        return;
+
+    // pairs with the fence in waitForSignalsInBuffer, so that either the writer
+    // sees the new signals or we see that it's idle
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bool wake = __atomic_exchange_n(&pbuf->wakeup.writerIdle, 0, __ATOMIC_SEQ_CST);
+
+    if(!__atomic_load_n(&pbuf->wakeup.highWaterNotified, __ATOMIC_RELAXED) && 
+            isSignalBufferAboveHighWater(pbuf)) {
+        __atomic_store_n(&pbuf->wakeup.highWaterNotified, 1, __ATOMIC_RELAXED);
+        wake = 1;
+    }
+
+    if(wake) {
+        uint64_t one = 1;
+        if(write(pbuf->wakeup.eventFd, &one, sizeof(one)) != sizeof(one))
+            perror("Warning: could not wake writer thread");
+    }
+}
+
+// called once the network thread has stopped pushing signals, so that the 
+// writer stops waiting for more and drains what's left
+void wakeSignalWriterToStop(SignalBuffers* pbuf)
+{
+    __atomic_store_n(&pbuf->wakeup.stopping, 1, __ATOMIC_SEQ_CST);
+
+    uint64_t one = 1;
+    if(write(pbuf->wakeup.eventFd, &one, sizeof(one)) != sizeof(one))
+        perror("Warning: could not wake writer thread");
+}
+
+bool isSignalWriterStopping(SignalBuffers* pbufs[], int nBuffers)
+{
+    for(int i = 0; i < nBuffers; i++)
+        if(__atomic_load_n(&pbufs[i]->wakeup.stopping, __ATOMIC_SEQ_CST))
+            return 1;
+    return 0;
+}
+
+// called by the writer thread, sleeps until there are signals in any of the 
+// nBuffers buffers it drains, or for up to about timeoutMsec (forever if -1), 
+// or until it's told to stop. Returns whether there are signals
+bool waitForSignalsInBuffers(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec)
+{
+    bool anySignals = 1;
+
+    // the writer is about to drain, so the next crossing of the high water mark
+    // should wake it again
+    for(int i = 0; i < nBuffers; i++)
+        __atomic_store_n(&pbufs[i]->wakeup.highWaterNotified, 0, __ATOMIC_RELAXED);
+
+    while(!anySignalsInBuffers(pbufs, nBuffers)) {
+        if(isSignalWriterStopping(pbufs, nBuffers)) {
+            anySignals = 0;
+            break;
+        }
+        for(int i = 0; i < nBuffers; i++)
+            __atomic_store_n(&pbufs[i]->wakeup.writerIdle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(anySignalsInBuffers(pbufs, nBuffers))
+            break;
+        if(!waitForSignalWriterEvent(pbufs, nBuffers, timeoutMsec)) {
+            anySignals = anySignalsInBuffers(pbufs, nBuffers);
+            break;
+        }
+    }
+
+    // at worst a network thread already took the idle flag and left a stale
+    // event, which only ends a later wait early
+    for(int i = 0; i < nBuffers; i++)
+        __atomic_store_n(&pbufs[i]->wakeup.writerIdle, 0, __ATOMIC_RELAXED);
+    return anySignals;
+}
+
+bool anySignalsInBuffers(SignalBuffers* pbufs[], int nBuffers)
+{
+    for(int i = 0; i < nBuffers; i++)
+        if(getSignalCountInBuffer(pbufs[i]) != 0)
+            return 1;
+    return 0;
+}
+
+// called by the writer thread, lets signals build up into a batch for up to 
+// timeoutMsec, returning early once any buffer is past its high water mark or
+// the writer is told to stop
+void waitForSignalBuffersHighWater(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec)
+{
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMsec / 1000;
+    deadline.tv_nsec += (long)(timeoutMsec % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while(!isSignalWriterStopping(pbufs, nBuffers)) {
+        for(int i = 0; i < nBuffers; i++)
+            if(isSignalBufferAboveHighWater(pbufs[i]))
+                return;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long remainingMsec = (deadline.tv_sec - now.tv_sec) * 1000 + 
+            (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+        if(remainingMsec <= 0)
+            break;
+        waitForSignalWriterEvent(pbufs, nBuffers, remainingMsec);
+    }
+}
+
+// block on the buffers' eventfds for up to timeoutMsec (or forever if -1) and
+// consume any pending wakeups, returns false if it timed out
+bool waitForSignalWriterEvent(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec)
+{
+    struct pollfd pfds[MAX_WAKEUP_BUFFERS];
+    for(int i = 0; i < nBuffers; i++) {
+        pfds[i].fd = pbufs[i]->wakeup.eventFd;
+        pfds[i].events = POLLIN;
+    }
+
+    int ready = poll(pfds, nBuffers, timeoutMsec);
+    if(ready == -1 && errno != EINTR)
+        diep("Error waiting for writer eventfd");
+
+    for(int i = 0; ready > 0 && i < nBuffers; i++) {
+        if(!(pfds[i].revents & POLLIN))
+            continue;
+        uint64_t count;
+        if(read(pfds[i].fd, &count, sizeof(count)) != sizeof(count))
+            perror("Warning: could not read writer eventfd");
+    }
+    return ready != 0;
+}
@@ -2,57 +2,220 @@
 #define BUFFER_H_INCLUDED
 
 #include "signal.h"
+#include "schema.h"
+#include "tap.h"
+#include "stats.h"
 
 /* Packet maxima */
-#define PACKET_BUFFER_SIZE 2000 
 #define PACKETSET_BUFFER_SIZE 50
-#define SIGNAL_BUFFER_SIZE 20000
+#define RECV_BATCH_SIZE 32
 
-/////////// DATA STRUCTURES //////////////
+/* PacketSet timestamp index, at least twice PACKETSET_BUFFER_SIZE */
+#define PACKETSET_INDEX_BITS 7
+#define PACKETSET_INDEX_SIZE (1 << PACKETSET_INDEX_BITS)
+#define PACKETSET_INDEX_MASK (PACKETSET_INDEX_SIZE - 1)
 
-typedef struct PacketRingBuffer
-{
-    Packet buffer[PACKET_BUFFER_SIZE];
-    bool occupied[PACKET_BUFFER_SIZE];
-    int head;
-} PacketRingBuffer;
+/* Signal buffer size in bytes, must be a power of 2 */
+#define SIGNAL_BUFFER_BYTES (16*1024*1024)
+#define SIGNAL_BUFFER_MASK (SIGNAL_BUFFER_BYTES - 1)
+
+/* When the writer thread is woken to drain the signal buffer, see SignalBufferWakeup */
+#define DEFAULT_HIGH_WATER_SIGNALS 10000
+#define DEFAULT_HIGH_WATER_BYTES (SIGNAL_BUFFER_BYTES / 4)
+#define DEFAULT_MAX_WRITE_LATENCY_MSEC 100
+#define MAX_WRITE_LATENCY_MSEC 60000
+
+/* with -P, marks each tick given up on, see giveUpOnPacketSet */
+#define PARTIAL_TICK_SIGNAL_NAME "signalLogger.partialTick"
+
+/* longest -P may wait for the rest of a tick, keeping partialTickUsec in 32 bits */
+#define MAX_PARTIAL_TICK_MSEC 60000
+
+/* most signal buffers one writer can wait on */
+#define MAX_WAKEUP_BUFFERS 8
+
+/* SignalRecords start on this boundary so that headers and data stay aligned */
+#define SIGNAL_RECORD_ALIGN 8
+#define ALIGN_SIGNAL_RECORD(nBytes) \
+    (((nBytes) + SIGNAL_RECORD_ALIGN - 1) & ~(SIGNAL_RECORD_ALIGN - 1))
+#define SIGNAL_RECORD_HEADER_BYTES ALIGN_SIGNAL_RECORD(sizeof(SignalRecord))
 
+/////////// DATA STRUCTURES //////////////
+
+// each slot in the PacketSetRingBuffer owns a tick buffer that its packets' data
+// is received into directly, so a tick's data is reassembled without copying
+// occupied PacketSets are also found by timestamp through index, an open 
+// addressing (linear probing) hash table holding 1 + the slot of each PacketSet, 
+// or 0 where empty
 typedef struct PacketSetRingBuffer {
     PacketSet buffer[PACKETSET_BUFFER_SIZE];
-    bool occupied[PACKET_BUFFER_SIZE];
+    bool occupied[PACKETSET_BUFFER_SIZE];
     int head;
+
+    uint8_t index[PACKETSET_INDEX_SIZE];
+
+    uint8_t tickData[PACKETSET_BUFFER_SIZE][MAX_DATA_SIZE_PER_TICK];
 } PacketSetRingBuffer;
 
+// each signal in the SignalRingBuffer is stored as a SignalRecord header followed
+// by its data bytes, padded out to SIGNAL_RECORD_ALIGN. The name, type, dims and
+// size are left in the signal's SignalDescriptor and looked up by descId.
+typedef struct SignalRecord {
+    uint32_t length; // total bytes in record, 0 marks a wrap back to the arena start
+    uint32_t timestamp;
+    uint32_t receivedUsec;
+    uint32_t descId;
+} SignalRecord;
+
+// single-producer / single-consumer queue of variable length SignalRecords: the 
+// network thread is the only one that writes head and the writer thread is the 
+// only one that writes tail. Each side publishes its index with a release store
+// and reads the other's with an acquire load, so neither thread ever blocks on
+// the other. head and tail are free-running byte counts, masked into the arena.
+// A record never straddles the end of the arena; the producer skips ahead to the
+// start instead, leaving a zero length record behind if there's room for one.
 typedef struct SignalRingBuffer {
-    Signal buffer[SIGNAL_BUFFER_SIZE];
-    bool occupied[SIGNAL_BUFFER_SIZE];
-    int head; // used to store new values by the network thread
-    int tail; // used to chase the head in the writer thread
+    uint8_t arena[SIGNAL_BUFFER_BYTES] __attribute__((aligned(SIGNAL_RECORD_ALIGN)));
+
+    // kept on separate cache lines so the two threads don't contend
+    uint32_t head __attribute__((aligned(64))); // written by the network thread
+    uint32_t nPushed;                           // signals stored, published after head
+    uint32_t tail __attribute__((aligned(64))); // written by the writer thread
+    uint32_t nPopped;                           // signals released
 } SignalRingBuffer;
 
+// the writer thread sleeps on eventFd until the network thread pushes signals 
+// into an empty buffer, then waits up to its latency deadline for more to 
+// arrive, unless the buffer fills past the high water mark first. The network
+// thread only writes eventFd on those two transitions, checked once per batch.
+// On shutdown stopping is set and eventFd written, so the writer drains what's
+// left without waiting any longer
+typedef struct SignalBufferWakeup {
+    int eventFd;
+    uint32_t highWaterSignals;
+    uint32_t highWaterBytes;
+
+    int writerIdle;        // writer is asleep, or about to be, on an empty buffer
+    int highWaterNotified; // writer has been woken for the high water mark since 
+                           // it last started draining
+    int stopping;          // no more signals will be pushed
+} SignalBufferWakeup;
+
+// a batch of packets received with one call into the kernel. Packet k's header
+// is received into header[k] and its data at landing[k], which getPacketLandings
+// points either at the tick buffer position packet k is expected to occupy or 
+// at scratch[k]
+typedef struct PacketBatch {
+    int nPackets;
+    int bytesRead[RECV_BATCH_SIZE];
+    uint8_t header[RECV_BATCH_SIZE][PACKET_HEADER_LENGTH];
+    uint8_t* landing[RECV_BATCH_SIZE];
+    uint8_t scratch[RECV_BATCH_SIZE][MAX_PACKET_DATA_LENGTH];
+} PacketBatch;
+
+// everything one stream of packets is reassembled and queued in, from the 
+// PacketSets through to the SignalRingBuffer the writer drains. Only the 
+// stream's network thread and writer threads touch it, so streams share nothing
+typedef struct SignalBuffers {
+    PacketSetRingBuffer psetbuf;
+    SignalRingBuffer sbuf;
+    SignalBufferWakeup wakeup;
+
+    SignalSchemas schemas;
+    // the layout of the last tick that matched no cached schema
+    TickSchema decodeSchema;
+
+    // the last packet received, used to predict where the next ones belong
+    PacketSet* pLastPacketSet;
+    uint32_t lastPacketTimestamp;
+    uint16_t lastIdxPacket;
+    uint16_t lastNumPackets;
+
+    // the batch being processed and the index of the packet being processed in it
+    PacketBatch* pCurrentBatch;
+    int idxCurrentPacket;
+
+    // signals are also published here as they're decoded, if not NULL
+    SignalTap* ptap;
+
+    // when the batch being processed was received, see getMonotonicUsec
+    uint32_t batchReceivedUsec;
+
+    // with -P, ticks still missing packets this long after their first packet
+    // are given up on, and every tick given up on is decoded as far as it can
+    // be and marked with a partial tick signal. 0 when off
+    uint32_t partialTickUsec;
+    const SignalDescriptor* pPartialTickDesc;
+
+    // set on the first of several receive threads, which every tick sent with
+    // signal ids goes to, to warn once that -w does nothing for them
+    bool warnSignalIds;
+
+    // only updated by the network thread
+    ReceiveStats stats;
+} SignalBuffers;
+
 ///////////// PROTOTYPES /////////////
 
-void clearBuffers();
+SignalBuffers* allocSignalBuffers();
+void freeSignalBuffers(SignalBuffers*);
 
-Packet* pushPacketAtHead(Packet);
-void removePacketFromBuffer(Packet* pp);
+void getPacketLandings(SignalBuffers*, PacketBatch*);
+void processPacketBatch(SignalBuffers*, PacketBatch*);
+void receivePacket(SignalBuffers*, const uint8_t* rawHeader, uint8_t* landing, int bytesRead);
+void protectPacketLandings(SignalBuffers*, const uint8_t* start, int nBytes);
 
-PacketSet* pushPacketSetAtHead(PacketSet);
-void removePacketSetFromBuffer(PacketSet* ppset);
+PacketSet* pushPacketSetAtHead(SignalBuffers*, PacketSet);
+void removePacketSetFromBuffer(SignalBuffers*, PacketSet* ppset);
+int hashPacketSetTimestamp(uint32_t timestamp);
+void addPacketSetToIndex(SignalBuffers*, int slot);
+void removePacketSetFromIndex(SignalBuffers*, int slot);
 
-Signal* pushSignalAtHead(Signal);
-int getSignalCountInBuffer();
-void removeSignalFromBuffer(Signal* pp);
-bool popSignalFromTail(Signal*);
+uint32_t getSignalRecordBytes(const Signal*);
+void storeSignalRecord(uint8_t* pRecord, const Signal*);
+void viewSignalRecord(const SignalSchemas*, const SignalRecord*, Signal*);
 
-PacketSet* findPacketSetForPacket(Packet*);
-PacketSet* createPacketSetForPacket(Packet*);
+bool pushSignalAtHead(SignalBuffers*, const Signal*);
+int getSignalCountInBuffer(SignalBuffers*);
+uint32_t getSignalBytesInBuffer(SignalBuffers*);
+bool peekSignalAtTail(SignalBuffers*, Signal*);
+void releaseSignalAtTail(SignalBuffers*);
+
+void initSignalBufferWakeup(SignalBuffers*, uint32_t highWaterSignals, uint32_t highWaterBytes);
+bool isSignalBufferAboveHighWater(SignalBuffers*);
+void wakeSignalWriterIfNeeded(SignalBuffers*);
+void wakeSignalWriterToStop(SignalBuffers*);
+bool isSignalWriterStopping(SignalBuffers* pbufs[], int nBuffers);
+bool waitForSignalsInBuffers(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec);
+bool anySignalsInBuffers(SignalBuffers* pbufs[], int nBuffers);
+void waitForSignalBuffersHighWater(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec);
+bool waitForSignalWriterEvent(SignalBuffers* pbufs[], int nBuffers, int timeoutMsec);
+
+PacketSet* findPacketSetForPacket(SignalBuffers*, Packet*);
+PacketSet* createPacketSetForPacket(SignalBuffers*, Packet*);
+void addPacketToPacketSet(SignalBuffers*, PacketSet*, const Packet*);
 
 bool checkReceivedAllPackets(PacketSet*);
-void processPacketSet(PacketSet*);
-void processData();
+void processPacketSet(SignalBuffers*, PacketSet*);
+void moveTickPacket(SignalBuffers*, PacketSet*, int idx, uint32_t offset);
+int processData(SignalBuffers*, uint8_t* data, int nBytes, uint32_t timestamp, bool partial);
+int processSignalIdData(SignalBuffers*, uint8_t* data, int nBytes, uint32_t timestamp, bool partial);
+void processDictionaryData(SignalBuffers*, const uint8_t* data, int nBytes, uint32_t timestamp);
+void queueSignal(SignalBuffers*, const SignalDescriptor* pdesc, uint8_t* data, uint32_t timestamp);
+
+void giveUpOnPacketSet(SignalBuffers*, PacketSet*);
+void giveUpOnExpiredPacketSets(SignalBuffers*);
+int recoverPartialPacketSet(SignalBuffers*, PacketSet*);
+int recoverFromTickSchema(SignalBuffers*, PacketSet*, uint32_t packetBytes);
+bool isTickRangeReceived(const PacketSet*, uint32_t packetBytes, uint32_t start, uint32_t end);
+void queuePartialTickSignal(SignalBuffers*, const PacketSet*, int nRecovered);
 
 void logIncompletePacketSet(const PacketSet*);
+void logPartialPacketSet(const PacketSet*, int nRecovered);
 void logDroppedSignal(const Signal* ps);
+void logMalformedTick(uint32_t timestamp, int offset);
+void logMalformedDictionary(uint32_t timestamp, int offset);
+void logUnknownSignalId(uint32_t timestamp, uint16_t signalId);
+void logInvalidPacket(int bytesRead);
 
 #endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "columns.h"
+#include "convert.h"
+#include "signalLogger.h"
+
+#define INITIAL_COLUMN_INDEX_SIZE 256
+#define INITIAL_COLUMN_SAMPLES 64
+
+/// PRIVATE DECLARATIONS
+
+uint32_t hashSignalLayout(const Signal* psig);
+bool signalMatchesColumn(const Signal* psig, const SignalColumn* pcol);
+void growSignalColumnIndex(SignalColumnSet*);
+void transposeSamples(uint8_t* pOut, const SignalColumn* pcol, bool widenChars);
+void writeTransposedSamples(MatBuffer* pmb, const SignalColumn* pcol, bool widenChars, 
+        bool widenToDouble);
+
+void initSignalColumnSet(SignalColumnSet* pset)
+{
+    memset(pset, 0, sizeof(SignalColumnSet));
+    pset->indexSize = INITIAL_COLUMN_INDEX_SIZE;
+    pset->index = (int*)calloc(pset->indexSize, sizeof(int));
+    if(pset->index == NULL)
+        diep("Error allocating signal column index");
+}
+
+void freeSignalColumnSet(SignalColumnSet* pset)
+{
+    for(int i = 0; i < pset->nColumns; i++) {
+        free(pset->columns[i].name);
+        free(pset->columns[i].timestamps);
+        free(pset->columns[i].data);
+    }
+    free(pset->columns);
+    free(pset->index);
+    memset(pset, 0, sizeof(SignalColumnSet));
+}
+
+// empty every column but keep the columns and their memory for the next flush
+void clearSignalColumnSet(SignalColumnSet* pset)
+{
+    for(int i = 0; i < pset->nColumns; i++)
+        pset->columns[i].nSamples = 0;
+}
+
+// FNV-1a over the name, type and dims that identify a column
+uint32_t hashSignalLayout(const Signal* psig)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < psig->lenName; i++)
+        hash = (hash ^ (uint8_t)psig->name[i]) * 16777619u;
+    hash = (hash ^ psig->dataTypeId) * 16777619u;
+    for(int i = 0; i < psig->nDims; i++)
+        hash = (hash ^ psig->dims[i]) * 16777619u;
+    return hash;
+}
+
+bool signalMatchesColumn(const Signal* psig, const SignalColumn* pcol)
+{
+    return psig->lenName == pcol->lenName && psig->dataTypeId == pcol->dataTypeId &&
+        psig->nDims == pcol->nDims && 
+        memcmp(psig->dims, pcol->dims, psig->nDims * sizeof(uint16_t)) == 0 &&
+        memcmp(psig->name, pcol->name, psig->lenName) == 0;
+}
+
+// double the index and re-insert every column, keeping it at most half full
+void growSignalColumnIndex(SignalColumnSet* pset)
+{
+    free(pset->index);
+    pset->indexSize *= 2;
+    pset->index = (int*)calloc(pset->indexSize, sizeof(int));
+    if(pset->index == NULL)
+        diep("Error allocating signal column index");
+
+    for(int c = 0; c < pset->nColumns; c++) {
+        Signal s;
+        SignalColumn* pcol = pset->columns + c;
+        s.name = pcol->name;
+        s.lenName = pcol->lenName;
+        s.dataTypeId = pcol->dataTypeId;
+        s.nDims = pcol->nDims;
+        memcpy(s.dims, pcol->dims, pcol->nDims * sizeof(uint16_t));
+
+        int i = hashSignalLayout(&s) & (pset->indexSize - 1);
+        while(pset->index[i] != 0)
+            i = (i + 1) & (pset->indexSize - 1);
+        pset->index[i] = c + 1;
+    }
+}
+
+SignalColumn* findOrAddSignalColumn(SignalColumnSet* pset, const Signal* psig)
+{
+    int mask = pset->indexSize - 1;
+    int i = hashSignalLayout(psig) & mask;
+
+    // probe the index for a column with this layout
+    while(pset->index[i] != 0) {
+        SignalColumn* pcol = pset->columns + pset->index[i] - 1;
+        if(signalMatchesColumn(psig, pcol))
+            return pcol;
+        i = (i + 1) & mask;
+    }
+
+    // not found, add a new column
+    if(pset->nColumns == pset->capacityColumns) {
+        pset->capacityColumns = pset->capacityColumns ? 2 * pset->capacityColumns : 64;
+        pset->columns = (SignalColumn*)realloc(pset->columns, 
+                pset->capacityColumns * sizeof(SignalColumn));
+        if(pset->columns == NULL)
+            diep("Error allocating signal columns");
+    }
+
+    SignalColumn* pcol = pset->columns + pset->nColumns;
+    memset(pcol, 0, sizeof(SignalColumn));
+    pcol->name = (char*)malloc(psig->lenName + 1);
+    if(pcol->name == NULL)
+        diep("Error allocating signal column");
+    memcpy(pcol->name, psig->name, psig->lenName);
+    pcol->name[psig->lenName] = '\0';
+    pcol->lenName = psig->lenName;
+    pcol->dataTypeId = psig->dataTypeId;
+    pcol->nDims = psig->nDims;
+    memcpy(pcol->dims, psig->dims, psig->nDims * sizeof(uint16_t));
+    pcol->nBytesPerSample = psig->nBytes;
+
+    pset->index[i] = ++pset->nColumns;
+    if(2 * pset->nColumns > pset->indexSize)
+        growSignalColumnIndex(pset);
+
+    return pcol;
+}
+
+void appendSignalToColumn(SignalColumn* pcol, const Signal* psig)
+{
+    if(pcol->nSamples == pcol->capacitySamples) {
+        pcol->capacitySamples = pcol->capacitySamples ? 
+            2 * pcol->capacitySamples : INITIAL_COLUMN_SAMPLES;
+        pcol->timestamps = (uint32_t*)realloc(pcol->timestamps, 
+                pcol->capacitySamples * sizeof(uint32_t));
+        pcol->data = (uint8_t*)realloc(pcol->data, 
+                (size_t)pcol->capacitySamples * pcol->nBytesPerSample);
+        if(pcol->timestamps == NULL || (pcol->data == NULL && pcol->nBytesPerSample))
+            diep("Error allocating signal column samples");
+    }
+
+    pcol->timestamps[pcol->nSamples] = psig->timestamp;
+    memcpy(pcol->data + (size_t)pcol->nSamples * pcol->nBytesPerSample, 
+            psig->data, pcol->nBytesPerSample);
+    pcol->nSamples++;
+}
+
+int getNonEmptyColumnCount(const SignalColumnSet* pset)
+{
+    int count = 0;
+    for(int i = 0; i < pset->nColumns; i++)
+        count += pset->columns[i].nSamples > 0;
+    return count;
+}
+
+// element e of sample s to s + nSamples * e in pOut
+void transposeSamples(uint8_t* pOut, const SignalColumn* pcol, bool widenChars)
+{
+    uint32_t elemBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    uint32_t nElements = pcol->nBytesPerSample / elemBytes;
+    uint32_t outElemBytes = widenChars ? sizeof(uint16_t) : elemBytes;
+
+    for(uint32_t e = 0; e < nElements; e++) {
+        const uint8_t* pIn = pcol->data + e * elemBytes;
+        for(uint32_t s = 0; s < pcol->nSamples; s++) {
+            if(widenChars) {
+                uint16_t c = *pIn;
+                memcpy(pOut, &c, sizeof(uint16_t));
+            } else {
+                memcpy(pOut, pIn, elemBytes);
+            }
+            pOut += outElemBytes;
+            pIn += pcol->nBytesPerSample;
+        }
+    }
+}
+
+// write a column's data as an nSamples x dims array, i.e. element e of sample s
+// goes to s + nSamples * e. Chars are widened to UTF-16 as they're written, and
+// with widenToDouble everything else is widened to double
+void writeTransposedSamples(MatBuffer* pmb, const SignalColumn* pcol, bool widenChars,
+        bool widenToDouble)
+{
+    uint32_t elemBytes = getSizeOfDataTypeId(pcol->dataTypeId);
+    uint32_t nElements = pcol->nBytesPerSample / elemBytes;
+    uint32_t outElemBytes = widenChars ? sizeof(uint16_t) : widenToDouble ? sizeof(double) : elemBytes;
+    uint32_t nBytes = pcol->nSamples * nElements * outElemBytes;
+
+    uint32_t miType = widenChars ? miUINT16 : widenToDouble ? miDOUBLE : 
+        convertDataTypeIdToMiType(pcol->dataTypeId);
+    if(nBytes <= 4) {
+        // small data element
+        uint32_t tag = (nBytes << 16) | miType;
+        appendMatBytes(pmb, &tag, sizeof(uint32_t));
+    } else {
+        uint32_t tag[2] = {miType, nBytes};
+        appendMatBytes(pmb, tag, sizeof(tag));
+    }
+
+    uint8_t* pOut = reserveMatBytes(pmb, nBytes);
+    if(widenToDouble) {
+        // a single element is already contiguous. Otherwise it's transposed as
+        // is into the end of the space the doubles take, and widened in place
+        const uint8_t* pIn = pcol->data;
+        if(nElements > 1) {
+            uint8_t* pTransposed = pOut + nBytes - pcol->nSamples * pcol->nBytesPerSample;
+            transposeSamples(pTransposed, pcol, 0);
+            pIn = pTransposed;
+        }
+        widenElementsToDouble((double*)pOut, pIn, pcol->nSamples * nElements, pcol->dataTypeId);
+    } else if(nElements == 1 && !widenChars) {
+        // already contiguous
+        memcpy(pOut, pcol->data, nBytes);
+    } else {
+        transposeSamples(pOut, pcol, widenChars);
+    }
+
+    padMatBuffer(pmb);
+}
+
+// write the non-empty columns as a G x 1 struct array with fields name, 
+// timestamp (nSamples x 1 uint32) and data (nSamples x dims). With widenToDouble
+// all but char data is written as double
+void writeSignalColumnsToMatBuffer(MatBuffer* pmb, const SignalColumnSet* pset, 
+        const char* varName, bool widenToDouble)
+{
+    const char* fieldNames[] = {"name", "timestamp", "data"};
+    uint32_t structDims[2] = {(uint32_t)getNonEmptyColumnCount(pset), 1};
+
+    size_t structOffset = beginMatMatrix(pmb, mxSTRUCT_CLASS, 2, structDims, varName);
+    writeMatFieldNames(pmb, fieldNames, 3);
+
+    for(int c = 0; c < pset->nColumns; c++) {
+        const SignalColumn* pcol = pset->columns + c;
+        if(pcol->nSamples == 0)
+            continue;
+
+        // set the .name field
+        writeMatString(pmb, pcol->name, pcol->lenName);
+
+        // set the .timestamp field
+        uint32_t tsDims[2] = {pcol->nSamples, 1};
+        writeMatNumericMatrix(pmb, mxUINT32_CLASS, miUINT32, 2, tsDims, 
+                pcol->timestamps, pcol->nSamples * sizeof(uint32_t));
+
+        // set the .data field, samples run down the first dimension followed by
+        // the signal's non-singleton dims, so 1 x N and N x 1 signals both 
+        // become nSamples x N
+        int nDims = 1;
+        uint32_t dims[MAX_SIGNAL_NDIMS + 2];
+        dims[0] = pcol->nSamples;
+        for(int i = 0; i < pcol->nDims; i++)
+            if(pcol->dims[i] != 1)
+                dims[nDims++] = pcol->dims[i];
+        while(nDims < 2)
+            dims[nDims++] = 1;
+
+        bool isChar = pcol->dataTypeId == DTID_CHAR;
+        bool widen = widenToDouble && !isChar;
+        size_t matrixOffset = beginMatMatrix(pmb, widen ? mxDOUBLE_CLASS :
+                convertDataTypeIdToMxClassId(pcol->dataTypeId), nDims, dims, "");
+        writeTransposedSamples(pmb, pcol, isChar, widen);
+        endMatMatrix(pmb, matrixOffset);
+    }
+
+    endMatMatrix(pmb, structOffset);
+}
@@ -0,0 +1,48 @@
+#ifndef COLUMNS_H_INCLUDED
+#define COLUMNS_H_INCLUDED
+
+#include "signal.h"
+#include "matfile.h"
+
+// the samples of one signal collected over a flush. Signals are grouped by name,
+// type and dims, so a signal that changes size gets one column per size. data 
+// holds each sample's bytes one after another; it is transposed when written so
+// that samples run down the first dimension, followed by the signal's 
+// non-singleton dims.
+typedef struct SignalColumn {
+    char* name;
+    uint16_t lenName;
+    uint8_t dataTypeId;
+    uint8_t nDims;
+    uint16_t dims[MAX_SIGNAL_NDIMS];
+    uint32_t nBytesPerSample;
+
+    uint32_t nSamples;
+    uint32_t capacitySamples;
+    uint32_t* timestamps;
+    uint8_t* data;
+} SignalColumn;
+
+// the columns for every signal seen so far, found through index, an open 
+// addressing hash table holding 1 + the column number, or 0 where empty
+typedef struct SignalColumnSet {
+    SignalColumn* columns;
+    int nColumns;
+    int capacityColumns;
+
+    int* index;
+    int indexSize; // a power of 2
+} SignalColumnSet;
+
+void initSignalColumnSet(SignalColumnSet*);
+void freeSignalColumnSet(SignalColumnSet*);
+void clearSignalColumnSet(SignalColumnSet*);
+
+SignalColumn* findOrAddSignalColumn(SignalColumnSet*, const Signal*);
+void appendSignalToColumn(SignalColumn*, const Signal*);
+int getNonEmptyColumnCount(const SignalColumnSet*);
+
+void writeSignalColumnsToMatBuffer(MatBuffer*, const SignalColumnSet*, const char* varName,
+        bool widenToDouble);
+
+#endif
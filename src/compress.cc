@@ -0,0 +1,201 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include "compress.h"
+#include "signalLogger.h"
+
+/// PRIVATE DECLARATIONS
+void * compressWorkerThread(void * arg);
+void compressChunk(z_stream* pstrm, CompressChunk* pc);
+void endDeflate(void* arg);
+void unlockCompressorMutex(void* arg);
+double getThreadBusySec();
+
+void startCompressorPool(CompressorPool* pool, int level, int nWorkers)
+{
+    memset(pool, 0, sizeof(CompressorPool));
+    pool->level = level;
+    pool->nWorkers = nWorkers;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->workCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+
+    for(int i = 0; i < nWorkers; i++)
+        if(pthread_create(pool->workers + i, NULL, compressWorkerThread, pool))
+            diep("Error creating compression threads");
+}
+
+// only once nothing is waiting on the pool, i.e. after the encode stage has stopped
+void stopCompressorPool(CompressorPool* pool)
+{
+    for(int i = 0; i < pool->nWorkers; i++)
+        pthread_cancel(pool->workers[i]);
+    for(int i = 0; i < pool->nWorkers; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    for(uint32_t i = 0; i < pool->capacityChunks; i++)
+        freeMatBuffer(&pool->chunks[i].out);
+    free(pool->chunks);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->workCond);
+    pthread_cond_destroy(&pool->doneCond);
+}
+
+// compress the MAT variable in pVar into a miCOMPRESSED element in pOut,
+// returning the time the workers spent on it between them
+double compressMatVariable(CompressorPool* pool, const MatBuffer* pVar, MatBuffer* pOut)
+{
+    uint32_t nChunks = (pVar->nBytes + COMPRESS_CHUNK_BYTES - 1) / COMPRESS_CHUNK_BYTES;
+    if(nChunks > pool->capacityChunks) {
+        pool->chunks = (CompressChunk*)realloc(pool->chunks, nChunks * sizeof(CompressChunk));
+        if(pool->chunks == NULL)
+            diep("Error allocating compression chunks");
+        for(uint32_t i = pool->capacityChunks; i < nChunks; i++)
+            initMatBuffer(&pool->chunks[i].out);
+        pool->capacityChunks = nChunks;
+    }
+
+    for(uint32_t i = 0; i < nChunks; i++) {
+        CompressChunk* pc = pool->chunks + i;
+        size_t offset = (size_t)i * COMPRESS_CHUNK_BYTES;
+        pc->data = pVar->data + offset;
+        pc->nBytes = pVar->nBytes - offset < COMPRESS_CHUNK_BYTES ?
+            pVar->nBytes - offset : COMPRESS_CHUNK_BYTES;
+        pc->nDictionaryBytes = offset < COMPRESS_DICTIONARY_BYTES ? offset : COMPRESS_DICTIONARY_BYTES;
+        pc->last = i == nChunks - 1;
+    }
+
+    // hand the chunks out and wait for the workers to finish them all
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cleanup_push(unlockCompressorMutex, pool);
+    pool->nChunks = nChunks;
+    pool->nextChunk = 0;
+    pool->nChunksDone = 0;
+    pthread_cond_broadcast(&pool->workCond);
+    while(pool->nChunksDone < nChunks)
+        pthread_cond_wait(&pool->doneCond, &pool->mutex);
+    pthread_cleanup_pop(1);
+
+    // the chunks' deflate streams laid end to end, between a zlib header and
+    // the adler32 of the whole variable
+    uint32_t nCompressedBytes = 2 + 4;
+    for(uint32_t i = 0; i < nChunks; i++)
+        nCompressedBytes += pool->chunks[i].out.nBytes;
+
+    clearMatBuffer(pOut);
+    uint32_t tag[2] = {miCOMPRESSED, nCompressedBytes};
+    appendMatBytes(pOut, tag, sizeof(tag));
+
+    // the level only goes in the header as a hint, and the check bits make the
+    // first two bytes a multiple of 31
+    uint8_t header[2] = {0x78, 0};
+    int level = pool->level;
+    header[1] = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    header[1] += 31 - ((header[0] << 8) + header[1]) % 31;
+    appendMatBytes(pOut, header, sizeof(header));
+
+    uLong adler = pool->chunks[0].adler;
+    double busySec = 0;
+    for(uint32_t i = 0; i < nChunks; i++) {
+        const CompressChunk* pc = pool->chunks + i;
+        appendMatBytes(pOut, pc->out.data, pc->out.nBytes);
+        if(i > 0)
+            adler = adler32_combine(adler, pc->adler, pc->nBytes);
+        busySec += pc->busySec;
+    }
+
+    // miCOMPRESSED elements aren't padded, unlike every other
+    uint8_t trailer[4] = {(uint8_t)(adler >> 24), (uint8_t)(adler >> 16),
+        (uint8_t)(adler >> 8), (uint8_t)adler};
+    appendMatBytes(pOut, trailer, sizeof(trailer));
+
+    return busySec;
+}
+
+void * compressWorkerThread(void * arg)
+{
+    CompressorPool* pool = (CompressorPool*)arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+    // a raw deflate stream, the zlib header and trailer are added around the chunks
+    z_stream strm;
+    memset(&strm, 0, sizeof(z_stream));
+    if(deflateInit2(&strm, pool->level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        diep("Error starting compression");
+    pthread_cleanup_push(endDeflate, &strm);
+
+    while(1) {
+        CompressChunk* pc;
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cleanup_push(unlockCompressorMutex, pool);
+        while(pool->nextChunk >= pool->nChunks)
+            pthread_cond_wait(&pool->workCond, &pool->mutex);
+        pc = pool->chunks + pool->nextChunk++;
+        pthread_cleanup_pop(1);
+
+        compressChunk(&strm, pc);
+
+        pthread_mutex_lock(&pool->mutex);
+        if(++pool->nChunksDone == pool->nChunks)
+            pthread_cond_signal(&pool->doneCond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+// deflate one chunk, primed with the data before it, ending it on a byte
+// boundary unless it's the last so the next chunk's output can follow it
+void compressChunk(z_stream* pstrm, CompressChunk* pc)
+{
+    double start = getThreadBusySec();
+
+    deflateReset(pstrm);
+    if(pc->nDictionaryBytes > 0)
+        deflateSetDictionary(pstrm, pc->data - pc->nDictionaryBytes, pc->nDictionaryBytes);
+
+    // a sync flush adds a few bytes more than deflateBound allows for
+    uLong bound = deflateBound(pstrm, pc->nBytes) + 16;
+    clearMatBuffer(&pc->out);
+    uint8_t* pOut = reserveMatBytes(&pc->out, bound);
+
+    pstrm->next_in = (Bytef*)pc->data;
+    pstrm->avail_in = pc->nBytes;
+    pstrm->next_out = pOut;
+    pstrm->avail_out = bound;
+    int ret = deflate(pstrm, pc->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if(pstrm->avail_in != 0 || (pc->last ? ret != Z_STREAM_END : ret != Z_OK))
+        diep("Error compressing flush");
+    pc->out.nBytes = bound - pstrm->avail_out;
+
+    pc->adler = adler32(adler32(0, NULL, 0), pc->data, pc->nBytes);
+    pc->busySec = getThreadBusySec() - start;
+}
+
+void endDeflate(void* arg)
+{
+    deflateEnd((z_stream*)arg);
+}
+
+// a thread cancelled in pthread_cond_wait holds the mutex again, give it back
+void unlockCompressorMutex(void* arg)
+{
+    pthread_mutex_unlock(&((CompressorPool*)arg)->mutex);
+}
+
+// cpu time of the calling thread, so compression speed is per core however
+// busy the machine is
+double getThreadBusySec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,60 @@
+#ifndef COMPRESS_H_INCLUDED
+#define COMPRESS_H_INCLUDED
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "matfile.h"
+
+// Compresses each flush's MAT variable into a miCOMPRESSED element, which
+// MATLAB loads like any other variable. A variable is split into chunks that a
+// pool of worker threads deflate at the same time, each chunk primed with the
+// bytes before it as its dictionary and all but the last ended on a byte
+// boundary with a sync flush. Laid end to end after a zlib header, with the
+// adler32s of the chunks combined into the trailer, they are one ordinary zlib
+// stream, compressed almost as well as if it had been done in one go.
+
+#define DEFAULT_COMPRESS_WORKERS 2
+#define MAX_COMPRESS_WORKERS 16
+
+/* variables are split into chunks of this many bytes, one per job */
+#define COMPRESS_CHUNK_BYTES (256*1024)
+/* how much of the data before a chunk it is primed with, deflate's window */
+#define COMPRESS_DICTIONARY_BYTES 32768
+
+// one chunk of the variable being compressed, and what it compressed to
+typedef struct CompressChunk {
+    const uint8_t* data;
+    uint32_t nBytes;
+    uint32_t nDictionaryBytes; // the bytes just before data
+    bool last;
+
+    MatBuffer out;
+    uint32_t adler;
+    double busySec;
+} CompressChunk;
+
+// a writer's compression workers. The encode stage hands them the chunks of one
+// variable at a time and waits for them all to be done
+typedef struct CompressorPool {
+    int level;
+    int nWorkers;
+    pthread_t workers[MAX_COMPRESS_WORKERS];
+
+    // guard the chunks being handed out and finished
+    pthread_mutex_t mutex;
+    pthread_cond_t workCond; // a chunk is waiting to be taken
+    pthread_cond_t doneCond; // the last chunk is done
+
+    CompressChunk* chunks;
+    uint32_t nChunks;
+    uint32_t capacityChunks;
+    uint32_t nextChunk;
+    uint32_t nChunksDone;
+} CompressorPool;
+
+void startCompressorPool(CompressorPool*, int level, int nWorkers);
+void stopCompressorPool(CompressorPool*);
+double compressMatVariable(CompressorPool*, const MatBuffer* pVar, MatBuffer* pOut);
+
+#endif
@@ -0,0 +1,317 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#include "convert.h"
+
+/* not yet chosen */
+#define CONVERT_LEVEL_UNSET -1
+
+// the level conversions run at, chosen on first use unless set
+int convertLevel = CONVERT_LEVEL_UNSET;
+
+/// PRIVATE DECLARATIONS
+void swapElementBytesPortable(uint8_t* data, uint32_t nElements, int elemBytes);
+void widenElementsPortable(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+#ifdef CONVERT_X86
+uint32_t swapElementBytesSse41(uint8_t* data, uint32_t nElements, int elemBytes);
+uint32_t swapElementBytesAvx2(uint8_t* data, uint32_t nElements, int elemBytes);
+uint32_t widenElementsSse41(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+uint32_t widenElementsAvx2(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+#endif
+
+/////// LEVELS /////////
+
+int getBestConvertLevel()
+{
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return CONVERT_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return CONVERT_SSE41;
+#endif
+    return CONVERT_PORTABLE;
+}
+
+int getConvertLevel()
+{
+    int level = __atomic_load_n(&convertLevel, __ATOMIC_RELAXED);
+    if(level == CONVERT_LEVEL_UNSET) {
+        level = getBestConvertLevel();
+        __atomic_store_n(&convertLevel, level, __ATOMIC_RELAXED);
+    }
+    return level;
+}
+
+// for comparing levels, no higher than getBestConvertLevel
+void setConvertLevel(int level)
+{
+    __atomic_store_n(&convertLevel, level, __ATOMIC_RELAXED);
+}
+
+const char* getConvertLevelName(int level)
+{
+    switch(level) {
+        case CONVERT_AVX2:
+            return "avx2";
+        case CONVERT_SSE41:
+            return "sse4.1";
+        default:
+            return "portable";
+    }
+}
+
+/////// BYTE SWAPPING /////////
+
+// reverse the bytes of each of the nElements elemBytes byte elements at data
+void swapElementBytes(uint8_t* data, uint32_t nElements, int elemBytes)
+{
+    if(elemBytes == 1)
+        return;
+
+    uint32_t nDone = 0;
+#ifdef CONVERT_X86
+    int level = getConvertLevel();
+    if(level == CONVERT_AVX2)
+        nDone = swapElementBytesAvx2(data, nElements, elemBytes);
+    else if(level == CONVERT_SSE41)
+        nDone = swapElementBytesSse41(data, nElements, elemBytes);
+#endif
+    swapElementBytesPortable(data + (size_t)nDone * elemBytes, nElements - nDone, elemBytes);
+}
+
+// swap a signal's data in place, data being where psig's data can be written
+void swapSignalBytes(uint8_t* data, const Signal* psig)
+{
+    int elemBytes = getSizeOfDataTypeId(psig->dataTypeId);
+    swapElementBytes(data, psig->nBytes / elemBytes, elemBytes);
+}
+
+void swapElementBytesPortable(uint8_t* data, uint32_t nElements, int elemBytes)
+{
+    if(elemBytes == 2) {
+        for(uint32_t i = 0; i < nElements; i++, data += 2) {
+            uint16_t v;
+            memcpy(&v, data, 2);
+            v = __builtin_bswap16(v);
+            memcpy(data, &v, 2);
+        }
+    } else if(elemBytes == 4) {
+        for(uint32_t i = 0; i < nElements; i++, data += 4) {
+            uint32_t v;
+            memcpy(&v, data, 4);
+            v = __builtin_bswap32(v);
+            memcpy(data, &v, 4);
+        }
+    } else if(elemBytes == 8) {
+        for(uint32_t i = 0; i < nElements; i++, data += 8) {
+            uint64_t v;
+            memcpy(&v, data, 8);
+            v = __builtin_bswap64(v);
+            memcpy(data, &v, 8);
+        }
+    }
+}
+
+/////// WIDENING /////////
+
+// convert nElements elements of dataTypeId at in to doubles at out. in may lie
+// within out as long as it ends where out does, so a column can be widened in
+// place: every element is read before the double it becomes is stored over it
+void widenElementsToDouble(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    if(dataTypeId == DTID_DOUBLE) {
+        memmove(out, in, (size_t)nElements * sizeof(double));
+        return;
+    }
+
+    uint32_t nDone = 0;
+#ifdef CONVERT_X86
+    int level = getConvertLevel();
+    if(level == CONVERT_AVX2)
+        nDone = widenElementsAvx2(out, in, nElements, dataTypeId);
+    else if(level == CONVERT_SSE41)
+        nDone = widenElementsSse41(out, in, nElements, dataTypeId);
+#endif
+    widenElementsPortable(out + nDone, in + (size_t)nDone * getSizeOfDataTypeId(dataTypeId),
+            nElements - nDone, dataTypeId);
+}
+
+#define WIDEN_PORTABLE(type, out, in, nElements) \
+    for(uint32_t i = 0; i < nElements; i++) { \
+        type v; \
+        memcpy(&v, in + i * sizeof(type), sizeof(type)); \
+        out[i] = v; \
+    }
+
+void widenElementsPortable(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    switch(dataTypeId) {
+        case DTID_SINGLE:
+            WIDEN_PORTABLE(single_t, out, in, nElements);
+            break;
+        case DTID_INT8:
+            WIDEN_PORTABLE(int8_t, out, in, nElements);
+            break;
+        case DTID_UINT8:
+        case DTID_CHAR:
+            WIDEN_PORTABLE(uint8_t, out, in, nElements);
+            break;
+        case DTID_INT16:
+            WIDEN_PORTABLE(int16_t, out, in, nElements);
+            break;
+        case DTID_UINT16:
+            WIDEN_PORTABLE(uint16_t, out, in, nElements);
+            break;
+        case DTID_INT32:
+            WIDEN_PORTABLE(int32_t, out, in, nElements);
+            break;
+        case DTID_UINT32:
+            WIDEN_PORTABLE(uint32_t, out, in, nElements);
+            break;
+    }
+}
+
+#ifdef CONVERT_X86
+
+/////// SSE4.1 AND AVX2 /////////
+
+// Each of these handles as many whole vectors of elements as it can, returning
+// how many elements that was. The portable versions do the rest.
+
+// byte shuffles reversing each 2, 4 and 8 byte element of 16 bytes
+#define SWAP_SHUFFLE_2 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+#define SWAP_SHUFFLE_4 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
+#define SWAP_SHUFFLE_8 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7
+
+__attribute__((target("sse4.1")))
+__m128i getSwapShuffle128(int elemBytes)
+{
+    // _mm_set_epi8 takes the bytes from the last
+    if(elemBytes == 2)
+        return _mm_set_epi8(SWAP_SHUFFLE_2);
+    if(elemBytes == 4)
+        return _mm_set_epi8(SWAP_SHUFFLE_4);
+    return _mm_set_epi8(SWAP_SHUFFLE_8);
+}
+
+__attribute__((target("sse4.1")))
+uint32_t swapElementBytesSse41(uint8_t* data, uint32_t nElements, int elemBytes)
+{
+    __m128i shuffle = getSwapShuffle128(elemBytes);
+    size_t nBytes = (size_t)nElements * elemBytes & ~(size_t)15;
+    for(size_t i = 0; i < nBytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_shuffle_epi8(v, shuffle));
+    }
+    return nBytes / elemBytes;
+}
+
+__attribute__((target("avx2")))
+uint32_t swapElementBytesAvx2(uint8_t* data, uint32_t nElements, int elemBytes)
+{
+    // vpshufb shuffles each 16 byte lane on its own
+    __m128i lane = getSwapShuffle128(elemBytes);
+    __m256i shuffle = _mm256_broadcastsi128_si256(lane);
+    size_t nBytes = (size_t)nElements * elemBytes & ~(size_t)31;
+    for(size_t i = 0; i < nBytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+    return nBytes / elemBytes;
+}
+
+// the low 4 elements of dataTypeId at p as 32 bit integers, for the types
+// narrower than that
+__attribute__((target("sse4.1")))
+__m128i loadNarrowAsInt32(const uint8_t* p, uint8_t dataTypeId)
+{
+    int32_t four;
+    switch(dataTypeId) {
+        case DTID_INT8:
+            memcpy(&four, p, 4);
+            return _mm_cvtepi8_epi32(_mm_cvtsi32_si128(four));
+        case DTID_UINT8:
+        case DTID_CHAR:
+            memcpy(&four, p, 4);
+            return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(four));
+        case DTID_INT16:
+            return _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)p));
+        case DTID_UINT16:
+            return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)p));
+        default:
+            return _mm_loadu_si128((const __m128i*)p);
+    }
+}
+
+// 4 elements at a time, converted 2 at a time
+__attribute__((target("sse4.1")))
+uint32_t widenElementsSse41(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    int elemBytes = getSizeOfDataTypeId(dataTypeId);
+    uint32_t n = nElements & ~3u;
+
+    if(dataTypeId == DTID_SINGLE) {
+        for(uint32_t i = 0; i < n; i += 4) {
+            __m128 v = _mm_loadu_ps((const float*)(in + i * 4));
+            __m128d lo = _mm_cvtps_pd(v);
+            __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+            _mm_storeu_pd(out + i, lo);
+            _mm_storeu_pd(out + i + 2, hi);
+        }
+        return n;
+    }
+
+    // uint32s are offset into int32 range and back, which is exact in a double
+    bool isUint32 = dataTypeId == DTID_UINT32;
+    __m128i flip = _mm_set1_epi32(isUint32 ? (int)0x80000000 : 0);
+    __m128d offset = _mm_set1_pd(isUint32 ? 2147483648.0 : 0.0);
+    for(uint32_t i = 0; i < n; i += 4) {
+        __m128i v = _mm_xor_si128(loadNarrowAsInt32(in + i * elemBytes, dataTypeId), flip);
+        __m128d lo = _mm_add_pd(_mm_cvtepi32_pd(v), offset);
+        __m128d hi = _mm_add_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v)), offset);
+        _mm_storeu_pd(out + i, lo);
+        _mm_storeu_pd(out + i + 2, hi);
+    }
+    return n;
+}
+
+// 8 elements at a time, converted 4 at a time
+__attribute__((target("avx2")))
+uint32_t widenElementsAvx2(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId)
+{
+    int elemBytes = getSizeOfDataTypeId(dataTypeId);
+    uint32_t n = nElements & ~7u;
+
+    if(dataTypeId == DTID_SINGLE) {
+        for(uint32_t i = 0; i < n; i += 8) {
+            __m128 lo = _mm_loadu_ps((const float*)(in + i * 4));
+            __m128 hi = _mm_loadu_ps((const float*)(in + i * 4 + 16));
+            __m256d dlo = _mm256_cvtps_pd(lo);
+            __m256d dhi = _mm256_cvtps_pd(hi);
+            _mm256_storeu_pd(out + i, dlo);
+            _mm256_storeu_pd(out + i + 4, dhi);
+        }
+        return n;
+    }
+
+    bool isUint32 = dataTypeId == DTID_UINT32;
+    __m128i flip = _mm_set1_epi32(isUint32 ? (int)0x80000000 : 0);
+    __m256d offset = _mm256_set1_pd(isUint32 ? 2147483648.0 : 0.0);
+    for(uint32_t i = 0; i < n; i += 8) {
+        const uint8_t* p = in + i * elemBytes;
+        __m128i lo = _mm_xor_si128(loadNarrowAsInt32(p, dataTypeId), flip);
+        __m128i hi = _mm_xor_si128(loadNarrowAsInt32(p + 4 * elemBytes, dataTypeId), flip);
+        __m256d dlo = _mm256_add_pd(_mm256_cvtepi32_pd(lo), offset);
+        __m256d dhi = _mm256_add_pd(_mm256_cvtepi32_pd(hi), offset);
+        _mm256_storeu_pd(out + i, dlo);
+        _mm256_storeu_pd(out + i + 4, dhi);
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef CONVERT_H_INCLUDED
+#define CONVERT_H_INCLUDED
+
+#include <inttypes.h>
+#include "signal.h"
+
+// Converts arrays of signal data elements: reversing each element's bytes for
+// senders of the other byte order (-e), and widening them to double for the
+// columns output (-W). Each has a portable version, which the compiler may
+// vectorize for whatever the build targets, and versions using SSE4.1 and AVX2
+// on x86 that are picked at run time by what the cpu supports.
+
+#define CONVERT_PORTABLE 0
+#define CONVERT_SSE41    1
+#define CONVERT_AVX2     2
+
+int getBestConvertLevel();
+int getConvertLevel();
+void setConvertLevel(int level);
+const char* getConvertLevelName(int level);
+
+void swapElementBytes(uint8_t* data, uint32_t nElements, int elemBytes);
+void swapSignalBytes(uint8_t* data, const Signal* psig);
+void widenElementsToDouble(double* out, const uint8_t* in, uint32_t nElements, uint8_t dataTypeId);
+
+#endif
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "signalLogger.h"
+
+#define MAT_VERSION 0x0100
+#define MAT_INITIAL_CAPACITY (1024*1024)
+
+// size of a data element tag, and of the flags subelement of a miMATRIX
+#define MAT_TAG_BYTES 8
+#define MAT_ARRAY_FLAGS_BYTES 16
+
+void initMatBuffer(MatBuffer* pmb)
+{
+    pmb->data = NULL;
+    pmb->nBytes = 0;
+    pmb->capacity = 0;
+}
+
+void freeMatBuffer(MatBuffer* pmb)
+{
+    free(pmb->data);
+    initMatBuffer(pmb);
+}
+
+void clearMatBuffer(MatBuffer* pmb)
+{
+    // keep the memory around for the next file
+    pmb->nBytes = 0;
+}
+
+// grow the buffer by nBytes and return a pointer to the new bytes
+uint8_t* reserveMatBytes(MatBuffer* pmb, size_t nBytes)
+{
+    if(pmb->nBytes + nBytes > pmb->capacity) {
+        size_t capacity = pmb->capacity ? pmb->capacity : MAT_INITIAL_CAPACITY;
+        while(pmb->nBytes + nBytes > capacity)
+            capacity *= 2;
+
+        uint8_t* data = (uint8_t*)realloc(pmb->data, capacity);
+        if(data == NULL)
+            diep("Error allocating MAT-file buffer");
+
+        pmb->data = data;
+        pmb->capacity = capacity;
+    }
+
+    uint8_t* p = pmb->data + pmb->nBytes;
+    pmb->nBytes += nBytes;
+    return p;
+}
+
+void appendMatBytes(MatBuffer* pmb, const void* data, size_t nBytes)
+{
+    memcpy(reserveMatBytes(pmb, nBytes), data, nBytes);
+}
+
+// zero pad the buffer out to the next 8 byte boundary
+void padMatBuffer(MatBuffer* pmb)
+{
+    size_t nPad = (8 - (pmb->nBytes & 7)) & 7;
+    if(nPad)
+        memset(reserveMatBytes(pmb, nPad), 0, nPad);
+}
+
+void writeMatHeader(MatBuffer* pmb)
+{
+    uint8_t* pHeader = reserveMatBytes(pmb, MAT_HEADER_BYTES);
+
+    // 116 bytes of descriptive text padded with spaces
+    time_t now = time(NULL);
+    char timeBuffer[64];
+    strftime(timeBuffer, sizeof(timeBuffer), "%a %b %d %H:%M:%S %Y", localtime(&now));
+
+    char text[117];
+    memset(pHeader, ' ', 116);
+    int len = snprintf(text, sizeof(text), 
+            "MATLAB 5.0 MAT-file, Platform: GLNXA64, Created on: %s", timeBuffer);
+    memcpy(pHeader, text, len < 116 ? len : 116);
+
+    // no subsystem data
+    memset(pHeader + 116, 0, 8);
+
+    // version, then the endian indicator which reads "MI" in the writer's byte order
+    uint16_t version = MAT_VERSION;
+    memcpy(pHeader + 124, &version, 2);
+    uint16_t endian = ('M' << 8) | 'I';
+    memcpy(pHeader + 126, &endian, 2);
+}
+
+void writeMatElement(MatBuffer* pmb, uint32_t miType, const void* data, uint32_t nBytes)
+{
+    if(nBytes <= 4) {
+        // small data element: the size is packed into the tag with the data after
+        uint8_t* p = reserveMatBytes(pmb, MAT_TAG_BYTES);
+        uint32_t tag = (nBytes << 16) | miType;
+        memcpy(p, &tag, 4);
+        memset(p + 4, 0, 4);
+        memcpy(p + 4, data, nBytes);
+        return;
+    }
+
+    uint32_t tag[2] = {miType, nBytes};
+    appendMatBytes(pmb, tag, MAT_TAG_BYTES);
+    appendMatBytes(pmb, data, nBytes);
+    padMatBuffer(pmb);
+}
+
+// MATLAB stores char arrays as UTF-16, widen each byte
+void writeMatCharElement(MatBuffer* pmb, const char* chars, uint32_t nChars)
+{
+    uint32_t nBytes = nChars * sizeof(uint16_t);
+    uint16_t* pChars;
+
+    if(nBytes <= 4) {
+        uint8_t* p = reserveMatBytes(pmb, MAT_TAG_BYTES);
+        uint32_t tag = (nBytes << 16) | miUINT16;
+        memcpy(p, &tag, 4);
+        memset(p + 4, 0, 4);
+        pChars = (uint16_t*)(p + 4);
+    } else {
+        uint32_t tag[2] = {miUINT16, nBytes};
+        appendMatBytes(pmb, tag, MAT_TAG_BYTES);
+        pChars = (uint16_t*)reserveMatBytes(pmb, nBytes);
+    }
+
+    for(uint32_t i = 0; i < nChars; i++)
+        pChars[i] = (uint8_t)chars[i];
+
+    padMatBuffer(pmb);
+}
+
+// start a miMATRIX element, writing its array flags, dimensions and name. Returns
+// the offset of the element so that its size can be filled in by endMatMatrix 
+// once all of its contents have been written.
+size_t beginMatMatrix(MatBuffer* pmb, uint8_t mxClass, int nDims, const uint32_t* dims,
+        const char* name)
+{
+    size_t matrixOffset = pmb->nBytes;
+
+    uint32_t tag[2] = {miMATRIX, 0};
+    appendMatBytes(pmb, tag, MAT_TAG_BYTES);
+
+    uint32_t flags[2] = {mxClass, 0};
+    writeMatElement(pmb, miUINT32, flags, sizeof(flags));
+
+    writeMatElement(pmb, miINT32, dims, nDims * sizeof(uint32_t));
+
+    writeMatElement(pmb, miINT8, name, strlen(name));
+
+    return matrixOffset;
+}
+
+// change one dimension of a matrix started by beginMatMatrix
+void setMatMatrixDim(MatBuffer* pmb, size_t matrixOffset, int iDim, uint32_t dim)
+{
+    uint8_t* pDims = pmb->data + matrixOffset + MAT_TAG_BYTES + 
+        MAT_ARRAY_FLAGS_BYTES + MAT_TAG_BYTES;
+    memcpy(pDims + iDim * sizeof(uint32_t), &dim, sizeof(uint32_t));
+}
+
+void endMatMatrix(MatBuffer* pmb, size_t matrixOffset)
+{
+    uint32_t nBytes = pmb->nBytes - matrixOffset - MAT_TAG_BYTES;
+    memcpy(pmb->data + matrixOffset + 4, &nBytes, sizeof(uint32_t));
+}
+
+// the field name length and field names subelements of a struct array
+void writeMatFieldNames(MatBuffer* pmb, const char** fieldNames, int nFields)
+{
+    int32_t fieldNameLength = MAT_FIELD_NAME_LENGTH;
+    writeMatElement(pmb, miINT32, &fieldNameLength, sizeof(int32_t));
+
+    uint32_t tag[2] = {miINT8, (uint32_t)(nFields * MAT_FIELD_NAME_LENGTH)};
+    appendMatBytes(pmb, tag, MAT_TAG_BYTES);
+
+    char* pNames = (char*)reserveMatBytes(pmb, nFields * MAT_FIELD_NAME_LENGTH);
+    memset(pNames, 0, nFields * MAT_FIELD_NAME_LENGTH);
+    for(int i = 0; i < nFields; i++)
+        strncpy(pNames + i * MAT_FIELD_NAME_LENGTH, fieldNames[i], MAT_FIELD_NAME_LENGTH - 1);
+
+    padMatBuffer(pmb);
+}
+
+// an unnamed 1 x len char array, as a struct field value
+void writeMatString(MatBuffer* pmb, const char* str, uint32_t len)
+{
+    // like mxCreateString, an empty string is 0 x 0
+    uint32_t dims[2] = {len ? 1u : 0u, len};
+    size_t matrixOffset = beginMatMatrix(pmb, mxCHAR_CLASS, 2, dims, "");
+    writeMatCharElement(pmb, str, len);
+    endMatMatrix(pmb, matrixOffset);
+}
+
+// an unnamed numeric array, as a struct field value
+void writeMatNumericMatrix(MatBuffer* pmb, uint8_t mxClass, uint32_t miType, 
+        int nDims, const uint32_t* dims, const void* data, uint32_t nBytes)
+{
+    size_t matrixOffset = beginMatMatrix(pmb, mxClass, nDims, dims, "");
+    writeMatElement(pmb, miType, data, nBytes);
+    endMatMatrix(pmb, matrixOffset);
+}
+
+uint8_t convertDataTypeIdToMxClassId(uint8_t dataTypeId)
+{
+    switch (dataTypeId) {
+        case DTID_DOUBLE: // double
+            return mxDOUBLE_CLASS;
+            
+        case DTID_SINGLE: // single
+            return mxSINGLE_CLASS;
+
+        case DTID_INT8: // int8
+            return mxINT8_CLASS;
+                
+        case DTID_UINT8: // uint8
+            return mxUINT8_CLASS;
+
+        case DTID_INT16: // int16
+            return mxINT16_CLASS;
+
+        case DTID_UINT16: // uint16
+            return mxUINT16_CLASS;
+
+        case DTID_INT32: // int32
+            return mxINT32_CLASS;
+
+        case DTID_UINT32: // uint32
+            return mxUINT32_CLASS;
+
+        case DTID_CHAR: // char
+            return mxCHAR_CLASS; 
+
+        default:
+            diep("Unknown data type Id");
+    }
+
+    // never reach here
+    return mxDOUBLE_CLASS;
+}
+
+uint32_t convertDataTypeIdToMiType(uint8_t dataTypeId)
+{
+    switch (dataTypeId) {
+        case DTID_DOUBLE: // double
+            return miDOUBLE;
+            
+        case DTID_SINGLE: // single
+            return miSINGLE;
+
+        case DTID_INT8: // int8
+            return miINT8;
+                
+        case DTID_UINT8: // uint8
+        case DTID_CHAR: // char arrives as uint8
+            return miUINT8;
+
+        case DTID_INT16: // int16
+            return miINT16;
+
+        case DTID_UINT16: // uint16
+            return miUINT16;
+
+        case DTID_INT32: // int32
+            return miINT32;
+
+        case DTID_UINT32: // uint32
+            return miUINT32;
+
+        default:
+            diep("Unknown data type Id");
+    }
+
+    // never reach here
+    return miDOUBLE;
+}
+
+uint8_t convertMxClassIdToDataTypeId(uint8_t mxClass)
+{
+    switch (mxClass) {
+        case mxDOUBLE_CLASS:
+            return DTID_DOUBLE;
+
+        case mxSINGLE_CLASS:
+            return DTID_SINGLE;
+
+        case mxINT8_CLASS:
+            return DTID_INT8;
+
+        case mxUINT8_CLASS:
+            return DTID_UINT8;
+
+        case mxINT16_CLASS:
+            return DTID_INT16;
+
+        case mxUINT16_CLASS:
+            return DTID_UINT16;
+
+        case mxINT32_CLASS:
+            return DTID_INT32;
+
+        case mxUINT32_CLASS:
+            return DTID_UINT32;
+
+        case mxCHAR_CLASS:
+            return DTID_CHAR;
+
+        default:
+            diep("Unsupported mx class Id");
+    }
+
+    // never reach here
+    return DTID_DOUBLE;
+}
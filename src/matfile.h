@@ -0,0 +1,75 @@
+#ifndef MATFILE_H_INCLUDED
+#define MATFILE_H_INCLUDED
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Writes Level 5 MAT-files directly into a memory buffer, without libmat/libmx.
+// Every data element is padded to 8 bytes, and elements of 4 bytes or fewer use
+// the small data element format, as MATLAB itself writes them.
+
+#define MAT_HEADER_BYTES 128
+#define MAT_FIELD_NAME_LENGTH 32
+
+/* MAT-file data types */
+#define miINT8       1
+#define miUINT8      2
+#define miINT16      3
+#define miUINT16     4
+#define miINT32      5
+#define miUINT32     6
+#define miSINGLE     7
+#define miDOUBLE     9
+#define miINT64     12
+#define miUINT64    13
+#define miMATRIX    14
+#define miCOMPRESSED 15
+#define miUTF8      16
+
+/* MAT-file array classes */
+#define mxCELL_CLASS    1
+#define mxSTRUCT_CLASS  2
+#define mxCHAR_CLASS    4
+#define mxDOUBLE_CLASS  6
+#define mxSINGLE_CLASS  7
+#define mxINT8_CLASS    8
+#define mxUINT8_CLASS   9
+#define mxINT16_CLASS  10
+#define mxUINT16_CLASS 11
+#define mxINT32_CLASS  12
+#define mxUINT32_CLASS 13
+
+// a growable buffer holding the bytes of a MAT-file being written
+typedef struct MatBuffer {
+    uint8_t* data;
+    size_t nBytes;
+    size_t capacity;
+} MatBuffer;
+
+void initMatBuffer(MatBuffer*);
+void freeMatBuffer(MatBuffer*);
+void clearMatBuffer(MatBuffer*);
+uint8_t* reserveMatBytes(MatBuffer*, size_t nBytes);
+void appendMatBytes(MatBuffer*, const void* data, size_t nBytes);
+void padMatBuffer(MatBuffer*);
+
+void writeMatHeader(MatBuffer*);
+void writeMatElement(MatBuffer*, uint32_t miType, const void* data, uint32_t nBytes);
+void writeMatCharElement(MatBuffer*, const char* chars, uint32_t nChars);
+
+size_t beginMatMatrix(MatBuffer*, uint8_t mxClass, int nDims, const uint32_t* dims, 
+        const char* name);
+void setMatMatrixDim(MatBuffer*, size_t matrixOffset, int iDim, uint32_t dim);
+void endMatMatrix(MatBuffer*, size_t matrixOffset);
+
+void writeMatFieldNames(MatBuffer*, const char** fieldNames, int nFields);
+void writeMatString(MatBuffer*, const char* str, uint32_t len);
+void writeMatNumericMatrix(MatBuffer*, uint8_t mxClass, uint32_t miType, 
+        int nDims, const uint32_t* dims, const void* data, uint32_t nBytes);
+
+// mapping between the signal data types in signal.h and MAT-file types
+uint8_t convertDataTypeIdToMxClassId(uint8_t dataTypeId);
+uint32_t convertDataTypeIdToMiType(uint8_t dataTypeId);
+uint8_t convertMxClassIdToDataTypeId(uint8_t mxClass);
+
+#endif
@@ -0,0 +1,290 @@
+#include <string.h>
+#include <zlib.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "matread.h"
+
+#define MAT_TAG_BYTES 8
+
+/// PRIVATE DECLARATIONS
+void collectElementSamples(const MatArray* pName, const MatArray* pTimestamp, 
+        const MatArray* pData, SignalColumnSet* pset, uint32_t tStart, uint32_t tEnd);
+
+// one sample at a time is gathered here from a flush, and its name
+uint8_t sampleBuffer[MAX_DATA_SIZE_PER_TICK];
+char nameBuffer[UINT16_MAX + 1];
+
+// read the data element at *pp, moving *pp past it and its padding. Returns
+// false if the element runs past end
+bool readMatElement(const uint8_t** pp, const uint8_t* end, MatElement* pel)
+{
+    const uint8_t* p = *pp;
+    if(end - p < MAT_TAG_BYTES)
+        return false;
+
+    uint32_t tag[2];
+    memcpy(tag, p, MAT_TAG_BYTES);
+
+    if(tag[0] >> 16) {
+        // small data element, the size is packed into the tag
+        pel->miType = tag[0] & 0xffff;
+        pel->nBytes = tag[0] >> 16;
+        pel->data = p + 4;
+        if(pel->nBytes > 4)
+            return false;
+        *pp = p + MAT_TAG_BYTES;
+        return true;
+    }
+
+    pel->miType = tag[0];
+    pel->nBytes = tag[1];
+    pel->data = p + MAT_TAG_BYTES;
+    if(pel->nBytes > (size_t)(end - pel->data))
+        return false;
+
+    // miMATRIX sizes already include their padding, miCOMPRESSED elements
+    // aren't padded, and everything else is padded to 8
+    if(pel->miType == miCOMPRESSED) {
+        *pp = pel->data + pel->nBytes;
+        return true;
+    }
+    size_t nPadded = (pel->nBytes + 7) & ~(size_t)7;
+    if(nPadded > (size_t)(end - pel->data))
+        nPadded = pel->nBytes;
+    *pp = pel->data + nPadded;
+    return true;
+}
+
+// pick apart the subelements of a miMATRIX element
+bool parseMatArray(const MatElement* pMatrix, MatArray* parr)
+{
+    if(pMatrix->miType != miMATRIX)
+        return false;
+
+    memset(parr, 0, sizeof(MatArray));
+    const uint8_t* p = pMatrix->data;
+    const uint8_t* end = pMatrix->data + pMatrix->nBytes;
+    parr->end = end;
+
+    MatElement flags, dims, name;
+    if(!readMatElement(&p, end, &flags) || flags.nBytes < 4 ||
+            !readMatElement(&p, end, &dims) ||
+            !readMatElement(&p, end, &name))
+        return false;
+
+    parr->mxClass = flags.data[0];
+
+    parr->nDims = dims.nBytes / sizeof(uint32_t);
+    if(parr->nDims > MAT_READ_MAX_DIMS)
+        return false;
+    memcpy(parr->dims, dims.data, parr->nDims * sizeof(uint32_t));
+
+    parr->name = (const char*)name.data;
+    parr->lenName = name.nBytes;
+
+    if(parr->mxClass == mxSTRUCT_CLASS) {
+        MatElement fieldNameLength, fieldNames;
+        if(!readMatElement(&p, end, &fieldNameLength) || fieldNameLength.nBytes < 4 ||
+                !readMatElement(&p, end, &fieldNames))
+            return false;
+        memcpy(&parr->fieldNameLength, fieldNameLength.data, sizeof(uint32_t));
+        if(parr->fieldNameLength == 0)
+            return false;
+        parr->nFields = fieldNames.nBytes / parr->fieldNameLength;
+        parr->fieldNames = (const char*)fieldNames.data;
+        parr->fieldData = p;
+        return true;
+    }
+
+    // an empty array may leave out its data entirely
+    if(p == end)
+        return true;
+    return readMatElement(&p, end, &parr->real);
+}
+
+// read the miMATRIX element at *pp and parse it
+bool readMatArray(const uint8_t** pp, const uint8_t* end, MatArray* parr)
+{
+    MatElement matrix;
+    return readMatElement(pp, end, &matrix) && parseMatArray(&matrix, parr);
+}
+
+// inflate a miCOMPRESSED element into pOut, which then holds the element it
+// compressed, usually a miMATRIX
+bool inflateMatElement(const MatElement* pCompressed, MatBuffer* pOut)
+{
+    if(pCompressed->miType != miCOMPRESSED)
+        return false;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(z_stream));
+    if(inflateInit(&strm) != Z_OK)
+        return false;
+    strm.next_in = (Bytef*)pCompressed->data;
+    strm.avail_in = pCompressed->nBytes;
+
+    clearMatBuffer(pOut);
+    int ret;
+    do {
+        // grow as we go rather than trust the size in the inflated element's tag
+        size_t nChunk = 4 * (size_t)pCompressed->nBytes + 4096;
+        strm.next_out = reserveMatBytes(pOut, nChunk);
+        strm.avail_out = nChunk;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        pOut->nBytes -= strm.avail_out;
+    } while(ret == Z_OK);
+    inflateEnd(&strm);
+    return ret == Z_STREAM_END;
+}
+
+// read the variable at *pp, inflating it into pInflated first if it's
+// compressed, in which case parr points into pInflated
+bool readMatVariable(const uint8_t** pp, const uint8_t* end, MatBuffer* pInflated, MatArray* parr)
+{
+    MatElement el;
+    if(!readMatElement(pp, end, &el))
+        return false;
+
+    if(el.miType == miCOMPRESSED) {
+        if(!inflateMatElement(&el, pInflated))
+            return false;
+        const uint8_t* p = pInflated->data;
+        return readMatArray(&p, pInflated->data + pInflated->nBytes, parr);
+    }
+
+    return parseMatArray(&el, parr);
+}
+
+uint32_t getMatArrayNumel(const MatArray* parr)
+{
+    uint32_t numel = 1;
+    for(int i = 0; i < parr->nDims; i++)
+        numel *= parr->dims[i];
+    return numel;
+}
+
+// returns the position of the field in each element of a struct array, or -1
+int findMatField(const MatArray* parr, const char* fieldName)
+{
+    size_t len = strlen(fieldName);
+    if(len >= parr->fieldNameLength)
+        return -1;
+
+    for(int f = 0; f < parr->nFields; f++) {
+        const char* pName = parr->fieldNames + f * parr->fieldNameLength;
+        if(strncmp(pName, fieldName, len) == 0 && pName[len] == '\0')
+            return f;
+    }
+    return -1;
+}
+
+// compare a char array, stored as UTF-16 or UTF-8, against a plain string
+bool matCharArrayEquals(const MatArray* parr, const char* str, uint32_t len)
+{
+    if(parr->mxClass != mxCHAR_CLASS)
+        return false;
+
+    if(parr->real.miType == miUINT16) {
+        if(parr->real.nBytes != len * sizeof(uint16_t))
+            return false;
+        for(uint32_t i = 0; i < len; i++) {
+            uint16_t c;
+            memcpy(&c, parr->real.data + i * sizeof(uint16_t), sizeof(uint16_t));
+            if(c != (uint8_t)str[i])
+                return false;
+        }
+        return true;
+    }
+
+    return parr->real.nBytes == len && memcmp(parr->real.data, str, len) == 0;
+}
+
+/////// SIGNAL FLUSHES /////////
+
+// add the samples of the signal called name (every signal if name is NULL) with
+// tStart <= timestamp <= tEnd in the flush to pset. A flush is a struct array
+// with fields name, timestamp and data. In the structs format each element is
+// one sample, in the columns format each element holds nSamples timestamps and
+// an nSamples x dims data array, so both are read as elements of nSamples >= 1
+void collectFlushSignals(const MatArray* pvar, SignalColumnSet* pset, const char* name,
+        uint32_t lenName, uint32_t tStart, uint32_t tEnd)
+{
+    if(pvar->mxClass != mxSTRUCT_CLASS)
+        return;
+
+    int fName = findMatField(pvar, "name");
+    int fTimestamp = findMatField(pvar, "timestamp");
+    int fData = findMatField(pvar, "data");
+    if(fName < 0 || fTimestamp < 0 || fData < 0 || pvar->nFields > 3)
+        return;
+
+    const uint8_t* p = pvar->fieldData;
+    uint32_t numel = getMatArrayNumel(pvar);
+    for(uint32_t e = 0; e < numel; e++) {
+        MatArray fields[3];
+        for(int f = 0; f < pvar->nFields; f++)
+            if(!readMatArray(&p, pvar->end, fields + f))
+                return;
+
+        if(name == NULL || matCharArrayEquals(fields + fName, name, lenName))
+            collectElementSamples(fields + fName, fields + fTimestamp, fields + fData, 
+                    pset, tStart, tEnd);
+    }
+}
+
+void collectElementSamples(const MatArray* pName, const MatArray* pTimestamp, 
+        const MatArray* pData, SignalColumnSet* pset, uint32_t tStart, uint32_t tEnd)
+{
+    if(pTimestamp->mxClass != mxUINT32_CLASS || pTimestamp->real.miType != miUINT32)
+        return;
+
+    uint32_t nSamples = getMatArrayNumel(pTimestamp);
+    uint32_t numel = getMatArrayNumel(pData);
+    if(nSamples == 0 || numel % nSamples != 0)
+        return;
+
+    // names are written as UTF-16 or UTF-8, narrow them back down to bytes
+    uint32_t nameElemBytes = pName->real.miType == miUINT16 ? sizeof(uint16_t) : 1;
+    uint32_t lenName = pName->real.nBytes / nameElemBytes;
+    if(pName->mxClass != mxCHAR_CLASS || lenName >= sizeof(nameBuffer))
+        return;
+    for(uint32_t i = 0; i < lenName; i++)
+        nameBuffer[i] = pName->real.data[i * nameElemBytes];
+    nameBuffer[lenName] = '\0';
+
+    Signal sig;
+    memset(&sig, 0, sizeof(Signal));
+    sig.name = nameBuffer;
+    sig.lenName = lenName;
+    sig.dataTypeId = convertMxClassIdToDataTypeId(pData->mxClass);
+
+    // with more than one sample, samples run down the first dimension. Only the
+    // non-singleton dims are kept so both formats group the same way
+    sig.nDims = 0;
+    for(int i = nSamples > 1 ? 1 : 0; i < pData->nDims; i++)
+        if(pData->dims[i] != 1 && sig.nDims < MAX_SIGNAL_NDIMS)
+            sig.dims[sig.nDims++] = pData->dims[i];
+
+    uint32_t nElements = numel / nSamples;
+    uint32_t elemBytes = getSizeOfDataTypeId(sig.dataTypeId);
+    uint32_t storedElemBytes = numel ? pData->real.nBytes / numel : elemBytes;
+    sig.nBytes = nElements * elemBytes;
+    if(sig.nBytes > sizeof(sampleBuffer) || (numel && storedElemBytes < elemBytes))
+        return;
+    sig.data = sampleBuffer;
+
+    for(uint32_t s = 0; s < nSamples; s++) {
+        memcpy(&sig.timestamp, pTimestamp->real.data + s * sizeof(uint32_t), sizeof(uint32_t));
+        if(sig.timestamp < tStart || sig.timestamp > tEnd)
+            continue;
+
+        // gather element e of sample s from s + nSamples * e, narrowing chars
+        // back down from UTF-16
+        for(uint32_t e = 0; e < nElements; e++)
+            memcpy(sampleBuffer + e * elemBytes,
+                    pData->real.data + (size_t)(s + nSamples * e) * storedElemBytes, elemBytes);
+
+        appendSignalToColumn(findOrAddSignalColumn(pset, &sig), &sig);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef MATREAD_H_INCLUDED
+#define MATREAD_H_INCLUDED
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "matfile.h"
+#include "columns.h"
+
+// Reads back the Level 5 MAT-file variables written by matfile.cc: numeric,
+// char and struct arrays. Everything points into the caller's buffer, nothing
+// is copied, except that a miCOMPRESSED variable has to be inflated into a
+// buffer of its own first.
+
+#define MAT_READ_MAX_DIMS 16
+
+// one data element, with the small data element format already unpacked
+typedef struct MatElement {
+    uint32_t miType;
+    uint32_t nBytes;
+    const uint8_t* data;
+} MatElement;
+
+typedef struct MatArray {
+    uint8_t mxClass;
+    int nDims;
+    uint32_t dims[MAT_READ_MAX_DIMS];
+    const char* name;
+    uint32_t lenName;
+
+    // numeric and char arrays: the real part
+    MatElement real;
+
+    // struct arrays: the field names, each fieldNameLength chars padded with
+    // NULs, then each element's fields one after another from fieldData
+    int nFields;
+    uint32_t fieldNameLength;
+    const char* fieldNames;
+    const uint8_t* fieldData;
+    const uint8_t* end;
+} MatArray;
+
+bool readMatElement(const uint8_t** pp, const uint8_t* end, MatElement*);
+bool parseMatArray(const MatElement* pMatrix, MatArray*);
+bool readMatArray(const uint8_t** pp, const uint8_t* end, MatArray*);
+bool inflateMatElement(const MatElement* pCompressed, MatBuffer* pOut);
+bool readMatVariable(const uint8_t** pp, const uint8_t* end, MatBuffer* pInflated, MatArray*);
+
+// signalLogger's flushes, in either output format
+void collectFlushSignals(const MatArray* pvar, SignalColumnSet* pset, const char* name,
+        uint32_t lenName, uint32_t tStart, uint32_t tEnd);
+
+uint32_t getMatArrayNumel(const MatArray*);
+int findMatField(const MatArray*, const char* fieldName);
+bool matCharArrayEquals(const MatArray*, const char* str, uint32_t len);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/filter.h>
+
+#include "signal.h"
+#include "buffer.h"
+#include "receiver.h"
+#include "signalLogger.h"
+
+// open a socket receiving on port. Several sockets opened with reusePort can 
+// share the port, see attachReceiveFanout for how packets are shared among them
+void openReceiveSocket(PacketReceiver* prcv, int port, int recvBufferBytes, int batchSize,
+        bool countKernelDrops, bool reusePort)
+{
+    int sock;
+    struct sockaddr_in si_me;
+
+    if ((sock=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1)
+        diep("socket");
+
+    // ask for a large receive buffer to ride out bursts while we're busy. 
+    // SO_RCVBUFFORCE can exceed net.core.rmem_max but needs CAP_NET_ADMIN
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &recvBufferBytes, sizeof(int)) == -1 &&
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &recvBufferBytes, sizeof(int)) == -1)
+        diep("setsockopt(SO_RCVBUF)");
+
+    // the kernel reports double the usable size to account for its bookkeeping
+    int actualBytes;
+    socklen_t optlen = sizeof(int);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &actualBytes, &optlen) == -1)
+        diep("getsockopt(SO_RCVBUF)");
+    printf("Socket receive buffer : %d bytes\n", actualBytes / 2);
+    if (actualBytes / 2 < recvBufferBytes)
+        fprintf(stderr, "WARNING: Socket receive buffer limited to %d of %d bytes requested, "
+                "raise net.core.rmem_max\n", actualBytes / 2, recvBufferBytes);
+
+    // have the kernel tell us how many packets it's dropped with each packet
+    if (countKernelDrops) {
+        int on = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(int)) == -1)
+            diep("setsockopt(SO_RXQ_OVFL)");
+    }
+
+    if (reusePort) {
+        int on = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int)) == -1)
+            diep("setsockopt(SO_REUSEPORT)");
+    }
+
+    // Setup Local Socket on specified port to accept from any address
+    memset((char *) &si_me, 0, sizeof(si_me)); 
+    si_me.sin_family = AF_INET;
+    si_me.sin_port = htons(port);
+    si_me.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock,(struct sockaddr*) &si_me, sizeof(si_me))==-1)
+        diep("bind");
+
+    prcv->sock = sock;
+    prcv->batchSize = batchSize;
+    prcv->kernelDropCount = 0;
+}
+
+// have the kernel hand each packet to one of the nSockets sockets sharing its 
+// port through SO_REUSEPORT, chosen by its tick's timestamp so that all of a 
+// tick's packets are received together. Packets with signal ids all go to the
+// first socket, where the dictionary they refer to is. Without this filter the 
+// kernel picks by source address and port, which keeps a tick together too, but
+// sends everything from one sender to the same socket.
+void attachReceiveFanout(PacketReceiver* prcv, int nSockets, bool bigEndian)
+{
+    // BPF loads are big endian, so a little endian version loads as version << 8
+    uint32_t versionShift = bigEndian ? 0 : 8;
+    uint32_t timestampLowByte = bigEndian ? 5 : 2;
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_H | BPF_ABS, 0, 0, 0 },
+        { BPF_JMP | BPF_JEQ | BPF_K, 4, 0, (uint32_t)PACKET_VERSION_SIGNAL_IDS << versionShift },
+        { BPF_JMP | BPF_JEQ | BPF_K, 3, 0, (uint32_t)PACKET_VERSION_DICTIONARY << versionShift },
+        // consecutive ticks take turns by the low byte of their timestamp
+        { BPF_LD | BPF_B | BPF_ABS, 0, 0, timestampLowByte },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)nSockets },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+        { BPF_RET | BPF_K, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    if (setsockopt(prcv->sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
+        perror("Warning: could not spread ticks across receive threads, "
+                "setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+}
+
+// stop receivePacketBatch waiting for packets after msec, so that ticks can be
+// given up on in time even when nothing else arrives (-P)
+void setReceiveTimeout(PacketReceiver* prcv, int msec)
+{
+    struct timeval tv;
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+    if (setsockopt(prcv->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+        diep("setsockopt(SO_RCVTIMEO)");
+}
+
+// block until at least one packet arrives (or the receive timeout passes, with
+// none), then receive as many packets as are waiting (up to batchSize) in
+// a single call. Each packet's header and data are received into the places
+// getPacketLandings chose for them.
+void receivePacketBatch(PacketReceiver* prcv, PacketBatch* pb)
+{
+    for(int k = 0; k < prcv->batchSize; k++) {
+        prcv->iovecs[k][0].iov_base = pb->header[k];
+        prcv->iovecs[k][0].iov_len = PACKET_HEADER_LENGTH;
+        prcv->iovecs[k][1].iov_base = pb->landing[k];
+        prcv->iovecs[k][1].iov_len = MAX_PACKET_DATA_LENGTH;
+
+        memset(&prcv->msgs[k].msg_hdr, 0, sizeof(struct msghdr));
+        prcv->msgs[k].msg_hdr.msg_iov = prcv->iovecs[k];
+        prcv->msgs[k].msg_hdr.msg_iovlen = 2;
+        prcv->msgs[k].msg_hdr.msg_control = prcv->control[k];
+        prcv->msgs[k].msg_hdr.msg_controllen = RECV_CONTROL_BYTES;
+    }
+
+    int n = recvmmsg(prcv->sock, prcv->msgs, prcv->batchSize, MSG_WAITFORONE, NULL);
+    if(n == -1) {
+        if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+            diep("recvmmsg()");
+        n = 0;
+    }
+
+    for(int k = 0; k < n; k++) {
+        pb->bytesRead[k] = prcv->msgs[k].msg_len;
+
+        // check the kernel's running count of dropped packets
+        struct msghdr* pmsg = &prcv->msgs[k].msg_hdr;
+        for(struct cmsghdr* pcmsg = CMSG_FIRSTHDR(pmsg); pcmsg != NULL; 
+                pcmsg = CMSG_NXTHDR(pmsg, pcmsg)) {
+            if(pcmsg->cmsg_level == SOL_SOCKET && pcmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t dropCount;
+                memcpy(&dropCount, CMSG_DATA(pcmsg), sizeof(uint32_t));
+                if(dropCount != prcv->kernelDropCount) {
+                    logKernelDrops(dropCount - prcv->kernelDropCount);
+                    // also read by the thread writing the stats file
+                    __atomic_store_n(&prcv->kernelDropCount, dropCount, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+
+    pb->nPackets = n;
+}
+
+void logKernelDrops(uint32_t nDropped)
+{
+    // the socket receive buffer filled up before we could read from it
+    fprintf(stderr, "\nWARNING: Kernel dropped %u packets, socket receive buffer overflow\n\n", 
+            nDropped);
+}
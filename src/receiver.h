@@ -0,0 +1,36 @@
+#ifndef RECEIVER_H_INCLUDED
+#define RECEIVER_H_INCLUDED
+
+#include <sys/socket.h>
+#include "buffer.h"
+
+#define DEFAULT_RECV_BUFFER_BYTES (8*1024*1024)
+#define MAX_RECV_BUFFER_BYTES (1024*1024*1024)
+
+// room for the SO_RXQ_OVFL control message delivered with each packet
+#define RECV_CONTROL_BYTES CMSG_SPACE(sizeof(uint32_t))
+
+// a stream's socket and what recvmmsg needs to receive a batch from it
+typedef struct PacketReceiver {
+    int sock;
+
+    // packets received per recvmmsg, at most RECV_BATCH_SIZE
+    int batchSize;
+
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    struct iovec iovecs[RECV_BATCH_SIZE][2];
+    uint8_t control[RECV_BATCH_SIZE][RECV_CONTROL_BYTES];
+
+    // running count of packets the kernel dropped for lack of socket buffer space
+    uint32_t kernelDropCount;
+} PacketReceiver;
+
+void openReceiveSocket(PacketReceiver*, int port, int recvBufferBytes, int batchSize,
+        bool countKernelDrops, bool reusePort);
+void attachReceiveFanout(PacketReceiver*, int nSockets, bool bigEndian);
+void setReceiveTimeout(PacketReceiver*, int msec);
+void receivePacketBatch(PacketReceiver*, PacketBatch*);
+
+void logKernelDrops(uint32_t nDropped);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "reorder.h"
+#include "signalLogger.h"
+
+#define INITIAL_REORDER_BYTES (1024*1024)
+#define INITIAL_REORDER_SIGNALS 1024
+
+/* marks a held record that has been released, in place of its descId */
+#define RELEASED_DESC_ID 0xFFFFFFFF
+
+/// PRIVATE DECLARATIONS
+uint8_t* reserveHeldRecord(ReorderWindow* pwin, uint32_t recordBytes);
+bool isHeldSignalBefore(const HeldSignal* a, const HeldSignal* b);
+void pushHeldSignal(ReorderWindow* pwin, const HeldSignal* ph);
+void popHeldSignal(ReorderWindow* pwin);
+void markReleasedRecord(ReorderWindow* pwin);
+
+void initReorderWindow(ReorderWindow* pwin, uint32_t depth, int maxHoldMsec)
+{
+    memset(pwin, 0, sizeof(ReorderWindow));
+    pwin->depth = depth;
+    pwin->maxHoldMsec = maxHoldMsec;
+}
+
+void freeReorderWindow(ReorderWindow* pwin)
+{
+    free(pwin->data);
+    free(pwin->heap);
+    memset(pwin, 0, sizeof(ReorderWindow));
+}
+
+// copy the signal into the window
+void holdSignal(ReorderWindow* pwin, const Signal* psig, double nowSec)
+{
+    if(pwin->anyReleased && psig->timestamp < pwin->lastReleasedTimestamp) {
+        uint32_t lateTicks = pwin->lastReleasedTimestamp - psig->timestamp;
+        pwin->nLate++;
+        if(lateTicks > pwin->maxLateTicks)
+            pwin->maxLateTicks = lateTicks;
+    }
+
+    if(!pwin->anyHeld || psig->timestamp > pwin->newestTimestamp)
+        pwin->newestTimestamp = psig->timestamp;
+    pwin->anyHeld = 1;
+
+    markReleasedRecord(pwin);
+    uint32_t recordBytes = getSignalRecordBytes(psig);
+    uint8_t* pRecord = reserveHeldRecord(pwin, recordBytes);
+    storeSignalRecord(pRecord, psig);
+
+    HeldSignal held;
+    held.timestamp = psig->timestamp;
+    held.seq = pwin->nextSeq++;
+    held.offset = pRecord - pwin->data;
+    held.heldSince = nowSec;
+    pushHeldSignal(pwin, &held);
+}
+
+// the earliest held signal if it's due to be released, or NULL. Its record is
+// only valid until the next call to holdSignal or releaseNextSignal
+const SignalRecord* releaseNextSignal(ReorderWindow* pwin, double nowSec)
+{
+    markReleasedRecord(pwin);
+    if(pwin->nHeld == 0)
+        return NULL;
+
+    // late signals, and the rest of a tick already partly released, go at once
+    const HeldSignal* ph = pwin->heap;
+    bool due = (pwin->anyReleased && ph->timestamp <= pwin->lastReleasedTimestamp) ||
+        pwin->newestTimestamp - ph->timestamp >= pwin->depth ||
+        (nowSec - ph->heldSince) * 1000 >= pwin->maxHoldMsec;
+    if(!due)
+        return NULL;
+
+    SignalRecord* prec = (SignalRecord*)(pwin->data + ph->offset);
+    if(!pwin->anyReleased || ph->timestamp > pwin->lastReleasedTimestamp)
+        pwin->lastReleasedTimestamp = ph->timestamp;
+    pwin->anyReleased = 1;
+    popHeldSignal(pwin);
+
+    // the record is left as it is until the caller is done with it
+    pwin->pReleased = prec;
+    return prec;
+}
+
+// mark the record last released, so that its space can be reclaimed once 
+// every record before it has been released too
+void markReleasedRecord(ReorderWindow* pwin)
+{
+    if(pwin->pReleased != NULL) {
+        pwin->pReleased->descId = RELEASED_DESC_ID;
+        pwin->pReleased = NULL;
+    }
+}
+
+// room for a record at the end of data, reclaiming released records at tail 
+// first, then moving the held records down or growing data if it's still full
+uint8_t* reserveHeldRecord(ReorderWindow* pwin, uint32_t recordBytes)
+{
+    while(pwin->tail < pwin->nBytes && 
+            ((SignalRecord*)(pwin->data + pwin->tail))->descId == RELEASED_DESC_ID)
+        pwin->tail += ((SignalRecord*)(pwin->data + pwin->tail))->length;
+    if(pwin->tail == pwin->nBytes)
+        pwin->tail = pwin->nBytes = 0;
+
+    if(pwin->nBytes + recordBytes > pwin->capacity && pwin->tail > 0) {
+        memmove(pwin->data, pwin->data + pwin->tail, pwin->nBytes - pwin->tail);
+        for(uint32_t i = 0; i < pwin->nHeld; i++)
+            pwin->heap[i].offset -= pwin->tail;
+        pwin->nBytes -= pwin->tail;
+        pwin->tail = 0;
+    }
+
+    if(pwin->nBytes + recordBytes > pwin->capacity) {
+        size_t capacity = pwin->capacity ? pwin->capacity : INITIAL_REORDER_BYTES;
+        while(pwin->nBytes + recordBytes > capacity)
+            capacity *= 2;
+        pwin->data = (uint8_t*)realloc(pwin->data, capacity);
+        if(pwin->data == NULL)
+            diep("Error allocating reorder window");
+        pwin->capacity = capacity;
+    }
+
+    uint8_t* pRecord = pwin->data + pwin->nBytes;
+    pwin->nBytes += recordBytes;
+    return pRecord;
+}
+
+/////// HEAP /////////
+
+bool isHeldSignalBefore(const HeldSignal* a, const HeldSignal* b)
+{
+    if(a->timestamp != b->timestamp)
+        return a->timestamp < b->timestamp;
+    return a->seq < b->seq;
+}
+
+void pushHeldSignal(ReorderWindow* pwin, const HeldSignal* ph)
+{
+    if(pwin->nHeld == pwin->capacityHeld) {
+        pwin->capacityHeld = pwin->capacityHeld ? 2 * pwin->capacityHeld : INITIAL_REORDER_SIGNALS;
+        pwin->heap = (HeldSignal*)realloc(pwin->heap, pwin->capacityHeld * sizeof(HeldSignal));
+        if(pwin->heap == NULL)
+            diep("Error allocating reorder window");
+    }
+
+    // sift up
+    uint32_t i = pwin->nHeld++;
+    while(i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if(!isHeldSignalBefore(ph, pwin->heap + parent))
+            break;
+        pwin->heap[i] = pwin->heap[parent];
+        i = parent;
+    }
+    pwin->heap[i] = *ph;
+}
+
+void popHeldSignal(ReorderWindow* pwin)
+{
+    HeldSignal last = pwin->heap[--pwin->nHeld];
+
+    // sift the last signal down from the root
+    uint32_t i = 0;
+    while(1) {
+        uint32_t child = 2 * i + 1;
+        if(child >= pwin->nHeld)
+            break;
+        if(child + 1 < pwin->nHeld && isHeldSignalBefore(pwin->heap + child + 1, pwin->heap + child))
+            child++;
+        if(!isHeldSignalBefore(pwin->heap + child, &last))
+            break;
+        pwin->heap[i] = pwin->heap[child];
+        i = child;
+    }
+    pwin->heap[i] = last;
+}
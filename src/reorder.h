@@ -0,0 +1,65 @@
+#ifndef REORDER_H_INCLUDED
+#define REORDER_H_INCLUDED
+
+#include <inttypes.h>
+#include "signal.h"
+#include "buffer.h"
+
+// UDP doesn't keep ticks in order, and ticks are queued for the writer in the 
+// order they finish arriving, so the writer holds signals back in a 
+// ReorderWindow and lets them go in timestamp order. A signal is released once
+// the newest timestamp seen is depth past its own, or once it has been held
+// for maxHoldMsec, whichever comes first. A signal arriving after a later one
+// has already been released is late; it is still written, as soon as possible,
+// and counted.
+
+/* default reorder window, 0 writes signals in the order they arrive */
+#define DEFAULT_REORDER_WINDOW_TICKS 0
+#define DEFAULT_REORDER_MAX_HOLD_MSEC 100
+
+// where a held signal's record is, keyed by timestamp and then by arrival so 
+// that a tick's signals stay in order
+typedef struct HeldSignal {
+    uint32_t timestamp;
+    uint32_t seq;
+    size_t offset;
+    double heldSince;
+} HeldSignal;
+
+typedef struct ReorderWindow {
+    uint32_t depth;
+    int maxHoldMsec;
+
+    // the held signals' SignalRecords, in the order they arrived, from tail to
+    // nBytes. Released records are marked, and skipped over once at tail
+    uint8_t* data;
+    size_t tail;
+    size_t nBytes;
+    size_t capacity;
+
+    // released but not yet marked, see releaseNextSignal
+    SignalRecord* pReleased;
+
+    // binary min-heap of the held signals
+    HeldSignal* heap;
+    uint32_t nHeld;
+    uint32_t capacityHeld;
+    uint32_t nextSeq;
+
+    bool anyHeld;
+    uint32_t newestTimestamp;
+    bool anyReleased;
+    uint32_t lastReleasedTimestamp;
+
+    // late arrivals since last cleared by the caller
+    uint32_t nLate;
+    uint32_t maxLateTicks;
+} ReorderWindow;
+
+void initReorderWindow(ReorderWindow*, uint32_t depth, int maxHoldMsec);
+void freeReorderWindow(ReorderWindow*);
+
+void holdSignal(ReorderWindow*, const Signal*, double nowSec);
+const SignalRecord* releaseNextSignal(ReorderWindow*, double nowSec);
+
+#endif
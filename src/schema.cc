@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signal.h"
+#include "schema.h"
+#include "signalLogger.h"
+
+/* longest name of a signal the logger makes up itself */
+#define MAX_LOCAL_SIGNAL_NAME_LENGTH 64
+
+/// PRIVATE DECLARATIONS
+
+const uint8_t* decodeSignalHeader(const uint8_t* pBuf, const uint8_t* pEnd, bool swapBytes, Signal* ps);
+uint32_t hashSignalHeader(const uint8_t* header, uint32_t nHeaderBytes);
+const SignalDescriptor* findOrAddSignalDescriptor(SignalSchemas*, const uint8_t* header,
+        uint32_t nHeaderBytes, const Signal* psig);
+bool tickMatchesSchema(const SignalSchemas*, const uint8_t* data, uint32_t nBytes,
+        const TickSchema* pschema);
+void appendToTickSchema(TickSchema* pschema, uint32_t descId, uint32_t headerOffset,
+        uint32_t dataOffset);
+
+void initSignalSchemas(SignalSchemas* pschemas)
+{
+    memset(pschemas, 0, sizeof(SignalSchemas));
+    pschemas->iLastMatched = -1;
+}
+
+void freeSignalSchemas(SignalSchemas* pschemas)
+{
+    for(uint32_t i = 0; i < pschemas->nDescriptors; i++)
+        free(pschemas->descriptors[i]);
+    for(int i = 0; i < TICK_SCHEMA_CACHE_SIZE; i++)
+        freeTickSchema(pschemas->cache + i);
+    initSignalSchemas(pschemas);
+}
+
+/////// TICK SCHEMAS /////////
+
+// decode the signal headers in a tick's reassembled data into *pschema, adding
+// descriptors for any not seen before. Returns false if the headers run past
+// the end of the data or one is invalid, in which case *pschema holds the
+// signals before that and *pBytesDecoded says where decoding stopped
+bool decodeTickSchema(SignalSchemas* pschemas, const uint8_t* data, uint32_t nBytes, 
+        TickSchema* pschema, uint32_t* pBytesDecoded)
+{
+    Signal s;
+    const uint8_t* pBuf = data;
+    const uint8_t* pEnd = data + nBytes;
+
+    pschema->nBytes = nBytes;
+    pschema->nSignals = 0;
+
+    while(pBuf < pEnd) {
+        const uint8_t* pHeader = pBuf;
+        const uint8_t* pData = decodeSignalHeader(pBuf, pEnd, pschemas->swapBytes, &s);
+        if(pData == NULL)
+            break;
+
+        // the data follows the header
+        pBuf = pData + s.nBytes;
+        if(pBuf > pEnd) {
+            pBuf = pHeader;
+            break;
+        }
+
+        const SignalDescriptor* pdesc = findOrAddSignalDescriptor(pschemas, pHeader, pData - pHeader, &s);
+        if(pdesc == NULL) {
+            pBuf = pHeader;
+            break;
+        }
+
+        appendToTickSchema(pschema, pdesc->descId, pHeader - data, pData - data);
+    }
+
+    *pBytesDecoded = pBuf - data;
+    return pBuf == pEnd;
+}
+
+// decode the signal header at pBuf into *ps, leaving the timestamp and data. 
+// Returns a pointer to the byte after the header, or NULL if it runs past pEnd,
+// has an unknown data type, or says the data is bigger than a whole tick
+const uint8_t* decodeSignalHeader(const uint8_t* pBuf, const uint8_t* pEnd, bool swapBytes, 
+        Signal* ps)
+{
+    // need at least the name length, type, and nDims
+    if(pEnd - pBuf < 4)
+        return NULL;
+
+    // get the number of bytes in the signal name
+    STORE_UINT16(pBuf, ps->lenName);
+    if(swapBytes)
+        ps->lenName = __builtin_bswap16(ps->lenName);
+
+    // point the signal name into the data buffer
+    ps->name = (const char*)pBuf;
+    if(pEnd - pBuf < ps->lenName + 2)
+        return NULL;
+    pBuf += ps->lenName;
+
+    // store the data type
+    STORE_UINT8(pBuf, ps->dataTypeId);
+    if(ps->dataTypeId > DTID_CHAR)
+        return NULL;
+
+    // store the number of dimensions
+    STORE_UINT8(pBuf, ps->nDims);
+    if(ps->nDims > MAX_SIGNAL_NDIMS || pEnd - pBuf < ps->nDims * (int)sizeof(uint16_t))
+        return NULL;
+
+    // store the dimensions
+    STORE_UINT16_ARRAY(pBuf, ps->dims, ps->nDims);
+    if(swapBytes) {
+        for(int i = 0; i < ps->nDims; i++)
+            ps->dims[i] = __builtin_bswap16(ps->dims[i]);
+    }
+
+    uint64_t nBytes = getNumBytesForSignalData(ps);
+    if(nBytes > MAX_DATA_SIZE_PER_TICK)
+        return NULL;
+    ps->nBytes = nBytes;
+    return pBuf;
+}
+
+// find a cached schema matching the tick's layout, trying the last one matched
+// first. Only the header bytes are compared, the data is never looked at
+const TickSchema* findTickSchema(SignalSchemas* pschemas, const uint8_t* data, uint32_t nBytes)
+{
+    int iLast = pschemas->iLastMatched;
+    int iMatch = -1;
+    if(iLast >= 0 && tickMatchesSchema(pschemas, data, nBytes, pschemas->cache + iLast))
+        iMatch = iLast;
+
+    for(uint32_t i = 0; iMatch < 0 && i < pschemas->nCached; i++) {
+        if((int)i != iLast && tickMatchesSchema(pschemas, data, nBytes, pschemas->cache + i))
+            iMatch = i;
+    }
+
+    if(iMatch < 0)
+        return NULL;
+
+    pschemas->cache[iMatch].lastUsed = ++pschemas->clock;
+    pschemas->iLastMatched = iMatch;
+    return pschemas->cache + iMatch;
+}
+
+// a tick matches if it's the same length and has every one of the schema's
+// signal headers at the same offset. Each header fixes where the next begins,
+// so that's enough to say the whole layout is the same
+bool tickMatchesSchema(const SignalSchemas* pschemas, const uint8_t* data, uint32_t nBytes,
+        const TickSchema* pschema)
+{
+    if(pschema->nBytes != nBytes)
+        return 0;
+
+    for(uint32_t i = 0; i < pschema->nSignals; i++) {
+        const SignalDescriptor* pdesc = pschemas->descriptors[pschema->descIds[i]];
+        if(memcmp(data + pschema->headerOffsets[i], pdesc->header, pdesc->nHeaderBytes) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+// move the decoded schema into the cache, in place of the least recently used
+// one once the cache is full. *pschema is left holding the replaced schema's
+// storage for the next decode to reuse
+const TickSchema* addTickSchema(SignalSchemas* pschemas, TickSchema* pschema)
+{
+    TickSchema* cache = pschemas->cache;
+    int slot = pschemas->nCached;
+    if(pschemas->nCached < TICK_SCHEMA_CACHE_SIZE)
+        pschemas->nCached++;
+    else {
+        slot = 0;
+        for(int i = 1; i < TICK_SCHEMA_CACHE_SIZE; i++) {
+            if(cache[i].lastUsed < cache[slot].lastUsed)
+                slot = i;
+        }
+    }
+
+    TickSchema replaced = cache[slot];
+    cache[slot] = *pschema;
+    *pschema = replaced;
+
+    cache[slot].lastUsed = ++pschemas->clock;
+    pschemas->iLastMatched = slot;
+    return cache + slot;
+}
+
+void freeTickSchema(TickSchema* pschema)
+{
+    free(pschema->descIds);
+    free(pschema->headerOffsets);
+    free(pschema->dataOffsets);
+    memset(pschema, 0, sizeof(TickSchema));
+}
+
+void appendToTickSchema(TickSchema* pschema, uint32_t descId, uint32_t headerOffset,
+        uint32_t dataOffset)
+{
+    if(pschema->nSignals == pschema->capacitySignals) {
+        uint32_t capacity = pschema->capacitySignals ? pschema->capacitySignals * 2 : 64;
+        pschema->descIds = (uint32_t*)realloc(pschema->descIds, capacity * sizeof(uint32_t));
+        pschema->headerOffsets = (uint32_t*)realloc(pschema->headerOffsets, capacity * sizeof(uint32_t));
+        pschema->dataOffsets = (uint32_t*)realloc(pschema->dataOffsets, capacity * sizeof(uint32_t));
+        if(pschema->descIds == NULL || pschema->headerOffsets == NULL || pschema->dataOffsets == NULL)
+            diep("Error allocating tick schema");
+        pschema->capacitySignals = capacity;
+    }
+
+    pschema->descIds[pschema->nSignals] = descId;
+    pschema->headerOffsets[pschema->nSignals] = headerOffset;
+    pschema->dataOffsets[pschema->nSignals] = dataOffset;
+    pschema->nSignals++;
+}
+
+/////// SIGNAL DICTIONARY /////////
+
+// give each signal id in a dictionary's reassembled data the descriptor for its
+// header. Returns false if an entry runs past the end of the data or its header
+// is invalid, in which case the entries before it still count, its id and the
+// ones after keep whatever they had, and *pBytesDecoded says where decoding
+// stopped
+bool decodeSignalDictionary(SignalSchemas* pschemas, const uint8_t* data, uint32_t nBytes,
+        uint32_t* pBytesDecoded)
+{
+    Signal s;
+    const uint8_t* pBuf = data;
+    const uint8_t* pEnd = data + nBytes;
+
+    while(pEnd - pBuf >= (int)sizeof(uint16_t)) {
+        const uint8_t* pEntry = pBuf;
+        uint16_t signalId;
+        STORE_UINT16(pBuf, signalId);
+        if(pschemas->swapBytes)
+            signalId = __builtin_bswap16(signalId);
+
+        const uint8_t* pHeader = pBuf;
+        pBuf = decodeSignalHeader(pHeader, pEnd, pschemas->swapBytes, &s);
+        if(pBuf == NULL) {
+            pBuf = pEntry;
+            break;
+        }
+
+        const SignalDescriptor* pdesc = findOrAddSignalDescriptor(pschemas, pHeader, pBuf - pHeader, &s);
+        if(pdesc == NULL) {
+            pBuf = pEntry;
+            break;
+        }
+
+        pschemas->dictionary[signalId] = pdesc->descId + 1;
+    }
+
+    *pBytesDecoded = pBuf - data;
+    return pBuf == pEnd;
+}
+
+// the descriptor a dictionary gave signalId, or NULL if none has
+const SignalDescriptor* findDictionarySignal(const SignalSchemas* pschemas, uint16_t signalId)
+{
+    uint32_t entry = pschemas->dictionary[signalId];
+    return entry ? pschemas->descriptors[entry - 1] : NULL;
+}
+
+/////// SIGNAL DESCRIPTORS /////////
+
+uint32_t hashSignalHeader(const uint8_t* header, uint32_t nHeaderBytes)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < nHeaderBytes; i++)
+        hash = (hash ^ header[i]) * 16777619u;
+    return hash;
+}
+
+// look up the descriptor for a signal header, adding one decoded from *psig if
+// it's new. Returns NULL if there's no room for another
+const SignalDescriptor* findOrAddSignalDescriptor(SignalSchemas* pschemas, const uint8_t* header,
+        uint32_t nHeaderBytes, const Signal* psig)
+{
+    uint32_t* descriptorIndex = pschemas->descriptorIndex;
+    uint32_t i = hashSignalHeader(header, nHeaderBytes) & SIGNAL_DESCRIPTOR_INDEX_MASK;
+
+    // probe forward to the descriptor or the first empty position, the index is
+    // never more than half full so there always is one
+    while(descriptorIndex[i] != 0) {
+        const SignalDescriptor* pdesc = pschemas->descriptors[descriptorIndex[i] - 1];
+        if(pdesc->nHeaderBytes == nHeaderBytes && memcmp(pdesc->header, header, nHeaderBytes) == 0)
+            return pdesc;
+        i = (i + 1) & SIGNAL_DESCRIPTOR_INDEX_MASK;
+    }
+
+    if(pschemas->nDescriptors == MAX_SIGNAL_DESCRIPTORS) {
+        fprintf(stderr, "\nWARNING: Too many distinct signals, dropping %.*s\n\n",
+                psig->lenName, psig->name);
+        return NULL;
+    }
+
+    // the descriptor, its copy of the header and its name share one allocation
+    SignalDescriptor* pdesc = (SignalDescriptor*)malloc(sizeof(SignalDescriptor) +
+            nHeaderBytes + psig->lenName + 1);
+    if(pdesc == NULL)
+        diep("Error allocating signal descriptor");
+
+    uint8_t* pHeader = (uint8_t*)(pdesc + 1);
+    memcpy(pHeader, header, nHeaderBytes);
+    char* pName = (char*)(pHeader + nHeaderBytes);
+    memcpy(pName, psig->name, psig->lenName);
+    pName[psig->lenName] = '\0';
+
+    pdesc->descId = pschemas->nDescriptors;
+    pdesc->header = pHeader;
+    pdesc->nHeaderBytes = nHeaderBytes;
+    pdesc->name = pName;
+    pdesc->lenName = psig->lenName;
+    pdesc->dataTypeId = psig->dataTypeId;
+    pdesc->nDims = psig->nDims;
+    memcpy(pdesc->dims, psig->dims, psig->nDims * sizeof(uint16_t));
+    pdesc->nBytes = psig->nBytes;
+
+    pschemas->descriptors[pschemas->nDescriptors++] = pdesc;
+    descriptorIndex[i] = pschemas->nDescriptors;
+    return pdesc;
+}
+
+// a descriptor for a signal the logger makes up itself rather than receives,
+// given the header a sender would have sent for it, in the sender's byte order
+// like every other. Returns NULL if there's no room for another
+const SignalDescriptor* addLocalSignalDescriptor(SignalSchemas* pschemas, const char* name,
+        uint8_t dataTypeId, uint8_t nDims, const uint16_t* dims)
+{
+    Signal s;
+    memset(&s, 0, sizeof(Signal));
+    s.name = name;
+    s.lenName = strlen(name);
+    s.dataTypeId = dataTypeId;
+    s.nDims = nDims;
+    if(s.lenName > MAX_LOCAL_SIGNAL_NAME_LENGTH || nDims > MAX_SIGNAL_NDIMS)
+        diep("Local signal name or dims too long");
+    memcpy(s.dims, dims, nDims * sizeof(uint16_t));
+    s.nBytes = getNumBytesForSignalData(&s);
+
+    uint8_t header[4 + MAX_LOCAL_SIGNAL_NAME_LENGTH + MAX_SIGNAL_NDIMS * sizeof(uint16_t)];
+    uint8_t* pHeader = header;
+    uint16_t lenName = pschemas->swapBytes ? __builtin_bswap16(s.lenName) : s.lenName;
+    memcpy(pHeader, &lenName, sizeof(uint16_t));
+    pHeader += sizeof(uint16_t);
+    memcpy(pHeader, name, s.lenName);
+    pHeader += s.lenName;
+    *pHeader++ = dataTypeId;
+    *pHeader++ = nDims;
+    for(int i = 0; i < nDims; i++) {
+        uint16_t dim = pschemas->swapBytes ? __builtin_bswap16(dims[i]) : dims[i];
+        memcpy(pHeader, &dim, sizeof(uint16_t));
+        pHeader += sizeof(uint16_t);
+    }
+
+    return findOrAddSignalDescriptor(pschemas, header, pHeader - header, &s);
+}
+
+const SignalDescriptor* getSignalDescriptor(const SignalSchemas* pschemas, uint32_t descId)
+{
+    return pschemas->descriptors[descId];
+}
+
+// fill in the parts of a Signal that its descriptor determines, leaving the
+// timestamp and data to the caller
+void viewSignalDescriptor(const SignalDescriptor* pdesc, Signal* psig)
+{
+    psig->descId = pdesc->descId;
+    psig->name = pdesc->name;
+    psig->lenName = pdesc->lenName;
+    psig->dataTypeId = pdesc->dataTypeId;
+    psig->nDims = pdesc->nDims;
+    memcpy(psig->dims, pdesc->dims, pdesc->nDims * sizeof(uint16_t));
+    psig->nBytes = pdesc->nBytes;
+}
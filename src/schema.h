@@ -0,0 +1,102 @@
+#ifndef SCHEMA_H_INCLUDED
+#define SCHEMA_H_INCLUDED
+
+#include <inttypes.h>
+#include "signal.h"
+
+// A Simulink model sends the same signals with the same types and dims on every
+// tick, so a tick's signal headers (name length, name, type, nDims, dims) are
+// decoded once into a TickSchema and later ticks are just checked against it.
+//
+// Each distinct signal header is a SignalDescriptor, numbered in the order first
+// seen. Signals carry the descriptor's id through the signal buffer instead of
+// their name, type and dims. Descriptors are only ever added, by the network
+// thread, and are published along with the first signal that refers to them.
+//
+// Senders using PACKET_VERSION_SIGNAL_IDS send the headers once, in dictionary
+// packets giving each signal a uint16 id, and ticks then carry only the ids. 
+// The dictionary maps each id to the descriptor for its header.
+
+/* distinct signal headers that can be described, ids are 0..MAX-1 */
+#define MAX_SIGNAL_DESCRIPTORS 65536
+#define SIGNAL_DESCRIPTOR_INDEX_BITS 17
+#define SIGNAL_DESCRIPTOR_INDEX_SIZE (1 << SIGNAL_DESCRIPTOR_INDEX_BITS)
+#define SIGNAL_DESCRIPTOR_INDEX_MASK (SIGNAL_DESCRIPTOR_INDEX_SIZE - 1)
+
+/* signal ids a dictionary can give out */
+#define SIGNAL_DICTIONARY_SIZE 65536
+
+/* tick layouts remembered, for models that alternate between a few */
+#define TICK_SCHEMA_CACHE_SIZE 8
+
+typedef struct SignalDescriptor {
+    uint32_t descId;
+
+    // the signal's header bytes as received, starting at the name length
+    const uint8_t* header;
+    uint32_t nHeaderBytes;
+
+    // decoded from header, name is null terminated
+    const char* name;
+    uint16_t lenName;
+    uint8_t dataTypeId;
+    uint8_t nDims;
+    uint16_t dims[MAX_SIGNAL_NDIMS];
+    uint32_t nBytes;
+} SignalDescriptor;
+
+// where each signal's header and data sit in a tick with this layout
+typedef struct TickSchema {
+    uint32_t nBytes;   // total bytes in the tick
+    uint32_t nSignals;
+    uint32_t capacitySignals;
+    uint32_t* descIds;
+    uint32_t* headerOffsets;
+    uint32_t* dataOffsets;
+    uint32_t lastUsed; // for picking which cached schema to replace
+} TickSchema;
+
+// the descriptors, dictionary and cached tick layouts of one stream of signals
+typedef struct SignalSchemas {
+    // only the network thread adds descriptors. Each is filled in before the 
+    // first signal referring to it is pushed, so the release store publishing
+    // that signal publishes the descriptor too
+    SignalDescriptor* descriptors[MAX_SIGNAL_DESCRIPTORS];
+    uint32_t nDescriptors;
+
+    // open addressing hash table of descriptors by header bytes, holding 1 + 
+    // the descId, or 0 where empty
+    uint32_t descriptorIndex[SIGNAL_DESCRIPTOR_INDEX_SIZE];
+
+    // 1 + the descId each signal id was last given by a dictionary, or 0
+    uint32_t dictionary[SIGNAL_DICTIONARY_SIZE];
+
+    TickSchema cache[TICK_SCHEMA_CACHE_SIZE];
+    uint32_t nCached;
+    uint32_t clock;
+    int iLastMatched;
+
+    // the sender is big endian: its name lengths, dims and signal ids are 
+    // swapped as they're decoded (and its data, by the caller)
+    bool swapBytes;
+} SignalSchemas;
+
+void initSignalSchemas(SignalSchemas*);
+void freeSignalSchemas(SignalSchemas*);
+
+bool decodeTickSchema(SignalSchemas*, const uint8_t* data, uint32_t nBytes, 
+        TickSchema* pschema, uint32_t* pBytesDecoded);
+const TickSchema* findTickSchema(SignalSchemas*, const uint8_t* data, uint32_t nBytes);
+const TickSchema* addTickSchema(SignalSchemas*, TickSchema* pschema);
+void freeTickSchema(TickSchema* pschema);
+
+bool decodeSignalDictionary(SignalSchemas*, const uint8_t* data, uint32_t nBytes,
+        uint32_t* pBytesDecoded);
+const SignalDescriptor* findDictionarySignal(const SignalSchemas*, uint16_t signalId);
+
+const SignalDescriptor* addLocalSignalDescriptor(SignalSchemas*, const char* name,
+        uint8_t dataTypeId, uint8_t nDims, const uint16_t* dims);
+const SignalDescriptor* getSignalDescriptor(const SignalSchemas*, uint32_t descId);
+void viewSignalDescriptor(const SignalDescriptor* pdesc, Signal* psig);
+
+#endif
@@ -0,0 +1,640 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "segment.h"
+#include "signalLogger.h"
+
+#define INITIAL_SEGMENT_NAME_INDEX_SIZE 256
+
+/// PRIVATE DECLARATIONS
+
+void appendToSegment(SegmentFile*, const uint8_t* data, size_t nBytes);
+void startSegmentBlock(SegmentAioBlock* pb, uint64_t fileOffset);
+void submitSegmentBlock(SegmentFile*, SegmentAioBlock* pb);
+bool reapSegmentBlock(SegmentAioBlock* pb, bool wait);
+uint64_t getSegmentBytesWritten(const SegmentFile*);
+void writeReadySegmentIndex(SegmentFile*);
+void writeAllToFd(int fd, const void* data, size_t nBytes, const char* errorMsg);
+uint32_t hashSegmentName(const char* name, uint32_t lenName);
+uint32_t findOrAddSegmentName(SegmentNameTable*, const char* name, uint16_t lenName);
+void growSegmentNameIndex(SegmentNameTable*);
+void clearSegmentNameTable(SegmentNameTable*);
+void appendSegmentIndexRecord(MatBuffer* pmb, uint32_t type, const void* payload,
+        uint32_t nPayloadBytes, const void* trailer, uint32_t nTrailerBytes);
+
+/////// SEGMENT FILE /////////
+
+void initSegmentFile(SegmentFile* pseg, int ioMode)
+{
+    memset(pseg, 0, sizeof(SegmentFile));
+    pseg->ioMode = ioMode;
+    pseg->fd = -1;
+    pseg->indexFd = -1;
+    initMatBuffer(&pseg->pendingIndex);
+
+    if(ioMode == SEGMENT_IO_BUFFERED)
+        return;
+
+    pseg->blocks = (SegmentAioBlock*)calloc(SEGMENT_AIO_BLOCKS, sizeof(SegmentAioBlock));
+    if(pseg->blocks == NULL)
+        diep("Error allocating segment blocks");
+    for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++) {
+        if(posix_memalign((void**)&pseg->blocks[i].data, SEGMENT_IO_ALIGN_BYTES,
+                    SEGMENT_AIO_BLOCK_BYTES) != 0)
+            diep("Error allocating segment blocks");
+    }
+}
+
+void freeSegmentFile(SegmentFile* pseg)
+{
+    closeSegment(pseg);
+    if(pseg->blocks != NULL) {
+        for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++)
+            free(pseg->blocks[i].data);
+        free(pseg->blocks);
+        pseg->blocks = NULL;
+    }
+    freeMatBuffer(&pseg->pendingIndex);
+}
+
+void openSegment(SegmentFile* pseg, const char* fileName, const char* indexFileName,
+        uint64_t preallocateBytes)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+    if(pseg->ioMode == SEGMENT_IO_DIRECT) {
+        pseg->fd = open(fileName, flags | O_DIRECT, mode);
+        if(pseg->fd == -1 && errno == EINVAL) {
+            // not every filesystem can do O_DIRECT, carry on through the page cache
+            perror("Warning: could not open segment file with O_DIRECT");
+            pseg->ioMode = SEGMENT_IO_AIO;
+        }
+    }
+    if(pseg->ioMode != SEGMENT_IO_DIRECT)
+        pseg->fd = open(fileName, flags, mode);
+    if(pseg->fd == -1)
+        diep("Error opening segment file");
+
+    // reserve the blocks for the whole segment up front so appending doesn't
+    // allocate as it goes. KEEP_SIZE leaves the file length alone, so the
+    // segment is always a valid MAT-file up to its last flush
+    if(preallocateBytes > 0 && fallocate(pseg->fd, FALLOC_FL_KEEP_SIZE, 0,
+                preallocateBytes) == -1 && errno != EOPNOTSUPP)
+        perror("Warning: could not preallocate segment file");
+
+    pseg->nBytes = 0;
+    if(pseg->blocks != NULL) {
+        pseg->iBlock = 0;
+        startSegmentBlock(pseg->blocks, 0);
+    }
+
+    MatBuffer header;
+    initMatBuffer(&header);
+    writeMatHeader(&header);
+    appendToSegment(pseg, header.data, header.nBytes);
+    freeMatBuffer(&header);
+
+    pseg->indexFd = open(indexFileName, flags, mode);
+    if(pseg->indexFd == -1)
+        diep("Error opening segment index file");
+
+    SegmentIndexHeader indexHeader;
+    memset(&indexHeader, 0, sizeof(indexHeader));
+    memcpy(indexHeader.magic, SEGMENT_INDEX_MAGIC, SEGMENT_INDEX_MAGIC_LENGTH);
+    indexHeader.version = SEGMENT_INDEX_VERSION;
+    writeAllToFd(pseg->indexFd, &indexHeader, sizeof(indexHeader),
+            "Error writing segment index file");
+}
+
+void closeSegment(SegmentFile* pseg)
+{
+    if(pseg->fd == -1)
+        return;
+
+    if(pseg->blocks != NULL) {
+        // write out the last block and wait for everything to land, then the
+        // index records that were waiting on it
+        SegmentAioBlock* pb = pseg->blocks + pseg->iBlock;
+        if(pb->nBytes > pb->nBytesSubmitted)
+            submitSegmentBlock(pseg, pb);
+        for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++)
+            reapSegmentBlock(pseg->blocks + i, 1);
+        writeReadySegmentIndex(pseg);
+    }
+
+    // give back whatever preallocated space wasn't used, along with any 
+    // O_DIRECT padding past the last flush
+    if(ftruncate(pseg->fd, pseg->nBytes) == -1)
+        perror("Warning: could not trim segment file");
+
+    close(pseg->fd);
+    close(pseg->indexFd);
+    pseg->fd = -1;
+    pseg->indexFd = -1;
+}
+
+// append one flush's variable to the segment, then its offset index records, 
+// which go after the data they point to
+void writeFlushToSegment(SegmentFile* pseg, const MatBuffer* pVar, const MatBuffer* pIndexRecords)
+{
+    appendToSegment(pseg, pVar->data, pVar->nBytes);
+
+    if(pseg->blocks == NULL) {
+        writeAllToFd(pseg->indexFd, pIndexRecords->data, pIndexRecords->nBytes,
+                "Error writing segment index file");
+        return;
+    }
+
+    // get the tail of the flush on its way too, rather than waiting for its block
+    // to fill. If the last write of this block hasn't finished, the next flush 
+    // will pick it up instead
+    SegmentAioBlock* pb = pseg->blocks + pseg->iBlock;
+    if(pb->nBytes > pb->nBytesSubmitted && reapSegmentBlock(pb, 0))
+        submitSegmentBlock(pseg, pb);
+
+    // the index records wait until the data they point to is written
+    if(pseg->nPendingFlushes == SEGMENT_AIO_MAX_PENDING_FLUSHES) {
+        for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++)
+            reapSegmentBlock(pseg->blocks + i, 1);
+        writeReadySegmentIndex(pseg);
+    }
+    appendMatBytes(&pseg->pendingIndex, pIndexRecords->data, pIndexRecords->nBytes);
+    pseg->pendingDataEnd[pseg->nPendingFlushes] = pseg->nBytes;
+    pseg->pendingIndexEnd[pseg->nPendingFlushes] = pseg->pendingIndex.nBytes;
+    pseg->nPendingFlushes++;
+
+    for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++)
+        reapSegmentBlock(pseg->blocks + i, 0);
+    writeReadySegmentIndex(pseg);
+}
+
+void appendToSegment(SegmentFile* pseg, const uint8_t* data, size_t nBytes)
+{
+    pseg->nBytes += nBytes;
+
+    if(pseg->blocks == NULL) {
+        writeAllToFd(pseg->fd, data, nBytes, "Error writing segment file");
+        return;
+    }
+
+    while(nBytes > 0) {
+        SegmentAioBlock* pb = pseg->blocks + pseg->iBlock;
+        size_t n = SEGMENT_AIO_BLOCK_BYTES - pb->nBytes;
+        if(n > nBytes)
+            n = nBytes;
+        memcpy(pb->data + pb->nBytes, data, n);
+        pb->nBytes += n;
+        data += n;
+        nBytes -= n;
+
+        if(pb->nBytes == SEGMENT_AIO_BLOCK_BYTES) {
+            // send the full block off and move on to the next, which may still 
+            // be on its way to disk from the last time round
+            submitSegmentBlock(pseg, pb);
+            pseg->iBlock = (pseg->iBlock + 1) % SEGMENT_AIO_BLOCKS;
+            SegmentAioBlock* pnext = pseg->blocks + pseg->iBlock;
+            reapSegmentBlock(pnext, 1);
+            startSegmentBlock(pnext, pb->fileOffset + SEGMENT_AIO_BLOCK_BYTES);
+        }
+    }
+}
+
+void startSegmentBlock(SegmentAioBlock* pb, uint64_t fileOffset)
+{
+    pb->fileOffset = fileOffset;
+    pb->nBytes = 0;
+    pb->nBytesSubmitted = 0;
+
+    // O_DIRECT writes of a partly filled block go out padded with these zeros
+    memset(pb->data, 0, SEGMENT_AIO_BLOCK_BYTES);
+}
+
+// start writing the block's staged bytes to the segment
+void submitSegmentBlock(SegmentFile* pseg, SegmentAioBlock* pb)
+{
+    // an earlier, shorter write of the same block could otherwise land after
+    // this one
+    reapSegmentBlock(pb, 1);
+
+    size_t nBytes = pb->nBytes;
+    if(pseg->ioMode == SEGMENT_IO_DIRECT)
+        nBytes = (nBytes + SEGMENT_IO_ALIGN_BYTES - 1) & ~(size_t)(SEGMENT_IO_ALIGN_BYTES - 1);
+
+    memset(&pb->cb, 0, sizeof(struct aiocb));
+    pb->cb.aio_fildes = pseg->fd;
+    pb->cb.aio_buf = pb->data;
+    pb->cb.aio_nbytes = nBytes;
+    pb->cb.aio_offset = pb->fileOffset;
+    pb->cb.aio_sigevent.sigev_notify = SIGEV_NONE;
+
+    if(aio_write(&pb->cb) == -1)
+        diep("Error writing segment file");
+    pb->inFlight = 1;
+    pb->nBytesSubmitted = pb->nBytes;
+}
+
+// check whether the block's last write has finished, waiting for it if wait is
+// set. Returns true once the block has no write in flight
+bool reapSegmentBlock(SegmentAioBlock* pb, bool wait)
+{
+    if(!pb->inFlight)
+        return 1;
+
+    int err;
+    while((err = aio_error(&pb->cb)) == EINPROGRESS) {
+        if(!wait)
+            return 0;
+        const struct aiocb* list[1] = { &pb->cb };
+        if(aio_suspend(list, 1, NULL) == -1 && errno != EINTR)
+            diep("Error waiting for segment write");
+    }
+
+    pb->inFlight = 0;
+    if(err != 0) {
+        errno = err;
+        diep("Error writing segment file");
+    }
+    if(aio_return(&pb->cb) != (ssize_t)pb->cb.aio_nbytes) {
+        fprintf(stderr, "Error writing segment file: short write\n");
+        exit(1);
+    }
+    return 1;
+}
+
+// bytes at the start of the segment that are known to be written: everything
+// before the first block with a write in flight, or else before whatever of the
+// current block hasn't been submitted
+uint64_t getSegmentBytesWritten(const SegmentFile* pseg)
+{
+    const SegmentAioBlock* pcur = pseg->blocks + pseg->iBlock;
+    uint64_t nBytes = pcur->fileOffset + pcur->nBytesSubmitted;
+
+    for(int i = 0; i < SEGMENT_AIO_BLOCKS; i++) {
+        const SegmentAioBlock* pb = pseg->blocks + i;
+        if(pb->inFlight && pb->fileOffset < nBytes)
+            nBytes = pb->fileOffset;
+    }
+    return nBytes;
+}
+
+// write out the index records of every pending flush whose data is now written
+void writeReadySegmentIndex(SegmentFile* pseg)
+{
+    uint64_t nBytesWritten = getSegmentBytesWritten(pseg);
+    uint32_t nReady = 0;
+    while(nReady < pseg->nPendingFlushes && pseg->pendingDataEnd[nReady] <= nBytesWritten)
+        nReady++;
+    if(nReady == 0)
+        return;
+
+    size_t nIndexBytes = pseg->pendingIndexEnd[nReady - 1];
+    writeAllToFd(pseg->indexFd, pseg->pendingIndex.data, nIndexBytes,
+            "Error writing segment index file");
+
+    // shuffle the flushes still waiting down to the front
+    pseg->nPendingFlushes -= nReady;
+    for(uint32_t i = 0; i < pseg->nPendingFlushes; i++) {
+        pseg->pendingDataEnd[i] = pseg->pendingDataEnd[nReady + i];
+        pseg->pendingIndexEnd[i] = pseg->pendingIndexEnd[nReady + i] - nIndexBytes;
+    }
+    memmove(pseg->pendingIndex.data, pseg->pendingIndex.data + nIndexBytes,
+            pseg->pendingIndex.nBytes - nIndexBytes);
+    pseg->pendingIndex.nBytes -= nIndexBytes;
+}
+
+void writeAllToFd(int fd, const void* data, size_t nBytes, const char* errorMsg)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    while(nBytes > 0) {
+        ssize_t n = write(fd, p, nBytes);
+        if(n == -1) {
+            if(errno == EINTR)
+                continue;
+            diep(errorMsg);
+        }
+        p += n;
+        nBytes -= n;
+    }
+}
+
+/////// INDEX BUILDER /////////
+
+void initSegmentIndexBuilder(SegmentIndexBuilder* pbuilder)
+{
+    memset(pbuilder, 0, sizeof(SegmentIndexBuilder));
+
+    pbuilder->names.indexSize = INITIAL_SEGMENT_NAME_INDEX_SIZE;
+    pbuilder->names.index = (uint32_t*)calloc(pbuilder->names.indexSize, sizeof(uint32_t));
+    if(pbuilder->names.index == NULL)
+        diep("Error allocating segment name index");
+}
+
+void freeSegmentIndexBuilder(SegmentIndexBuilder* pbuilder)
+{
+    clearSegmentNameTable(&pbuilder->names);
+    free(pbuilder->names.names);
+    free(pbuilder->names.lenNames);
+    free(pbuilder->names.lastFlush);
+    free(pbuilder->names.index);
+    free(pbuilder->flushNameIds);
+    memset(pbuilder, 0, sizeof(SegmentIndexBuilder));
+}
+
+// start the index entry for the next flush. Returns true if the flush should 
+// start a new segment, because this one is full, too old, or from an earlier day
+bool beginSegmentFlush(SegmentIndexBuilder* pbuilder, uint64_t maxBytes, int maxSeconds)
+{
+    time_t now = time(NULL);
+    bool rotate = !pbuilder->open || pbuilder->nBytes >= maxBytes ||
+        now - pbuilder->openTime >= maxSeconds;
+
+    if(!rotate) {
+        // segments live in a folder per day, so start a new one at midnight.
+        // The whole date is compared, the day of the month alone would miss a
+        // segment opened a month or more ago on the same day number
+        struct tm tmOpen, tmNow;
+        localtime_r(&pbuilder->openTime, &tmOpen);
+        localtime_r(&now, &tmNow);
+        rotate = tmOpen.tm_year != tmNow.tm_year || tmOpen.tm_yday != tmNow.tm_yday;
+    }
+
+    if(rotate) {
+        // name ids start over in each segment
+        clearSegmentNameTable(&pbuilder->names);
+        pbuilder->nNamesIndexed = 0;
+
+        pbuilder->open = 1;
+        pbuilder->nBytes = MAT_HEADER_BYTES;
+        pbuilder->openTime = now;
+        pbuilder->nFlushes = 0;
+    }
+
+    memset(&pbuilder->flush, 0, sizeof(SegmentIndexEntry));
+    pbuilder->flush.flushNumber = pbuilder->nFlushes;
+    pbuilder->flush.offset = pbuilder->nBytes;
+    return rotate;
+}
+
+// keep track of the timestamps and names going into this flush for its index entry
+void noteSignalInSegmentFlush(SegmentIndexBuilder* pbuilder, const Signal* psig)
+{
+    SegmentIndexEntry* pEntry = &pbuilder->flush;
+    if(pEntry->nSignals == 0 || psig->timestamp < pEntry->minTimestamp)
+        pEntry->minTimestamp = psig->timestamp;
+    if(pEntry->nSignals == 0 || psig->timestamp > pEntry->maxTimestamp)
+        pEntry->maxTimestamp = psig->timestamp;
+    pEntry->nSignals++;
+
+    uint32_t nameId = findOrAddSegmentName(&pbuilder->names, psig->name, psig->lenName);
+    if(pbuilder->names.lastFlush[nameId] == pEntry->flushNumber + 1)
+        return;
+
+    // first time this name is seen in this flush
+    pbuilder->names.lastFlush[nameId] = pEntry->flushNumber + 1;
+    if(pEntry->nNames == pbuilder->capacityFlushNameIds) {
+        pbuilder->capacityFlushNameIds = pbuilder->capacityFlushNameIds ?
+            2 * pbuilder->capacityFlushNameIds : 64;
+        pbuilder->flushNameIds = (uint32_t*)realloc(pbuilder->flushNameIds,
+                pbuilder->capacityFlushNameIds * sizeof(uint32_t));
+        if(pbuilder->flushNameIds == NULL)
+            diep("Error allocating segment flush names");
+    }
+    pbuilder->flushNameIds[pEntry->nNames++] = nameId;
+}
+
+// finish the flush's index entry now that its variable is nBytes long, and build
+// the index records for it, along with any names it introduced, in pIndexRecords
+void endSegmentFlush(SegmentIndexBuilder* pbuilder, uint32_t nBytes, MatBuffer* pIndexRecords)
+{
+    SegmentIndexEntry* pEntry = &pbuilder->flush;
+    pEntry->nBytes = nBytes;
+    pbuilder->nBytes += nBytes;
+    pbuilder->nFlushes++;
+
+    clearMatBuffer(pIndexRecords);
+    for(; pbuilder->nNamesIndexed < pbuilder->names.nNames; pbuilder->nNamesIndexed++) {
+        SegmentIndexName name;
+        name.nameId = pbuilder->nNamesIndexed;
+        name.lenName = pbuilder->names.lenNames[name.nameId];
+        appendSegmentIndexRecord(pIndexRecords, SEGMENT_RECORD_NAME,
+                &name, sizeof(name), pbuilder->names.names[name.nameId], name.lenName);
+    }
+    appendSegmentIndexRecord(pIndexRecords, SEGMENT_RECORD_FLUSH,
+            pEntry, sizeof(SegmentIndexEntry),
+            pbuilder->flushNameIds, pEntry->nNames * sizeof(uint32_t));
+}
+
+void appendSegmentIndexRecord(MatBuffer* pmb, uint32_t type, const void* payload,
+        uint32_t nPayloadBytes, const void* trailer, uint32_t nTrailerBytes)
+{
+    SegmentIndexRecord record;
+    record.type = type;
+    record.nBytes = sizeof(record) + nPayloadBytes + nTrailerBytes;
+    record.nBytes = (record.nBytes + 7) & ~7u;
+
+    appendMatBytes(pmb, &record, sizeof(record));
+    appendMatBytes(pmb, payload, nPayloadBytes);
+    appendMatBytes(pmb, trailer, nTrailerBytes);
+    padMatBuffer(pmb);
+}
+
+/////// NAME TABLE /////////
+
+// FNV-1a over the name
+uint32_t hashSegmentName(const char* name, uint32_t lenName)
+{
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < lenName; i++)
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    return hash;
+}
+
+uint32_t findOrAddSegmentName(SegmentNameTable* ptable, const char* name, uint16_t lenName)
+{
+    uint32_t mask = ptable->indexSize - 1;
+    uint32_t i = hashSegmentName(name, lenName) & mask;
+
+    while(ptable->index[i] != 0) {
+        uint32_t id = ptable->index[i] - 1;
+        if(ptable->lenNames[id] == lenName && memcmp(ptable->names[id], name, lenName) == 0)
+            return id;
+        i = (i + 1) & mask;
+    }
+
+    // not found, add it
+    if(ptable->nNames == ptable->capacityNames) {
+        ptable->capacityNames = ptable->capacityNames ? 2 * ptable->capacityNames : 64;
+        ptable->names = (char**)realloc(ptable->names, ptable->capacityNames * sizeof(char*));
+        ptable->lenNames = (uint16_t*)realloc(ptable->lenNames,
+                ptable->capacityNames * sizeof(uint16_t));
+        ptable->lastFlush = (uint32_t*)realloc(ptable->lastFlush,
+                ptable->capacityNames * sizeof(uint32_t));
+        if(ptable->names == NULL || ptable->lenNames == NULL || ptable->lastFlush == NULL)
+            diep("Error allocating segment names");
+    }
+
+    uint32_t id = ptable->nNames;
+    ptable->names[id] = (char*)malloc(lenName);
+    if(ptable->names[id] == NULL && lenName > 0)
+        diep("Error allocating segment name");
+    memcpy(ptable->names[id], name, lenName);
+    ptable->lenNames[id] = lenName;
+    ptable->lastFlush[id] = 0;
+
+    ptable->index[i] = ++ptable->nNames;
+    if(2 * ptable->nNames > ptable->indexSize)
+        growSegmentNameIndex(ptable);
+
+    return id;
+}
+
+// double the index and re-insert every name, keeping it at most half full
+void growSegmentNameIndex(SegmentNameTable* ptable)
+{
+    free(ptable->index);
+    ptable->indexSize *= 2;
+    ptable->index = (uint32_t*)calloc(ptable->indexSize, sizeof(uint32_t));
+    if(ptable->index == NULL)
+        diep("Error allocating segment name index");
+
+    for(uint32_t id = 0; id < ptable->nNames; id++) {
+        uint32_t i = hashSegmentName(ptable->names[id], ptable->lenNames[id]) &
+            (ptable->indexSize - 1);
+        while(ptable->index[i] != 0)
+            i = (i + 1) & (ptable->indexSize - 1);
+        ptable->index[i] = id + 1;
+    }
+}
+
+void clearSegmentNameTable(SegmentNameTable* ptable)
+{
+    for(uint32_t id = 0; id < ptable->nNames; id++)
+        free(ptable->names[id]);
+    ptable->nNames = 0;
+    if(ptable->index != NULL)
+        memset(ptable->index, 0, ptable->indexSize * sizeof(uint32_t));
+}
+
+/////// READING THE INDEX /////////
+
+// read a whole offset index into memory and find its names and flushes. A
+// record cut short at the end of the file (the logger died mid-write) is ignored
+bool readSegmentIndex(const char* indexFileName, SegmentIndex* pindex)
+{
+    memset(pindex, 0, sizeof(SegmentIndex));
+
+    FILE* fp = fopen(indexFileName, "rb");
+    if(fp == NULL)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    long nBytes = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(nBytes < (long)sizeof(SegmentIndexHeader)) {
+        fclose(fp);
+        return false;
+    }
+
+    pindex->data = (uint8_t*)malloc(nBytes);
+    if(pindex->data == NULL)
+        diep("Error allocating segment index");
+    pindex->nBytes = fread(pindex->data, 1, nBytes, fp);
+    fclose(fp);
+
+    const SegmentIndexHeader* pHeader = (const SegmentIndexHeader*)pindex->data;
+    if(pindex->nBytes != (size_t)nBytes ||
+            memcmp(pHeader->magic, SEGMENT_INDEX_MAGIC, SEGMENT_INDEX_MAGIC_LENGTH) != 0 ||
+            pHeader->version != SEGMENT_INDEX_VERSION) {
+        freeSegmentIndex(pindex);
+        return false;
+    }
+
+    // count the records on the first pass, fill in the arrays on the second
+    for(int pass = 0; pass < 2; pass++) {
+        uint32_t nNames = 0, nFlushes = 0;
+        size_t offset = sizeof(SegmentIndexHeader);
+        while(offset + sizeof(SegmentIndexRecord) <= pindex->nBytes) {
+            const SegmentIndexRecord* pRecord =
+                (const SegmentIndexRecord*)(pindex->data + offset);
+            if(pRecord->nBytes < sizeof(SegmentIndexRecord) ||
+                    pRecord->nBytes > pindex->nBytes - offset)
+                break;
+            const uint8_t* payload = (const uint8_t*)(pRecord + 1);
+            uint32_t nPayloadBytes = pRecord->nBytes - sizeof(SegmentIndexRecord);
+
+            if(pRecord->type == SEGMENT_RECORD_NAME &&
+                    nPayloadBytes >= sizeof(SegmentIndexName)) {
+                const SegmentIndexName* pName = (const SegmentIndexName*)payload;
+                if(pName->nameId != nNames ||
+                        pName->lenName > nPayloadBytes - sizeof(SegmentIndexName))
+                    break;
+                if(pass == 1) {
+                    pindex->names[nNames] = (const char*)(pName + 1);
+                    pindex->lenNames[nNames] = pName->lenName;
+                }
+                nNames++;
+
+            } else if(pRecord->type == SEGMENT_RECORD_FLUSH &&
+                    nPayloadBytes >= sizeof(SegmentIndexEntry)) {
+                const SegmentIndexEntry* pEntry = (const SegmentIndexEntry*)payload;
+                if(pEntry->nNames > (nPayloadBytes - sizeof(SegmentIndexEntry)) / sizeof(uint32_t))
+                    break;
+                if(pass == 1)
+                    pindex->flushes[nFlushes] = pEntry;
+                nFlushes++;
+            }
+
+            offset += pRecord->nBytes;
+        }
+
+        if(pass == 0) {
+            pindex->nNames = nNames;
+            pindex->nFlushes = nFlushes;
+            pindex->names = (const char**)malloc((nNames + 1) * sizeof(const char*));
+            pindex->lenNames = (uint32_t*)malloc((nNames + 1) * sizeof(uint32_t));
+            pindex->flushes = (const SegmentIndexEntry**)malloc(
+                    (nFlushes + 1) * sizeof(const SegmentIndexEntry*));
+            if(pindex->names == NULL || pindex->lenNames == NULL || pindex->flushes == NULL)
+                diep("Error allocating segment index");
+        }
+    }
+
+    return true;
+}
+
+void freeSegmentIndex(SegmentIndex* pindex)
+{
+    free(pindex->data);
+    free(pindex->names);
+    free(pindex->lenNames);
+    free(pindex->flushes);
+    memset(pindex, 0, sizeof(SegmentIndex));
+}
+
+// returns the id of name in this segment, or -1 if it was never logged there
+int findSegmentIndexName(const SegmentIndex* pindex, const char* name, uint32_t lenName)
+{
+    for(uint32_t id = 0; id < pindex->nNames; id++)
+        if(pindex->lenNames[id] == lenName && memcmp(pindex->names[id], name, lenName) == 0)
+            return id;
+    return -1;
+}
+
+bool segmentFlushHasName(const SegmentIndexEntry* pEntry, uint32_t nameId)
+{
+    const uint32_t* nameIds = (const uint32_t*)(pEntry + 1);
+    for(uint32_t i = 0; i < pEntry->nNames; i++)
+        if(nameIds[i] == nameId)
+            return true;
+    return false;
+}
@@ -0,0 +1,183 @@
+#ifndef SEGMENT_H_INCLUDED
+#define SEGMENT_H_INCLUDED
+
+#include <inttypes.h>
+#include <time.h>
+#include <aio.h>
+#include "signal.h"
+#include "matfile.h"
+
+// Each flush of the signal buffer is appended to the open segment file as its
+// own variable signals_NNNNNN, so a segment is an ordinary MAT-file that loads
+// in MATLAB. A segment is rotated once it reaches a size or age limit, or the
+// day changes.
+//
+// Alongside each segment signal.YYYYMMDD.HHMMSS.mmm.mat is an offset index
+// signal.YYYYMMDD.HHMMSS.mmm.idx: a SegmentIndexHeader followed by records,
+// each a SegmentIndexRecord then its payload, padded to 8 bytes:
+//
+//   SEGMENT_RECORD_NAME  : a SegmentIndexName then the name's chars, giving the
+//                          next name id in this segment, starting from 0
+//   SEGMENT_RECORD_FLUSH : a SegmentIndexEntry then entry.nNames uint32 ids of
+//                          the signal names present in the flush
+//
+// A name record always comes before the first flush that uses it, and readers
+// skip record types they don't know. Values are in host (little-endian) byte
+// order. Both files are only ever appended to, so everything up to the last
+// flush stays readable if the logger dies.
+//
+// With AIO the last partly filled block is rewritten in place as it fills, and
+// under O_DIRECT those writes are rounded up to SEGMENT_IO_ALIGN_BYTES, so an
+// open segment may end in zeros past its last flush. The index only ever
+// points at data already written, and the file is trimmed when it's closed.
+
+#define DEFAULT_SEGMENT_MAX_BYTES (256*1024*1024)
+#define DEFAULT_SEGMENT_MAX_SECONDS (10*60)
+
+/* how segment data reaches the disk, chosen at startup */
+#define SEGMENT_IO_BUFFERED 0 // write() through the page cache
+#define SEGMENT_IO_AIO 1      // POSIX AIO, several large writes in flight
+#define SEGMENT_IO_DIRECT 2   // POSIX AIO with O_DIRECT, bypassing the page cache
+
+/* with AIO the segment is staged in blocks this size, each written once full */
+#define SEGMENT_AIO_BLOCK_BYTES (4*1024*1024)
+#define SEGMENT_AIO_BLOCKS 4
+/* O_DIRECT offsets, lengths and buffers are multiples of this */
+#define SEGMENT_IO_ALIGN_BYTES 4096
+/* flushes whose index records may wait on their data being written */
+#define SEGMENT_AIO_MAX_PENDING_FLUSHES 256
+
+#define SEGMENT_VAR_NAME_FORMAT "signals_%06u"
+#define SEGMENT_INDEX_MAGIC "SIGIDX\r\n"
+#define SEGMENT_INDEX_MAGIC_LENGTH 8
+#define SEGMENT_INDEX_VERSION 2
+
+#define SEGMENT_RECORD_NAME 1
+#define SEGMENT_RECORD_FLUSH 2
+
+typedef struct SegmentIndexHeader {
+    char magic[SEGMENT_INDEX_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t reserved;
+} SegmentIndexHeader;
+
+typedef struct SegmentIndexRecord {
+    uint32_t type;
+    uint32_t nBytes; // including this header and the padding
+} SegmentIndexRecord;
+
+typedef struct SegmentIndexName {
+    uint32_t nameId;
+    uint32_t lenName;
+} SegmentIndexName;
+
+typedef struct SegmentIndexEntry {
+    uint64_t offset;       // byte offset of the flush's variable in the segment
+    uint32_t nBytes;       // length of the variable including its tag
+    uint32_t flushNumber;  // the variable is named signals_<flushNumber>
+    uint32_t nSignals;     // samples written in this flush
+    uint32_t minTimestamp;
+    uint32_t maxTimestamp;
+    uint32_t nNames;       // number of name ids following the entry
+} SegmentIndexEntry;
+
+// the signal names seen in a segment, each given the next id. index is an open
+// addressing hash table holding 1 + the name id, or 0 where empty
+typedef struct SegmentNameTable {
+    char** names;
+    uint16_t* lenNames;
+    uint32_t* lastFlush; // 1 + the last flush number the name was seen in
+    uint32_t nNames;
+    uint32_t capacityNames;
+
+    uint32_t* index;
+    uint32_t indexSize; // a power of 2
+} SegmentNameTable;
+
+// one block of a segment staged in memory for AIO. Blocks tile the segment in
+// file order, so each starts on an aligned offset
+typedef struct SegmentAioBlock {
+    struct aiocb cb;
+    uint8_t* data;            // SEGMENT_AIO_BLOCK_BYTES, aligned for O_DIRECT
+    uint64_t fileOffset;      // where data[0] goes in the segment
+    uint32_t nBytes;          // bytes staged so far
+    uint32_t nBytesSubmitted; // bytes covered by the last write submitted
+    bool inFlight;
+} SegmentAioBlock;
+
+// the segment being written to disk
+typedef struct SegmentFile {
+    int ioMode;
+
+    // the segment and its offset index, -1 when none is open
+    int fd;
+    int indexFd;
+
+    // bytes written to the segment so far
+    uint64_t nBytes;
+
+    // AIO only: the blocks are filled in turn, a full block is submitted and 
+    // the next one taken, waiting for its last write if it is still in flight
+    SegmentAioBlock* blocks;
+    int iBlock;
+
+    // AIO only: an index record mustn't reach the disk before the data it 
+    // points to, so each flush's records wait here until the segment has been 
+    // written up to pendingDataEnd
+    MatBuffer pendingIndex;
+    uint32_t nPendingFlushes;
+    uint64_t pendingDataEnd[SEGMENT_AIO_MAX_PENDING_FLUSHES];
+    size_t pendingIndexEnd[SEGMENT_AIO_MAX_PENDING_FLUSHES];
+} SegmentFile;
+
+// decides which segment each flush goes in and where, and builds its index 
+// records, ahead of the flush being written. Mirrors the SegmentFile the flushes
+// are later written to
+typedef struct SegmentIndexBuilder {
+    bool open;
+    uint64_t nBytes;
+    time_t openTime;
+    uint32_t nFlushes;
+
+    SegmentNameTable names;
+    uint32_t nNamesIndexed; // names already in the offset index
+
+    // the flush being built: its index entry and the ids of the names in it
+    SegmentIndexEntry flush;
+    uint32_t* flushNameIds;
+    uint32_t capacityFlushNameIds;
+} SegmentIndexBuilder;
+
+void initSegmentFile(SegmentFile*, int ioMode);
+void freeSegmentFile(SegmentFile*);
+void openSegment(SegmentFile*, const char* fileName, const char* indexFileName,
+        uint64_t preallocateBytes);
+void closeSegment(SegmentFile*);
+void writeFlushToSegment(SegmentFile*, const MatBuffer* pVar, const MatBuffer* pIndexRecords);
+
+void initSegmentIndexBuilder(SegmentIndexBuilder*);
+void freeSegmentIndexBuilder(SegmentIndexBuilder*);
+bool beginSegmentFlush(SegmentIndexBuilder*, uint64_t maxBytes, int maxSeconds);
+void noteSignalInSegmentFlush(SegmentIndexBuilder*, const Signal*);
+void endSegmentFlush(SegmentIndexBuilder*, uint32_t nBytes, MatBuffer* pIndexRecords);
+
+// a segment's offset index read back into memory. names and flushes point into
+// data, names are not NUL terminated
+typedef struct SegmentIndex {
+    uint8_t* data;
+    size_t nBytes;
+
+    uint32_t nNames;
+    const char** names;
+    uint32_t* lenNames;
+
+    uint32_t nFlushes;
+    const SegmentIndexEntry** flushes;
+} SegmentIndex;
+
+bool readSegmentIndex(const char* indexFileName, SegmentIndex*);
+void freeSegmentIndex(SegmentIndex*);
+int findSegmentIndexName(const SegmentIndex*, const char* name, uint32_t lenName);
+bool segmentFlushHasName(const SegmentIndexEntry*, uint32_t nameId);
+
+#endif
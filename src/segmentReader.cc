@@ -0,0 +1,327 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "matread.h"
+#include "segment.h"
+#include "segmentReader.h"
+#include "signalLogger.h"
+
+/// PRIVATE DECLARATIONS
+void scanSegmentFlushes(SegmentReader*);
+bool openNextQueryFlush(SegmentQuery*);
+bool findNextQueryElement(SegmentQuery*);
+bool makeElementView(const MatArray* pTimestamp, const MatArray* pData, SegmentSignalView*);
+bool nextViewInElement(SegmentQuery*, SegmentSignalView*);
+
+/////// OPENING SEGMENTS /////////
+
+// map the segment fileName and read its offset index, returning false if it
+// isn't there or is too short to be a MAT-file
+bool openSegmentReader(SegmentReader* preader, const char* fileName)
+{
+    memset(preader, 0, sizeof(SegmentReader));
+    initMatBuffer(&preader->flushBuffer);
+    initMatBuffer(&preader->inflatedBuffer);
+
+    int fd = open(fileName, O_RDONLY);
+    if(fd == -1)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < MAT_HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    void* pmap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmap == MAP_FAILED)
+        return false;
+    preader->data = (const uint8_t*)pmap;
+    preader->nBytes = st.st_size;
+
+    // only the pages of the flushes asked for should be read in
+    madvise(pmap, preader->nBytes, MADV_RANDOM);
+
+    // signal.YYYYMMDD.HHMMSS.mmm.mat --> signal.YYYYMMDD.HHMMSS.mmm.idx
+    char indexFileName[MAX_FILENAME_LENGTH];
+    size_t len = strlen(fileName);
+    if(len >= 4 && strcmp(fileName + len - 4, ".mat") == 0) {
+        snprintf(indexFileName, MAX_FILENAME_LENGTH, "%.*s.idx", (int)(len - 4), fileName);
+        preader->indexed = readSegmentIndex(indexFileName, &preader->index);
+    }
+
+    if(preader->indexed) {
+        preader->nFlushes = preader->index.nFlushes;
+        preader->flushes = preader->index.flushes;
+    } else {
+        scanSegmentFlushes(preader);
+    }
+    return true;
+}
+
+void closeSegmentReader(SegmentReader* preader)
+{
+    if(preader->data != NULL)
+        munmap((void*)preader->data, preader->nBytes);
+    if(preader->indexed)
+        freeSegmentIndex(&preader->index);
+    else
+        free(preader->flushes);
+    free(preader->scannedFlushes);
+    freeMatBuffer(&preader->flushBuffer);
+    freeMatBuffer(&preader->inflatedBuffer);
+    memset(preader, 0, sizeof(SegmentReader));
+}
+
+// without an index, find each variable from the one before's tag. They're
+// numbered in file order, and could hold any name or timestamp. An open
+// segment may end in zeros, which aren't a variable
+void scanSegmentFlushes(SegmentReader* preader)
+{
+    uint32_t capacityFlushes = 0;
+    const uint8_t* p = preader->data + MAT_HEADER_BYTES;
+    const uint8_t* end = preader->data + preader->nBytes;
+    while(p < end) {
+        const uint8_t* pVar = p;
+        MatElement el;
+        if(!readMatElement(&p, end, &el) ||
+                (el.miType != miMATRIX && el.miType != miCOMPRESSED))
+            break;
+
+        if(preader->nFlushes == capacityFlushes) {
+            capacityFlushes = capacityFlushes ? 2 * capacityFlushes : 64;
+            preader->scannedFlushes = (SegmentIndexEntry*)realloc(preader->scannedFlushes,
+                    capacityFlushes * sizeof(SegmentIndexEntry));
+            if(preader->scannedFlushes == NULL)
+                diep("Error allocating segment flushes");
+        }
+
+        SegmentIndexEntry* pEntry = preader->scannedFlushes + preader->nFlushes;
+        memset(pEntry, 0, sizeof(SegmentIndexEntry));
+        pEntry->offset = pVar - preader->data;
+        pEntry->nBytes = el.data + el.nBytes - pVar;
+        pEntry->flushNumber = preader->nFlushes;
+        pEntry->maxTimestamp = UINT32_MAX;
+        preader->nFlushes++;
+    }
+
+    preader->flushes = (const SegmentIndexEntry**)malloc(
+            (preader->nFlushes + 1) * sizeof(const SegmentIndexEntry*));
+    if(preader->flushes == NULL)
+        diep("Error allocating segment flushes");
+    for(uint32_t i = 0; i < preader->nFlushes; i++)
+        preader->flushes[i] = preader->scannedFlushes + i;
+}
+
+/////// QUERIES /////////
+
+// look for the samples of name with tStart <= timestamp <= tEnd
+void beginSegmentQuery(SegmentQuery* pq, SegmentReader* preader, const char* name,
+        uint32_t tStart, uint32_t tEnd)
+{
+    memset(pq, 0, sizeof(SegmentQuery));
+    pq->preader = preader;
+    pq->name = name;
+    pq->lenName = strlen(name);
+    pq->tStart = tStart;
+    pq->tEnd = tEnd;
+
+    pq->nameId = -1;
+    if(preader->indexed) {
+        pq->nameId = findSegmentIndexName(&preader->index, name, pq->lenName);
+        if(pq->nameId < 0) {
+            // never logged in this segment
+            preader->nFlushesSkipped += preader->nFlushes;
+            pq->iFlush = preader->nFlushes;
+        }
+    }
+}
+
+// fill in the next run of samples found, returning false once there are no more
+bool nextSegmentSignalView(SegmentQuery* pq, SegmentSignalView* pview)
+{
+    while(true) {
+        if(pq->inElement) {
+            if(nextViewInElement(pq, pview))
+                return true;
+            pq->inElement = false;
+        }
+
+        if(pq->inFlush) {
+            if(findNextQueryElement(pq)) {
+                pq->inElement = true;
+                pq->iSample = 0;
+                continue;
+            }
+            pq->inFlush = false;
+        }
+
+        if(!openNextQueryFlush(pq))
+            return false;
+    }
+}
+
+// move on to the next flush the index says may hold the signal in the range
+bool openNextQueryFlush(SegmentQuery* pq)
+{
+    SegmentReader* preader = pq->preader;
+    for(; pq->iFlush < preader->nFlushes; pq->iFlush++) {
+        const SegmentIndexEntry* pEntry = preader->flushes[pq->iFlush];
+        if(preader->indexed && (pEntry->maxTimestamp < pq->tStart ||
+                    pEntry->minTimestamp > pq->tEnd ||
+                    !segmentFlushHasName(pEntry, pq->nameId))) {
+            preader->nFlushesSkipped++;
+            continue;
+        }
+
+        // the index may have been written after the segment was mapped
+        if(pEntry->offset > preader->nBytes || pEntry->nBytes < 2 * sizeof(uint32_t) ||
+                pEntry->nBytes > preader->nBytes - pEntry->offset) {
+            preader->nFlushesBad++;
+            continue;
+        }
+
+        // elements within a variable are aligned to 8 bytes relative to its
+        // start, so views can point at them. Compressed variables aren't padded,
+        // so one that follows them is copied to an aligned buffer first (one
+        // that's compressed itself is inflated into one anyway)
+        const uint8_t* p = preader->data + pEntry->offset;
+        uint32_t miType;
+        memcpy(&miType, p, sizeof(uint32_t));
+        if((pEntry->offset & 7) != 0 && miType != miCOMPRESSED) {
+            clearMatBuffer(&preader->flushBuffer);
+            appendMatBytes(&preader->flushBuffer, p, pEntry->nBytes);
+            p = preader->flushBuffer.data;
+        }
+
+        if(!readMatVariable(&p, p + pEntry->nBytes, &preader->inflatedBuffer, &pq->var) ||
+                pq->var.mxClass != mxSTRUCT_CLASS || pq->var.nFields > 3 ||
+                (pq->fName = findMatField(&pq->var, "name")) < 0 ||
+                (pq->fTimestamp = findMatField(&pq->var, "timestamp")) < 0 ||
+                (pq->fData = findMatField(&pq->var, "data")) < 0) {
+            preader->nFlushesBad++;
+            continue;
+        }
+        preader->nFlushesRead++;
+
+        pq->inFlush = true;
+        pq->wholeFlush = preader->indexed && pEntry->minTimestamp >= pq->tStart &&
+            pEntry->maxTimestamp <= pq->tEnd;
+        pq->p = pq->var.fieldData;
+        pq->iElement = 0;
+        pq->numel = getMatArrayNumel(&pq->var);
+        pq->element.flushNumber = pEntry->flushNumber;
+        pq->iFlush++;
+        return true;
+    }
+    return false;
+}
+
+// move on to the flush's next element holding the signal. Only the name's chars
+// and the tags of the other fields are read to get past an element, the rest
+// is never touched
+bool findNextQueryElement(SegmentQuery* pq)
+{
+    while(pq->iElement < pq->numel) {
+        MatArray fields[3];
+        for(int f = 0; f < pq->var.nFields; f++)
+            if(!readMatArray(&pq->p, pq->var.end, fields + f)) {
+                pq->iElement = pq->numel;
+                pq->preader->nFlushesBad++;
+                return false;
+            }
+        pq->iElement++;
+
+        if(matCharArrayEquals(fields + pq->fName, pq->name, pq->lenName) &&
+                makeElementView(fields + pq->fTimestamp, fields + pq->fData, &pq->element))
+            return true;
+    }
+    return false;
+}
+
+// a view of every sample in an element of a flush, whichever format it was
+// written in (see collectFlushSignals in matread.cc)
+bool makeElementView(const MatArray* pTimestamp, const MatArray* pData, SegmentSignalView* pview)
+{
+    if(pTimestamp->mxClass != mxUINT32_CLASS || pTimestamp->real.miType != miUINT32)
+        return false;
+
+    uint32_t nSamples = getMatArrayNumel(pTimestamp);
+    uint32_t numel = getMatArrayNumel(pData);
+    if(nSamples == 0 || numel % nSamples != 0)
+        return false;
+
+    switch(pData->mxClass) {
+        case mxDOUBLE_CLASS: case mxSINGLE_CLASS: case mxINT8_CLASS: case mxUINT8_CLASS:
+        case mxINT16_CLASS: case mxUINT16_CLASS: case mxINT32_CLASS: case mxUINT32_CLASS:
+        case mxCHAR_CLASS:
+            break;
+        default:
+            return false;
+    }
+    pview->dataTypeId = convertMxClassIdToDataTypeId(pData->mxClass);
+    pview->elemBytes = pData->mxClass == mxCHAR_CLASS && pData->real.miType == miUINT16 ?
+        sizeof(uint16_t) : getSizeOfDataTypeId(pview->dataTypeId);
+    if(pData->real.nBytes != (size_t)numel * pview->elemBytes)
+        return false;
+
+    // only the non-singleton dims of each sample are kept, as when the samples
+    // are collected into columns
+    pview->nDims = 0;
+    for(int i = nSamples > 1 ? 1 : 0; i < pData->nDims; i++)
+        if(pData->dims[i] != 1 && pview->nDims < MAX_SIGNAL_NDIMS)
+            pview->dims[pview->nDims++] = pData->dims[i];
+
+    pview->nSamples = nSamples;
+    pview->nElements = numel / nSamples;
+    pview->stride = nSamples;
+    pview->timestamps = (const uint32_t*)pTimestamp->real.data;
+    pview->data = pData->real.data;
+
+    return ((uintptr_t)pview->timestamps % sizeof(uint32_t)) == 0 &&
+        ((uintptr_t)pview->data % pview->elemBytes) == 0;
+}
+
+// the next run of the element's samples in the range. Samples are usually in
+// timestamp order, but needn't be, so a run ends at the first one outside it
+bool nextViewInElement(SegmentQuery* pq, SegmentSignalView* pview)
+{
+    const SegmentSignalView* pel = &pq->element;
+    uint32_t first, last;
+    if(pq->wholeFlush) {
+        if(pq->iSample > 0)
+            return false;
+        first = 0;
+        last = pel->nSamples;
+    } else {
+        first = pq->iSample;
+        while(first < pel->nSamples && (pel->timestamps[first] < pq->tStart ||
+                    pel->timestamps[first] > pq->tEnd))
+            first++;
+        if(first == pel->nSamples) {
+            pq->iSample = first;
+            return false;
+        }
+        last = first + 1;
+        while(last < pel->nSamples && pel->timestamps[last] >= pq->tStart &&
+                pel->timestamps[last] <= pq->tEnd)
+            last++;
+    }
+    pq->iSample = last;
+
+    *pview = *pel;
+    pview->nSamples = last - first;
+    pview->timestamps += first;
+    if(pview->data != NULL)
+        pview->data += (size_t)first * pview->elemBytes;
+    return true;
+}
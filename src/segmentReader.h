@@ -0,0 +1,111 @@
+#ifndef SEGMENTREADER_H_INCLUDED
+#define SEGMENTREADER_H_INCLUDED
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "signal.h"
+#include "matfile.h"
+#include "matread.h"
+#include "segment.h"
+
+// Reads one signal at a time back out of the segments written by signalLogger,
+// without loading them whole. The segment is mmapped, and its offset index (see
+// segment.h) says which flushes hold the signal and what timestamps they span,
+// so only those flushes are looked at. Within a flush, each element's name and
+// the tags of its fields are read to find the signal, and the data of every
+// other signal is never touched. The mapping is marked for random access so the
+// kernel doesn't read ahead into pages nobody asked for.
+//
+// The samples found are handed back as views pointing straight into the
+// mapping, nothing is copied. A flush compressed with -z has to be inflated
+// first, so views of it point into the reader's own buffer instead, and only
+// last until the query moves on to the next flush.
+//
+// A .mat without a readable .idx beside it, such as one written before the
+// index existed, can still be read: its variables are found by walking their
+// tags, and every one is searched for the signal.
+
+// the data element e of sample s of a view, as type
+#define SEGMENT_VIEW_ELEMENT(type, pview, s, e) \
+    (((const type*)(pview)->data)[(s) + (size_t)(e) * (pview)->stride])
+
+// a run of samples of one signal in one flush, all in the query's range.
+// timestamps and data are aligned for their types
+typedef struct SegmentSignalView {
+    uint32_t flushNumber;
+    uint32_t nSamples;
+    const uint32_t* timestamps;
+
+    // the data as stored: chars are stored as UTF-16, and written with -W
+    // everything else is stored as double
+    uint8_t dataTypeId;
+    uint8_t elemBytes;
+    uint8_t nDims;
+    uint16_t dims[MAX_SIGNAL_NDIMS];
+    uint32_t nElements; // per sample
+
+    // samples run down the first dimension as in the columns format, so
+    // element e of sample s is at data + (s + e * stride) * elemBytes
+    const uint8_t* data;
+    uint32_t stride;
+} SegmentSignalView;
+
+// an open segment
+typedef struct SegmentReader {
+    const uint8_t* data;
+    size_t nBytes;
+
+    // the flushes, from the offset index if there is one, otherwise found by
+    // walking the file, with no timestamps or names
+    bool indexed;
+    SegmentIndex index;
+    uint32_t nFlushes;
+    const SegmentIndexEntry** flushes;
+    SegmentIndexEntry* scannedFlushes;
+
+    // compressed flushes are inflated here, and misaligned ones copied
+    MatBuffer flushBuffer;
+    MatBuffer inflatedBuffer;
+
+    // over the life of the reader
+    uint32_t nFlushesRead;
+    uint32_t nFlushesSkipped;
+    uint32_t nFlushesBad; // past the end of the file, or couldn't be parsed
+} SegmentReader;
+
+// a signal being pulled out of a segment one view at a time
+typedef struct SegmentQuery {
+    SegmentReader* preader;
+    const char* name;
+    uint32_t lenName;
+    uint32_t tStart;
+    uint32_t tEnd;
+    int nameId; // -1 when the segment has no index to look it up in
+
+    // the next flush to look in
+    uint32_t iFlush;
+
+    // the flush being searched, and its next element. Every sample of a flush
+    // wholly inside the range is in it, so its timestamps needn't be checked
+    bool inFlush;
+    bool wholeFlush;
+    MatArray var;
+    const uint8_t* p;
+    uint32_t iElement;
+    uint32_t numel;
+    int fName, fTimestamp, fData;
+
+    // the element holding the signal, and its next sample to look at
+    bool inElement;
+    SegmentSignalView element;
+    uint32_t iSample;
+} SegmentQuery;
+
+bool openSegmentReader(SegmentReader*, const char* fileName);
+void closeSegmentReader(SegmentReader*);
+
+void beginSegmentQuery(SegmentQuery*, SegmentReader*, const char* name, uint32_t tStart,
+        uint32_t tEnd);
+bool nextSegmentSignalView(SegmentQuery*, SegmentSignalView*);
+
+#endif
@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "mat.h"
 
 #include "signal.h"
 #include "signalLogger.h"
@@ -14,7 +13,7 @@ const char* dataTypeIdNames[] = {"double", "single", "int8", "uint8",
 
 const char * getDataTypeIdName(uint8_t dataTypeId)
 {
-    if(dataTypeId < 0 || dataTypeId > 7)
+    if(dataTypeId > DTID_CHAR)
         diep("Invalid data type Id");
 
     return dataTypeIdNames[dataTypeId];
@@ -33,6 +32,7 @@ uint8_t getSizeOfDataTypeId(uint8_t dataTypeId)
 
         case DTID_INT8: // int8
         case DTID_UINT8: // uint8
+        case DTID_CHAR: // char
             return 1;
 
         case DTID_INT16: // int16
@@ -46,46 +46,59 @@ uint8_t getSizeOfDataTypeId(uint8_t dataTypeId)
     return 0;
 }
 
-int getNumBytesForSignalData(const Signal* psig)
+// in 64 bits, as a header off the wire can have dims multiplying out past 32
+uint64_t getNumBytesForSignalData(const Signal* psig)
 {
-    int nBytes = getSizeOfDataTypeId(psig->dataTypeId);
+    uint64_t nBytes = getSizeOfDataTypeId(psig->dataTypeId);
     for(int idim = 0; idim < psig->nDims; idim++) 
         nBytes *= psig->dims[idim];
 
     return nBytes;
 }
 
-Packet parsePacket(uint8_t* rawPacket, int bytesRead)
+// parse the PACKET_HEADER_LENGTH bytes at rawHeader into *pp. The remaining
+// bytesRead - PACKET_HEADER_LENGTH bytes of the datagram were received at rawData 
+// and are not copied. With swapBytes the header is big endian. Returns false if 
+// the header is invalid.
+bool parsePacket(const uint8_t* rawHeader, uint8_t* rawData, int bytesRead, bool swapBytes, 
+        Packet* pp)
 {
-    Packet p;
+    if (bytesRead < PACKET_HEADER_LENGTH)
+        return 0;
 
-    if (bytesRead < 8)
-        diep("Packet too short!");
-
-    uint8_t* pBuf = rawPacket;
+    const uint8_t* pBuf = rawHeader;
 
     // store the packet version
-    STORE_UINT16(pBuf, p.packetVersion);
+    STORE_UINT16(pBuf, pp->packetVersion);
 
     // store the timestamp
-    STORE_UINT32(pBuf, p.timestamp);
+    STORE_UINT32(pBuf, pp->timestamp);
 
     // store the number of packets
-    STORE_UINT16(pBuf, p.numPackets);
+    STORE_UINT16(pBuf, pp->numPackets);
 
     // store the 1-indexed packet number
-    STORE_UINT16(pBuf, p.idxPacket);
+    STORE_UINT16(pBuf, pp->idxPacket);
+
+    if(swapBytes) {
+        pp->packetVersion = __builtin_bswap16(pp->packetVersion);
+        pp->timestamp = __builtin_bswap32(pp->timestamp);
+        pp->numPackets = __builtin_bswap16(pp->numPackets);
+        pp->idxPacket = __builtin_bswap16(pp->idxPacket);
+    }
+
+    if (pp->numPackets > MAX_PACKETS_PER_TICK || pp->idxPacket < 1 || 
+            pp->idxPacket > pp->numPackets)
+        return 0;
 
     // convert this to 0-indexed
-    p.idxPacket--;
+    pp->idxPacket--;
 
-    // compute the data length in this packet
-    p.rawLength = bytesRead - (pBuf - rawPacket);
-    
-    // copy the raw data into the data buffer
-    STORE_UINT8_ARRAY(pBuf, p.rawData, p.rawLength);
+    // point at the data in this packet
+    pp->rawData = rawData;
+    pp->rawLength = bytesRead - PACKET_HEADER_LENGTH;
 
-    return p;
+    return 1;
 }
 
 void printPacket(const Packet* pp)
@@ -98,7 +111,7 @@ void printSignal(const Signal* psig)
 {
     int nElements = 1;
 
-    printf("%d : %10s [", psig->timestamp, psig->name);
+    printf("%d : %10.*s [", psig->timestamp, (int)psig->lenName, psig->name);
     
     if (psig->nDims == 1) {
         printf("%4d x %4d", (int)psig->dims[0], 1);
@@ -113,7 +126,7 @@ void printSignal(const Signal* psig)
     }
     printf(" %6s ] : ", getDataTypeIdName(psig->dataTypeId));
 
-    printf("%s ", (char*)psig->data);
+    printf("%.*s ", (int)psig->nBytes, (const char*)psig->data);
     /*
     for(int i = 0; i < nElements; i++) {
         printf("%d ", (int)psig->data[i]);
@@ -5,12 +5,25 @@
 
 /* packet maxima */
 #define MAX_PACKET_LENGTH 1500
+#define PACKET_HEADER_LENGTH 10
+#define MAX_PACKET_DATA_LENGTH (MAX_PACKET_LENGTH - PACKET_HEADER_LENGTH)
 #define MAX_PACKETS_PER_TICK 20 
-#define MAX_DATA_SIZE_PER_TICK (MAX_PACKETS_PER_TICK * MAX_PACKET_LENGTH)
+#define MAX_DATA_SIZE_PER_TICK (MAX_PACKETS_PER_TICK * MAX_PACKET_DATA_LENGTH)
+
+/* packetVersion, says what a tick's reassembled data holds: */
+// each signal's header (uint16 lenName, name, uint8 dataTypeId, uint8 nDims, 
+// uint16 dims[nDims]) followed by its data. Any version not listed below is 
+// treated this way too
+#define PACKET_VERSION_SIGNAL_NAMES 1
+// each signal's uint16 signal id followed by its data, the id having been given
+// a header by an earlier dictionary
+#define PACKET_VERSION_SIGNAL_IDS 2
+// a dictionary: each signal's uint16 signal id followed by its header. A sender
+// too big for one tick can send its dictionary as several, with different
+// timestamps, and should resend it every so often so the logger can join late
+#define PACKET_VERSION_DICTIONARY 3
 
 /* Signal maxima */
-#define MAX_SIGNAL_NAME 200
-#define MAX_SIGNAL_SIZE 10000 
 #define MAX_SIGNAL_NDIMS 10
 
 #define DTID_DOUBLE 0
@@ -64,43 +77,64 @@ typedef double double_t;
 
 /////////// DATA STRUCTURES //////////////
 
+// the header fields of a received packet; the data itself stays wherever it 
+// was received and rawData points at it
 typedef struct Packet 
 {
     uint16_t packetVersion;
     uint32_t timestamp;
     uint16_t numPackets;
-    uint16_t idxPacket; // 1-indexed
+    uint16_t idxPacket; // 1-indexed on the wire, 0-indexed once parsed
 
-    uint8_t rawData[MAX_PACKET_LENGTH];
+    uint8_t* rawData;
     uint16_t rawLength;
 } Packet;
 
+// the packets received so far for one tick, or dictionary. The data for packet i is stored at
+// data + i * MAX_PACKET_DATA_LENGTH in this PacketSet's tick buffer
 typedef struct PacketSet
 {
+    uint16_t packetVersion;
     uint32_t timestamp;
     uint16_t numPackets;
+    uint16_t numReceived;
 
     bool packetReceived[MAX_PACKETS_PER_TICK];
-    Packet* pPackets[MAX_PACKETS_PER_TICK];
+    uint16_t packetLength[MAX_PACKETS_PER_TICK];
+    uint8_t* data;
+
+    // when its first packet arrived, see getMonotonicUsec in stats.h
+    uint32_t firstReceivedUsec;
 } PacketSet;
 
+// a Signal is a view: data points into whichever buffer currently holds the 
+// signal's bytes (the tick data buffer while decoding, the signal ring buffer 
+// once queued for the writer), and name into the SignalDescriptor for descId 
+// (see schema.h), where it is null terminated, so it is cheap to pass around by
+// value. Signals that didn't come off the network have no descId.
 typedef struct Signal
 {
+    uint32_t descId;
     uint32_t timestamp;
-    char name[MAX_SIGNAL_NAME];
+    const char* name;
+    uint16_t lenName;
     uint8_t dataTypeId;
     uint8_t nDims;
     uint16_t dims[MAX_SIGNAL_NDIMS];
-    uint8_t data[MAX_SIGNAL_SIZE];
+    const uint8_t* data;
+    uint32_t nBytes;
+
+    // when its tick was complete, see getMonotonicUsec in stats.h
+    uint32_t receivedUsec;
 } Signal;
 
 ////// PROTOTYPES ////////
 
 uint8_t getSizeOfDataTypeId(uint8_t);
 const char * getDataTypeIdName(uint8_t);
-int getNumBytesForSignalData(const Signal* psig);
+uint64_t getNumBytesForSignalData(const Signal* psig);
 
-Packet parsePacket(uint8_t*, int);
+bool parsePacket(const uint8_t* rawHeader, uint8_t* rawData, int bytesRead, bool swapBytes, Packet*);
 
 void printPacket(const Packet*);
 void printPacketSet(const PacketSet*);
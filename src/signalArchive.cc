@@ -0,0 +1,328 @@
+/* Signal Archive
+ *
+ * Recodes segment files written by signalLogger into archive files (see
+ * archive.h) for long term storage, and pulls signals back out of them. Every
+ * column archived is decoded again straight away and checked against what
+ * went in, so an archive is only written if it reads back exactly.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <inttypes.h>
+
+// local includes
+#include "signal.h"
+#include "matfile.h"
+#include "matread.h"
+#include "columns.h"
+#include "archive.h"
+#include "signalLogger.h"
+
+#define ARCHIVE_EXTENSION ".sarc"
+#define DEFAULT_OUTPUT_FILE "archive.mat"
+
+/// PRIVATE DECLARATIONS
+
+bool readWholeFile(const char* fileName, MatBuffer* pmb);
+void archiveSegment(const char* segmentFileName);
+bool verifyArchive(const uint8_t* data, size_t nBytes, const SignalColumnSet* pset);
+void extractFromArchive(const char* archiveFileName, const char* name, const char* outputFile);
+void reserveColumnSamples(SignalColumn* pcol, uint32_t nSamples);
+void writeFile(const char* fileName, const MatBuffer* pmb);
+double getWallSec();
+
+///////////// GLOBALS /////////////
+
+// the segment being archived, and a flush's variable if it had to be inflated
+MatBuffer segmentBuffer;
+MatBuffer inflatedBuffer;
+MatBuffer archiveBuffer;
+
+// the time spent decoding while verifying, and the bytes decoded
+double decodeSec;
+uint64_t nDecodedBytes;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: signalArchive segment.mat...\n"
+           "       signalArchive -x name [-o output.mat] archive" ARCHIVE_EXTENSION "\n"
+           "  Writes segment" ARCHIVE_EXTENSION " alongside each segment, holding its samples delta\n"
+           "  and XOR coded by signal, after checking it decodes back exactly\n"
+           "  -x name     : extract signal name from an archive instead\n"
+           "  -o file     : .mat file to extract it to (default %s), laid out like\n"
+           "                signalLogger -f columns\n",
+           DEFAULT_OUTPUT_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* extractName = NULL;
+    const char* outputFile = DEFAULT_OUTPUT_FILE;
+
+    int opt;
+    while((opt = getopt(argc, argv, "x:o:")) != -1) {
+        switch(opt) {
+            case 'x':
+                extractName = optarg;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    if(argc - optind < 1 || (extractName != NULL && argc - optind != 1)) {
+        usage();
+        exit(1);
+    }
+
+    if(extractName != NULL) {
+        extractFromArchive(argv[optind], extractName, outputFile);
+        return(EXIT_SUCCESS);
+    }
+
+    initMatBuffer(&segmentBuffer);
+    initMatBuffer(&inflatedBuffer);
+    initMatBuffer(&archiveBuffer);
+
+    for(int i = optind; i < argc; i++)
+        archiveSegment(argv[i]);
+
+    freeMatBuffer(&segmentBuffer);
+    freeMatBuffer(&inflatedBuffer);
+    freeMatBuffer(&archiveBuffer);
+
+    return(EXIT_SUCCESS);
+}
+
+bool readWholeFile(const char* fileName, MatBuffer* pmb)
+{
+    FILE* fp = fopen(fileName, "rb");
+    if(fp == NULL)
+        return false;
+
+    clearMatBuffer(pmb);
+    uint8_t buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        appendMatBytes(pmb, buf, n);
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+void archiveSegment(const char* segmentFileName)
+{
+    if(!readWholeFile(segmentFileName, &segmentBuffer) || segmentBuffer.nBytes < MAT_HEADER_BYTES) {
+        fprintf(stderr, "Warning: could not read segment %s\n", segmentFileName);
+        return;
+    }
+
+    // gather every flush's samples by signal
+    SignalColumnSet columns;
+    initSignalColumnSet(&columns);
+    const uint8_t* p = segmentBuffer.data + MAT_HEADER_BYTES;
+    const uint8_t* end = segmentBuffer.data + segmentBuffer.nBytes;
+    int nFlushes = 0;
+    while(p < end) {
+        MatArray var;
+        if(!readMatVariable(&p, end, &inflatedBuffer, &var)) {
+            fprintf(stderr, "Warning: could not parse flush %d of %s, archiving those before it\n",
+                    nFlushes + 1, segmentFileName);
+            break;
+        }
+        collectFlushSignals(&var, &columns, NULL, 0, 0, UINT32_MAX);
+        nFlushes++;
+    }
+
+    clearMatBuffer(&archiveBuffer);
+    writeArchiveHeader(&archiveBuffer, getNonEmptyColumnCount(&columns));
+    uint64_t nSamples = 0;
+    uint64_t nRawBytes = 0;
+    for(int c = 0; c < columns.nColumns; c++) {
+        const SignalColumn* pcol = columns.columns + c;
+        if(pcol->nSamples == 0)
+            continue;
+        encodeArchiveColumn(&archiveBuffer, pcol);
+        nSamples += pcol->nSamples;
+        nRawBytes += (uint64_t)pcol->nSamples * (sizeof(uint32_t) + pcol->nBytesPerSample);
+    }
+
+    if(!verifyArchive(archiveBuffer.data, archiveBuffer.nBytes, &columns)) {
+        fprintf(stderr, "Error: %s did not decode back to what was archived\n", segmentFileName);
+        exit(1);
+    }
+
+    // signal.YYYYMMDD.HHMMSS.mmm.mat --> signal.YYYYMMDD.HHMMSS.mmm.sarc
+    char archiveFileName[MAX_FILENAME_LENGTH];
+    size_t len = strlen(segmentFileName);
+    if(len >= 4 && strcmp(segmentFileName + len - 4, ".mat") == 0)
+        len -= 4;
+    snprintf(archiveFileName, MAX_FILENAME_LENGTH, "%.*s" ARCHIVE_EXTENSION,
+            (int)len, segmentFileName);
+    writeFile(archiveFileName, &archiveBuffer);
+
+    printf("%s ==> %s\n", segmentFileName, archiveFileName);
+    printf("  %d flushes, %d columns, %" PRIu64 " samples, %" PRIu64 " bytes raw\n",
+            nFlushes, getNonEmptyColumnCount(&columns), nSamples, nRawBytes);
+    printf("  %zu bytes as .mat, %zu archived (%.1fx raw, %.1fx .mat), decoded at %.0f MB/s\n",
+            segmentBuffer.nBytes, archiveBuffer.nBytes,
+            archiveBuffer.nBytes ? (double)nRawBytes / archiveBuffer.nBytes : 0,
+            archiveBuffer.nBytes ? (double)segmentBuffer.nBytes / archiveBuffer.nBytes : 0,
+            decodeSec > 0 ? nDecodedBytes / decodeSec / 1e6 : 0);
+
+    freeSignalColumnSet(&columns);
+}
+
+// decode every column of the archive in data and check it against the columns
+// it was encoded from
+bool verifyArchive(const uint8_t* data, size_t nBytes, const SignalColumnSet* pset)
+{
+    SignalArchive archive;
+    if(!viewSignalArchive(data, nBytes, &archive))
+        return false;
+
+    uint32_t* timestamps = NULL;
+    uint8_t* samples = NULL;
+    size_t capacityBytes = 0;
+    bool ok = true;
+    decodeSec = 0;
+    nDecodedBytes = 0;
+
+    uint32_t i = 0;
+    for(int c = 0; c < pset->nColumns && ok; c++) {
+        const SignalColumn* pcol = pset->columns + c;
+        if(pcol->nSamples == 0)
+            continue;
+        if(i >= archive.nColumns) {
+            ok = false;
+            break;
+        }
+
+        const ArchiveColumnHeader* pac = archive.columns[i++];
+        size_t nDataBytes = (size_t)pcol->nSamples * pcol->nBytesPerSample;
+        if(pac->nSamples != pcol->nSamples || getArchiveSampleBytes(pac) != pcol->nBytesPerSample) {
+            ok = false;
+            break;
+        }
+
+        if(nDataBytes > capacityBytes || pcol->nSamples * sizeof(uint32_t) > capacityBytes) {
+            capacityBytes = nDataBytes > pcol->nSamples * sizeof(uint32_t) ?
+                nDataBytes : pcol->nSamples * sizeof(uint32_t);
+            free(timestamps);
+            free(samples);
+            timestamps = (uint32_t*)malloc(capacityBytes);
+            samples = (uint8_t*)malloc(capacityBytes);
+            if(timestamps == NULL || samples == NULL)
+                diep("Error allocating archive verification buffers");
+        }
+
+        double start = getWallSec();
+        ok = decodeArchiveColumn(pac, timestamps, samples);
+        decodeSec += getWallSec() - start;
+        nDecodedBytes += pcol->nSamples * sizeof(uint32_t) + nDataBytes;
+
+        ok = ok && memcmp(timestamps, pcol->timestamps, pcol->nSamples * sizeof(uint32_t)) == 0 &&
+            memcmp(samples, pcol->data, nDataBytes) == 0 &&
+            pac->lenName == pcol->lenName &&
+            memcmp(getArchiveColumnName(pac), pcol->name, pcol->lenName) == 0;
+    }
+
+    ok = ok && i == archive.nColumns;
+    free(timestamps);
+    free(samples);
+    closeSignalArchive(&archive);
+    return ok;
+}
+
+void extractFromArchive(const char* archiveFileName, const char* name, const char* outputFile)
+{
+    SignalArchive archive;
+    if(!openSignalArchive(archiveFileName, &archive)) {
+        fprintf(stderr, "Error: could not open archive %s\n", archiveFileName);
+        exit(1);
+    }
+
+    SignalColumnSet columns;
+    initSignalColumnSet(&columns);
+    uint32_t lenName = strlen(name);
+    uint32_t nSamples = 0;
+    for(int i = findArchiveColumn(&archive, name, lenName, 0); i >= 0;
+            i = findArchiveColumn(&archive, name, lenName, i + 1)) {
+        const ArchiveColumnHeader* pac = archive.columns[i];
+
+        // a Signal with just the layout, to find its column by
+        Signal s;
+        memset(&s, 0, sizeof(Signal));
+        s.name = getArchiveColumnName(pac);
+        s.lenName = pac->lenName;
+        s.dataTypeId = pac->dataTypeId;
+        s.nDims = pac->nDims;
+        memcpy(s.dims, pac->dims, pac->nDims * sizeof(uint16_t));
+        s.nBytes = getArchiveSampleBytes(pac);
+
+        SignalColumn* pcol = findOrAddSignalColumn(&columns, &s);
+        reserveColumnSamples(pcol, pac->nSamples);
+        if(!decodeArchiveColumn(pac, pcol->timestamps, pcol->data)) {
+            fprintf(stderr, "Error: column %d of %s is corrupt\n", i, archiveFileName);
+            exit(1);
+        }
+        pcol->nSamples = pac->nSamples;
+        nSamples += pac->nSamples;
+    }
+
+    MatBuffer mb;
+    initMatBuffer(&mb);
+    writeMatHeader(&mb);
+    writeSignalColumnsToMatBuffer(&mb, &columns, "signals", 0);
+    writeFile(outputFile, &mb);
+    freeMatBuffer(&mb);
+
+    printf("%u samples of %s ==> %s\n", nSamples, name, outputFile);
+
+    freeSignalColumnSet(&columns);
+    closeSignalArchive(&archive);
+}
+
+// make room for nSamples in a column that's still empty
+void reserveColumnSamples(SignalColumn* pcol, uint32_t nSamples)
+{
+    if(nSamples <= pcol->capacitySamples)
+        return;
+    pcol->capacitySamples = nSamples;
+    pcol->timestamps = (uint32_t*)realloc(pcol->timestamps, nSamples * sizeof(uint32_t));
+    pcol->data = (uint8_t*)realloc(pcol->data, (size_t)nSamples * pcol->nBytesPerSample);
+    if(pcol->timestamps == NULL || pcol->data == NULL)
+        diep("Error allocating signal column");
+}
+
+void writeFile(const char* fileName, const MatBuffer* pmb)
+{
+    FILE* fp = fopen(fileName, "wb");
+    if(fp == NULL)
+        diep("Error opening output file");
+    if(fwrite(pmb->data, 1, pmb->nBytes, fp) != pmb->nBytes)
+        diep("Error writing output file");
+    fclose(fp);
+}
+
+double getWallSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,611 @@
+/* Signal Generator
+ *
+ * Sends synthetic ticks to a signalLogger in the same format a Simulink model
+ * does (see signal.h), so the logger can be driven and benchmarked without a
+ * real target. The number of signals, their type and dims, the tick rate and
+ * how many packets each tick is split over are all configurable, and packets
+ * can be deliberately lost or reordered. Element k of signal j in the tick
+ * with timestamp t holds t + j + k, cast to the signal's type, so what's
+ * logged can be checked.
+ *
+ * When it stops it prints what it sent as JSON on stdout, for bench/benchmark.py
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// local includes
+#include "signal.h"
+#include "convert.h"
+#include "signalLogger.h"
+
+#define DEFAULT_PORT 25000
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_NUM_SIGNALS 10
+#define DEFAULT_TICK_RATE 1000
+#define DEFAULT_DICTIONARY_INTERVAL_TICKS 1000
+
+#define MAX_GENERATED_SIGNALS 4096
+#define MAX_GENERATED_NAME_LENGTH 32
+
+/* a signal's header on the wire: lenName, name, dataTypeId, nDims, dims */
+#define MAX_GENERATED_HEADER_BYTES \
+    (2 + MAX_GENERATED_NAME_LENGTH + 2 + 2 * MAX_SIGNAL_NDIMS)
+
+/* the most packets that could go out for one tick, its own plus one held back */
+#define MAX_PACKETS_PER_SEND (MAX_PACKETS_PER_TICK + 1)
+
+/* dictionaries are sent with timestamps counting down from here, out of the
+   way of the ticks' own, so the two are never reassembled together */
+#define FIRST_DICTIONARY_TIMESTAMP 0xFFFFFFFFu
+
+///////////// DATA STRUCTURES /////////////
+
+typedef struct GeneratedSignal {
+    char name[MAX_GENERATED_NAME_LENGTH];
+    uint8_t dataTypeId;
+    uint8_t nDims;
+    uint16_t dims[MAX_SIGNAL_NDIMS];
+    uint32_t nElements;
+    uint32_t nBytes;
+
+    uint8_t header[MAX_GENERATED_HEADER_BYTES];
+    uint16_t nHeaderBytes;
+} GeneratedSignal;
+
+// a packet waiting to be sent, data points into one of the tick buffers
+typedef struct OutgoingPacket {
+    uint8_t header[PACKET_HEADER_LENGTH];
+    const uint8_t* data;
+    uint16_t nBytes;
+} OutgoingPacket;
+
+typedef struct GeneratorCounts {
+    uint64_t ticks;
+    uint64_t completeTicks;     // every packet sent
+    uint64_t signals;           // in complete ticks
+    uint64_t packets;
+    uint64_t packetsLost;       // deliberately not sent
+    uint64_t packetsReordered;  // held back behind the packet after them
+    uint64_t dictionaries;
+    uint64_t bytes;
+} GeneratorCounts;
+
+/// PRIVATE DECLARATIONS
+
+bool parseDataType(const char* arg, int* pDataTypeId);
+bool parseDims(const char* arg, GeneratedSignal* pgsig);
+void buildSignals(int dataTypeId, const GeneratedSignal* pshape);
+uint32_t fillTickData(uint8_t* data, uint32_t timestamp, bool withIds);
+void fillSignalData(uint8_t* pBuf, const GeneratedSignal* pgsig, uint32_t value);
+uint32_t fillDictionaryData(uint8_t* data, int* pNextSignal);
+int splitTick(OutgoingPacket* packets, uint16_t version, uint32_t timestamp,
+        const uint8_t* data, uint32_t nBytes, int minPackets);
+void sendTick(OutgoingPacket* packets, int nPackets, bool dropAndReorder);
+void flushHeldPacket();
+double getMonotonicSec();
+void stopGenerator(int sig);
+void printCounts(double elapsedSec);
+uint16_t toSenderOrder16(uint16_t v);
+uint32_t toSenderOrder32(uint32_t v);
+
+///////////// GLOBALS /////////////
+volatile sig_atomic_t stopping = 0;
+
+GeneratedSignal signals[MAX_GENERATED_SIGNALS];
+int nSignals = 0;
+
+int sock;
+struct sockaddr_in destAddr;
+
+double lossFraction = 0;
+double reorderFraction = 0;
+double targetTickRate = DEFAULT_TICK_RATE;
+
+// send everything big endian, like a big endian target would
+bool bigEndian = 0;
+
+// a packet held back to be sent after the next one
+OutgoingPacket heldPacket;
+bool holdingPacket = 0;
+uint8_t heldData[MAX_PACKET_DATA_LENGTH];
+
+GeneratorCounts counts;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: signalGenerator [-a address] [-n signals] [-y type] [-d dims]\n"
+           "                       [-r ticks/sec] [-c ticks] [-T secs] [-P packets]\n"
+           "                       [-l percent] [-o percent] [-i] [-D ticks] [-x seed]\n"
+           "                       [-e order] [port]\n"
+           "  Sends synthetic ticks to a signalLogger on port (default %d)\n"
+           "  -a address : where to send them (default %s)\n"
+           "  -n signals : signals in each tick (default %d, at most %d)\n"
+           "  -y type    : their data type, double, single, int8, uint8, int16, uint16,\n"
+           "               int32, uint32, char, or mixed to cycle through them all\n"
+           "               (default double)\n"
+           "  -d dims    : their dims, like 3x2 (default 1)\n"
+           "  -r rate    : ticks per second, 0 to send as fast as possible (default %d)\n"
+           "  -c ticks   : stop after sending this many ticks\n"
+           "  -T secs    : stop after this many seconds\n"
+           "  -P packets : split each tick over at least this many packets (default 1,\n"
+           "               at most %d)\n"
+           "  -l percent : lose this percentage of packets, chosen at random\n"
+           "  -o percent : send this percentage of packets after the packet following\n"
+           "               them, chosen at random\n"
+           "  -i         : send signal ids (packetVersion 2) instead of headers, with\n"
+           "               a dictionary (packetVersion 3) first and every so often\n"
+           "  -D ticks   : with -i, resend the dictionary this often (default %d)\n"
+           "  -x seed    : seed for choosing packets to lose and reorder\n"
+           "  -e order   : byte order to send in, little (default) or big\n",
+           DEFAULT_PORT, DEFAULT_ADDRESS, DEFAULT_NUM_SIGNALS, MAX_GENERATED_SIGNALS,
+           DEFAULT_TICK_RATE, MAX_PACKETS_PER_TICK, DEFAULT_DICTIONARY_INTERVAL_TICKS);
+}
+
+void stopGenerator(int sig)
+{
+    stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* address = DEFAULT_ADDRESS;
+    int port = DEFAULT_PORT;
+    int dataTypeId = DTID_DOUBLE;
+    long maxTicks = -1;
+    double maxSeconds = -1;
+    int minPackets = 1;
+    bool withIds = 0;
+    long dictionaryIntervalTicks = DEFAULT_DICTIONARY_INTERVAL_TICKS;
+    long seed = 1;
+
+    GeneratedSignal shape;
+    memset(&shape, 0, sizeof(GeneratedSignal));
+    shape.nDims = 1;
+    shape.dims[0] = 1;
+    nSignals = DEFAULT_NUM_SIGNALS;
+
+    int opt;
+    while((opt = getopt(argc, argv, "a:n:y:d:r:c:T:P:l:o:iD:x:e:")) != -1) {
+        switch(opt) {
+            case 'a':
+                address = optarg;
+                break;
+            case 'n':
+                nSignals = atoi(optarg);
+                break;
+            case 'y':
+                if(!parseDataType(optarg, &dataTypeId)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'd':
+                if(!parseDims(optarg, &shape)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'r':
+                targetTickRate = atof(optarg);
+                break;
+            case 'c':
+                maxTicks = atol(optarg);
+                break;
+            case 'T':
+                maxSeconds = atof(optarg);
+                break;
+            case 'P':
+                minPackets = atoi(optarg);
+                break;
+            case 'l':
+                lossFraction = atof(optarg) / 100;
+                break;
+            case 'o':
+                reorderFraction = atof(optarg) / 100;
+                break;
+            case 'i':
+                withIds = 1;
+                break;
+            case 'D':
+                dictionaryIntervalTicks = atol(optarg);
+                break;
+            case 'x':
+                seed = atol(optarg);
+                break;
+            case 'e':
+                if(strcmp(optarg, "big") == 0)
+                    bigEndian = 1;
+                else if(strcmp(optarg, "little") != 0) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if(optind < argc)
+        port = atoi(argv[optind]);
+
+    if(nSignals < 1 || nSignals > MAX_GENERATED_SIGNALS || minPackets < 1 ||
+            minPackets > MAX_PACKETS_PER_TICK || targetTickRate < 0 ||
+            dictionaryIntervalTicks < 1) {
+        usage();
+        exit(1);
+    }
+
+    buildSignals(dataTypeId, &shape);
+
+    static uint8_t tickData[MAX_DATA_SIZE_PER_TICK];
+    static uint8_t dictionaryData[MAX_DATA_SIZE_PER_TICK];
+    uint32_t nTickBytes = fillTickData(tickData, 0, withIds);
+    if(nTickBytes > MAX_DATA_SIZE_PER_TICK) {
+        fprintf(stderr, "Each tick would be %u bytes, more than the %d that fit in %d packets\n",
+                nTickBytes, MAX_DATA_SIZE_PER_TICK, MAX_PACKETS_PER_TICK);
+        exit(1);
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock == -1)
+        diep("Error creating socket");
+
+    memset(&destAddr, 0, sizeof(destAddr));
+    destAddr.sin_family = AF_INET;
+    destAddr.sin_port = htons(port);
+    if(inet_pton(AF_INET, address, &destAddr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", address);
+        exit(1);
+    }
+
+    srand48(seed);
+    signal(SIGINT, stopGenerator);
+    signal(SIGTERM, stopGenerator);
+
+    fprintf(stderr, "Sending %d signals, %u bytes per tick, to %s:%d at %g ticks/sec\n",
+            nSignals, nTickBytes, address, port, targetTickRate);
+
+    OutgoingPacket packets[MAX_PACKETS_PER_TICK];
+    uint32_t dictionaryTimestamp = FIRST_DICTIONARY_TIMESTAMP;
+    double startSec = getMonotonicSec();
+    double nowSec = startSec;
+
+    for(long iTick = 0; !stopping && iTick != maxTicks; iTick++)
+    {
+        if(maxSeconds >= 0 && nowSec - startSec >= maxSeconds)
+            break;
+
+        // a large dictionary goes out as several, each with its own timestamp
+        if(withIds && iTick % dictionaryIntervalTicks == 0) {
+            int nextSignal = 0;
+            while(nextSignal < nSignals) {
+                uint32_t nBytes = fillDictionaryData(dictionaryData, &nextSignal);
+                int nPackets = splitTick(packets, PACKET_VERSION_DICTIONARY,
+                        dictionaryTimestamp--, dictionaryData, nBytes, 1);
+                sendTick(packets, nPackets, 0);
+                counts.dictionaries++;
+            }
+        }
+
+        // timestamps start at 1 like a model's
+        uint32_t timestamp = iTick + 1;
+        nTickBytes = fillTickData(tickData, timestamp, withIds);
+        int nPackets = splitTick(packets, withIds ? PACKET_VERSION_SIGNAL_IDS :
+                PACKET_VERSION_SIGNAL_NAMES, timestamp, tickData, nTickBytes, minPackets);
+
+        uint64_t lostBefore = counts.packetsLost;
+        sendTick(packets, nPackets, 1);
+        counts.ticks++;
+        if(counts.packetsLost == lostBefore) {
+            counts.completeTicks++;
+            counts.signals += nSignals;
+        }
+
+        // keep to the schedule from the start, rather than sleeping a tick's
+        // worth each time, so a late tick is made up for
+        nowSec = getMonotonicSec();
+        if(targetTickRate > 0) {
+            double dueSec = startSec + (iTick + 1) / targetTickRate;
+            if(dueSec > nowSec) {
+                struct timespec ts;
+                ts.tv_sec = (time_t)dueSec;
+                ts.tv_nsec = (long)((dueSec - ts.tv_sec) * 1e9);
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                nowSec = getMonotonicSec();
+            }
+        }
+    }
+    flushHeldPacket();
+
+    printCounts(getMonotonicSec() - startSec);
+    close(sock);
+    return(EXIT_SUCCESS);
+}
+
+double getMonotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/////// SIGNALS /////////
+
+bool parseDataType(const char* arg, int* pDataTypeId)
+{
+    if(strcmp(arg, "mixed") == 0) {
+        *pDataTypeId = -1;
+        return 1;
+    }
+    for(int i = 0; i <= DTID_CHAR; i++) {
+        if(strcmp(arg, getDataTypeIdName(i)) == 0) {
+            *pDataTypeId = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// dims like 3x2, into pgsig's nDims and dims
+bool parseDims(const char* arg, GeneratedSignal* pgsig)
+{
+    pgsig->nDims = 0;
+    while(1) {
+        int dim, nChars;
+        if(pgsig->nDims == MAX_SIGNAL_NDIMS || sscanf(arg, "%d%n", &dim, &nChars) != 1 ||
+                dim < 0 || dim > UINT16_MAX)
+            return 0;
+        pgsig->dims[pgsig->nDims++] = dim;
+        arg += nChars;
+
+        if(*arg == '\0')
+            return 1;
+        if(*arg != 'x')
+            return 0;
+        arg++;
+    }
+}
+
+// name every signal and lay out its header, with the dims of pshape. A
+// dataTypeId of -1 cycles through every type
+void buildSignals(int dataTypeId, const GeneratedSignal* pshape)
+{
+    for(int j = 0; j < nSignals; j++) {
+        GeneratedSignal* pgsig = signals + j;
+        memcpy(pgsig, pshape, sizeof(GeneratedSignal));
+        snprintf(pgsig->name, MAX_GENERATED_NAME_LENGTH, "sig%04d", j);
+        pgsig->dataTypeId = dataTypeId >= 0 ? dataTypeId : j % (DTID_CHAR + 1);
+
+        pgsig->nElements = 1;
+        for(int idim = 0; idim < pgsig->nDims; idim++)
+            pgsig->nElements *= pgsig->dims[idim];
+        pgsig->nBytes = pgsig->nElements * getSizeOfDataTypeId(pgsig->dataTypeId);
+
+        uint8_t* pBuf = pgsig->header;
+        uint16_t lenName = strlen(pgsig->name);
+        uint16_t lenNameSent = toSenderOrder16(lenName);
+        memcpy(pBuf, &lenNameSent, sizeof(uint16_t));
+        pBuf += sizeof(uint16_t);
+        memcpy(pBuf, pgsig->name, lenName);
+        pBuf += lenName;
+        *pBuf++ = pgsig->dataTypeId;
+        *pBuf++ = pgsig->nDims;
+        for(int idim = 0; idim < pgsig->nDims; idim++) {
+            uint16_t dim = toSenderOrder16(pgsig->dims[idim]);
+            memcpy(pBuf, &dim, sizeof(uint16_t));
+            pBuf += sizeof(uint16_t);
+        }
+        pgsig->nHeaderBytes = pBuf - pgsig->header;
+    }
+}
+
+// lay out a tick's signals, each after its header or its id, returning the
+// tick's length. With a timestamp of 0 only the length is worked out
+uint32_t fillTickData(uint8_t* data, uint32_t timestamp, bool withIds)
+{
+    uint32_t nBytes = 0;
+    for(int j = 0; j < nSignals; j++) {
+        const GeneratedSignal* pgsig = signals + j;
+        uint32_t nPrefixBytes = withIds ? sizeof(uint16_t) : pgsig->nHeaderBytes;
+
+        if(timestamp != 0) {
+            uint8_t* pBuf = data + nBytes;
+            if(withIds) {
+                uint16_t signalId = toSenderOrder16(j);
+                memcpy(pBuf, &signalId, sizeof(uint16_t));
+            } else
+                memcpy(pBuf, pgsig->header, pgsig->nHeaderBytes);
+            fillSignalData(pBuf + nPrefixBytes, pgsig, timestamp + j);
+        }
+        nBytes += nPrefixBytes + pgsig->nBytes;
+    }
+    return nBytes;
+}
+
+// element k holds value + k
+void fillSignalData(uint8_t* pBuf, const GeneratedSignal* pgsig, uint32_t value)
+{
+    uint8_t* pData = pBuf;
+    for(uint32_t k = 0; k < pgsig->nElements; k++) {
+        uint32_t v = value + k;
+        switch(pgsig->dataTypeId) {
+            case DTID_DOUBLE: { double_t x = v; memcpy(pBuf, &x, sizeof(x)); pBuf += sizeof(x); break; }
+            case DTID_SINGLE: { single_t x = v; memcpy(pBuf, &x, sizeof(x)); pBuf += sizeof(x); break; }
+            case DTID_INT16:  { int16_t x = v;  memcpy(pBuf, &x, sizeof(x)); pBuf += sizeof(x); break; }
+            case DTID_UINT16: { uint16_t x = v; memcpy(pBuf, &x, sizeof(x)); pBuf += sizeof(x); break; }
+            case DTID_INT32:  { int32_t x = v;  memcpy(pBuf, &x, sizeof(x)); pBuf += sizeof(x); break; }
+            case DTID_UINT32: memcpy(pBuf, &v, sizeof(v)); pBuf += sizeof(v); break;
+            default:          *pBuf++ = (uint8_t)v; break;
+        }
+    }
+
+    if(bigEndian)
+        swapElementBytes(pData, pgsig->nElements, getSizeOfDataTypeId(pgsig->dataTypeId));
+}
+
+// lay out dictionary entries from *pNextSignal on, as many as fit in one tick,
+// moving *pNextSignal past them
+uint32_t fillDictionaryData(uint8_t* data, int* pNextSignal)
+{
+    uint32_t nBytes = 0;
+    while(*pNextSignal < nSignals) {
+        const GeneratedSignal* pgsig = signals + *pNextSignal;
+        if(nBytes + sizeof(uint16_t) + pgsig->nHeaderBytes > MAX_DATA_SIZE_PER_TICK)
+            break;
+
+        uint16_t signalId = toSenderOrder16(*pNextSignal);
+        memcpy(data + nBytes, &signalId, sizeof(uint16_t));
+        memcpy(data + nBytes + sizeof(uint16_t), pgsig->header, pgsig->nHeaderBytes);
+        nBytes += sizeof(uint16_t) + pgsig->nHeaderBytes;
+        (*pNextSignal)++;
+    }
+    return nBytes;
+}
+
+/////// SENDING /////////
+
+// split a tick's data evenly over as few packets as it fits in, but at least
+// minPackets, returning how many
+int splitTick(OutgoingPacket* packets, uint16_t version, uint32_t timestamp,
+        const uint8_t* data, uint32_t nBytes, int minPackets)
+{
+    int nPackets = (nBytes + MAX_PACKET_DATA_LENGTH - 1) / MAX_PACKET_DATA_LENGTH;
+    if(nPackets < minPackets)
+        nPackets = minPackets;
+    uint32_t nBytesPerPacket = (nBytes + nPackets - 1) / nPackets;
+
+    for(int i = 0; i < nPackets; i++) {
+        OutgoingPacket* pp = packets + i;
+        uint16_t versionSent = toSenderOrder16(version);
+        uint32_t timestampSent = toSenderOrder32(timestamp);
+        uint16_t numPackets = toSenderOrder16(nPackets);
+        uint16_t idxPacket = toSenderOrder16(i + 1);
+
+        uint8_t* pBuf = pp->header;
+        memcpy(pBuf, &versionSent, sizeof(uint16_t));
+        memcpy(pBuf + 2, &timestampSent, sizeof(uint32_t));
+        memcpy(pBuf + 6, &numPackets, sizeof(uint16_t));
+        memcpy(pBuf + 8, &idxPacket, sizeof(uint16_t));
+
+        uint32_t offset = i * nBytesPerPacket;
+        pp->data = data + (offset < nBytes ? offset : nBytes);
+        pp->nBytes = offset >= nBytes ? 0 :
+            (nBytes - offset < nBytesPerPacket ? nBytes - offset : nBytesPerPacket);
+    }
+    return nPackets;
+}
+
+// send a tick's packets with one call into the kernel, losing and reordering
+// some of them if asked to
+void sendTick(OutgoingPacket* packets, int nPackets, bool dropAndReorder)
+{
+    struct mmsghdr msgs[MAX_PACKETS_PER_SEND];
+    struct iovec iovecs[MAX_PACKETS_PER_SEND][2];
+    OutgoingPacket* pending[MAX_PACKETS_PER_SEND];
+    int nPending = 0;
+
+    // a packet held back from the tick before is released at most once per
+    // tick, after which no more are held back until the next
+    OutgoingPacket released;
+    bool canHold = dropAndReorder && reorderFraction > 0;
+
+    for(int i = 0; i < nPackets; i++) {
+        OutgoingPacket* pp = packets + i;
+        if(dropAndReorder && lossFraction > 0 && drand48() < lossFraction) {
+            counts.packetsLost++;
+            continue;
+        }
+
+        pending[nPending++] = pp;
+        if(holdingPacket) {
+            // goes out after the packet that was sent after it
+            released = heldPacket;
+            pending[nPending++] = &released;
+            holdingPacket = 0;
+            canHold = 0;
+        } else if(canHold && drand48() < reorderFraction) {
+            // its data is copied since the tick buffer will have been reused
+            // by the time it goes out
+            heldPacket = *pp;
+            memcpy(heldData, pp->data, pp->nBytes);
+            heldPacket.data = heldData;
+            holdingPacket = 1;
+            nPending--;
+            counts.packetsReordered++;
+        }
+    }
+
+    for(int i = 0; i < nPending; i++) {
+        iovecs[i][0].iov_base = pending[i]->header;
+        iovecs[i][0].iov_len = PACKET_HEADER_LENGTH;
+        iovecs[i][1].iov_base = (void*)pending[i]->data;
+        iovecs[i][1].iov_len = pending[i]->nBytes;
+
+        memset(msgs + i, 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_name = &destAddr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(destAddr);
+        msgs[i].msg_hdr.msg_iov = iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    int nSent = 0;
+    while(nSent < nPending) {
+        int n = sendmmsg(sock, msgs + nSent, nPending - nSent, 0);
+        if(n == -1)
+            diep("Error sending packets");
+        nSent += n;
+    }
+
+    counts.packets += nPending;
+    for(int i = 0; i < nPending; i++)
+        counts.bytes += PACKET_HEADER_LENGTH + pending[i]->nBytes;
+}
+
+// send the packet still being held back, if any, when stopping
+void flushHeldPacket()
+{
+    if(!holdingPacket)
+        return;
+    holdingPacket = 0;
+    OutgoingPacket held = heldPacket;
+    sendTick(&held, 1, 0);
+}
+
+void printCounts(double elapsedSec)
+{
+    printf("{\"ticks\": %llu, \"completeTicks\": %llu, \"signals\": %llu, "
+           "\"packets\": %llu, \"packetsLost\": %llu, \"packetsReordered\": %llu, "
+           "\"dictionaries\": %llu, \"bytes\": %llu, \"elapsedSec\": %.3f, "
+           "\"targetTickRate\": %.1f, \"tickRate\": %.1f}\n",
+           (unsigned long long)counts.ticks, (unsigned long long)counts.completeTicks,
+           (unsigned long long)counts.signals, (unsigned long long)counts.packets,
+           (unsigned long long)counts.packetsLost, (unsigned long long)counts.packetsReordered,
+           (unsigned long long)counts.dictionaries, (unsigned long long)counts.bytes,
+           elapsedSec, targetTickRate, elapsedSec > 0 ? counts.ticks / elapsedSec : 0.0);
+    fflush(stdout);
+}
+
+uint16_t toSenderOrder16(uint16_t v)
+{
+    return bigEndian ? __builtin_bswap16(v) : v;
+}
+
+uint32_t toSenderOrder32(uint32_t v)
+{
+    return bigEndian ? __builtin_bswap32(v) : v;
+}
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <string.h> /* For strcmp() */
 #include <stdlib.h> /* For EXIT_FAILURE, EXIT_SUCCESS */
+#include <errno.h>
+#include <limits.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -22,6 +24,10 @@
 #include "signal.h"
 #include "buffer.h"
 #include "writer.h"
+#include "segment.h"
+#include "receiver.h"
+#include "stream.h"
+#include "compress.h"
 #include "signalLogger.h"
 
 #define PORT 25000 
@@ -31,9 +37,62 @@
 #define DEFAULT_DATA_ROOT "/expdata/signals"
 char dataRoot[MAX_FILENAME_LENGTH];
 
+// how signals are laid out in the .mat files, see writer.h, and whether the
+// columns format widens data to double
+int outputFormat = OUTPUT_SIGNAL_STRUCTS;
+bool widenColumns = 0;
+
+// when the writer rotates to a new segment file, see segment.h
+uint64_t segmentMaxBytes = DEFAULT_SEGMENT_MAX_BYTES;
+int segmentMaxSeconds = DEFAULT_SEGMENT_MAX_SECONDS;
+
+// how segment files are written, see segment.h
+int segmentIoMode = SEGMENT_IO_BUFFERED;
+
+// how long signals may wait in the buffer before the writer drains them
+int writerMaxLatencyMsec = DEFAULT_MAX_WRITE_LATENCY_MSEC;
+
+// how far the writer lets ticks arrive out of order, see reorder.h
+uint32_t reorderWindowTicks = DEFAULT_REORDER_WINDOW_TICKS;
+int reorderMaxHoldMsec = DEFAULT_REORDER_MAX_HOLD_MSEC;
+
+// zlib level each flush is compressed at, 0 for none, and the threads each
+// writer compresses on, see compress.h
+int compressLevel = 0;
+int compressWorkers = DEFAULT_COMPRESS_WORKERS;
+
+// socket and signal buffer settings shared by every stream, see stream.cc
+int recvBufferBytes = DEFAULT_RECV_BUFFER_BYTES;
+int recvBatchSize = RECV_BATCH_SIZE;
+bool countKernelDrops = 0;
+int highWaterSignals = DEFAULT_HIGH_WATER_SIGNALS;
+uint32_t highWaterBytes = DEFAULT_HIGH_WATER_BYTES;
+
+// size of each receive thread's live tap, 0 for none, see tap.h
+uint64_t tapBytes = 0;
+
+// senders are big endian, so their packets are byte swapped, see convert.h
+bool bigEndianSenders = 0;
+
+// how long to wait for the rest of a tick before keeping what arrived of it,
+// 0 to only give up on a tick once its slot is needed, see giveUpOnPacketSet
+int partialTickMsec = 0;
+
+// receive threads each stream is spread over, see stream.h
+int nReceiveWorkers = 1;
+
+// where and how often counters are written out as JSON, see stats.h
+const char* statsFileName = NULL;
+int statsIntervalSec = DEFAULT_STATS_INTERVAL_SEC;
+
+/// PRIVATE DECLARATIONS
+double getWallClockSec();
+void writeStatsFile(const char* fileName);
+
 ///////////// GLOBALS /////////////
-int sock;
-pthread_t writerThread;
+SignalStream streams[MAX_SIGNAL_STREAMS];
+int nStreams = 0;
+double startSec;
 
 void diep(const char *s)
 {
@@ -44,118 +103,383 @@ void diep(const char *s)
 void finish_main(int sig)
 {
     printf("Finishing Main\n");
-    pthread_cancel(writerThread);
-    pthread_join(writerThread, NULL);
-    close(sock);
+    if(statsFileName != NULL)
+        writeStatsFile(statsFileName);
+    for(int i = 0; i < nStreams; i++)
+        stopSignalStream(streams + i);
     exit(-1);
 }
 
-bool checkDataRootAccessible()
+double getWallClockSec()
 {
-	// check that we have read and write access to the data root
-	return access( dataRoot, R_OK | W_OK ) != -1; 
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-int main(int argc, char *argv[])
+// replace the stats file with the current stats of every stream, writing them
+// alongside first so readers never see a partial file
+void writeStatsFile(const char* fileName)
 {
-	// copy the default data root in, later make this an option?
-    strncpy(dataRoot, DEFAULT_DATA_ROOT, MAX_FILENAME_LENGTH);
+    char tmpName[MAX_FILENAME_LENGTH + 8];
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
 
-	printf("Signal data root : %s\n", dataRoot);
+    FILE* fp = fopen(tmpName, "w");
+    if(fp == NULL) {
+        perror("Warning: could not write stats file");
+        return;
+    }
 
-	if (!checkDataRootAccessible())
-	{
-		diep("No read/write access to data root. Check permissions");
-		exit(1);
-	}
+    double nowSec = getWallClockSec();
+    fprintf(fp, "{\"time\": %.3f, \"uptimeSec\": %.3f, \"streams\": [\n", 
+            nowSec, nowSec - startSec);
+    for(int i = 0; i < nStreams; i++) {
+        writeSignalStreamStats(fp, streams + i, nowSec);
+        fprintf(fp, i < nStreams - 1 ? ",\n" : "\n");
+    }
+    fprintf(fp, "]}\n");
 
-	uint8_t rawPacket[MAX_PACKET_LENGTH];
-    int port = PORT;
-    bool receivedAll; 
+    if(fclose(fp) != 0 || rename(tmpName, fileName) == -1)
+        perror("Warning: could not write stats file");
+}
 
-    printf("Starting Data Logger on port %d\n", port);
+bool checkDataRootAccessible(const char* dir)
+{
+    // a stream's own directory is created the first time it's logged to
+    if(access(dir, F_OK) == -1)
+        mkdir(dir, 0775);
 
-    // Setup Socket Variables
-    struct sockaddr_in si_me, si_other;
-    int slen=sizeof(si_other);
+    // check that we have read and write access to the data root
+    return access( dir, R_OK | W_OK ) != -1; 
+}
 
-    if ((sock=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1)
-        diep("socket");
+// parse a whole decimal number, nothing after it
+bool parseIntOption(const char* arg, int* pValue)
+{
+    char* end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if(end == arg || *end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+        return 0;
+    *pValue = (int)value;
+    return 1;
+}
 
-    // Setup Local Socket on specified port to accept from any address
-    memset((char *) &si_me, 0, sizeof(si_me)); 
-    si_me.sin_family = AF_INET;
-    si_me.sin_port = htons(port);
-    si_me.sin_addr.s_addr = htonl(INADDR_ANY);
-    if (bind(sock,(struct sockaddr*) &si_me, sizeof(si_me))==-1)
-        diep("bind");
+// parse port[,cpu[,dir]] into the next stream
+bool parseStreamOption(const char* arg)
+{
+    if(nStreams == MAX_SIGNAL_STREAMS)
+        return 0;
+
+    SignalStream* pstream = streams + nStreams;
+    memset(pstream, 0, sizeof(SignalStream));
+    pstream->cpu = STREAM_CPU_ANY;
+
+    int nChars = 0;
+    if(sscanf(arg, "%d%n", &pstream->port, &nChars) != 1 || pstream->port <= 0)
+        return 0;
+    arg += nChars;
+
+    if(*arg == ',') {
+        arg++;
+        if(*arg != ',' && *arg != '\0') {
+            if(sscanf(arg, "%d%n", &pstream->cpu, &nChars) != 1 || pstream->cpu < 0)
+                return 0;
+            arg += nChars;
+        }
+        if(*arg == ',')
+            strncpy(pstream->dataRoot, arg + 1, MAX_FILENAME_LENGTH - 1);
+        else if(*arg != '\0')
+            return 0;
+    } else if(*arg != '\0')
+        return 0;
+
+    snprintf(pstream->label, MAX_WRITER_LABEL_LENGTH, "[%d] ", pstream->port);
+    nStreams++;
+    return 1;
+}
 
-    //Register INT handler
-    signal(SIGINT, finish_main);
+void usage()
+{
+    printf("Usage: signalLogger [-s port[,cpu[,dir]]]... [-r bytes] [-b count] [-D]\n"
+           "                    [-f format]\n"
+           "                    [-W] [-e order] [-w threads] [-S megabytes] [-T seconds]\n"
+           "                    [-O io] [-L msec] [-H signals] [-B kbytes]\n"
+           "                    [-R ticks[,msec]] [-t megabytes] [-j file[,secs]]\n"
+           "                    [-z level[,threads]] [-P msec]\n"
+           "  -s stream : receive on this port, repeat to log several models at once,\n"
+           "              each on its own threads. The receive thread can be pinned\n"
+           "              to a cpu, and signals go to dir (default %s/<port>).\n"
+           "              Without -s, port %d is logged to %s\n"
+           "  -w count  : receive each stream on this many threads, each with its own\n"
+           "              SO_REUSEPORT socket, pinned to the cpus from the stream's\n"
+           "              cpu on if it has one (default 1, at most %d)\n"
+           "  -r bytes  : socket receive buffer size (default %d, at most %d)\n"
+           "  -b count  : receive at most this many packets per call into the kernel\n"
+           "              (default and at most %d)\n"
+           "  -D        : count packets dropped by the kernel (SO_RXQ_OVFL)\n"
+           "  -f format : .mat file layout, one of\n"
+           "                structs : N x 1 struct array, one element per sample (default)\n"
+           "                columns : one element per signal, with its timestamps and\n"
+           "                          an nSamples x dims data array\n"
+           "  -W        : with -f columns, write all but char data as double\n"
+           "  -e order  : byte order the senders use, little (default) or big\n"
+           "  -S mb     : start a new segment file after this many megabytes (default %d)\n"
+           "  -T secs   : start a new segment file after this many seconds (default %d)\n"
+           "  -O io     : how segment files are written, one of\n"
+           "                buffered : write() through the page cache (default)\n"
+           "                aio      : POSIX AIO, several large writes in flight\n"
+           "                direct   : POSIX AIO with O_DIRECT, bypassing the page cache\n"
+           "  -L msec   : longest a signal waits before being written (default %d,\n"
+           "              at most %d)\n"
+           "  -H count  : write as soon as this many signals are waiting (default %d)\n"
+           "  -B kbytes : write as soon as this much signal data is waiting (default %d,\n"
+           "              at most %d)\n"
+           "  -R window : write signals in timestamp order, holding each one until the\n"
+           "              newest timestamp is this many ticks past it, or for at most\n"
+           "              msec (default %d). Off by default\n"
+           "  -t mb     : publish signals live to shared memory rings of this many\n"
+           "              megabytes (rounded up to a power of 2, at most %d), one per\n"
+           "              receive thread, at /dev/shm/signalLogger.<port>.<thread>.\n"
+           "              See signalTap for reading them\n"
+           "  -j stats  : every secs (default %d), rewrite file with JSON counters,\n"
+           "              rates and latency histograms for each stream\n"
+           "  -z level  : compress each flush with zlib at this level (1-9), as a\n"
+           "              miCOMPRESSED variable MATLAB loads as usual, split over this\n"
+           "              many threads per stream (default %d, at most %d)\n"
+           "  -P msec   : give up on a tick this long after its first packet arrives,\n"
+           "              keeping the signals in the packets that did, and mark it\n"
+           "              with a %s signal of [packets received,\n"
+           "              packets, signals kept]. At most %d, off by default\n",
+           DEFAULT_DATA_ROOT, PORT, DEFAULT_DATA_ROOT, MAX_RECEIVE_WORKERS,
+           DEFAULT_RECV_BUFFER_BYTES, MAX_RECV_BUFFER_BYTES, RECV_BATCH_SIZE,
+           DEFAULT_SEGMENT_MAX_BYTES / (1024*1024),
+           DEFAULT_SEGMENT_MAX_SECONDS, DEFAULT_MAX_WRITE_LATENCY_MSEC, MAX_WRITE_LATENCY_MSEC,
+           DEFAULT_HIGH_WATER_SIGNALS, DEFAULT_HIGH_WATER_BYTES / 1024, SIGNAL_BUFFER_BYTES / 1024,
+           DEFAULT_REORDER_MAX_HOLD_MSEC, MAX_TAP_MEGABYTES, DEFAULT_STATS_INTERVAL_SEC,
+           DEFAULT_COMPRESS_WORKERS, MAX_COMPRESS_WORKERS, PARTIAL_TICK_SIGNAL_NAME,
+           MAX_PARTIAL_TICK_MSEC);
+}
 
-    printf("Socket bound and waiting...\n");
+int main(int argc, char *argv[])
+{
+    int segmentMaxMegabytes = DEFAULT_SEGMENT_MAX_BYTES / (1024*1024);
+    int highWaterKbytes = DEFAULT_HIGH_WATER_BYTES / 1024;
+    int tapMegabytes = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "s:w:r:b:Df:WS:T:O:L:H:B:R:t:j:z:e:P:")) != -1) {
+        switch(opt) {
+            case 's':
+                if(!parseStreamOption(optarg)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'w':
+                nReceiveWorkers = atoi(optarg);
+                break;
+            case 'r':
+                if(!parseIntOption(optarg, &recvBufferBytes)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'b':
+                if(!parseIntOption(optarg, &recvBatchSize)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'D':
+                countKernelDrops = 1;
+                break;
+            case 'f':
+                if(strcmp(optarg, "structs") == 0)
+                    outputFormat = OUTPUT_SIGNAL_STRUCTS;
+                else if(strcmp(optarg, "columns") == 0)
+                    outputFormat = OUTPUT_SIGNAL_COLUMNS;
+                else {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'W':
+                widenColumns = 1;
+                break;
+            case 'e':
+                if(strcmp(optarg, "little") == 0)
+                    bigEndianSenders = 0;
+                else if(strcmp(optarg, "big") == 0)
+                    bigEndianSenders = 1;
+                else {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'S':
+                if(!parseIntOption(optarg, &segmentMaxMegabytes)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'T':
+                if(!parseIntOption(optarg, &segmentMaxSeconds)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'O':
+                if(strcmp(optarg, "buffered") == 0)
+                    segmentIoMode = SEGMENT_IO_BUFFERED;
+                else if(strcmp(optarg, "aio") == 0)
+                    segmentIoMode = SEGMENT_IO_AIO;
+                else if(strcmp(optarg, "direct") == 0)
+                    segmentIoMode = SEGMENT_IO_DIRECT;
+                else {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'L':
+                if(!parseIntOption(optarg, &writerMaxLatencyMsec)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'H':
+                if(!parseIntOption(optarg, &highWaterSignals)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if(!parseIntOption(optarg, &highWaterKbytes)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'j': {
+                // file[,secs]
+                char* comma = strrchr(optarg, ',');
+                if(comma != NULL) {
+                    *comma = '\0';
+                    statsIntervalSec = atoi(comma + 1);
+                }
+                statsFileName = optarg;
+                break;
+            }
+            case 't':
+                if(!parseIntOption(optarg, &tapMegabytes)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'R':
+                if(sscanf(optarg, "%u,%d", &reorderWindowTicks, &reorderMaxHoldMsec) < 1) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'P':
+                if(!parseIntOption(optarg, &partialTickMsec)) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            case 'z':
+                if(sscanf(optarg, "%d,%d", &compressLevel, &compressWorkers) < 1) {
+                    usage();
+                    exit(1);
+                }
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
 
-    clearBuffers();
+    if(segmentMaxMegabytes < 1 || segmentMaxSeconds < 1 ||
+            writerMaxLatencyMsec < 0 || writerMaxLatencyMsec > MAX_WRITE_LATENCY_MSEC ||
+            highWaterSignals < 1 || highWaterKbytes < 1 ||
+            highWaterKbytes > SIGNAL_BUFFER_BYTES / 1024 || 
+            recvBufferBytes < 1 || recvBufferBytes > MAX_RECV_BUFFER_BYTES ||
+            recvBatchSize < 1 || recvBatchSize > RECV_BATCH_SIZE ||
+            reorderMaxHoldMsec <= 0 || statsIntervalSec <= 0 || nReceiveWorkers < 1 || nReceiveWorkers > MAX_RECEIVE_WORKERS ||
+            compressLevel < 0 || compressLevel > 9 || compressWorkers < 1 ||
+            compressWorkers > MAX_COMPRESS_WORKERS ||
+            tapMegabytes < 0 || tapMegabytes > MAX_TAP_MEGABYTES ||
+            partialTickMsec < 0 || partialTickMsec > MAX_PARTIAL_TICK_MSEC) {
+        usage();
+        exit(1);
+    }
 
-    // Setup signal buffer mutex so that multiple locking is okay
+    segmentMaxBytes = (uint64_t)segmentMaxMegabytes * 1024 * 1024;
+    highWaterBytes = (uint32_t)highWaterKbytes * 1024;
 
-    // Start File Writer Thread
-    int rc = pthread_create(&writerThread, NULL, signalWriterThread, NULL); 
-    if (rc) {
-        printf("ERROR!  Return code from pthread_create() is %d\n", rc);
-        exit(-1);
+    // the tap's ring wraps by masking, so it's a power of 2
+    if(tapMegabytes > 0) {
+        tapBytes = 1024 * 1024;
+        while(tapBytes < (uint64_t)tapMegabytes * 1024 * 1024)
+            tapBytes *= 2;
     }
 
-    while(1)
-    {
-
-        // Read from the socket 
-        int bytesRead = recvfrom(sock, rawPacket, MAX_PACKET_LENGTH, 0,
-                (struct sockaddr*)&si_other, (socklen_t *)&slen);
-
-        if(bytesRead == -1)
-            diep("recvfrom()");
-
-        // parse rawPacket into a Packet struct
-        Packet p;
-		memset(&p, 0, sizeof(Packet));
-        p = parsePacket(rawPacket, bytesRead);
-
-        // add Packet to the head of the packet buffer
-        Packet* pPacket;
-        pPacket = pushPacketAtHead(p);
-        //printPacket(pPacket);
-
-        PacketSet* pPacketSet;
-        pPacketSet = findPacketSetForPacket(pPacket);
-
-        if(pPacketSet == NULL)
-        {
-            pPacketSet = createPacketSetForPacket(pPacket);
-        } else {
-            // store a pointer to this packet inside the packet set
-            pPacketSet->pPackets[pPacket->idxPacket] = pPacket;
-            pPacketSet->packetReceived[pPacket->idxPacket] = 1;
-			//printf("added packet %d at %x to ps\n", pPacket->idxPacket, pPacket);
-        }
+	// copy the default data root in, later make this an option?
+    strncpy(dataRoot, DEFAULT_DATA_ROOT, MAX_FILENAME_LENGTH);
 
-        // have we received the full group of packets yet?
-        receivedAll = checkReceivedAllPackets(pPacketSet);
-        if (receivedAll) {
+	printf("Signal data root : %s\n", dataRoot);
 
-            // look at the multi-packet data in this set
-            // turn it into signals on the SignalBuffer, and remove the 
-            // packet set and packets from their buffers
-            processPacketSet(pPacketSet);
+	if (!checkDataRootAccessible(dataRoot))
+	{
+		diep("No read/write access to data root. Check permissions");
+		exit(1);
+	}
 
-            removePacketSetFromBuffer(pPacketSet);
+    // with no streams given, log the one default port straight into the data root
+    if(nStreams == 0) {
+        memset(streams, 0, sizeof(SignalStream));
+        streams[0].port = PORT;
+        streams[0].cpu = STREAM_CPU_ANY;
+        snprintf(streams[0].dataRoot, MAX_FILENAME_LENGTH, "%s", dataRoot);
+        nStreams = 1;
+    }
 
-        }
+    for(int i = 0; i < nStreams; i++) {
+        streams[i].nWorkers = nReceiveWorkers;
+        if(streams[i].dataRoot[0] == '\0')
+            snprintf(streams[i].dataRoot, MAX_FILENAME_LENGTH, "%s/%d", dataRoot, streams[i].port);
+        if(!checkDataRootAccessible(streams[i].dataRoot))
+            diep("No read/write access to stream data root. Check permissions");
+    }
+
+    // block SIGINT and SIGTERM here so every thread started below inherits the
+    // mask, and wait for them in this thread instead
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+
+    startSec = getWallClockSec();
+    for(int i = 0; i < nStreams; i++) {
+        printf("Starting Data Logger on port %d => %s\n", streams[i].port, streams[i].dataRoot);
+        streams[i].lastStatsSec = startSec;
+        startSignalStream(streams + i);
     }
 
-    pthread_cancel(writerThread);
-    pthread_join(writerThread, NULL);
-    close(sock);
+    printf("Socket bound and waiting...\n");
+
+    // wait to be stopped, writing out stats every so often if asked to
+    int sig;
+    if(statsFileName == NULL)
+        sigwait(&stopSignals, &sig);
+    else {
+        struct timespec interval;
+        interval.tv_sec = statsIntervalSec;
+        interval.tv_nsec = 0;
+        while((sig = sigtimedwait(&stopSignals, NULL, &interval)) == -1)
+            writeStatsFile(statsFileName);
+    }
+    finish_main(sig);
 
     return(EXIT_SUCCESS);
 
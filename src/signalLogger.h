@@ -6,6 +6,6 @@
 void diep(const char *s);
 
 
-bool checkDataRootAccessible();
+bool checkDataRootAccessible(const char* dir);
 
 #endif
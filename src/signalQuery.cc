@@ -0,0 +1,248 @@
+/* Signal Query
+ *
+ * Pulls one signal over a range of timestamps out of the segment files written
+ * by signalLogger, using the reader in segmentReader.cc. Each segment's offset
+ * index (see segment.h) says which flushes hold the signal and what timestamps
+ * they span, so only those flushes are read and parsed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+
+// local includes
+#include "signal.h"
+#include "matfile.h"
+#include "matread.h"
+#include "columns.h"
+#include "segment.h"
+#include "segmentReader.h"
+#include "signalLogger.h"
+
+// NO TRAILING SLASH!
+#define DEFAULT_DATA_ROOT "/expdata/signals"
+#define DEFAULT_OUTPUT_FILE "query.mat"
+
+/// PRIVATE DECLARATIONS
+
+int filterDayFolder(const struct dirent* entry);
+void querySegmentsInFolder(const char* folder);
+void querySegment(const char* folder, const char* segmentName);
+void appendViewToResult(const SegmentSignalView*);
+void writeQueryResult(const char* outputFile);
+
+///////////// GLOBALS /////////////
+char dataRoot[MAX_FILENAME_LENGTH];
+
+// what we're looking for
+const char* queryName;
+uint32_t queryNameLength;
+uint32_t queryStart;
+uint32_t queryEnd;
+
+// one sample at a time is gathered here from a view
+uint8_t viewSample[MAX_DATA_SIZE_PER_TICK];
+
+// the matching samples, grouped like the columns output format
+SignalColumnSet resultColumns;
+
+int nSegmentsSearched;
+int nFlushesRead;
+int nFlushesSkipped;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: signalQuery [-r dataRoot] [-d YYYYMMDD] [-o output.mat] name tStart tEnd\n"
+           "  Extracts the samples of signal name with tStart <= timestamp <= tEnd\n"
+           "  -r dataRoot : where signalLogger wrote its data (default %s)\n"
+           "  -d day      : only search this day's folder\n"
+           "  -o file     : .mat file to write the samples to (default %s), laid out\n"
+           "                like signalLogger -f columns\n",
+           DEFAULT_DATA_ROOT, DEFAULT_OUTPUT_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* day = NULL;
+    const char* outputFile = DEFAULT_OUTPUT_FILE;
+    strncpy(dataRoot, DEFAULT_DATA_ROOT, MAX_FILENAME_LENGTH);
+
+    int opt;
+    while((opt = getopt(argc, argv, "r:d:o:")) != -1) {
+        switch(opt) {
+            case 'r':
+                strncpy(dataRoot, optarg, MAX_FILENAME_LENGTH - 1);
+                break;
+            case 'd':
+                day = optarg;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    if(argc - optind != 3) {
+        usage();
+        exit(1);
+    }
+    queryName = argv[optind];
+    queryNameLength = strlen(queryName);
+    queryStart = strtoul(argv[optind + 1], NULL, 10);
+    queryEnd = strtoul(argv[optind + 2], NULL, 10);
+
+    initSignalColumnSet(&resultColumns);
+
+    char folder[MAX_FILENAME_LENGTH];
+    if(day != NULL) {
+        snprintf(folder, MAX_FILENAME_LENGTH, "%s/%s", dataRoot, day);
+        querySegmentsInFolder(folder);
+    } else {
+        // search every day, in order
+        struct dirent** days;
+        int nDays = scandir(dataRoot, &days, filterDayFolder, alphasort);
+        if(nDays < 0)
+            diep("Error listing data root");
+
+        for(int i = 0; i < nDays; i++) {
+            snprintf(folder, MAX_FILENAME_LENGTH, "%s/%s", dataRoot, days[i]->d_name);
+            querySegmentsInFolder(folder);
+            free(days[i]);
+        }
+        free(days);
+    }
+
+    writeQueryResult(outputFile);
+
+    freeSignalColumnSet(&resultColumns);
+
+    return(EXIT_SUCCESS);
+}
+
+// the data root holds a YYYYMMDD folder per day
+int filterDayFolder(const struct dirent* entry)
+{
+    if(strlen(entry->d_name) != 8)
+        return 0;
+    for(int i = 0; i < 8; i++)
+        if(entry->d_name[i] < '0' || entry->d_name[i] > '9')
+            return 0;
+    return 1;
+}
+
+// the segments in a folder are listed in its index.txt in the order they were written
+void querySegmentsInFolder(const char* folder)
+{
+    char indexFileName[MAX_FILENAME_LENGTH];
+    snprintf(indexFileName, MAX_FILENAME_LENGTH, "%s/index.txt", folder);
+
+    FILE* indexFile = fopen(indexFileName, "r");
+    if(indexFile == NULL) {
+        fprintf(stderr, "Warning: could not open %s\n", indexFileName);
+        return;
+    }
+
+    char line[MAX_FILENAME_LENGTH];
+    while(fgets(line, MAX_FILENAME_LENGTH, indexFile) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] != '\0')
+            querySegment(folder, line);
+    }
+
+    fclose(indexFile);
+}
+
+void querySegment(const char* folder, const char* segmentName)
+{
+    char segmentFileName[MAX_FILENAME_LENGTH];
+    snprintf(segmentFileName, MAX_FILENAME_LENGTH, "%s/%s", folder, segmentName);
+
+    SegmentReader reader;
+    if(!openSegmentReader(&reader, segmentFileName)) {
+        fprintf(stderr, "Warning: could not open segment %s\n", segmentFileName);
+        return;
+    }
+    if(!reader.indexed)
+        fprintf(stderr, "Warning: no offset index for %s, searching every flush\n",
+                segmentFileName);
+    nSegmentsSearched++;
+
+    SegmentQuery query;
+    SegmentSignalView view;
+    beginSegmentQuery(&query, &reader, queryName, queryStart, queryEnd);
+    while(nextSegmentSignalView(&query, &view))
+        appendViewToResult(&view);
+
+    if(reader.nFlushesBad > 0)
+        fprintf(stderr, "Warning: could not read %u flushes of %s\n",
+                reader.nFlushesBad, segmentFileName);
+    nFlushesRead += reader.nFlushesRead;
+    nFlushesSkipped += reader.nFlushesSkipped;
+    closeSegmentReader(&reader);
+}
+
+// gather each sample of the view into viewSample and add it to its column,
+// narrowing chars back down from UTF-16
+void appendViewToResult(const SegmentSignalView* pview)
+{
+    Signal sig;
+    memset(&sig, 0, sizeof(Signal));
+    sig.name = queryName;
+    sig.lenName = queryNameLength;
+    sig.dataTypeId = pview->dataTypeId;
+    sig.nDims = pview->nDims;
+    memcpy(sig.dims, pview->dims, sizeof(sig.dims));
+
+    uint32_t elemBytes = getSizeOfDataTypeId(sig.dataTypeId);
+    sig.nBytes = pview->nElements * elemBytes;
+    if(sig.nBytes > sizeof(viewSample))
+        return;
+    sig.data = viewSample;
+
+    SignalColumn* pcol = findOrAddSignalColumn(&resultColumns, &sig);
+    for(uint32_t s = 0; s < pview->nSamples; s++) {
+        sig.timestamp = pview->timestamps[s];
+        for(uint32_t e = 0; e < pview->nElements; e++)
+            memcpy(viewSample + e * elemBytes,
+                    pview->data + ((size_t)s + (size_t)e * pview->stride) * pview->elemBytes,
+                    elemBytes);
+        appendSignalToColumn(pcol, &sig);
+    }
+}
+
+void writeQueryResult(const char* outputFile)
+{
+    MatBuffer mb;
+    initMatBuffer(&mb);
+    writeMatHeader(&mb);
+    writeSignalColumnsToMatBuffer(&mb, &resultColumns, "signals", 0);
+
+    FILE* fp = fopen(outputFile, "wb");
+    if(fp == NULL)
+        diep("Error opening output file");
+    if(fwrite(mb.data, 1, mb.nBytes, fp) != mb.nBytes)
+        diep("Error writing output file");
+    fclose(fp);
+    freeMatBuffer(&mb);
+
+    uint32_t nSamples = 0;
+    for(int c = 0; c < resultColumns.nColumns; c++)
+        nSamples += resultColumns.columns[c].nSamples;
+
+    printf("%u samples of %s ==> %s\n", nSamples, queryName, outputFile);
+    printf("searched %d segments, read %d flushes, skipped %d\n",
+            nSegmentsSearched, nFlushesRead, nFlushesSkipped);
+}
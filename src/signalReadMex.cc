@@ -0,0 +1,212 @@
+/* Signal Read MEX
+ *
+ * Pulls one signal over a range of timestamps out of signalLogger's segments
+ * straight into MATLAB, using the reader in segmentReader.cc, so only the
+ * flushes holding the signal are ever read rather than loading every file:
+ *
+ *     [timestamps, data] = signalRead(files, name)
+ *     [timestamps, data] = signalRead(files, name, tStart, tEnd)
+ *
+ * files is a segment's file name or a cell array of them, searched in order.
+ * timestamps is nSamples x 1 uint32 and data is nSamples x dims in the class
+ * the signal was logged as, laid out like the columns format. Build with
+ * make mex in src, which needs MATLAB_ROOT in the Makefile set.
+ */
+
+// matfile.h defines the mx*_CLASS ids as macros, which would clash with the
+// mxClassID enum in matrix.h, so mex.h must come first
+#include "mex.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "signal.h"
+#include "matfile.h"
+#include "segmentReader.h"
+#include "signalLogger.h"
+
+#define SIGNAL_READ_ERROR_ID "signalRead:error"
+
+/// PRIVATE DECLARATIONS
+bool readSignalFromSegment(const char* fileName);
+bool stageView(const SegmentSignalView*);
+mxArray* createDataOutput();
+
+///////////// GLOBALS /////////////
+
+// what we're looking for
+char queryName[UINT16_MAX + 1];
+uint32_t queryStart;
+uint32_t queryEnd;
+
+// the samples found so far, each sample's elements one after another with chars
+// as mxChar, and the shape they all have to share
+uint32_t nStagedSamples;
+uint32_t capacityStagedSamples;
+uint32_t* stagedTimestamps;
+uint8_t* stagedData;
+bool haveShape;
+SegmentSignalView shape;
+uint32_t stagedElemBytes;
+
+char errorMessage[2 * MAX_FILENAME_LENGTH];
+
+// the reader's only unrecoverable errors are failed allocations
+void diep(const char *s)
+{
+    mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "%s: %s", s, strerror(errno));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if(nrhs != 2 && nrhs != 4)
+        mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID,
+                "Usage: [timestamps, data] = signalRead(files, name[, tStart, tEnd])");
+    if(nlhs > 2)
+        mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "Too many outputs");
+
+    const mxArray* pFiles = prhs[0];
+    if(!mxIsChar(pFiles) && !mxIsCell(pFiles))
+        mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "files must be a string or a cell array of strings");
+    if(!mxIsChar(prhs[1]) || mxGetString(prhs[1], queryName, sizeof(queryName)) != 0)
+        mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "name must be a string");
+
+    queryStart = 0;
+    queryEnd = UINT32_MAX;
+    if(nrhs == 4) {
+        if(!mxIsNumeric(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1 ||
+                !mxIsNumeric(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1)
+            mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "tStart and tEnd must be numeric scalars");
+        double tStart = mxGetScalar(prhs[2]);
+        double tEnd = mxGetScalar(prhs[3]);
+        queryStart = tStart <= 0 ? 0 : tStart >= UINT32_MAX ? UINT32_MAX : (uint32_t)tStart;
+        queryEnd = tEnd <= 0 ? 0 : tEnd >= UINT32_MAX ? UINT32_MAX : (uint32_t)tEnd;
+    }
+
+    nStagedSamples = 0;
+    capacityStagedSamples = 0;
+    stagedTimestamps = NULL;
+    stagedData = NULL;
+    haveShape = false;
+
+    char fileName[MAX_FILENAME_LENGTH];
+    size_t nFiles = mxIsChar(pFiles) ? 1 : mxGetNumberOfElements(pFiles);
+    for(size_t i = 0; i < nFiles; i++) {
+        const mxArray* pFile = mxIsChar(pFiles) ? pFiles : mxGetCell(pFiles, i);
+        if(pFile == NULL || !mxIsChar(pFile) ||
+                mxGetString(pFile, fileName, sizeof(fileName)) != 0)
+            mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "files must be a string or a cell array of strings");
+
+        // the reader is closed before raising any error, which never returns
+        if(!readSignalFromSegment(fileName))
+            mexErrMsgIdAndTxt(SIGNAL_READ_ERROR_ID, "%s", errorMessage);
+    }
+
+    plhs[0] = mxCreateNumericMatrix(nStagedSamples, 1, (mxClassID)mxUINT32_CLASS, mxREAL);
+    memcpy(mxGetData(plhs[0]), stagedTimestamps, nStagedSamples * sizeof(uint32_t));
+    if(nlhs > 1)
+        plhs[1] = createDataOutput();
+
+    mxFree(stagedTimestamps);
+    mxFree(stagedData);
+}
+
+bool readSignalFromSegment(const char* fileName)
+{
+    SegmentReader reader;
+    if(!openSegmentReader(&reader, fileName)) {
+        snprintf(errorMessage, sizeof(errorMessage), "Could not open segment %s", fileName);
+        return false;
+    }
+
+    bool ok = true;
+    SegmentQuery query;
+    SegmentSignalView view;
+    beginSegmentQuery(&query, &reader, queryName, queryStart, queryEnd);
+    while(ok && nextSegmentSignalView(&query, &view))
+        if(!stageView(&view)) {
+            snprintf(errorMessage, sizeof(errorMessage),
+                    "%s changes type or size in flush %u of %s, which signalRead can't return "
+                    "as one array", queryName, view.flushNumber, fileName);
+            ok = false;
+        }
+
+    if(ok && reader.nFlushesBad > 0)
+        mexWarnMsgIdAndTxt("signalRead:badFlushes", "Could not read %u flushes of %s",
+                reader.nFlushesBad, fileName);
+    closeSegmentReader(&reader);
+    return ok;
+}
+
+// copy the view's samples onto the end of those staged, returning false if its
+// shape differs from theirs
+bool stageView(const SegmentSignalView* pview)
+{
+    if(!haveShape) {
+        shape = *pview;
+        haveShape = true;
+        stagedElemBytes = pview->dataTypeId == DTID_CHAR ? sizeof(mxChar) :
+            getSizeOfDataTypeId(pview->dataTypeId);
+    } else if(pview->dataTypeId != shape.dataTypeId || pview->nDims != shape.nDims ||
+            memcmp(pview->dims, shape.dims, shape.nDims * sizeof(uint16_t)) != 0) {
+        return false;
+    }
+
+    uint32_t nSampleBytes = pview->nElements * stagedElemBytes;
+    if(nStagedSamples + pview->nSamples > capacityStagedSamples) {
+        capacityStagedSamples = 2 * (nStagedSamples + pview->nSamples);
+        stagedTimestamps = (uint32_t*)mxRealloc(stagedTimestamps,
+                capacityStagedSamples * sizeof(uint32_t));
+        stagedData = (uint8_t*)mxRealloc(stagedData, (size_t)capacityStagedSamples * nSampleBytes);
+    }
+
+    memcpy(stagedTimestamps + nStagedSamples, pview->timestamps, pview->nSamples * sizeof(uint32_t));
+    uint8_t* pOut = stagedData + (size_t)nStagedSamples * nSampleBytes;
+    for(uint32_t s = 0; s < pview->nSamples; s++)
+        for(uint32_t e = 0; e < pview->nElements; e++, pOut += stagedElemBytes) {
+            if(pview->dataTypeId == DTID_CHAR && pview->elemBytes == 1) {
+                mxChar c = SEGMENT_VIEW_ELEMENT(uint8_t, pview, s, e);
+                memcpy(pOut, &c, sizeof(mxChar));
+            } else {
+                memcpy(pOut, pview->data + ((size_t)s + (size_t)e * pview->stride) *
+                        pview->elemBytes, stagedElemBytes);
+            }
+        }
+
+    nStagedSamples += pview->nSamples;
+    return true;
+}
+
+// the staged samples as an nSamples x dims array, i.e. element e of sample s
+// goes to s + nSamples * e
+mxArray* createDataOutput()
+{
+    if(!haveShape)
+        return mxCreateDoubleMatrix(0, 0, mxREAL);
+
+    mwSize dims[MAX_SIGNAL_NDIMS + 1];
+    mwSize nDims = 0;
+    dims[nDims++] = nStagedSamples;
+    for(int i = 0; i < shape.nDims; i++)
+        dims[nDims++] = shape.dims[i];
+    if(nDims == 1)
+        dims[nDims++] = 1;
+
+    // the class ids in a MAT-file are MATLAB's own mxClassID values, as are
+    // the macros for them in matfile.h
+    mxArray* pData;
+    if(shape.dataTypeId == DTID_CHAR)
+        pData = mxCreateCharArray(nDims, dims);
+    else
+        pData = mxCreateNumericArray(nDims, dims,
+                (mxClassID)convertDataTypeIdToMxClassId(shape.dataTypeId), mxREAL);
+
+    uint8_t* pOut = (uint8_t*)mxGetData(pData);
+    for(uint32_t s = 0; s < nStagedSamples; s++)
+        for(uint32_t e = 0; e < shape.nElements; e++)
+            memcpy(pOut + ((size_t)s + (size_t)e * nStagedSamples) * stagedElemBytes,
+                    stagedData + ((size_t)s * shape.nElements + e) * stagedElemBytes,
+                    stagedElemBytes);
+    return pData;
+}
@@ -0,0 +1,152 @@
+/* Signal Tap
+ *
+ * Prints the signals a running signalLogger is receiving, live, by reading the
+ * shared memory tap it publishes them to (see tap.h). Mostly an example of 
+ * reading the tap, and a way to check what a model is sending.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <inttypes.h>
+
+// local includes
+#include "signal.h"
+#include "tap.h"
+#include "signalLogger.h"
+
+#define DEFAULT_PORT 25000
+
+/* how long to sleep when caught up with the logger */
+#define TAP_POLL_USEC 200
+
+#define MAX_PRINTED_NAME_LENGTH 256
+
+/// PRIVATE DECLARATIONS
+
+void printTapSignal(const Signal* psig);
+double getSignalValue(const Signal* psig, uint32_t index);
+void finishTap(int sig);
+
+///////////// GLOBALS /////////////
+volatile sig_atomic_t stopping = 0;
+
+void diep(const char *s)
+{
+    perror(s);
+    exit(1);
+}
+
+void usage()
+{
+    printf("Usage: signalTap [-w worker] [-n signals] [port]\n"
+           "  Prints the signals signalLogger receives on port (default %d) as they\n"
+           "  arrive, along with the first value of each\n"
+           "  -w worker  : which of the port's receive threads to watch (default 0)\n"
+           "  -n signals : stop after printing this many signals\n",
+           DEFAULT_PORT);
+}
+
+void finishTap(int sig)
+{
+    stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int port = DEFAULT_PORT;
+    int worker = 0;
+    long maxSignals = -1;
+
+    int opt;
+    while((opt = getopt(argc, argv, "w:n:")) != -1) {
+        switch(opt) {
+            case 'w':
+                worker = atoi(optarg);
+                break;
+            case 'n':
+                maxSignals = atol(optarg);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+    if(optind < argc)
+        port = atoi(argv[optind]);
+
+    TapReader reader;
+    if(!openTapReader(&reader, port, worker)) {
+        fprintf(stderr, "No tap for port %d worker %d, is signalLogger running with -t?\n",
+                port, worker);
+        exit(1);
+    }
+
+    signal(SIGINT, finishTap);
+
+    long nSignals = 0;
+    uint64_t nLappedReported = 0;
+    while(!stopping && nSignals != maxSignals)
+    {
+        const TapRecord* prec = peekTapRecord(&reader);
+        if(prec == NULL) {
+            usleep(TAP_POLL_USEC);
+            continue;
+        }
+
+        // read the signal in place, only printing it once it's known to be intact
+        Signal sig;
+        bool valid = viewTapRecord(&reader, prec, &sig);
+        char name[MAX_PRINTED_NAME_LENGTH];
+        snprintf(name, sizeof(name), "%.*s", valid ? (int)sig.lenName : 0, sig.name);
+        double value = valid && sig.nBytes > 0 ? getSignalValue(&sig, 0) : 0;
+
+        if(!finishTapRecord(&reader) || !valid)
+            continue;
+
+        sig.name = name;
+        sig.lenName = strlen(name);
+        printTapSignal(&sig);
+        if(sig.nBytes > 0)
+            printf(" : %g\n", value);
+        else
+            printf("\n");
+        nSignals++;
+
+        if(reader.nLapped != nLappedReported) {
+            fprintf(stderr, "WARNING: fell behind the logger, skipped ahead %lu times\n",
+                    (unsigned long)reader.nLapped);
+            nLappedReported = reader.nLapped;
+        }
+    }
+
+    closeTapReader(&reader);
+    return(EXIT_SUCCESS);
+}
+
+void printTapSignal(const Signal* psig)
+{
+    printf("%u : %s [", psig->timestamp, psig->name);
+    for(int idim = 0; idim < psig->nDims; idim++)
+        printf(idim ? " x %d" : "%d", (int)psig->dims[idim]);
+    printf(" %s]", getDataTypeIdName(psig->dataTypeId));
+}
+
+double getSignalValue(const Signal* psig, uint32_t index)
+{
+    const uint8_t* p = psig->data + index * getSizeOfDataTypeId(psig->dataTypeId);
+
+    switch(psig->dataTypeId) {
+        case DTID_DOUBLE: { double_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case DTID_SINGLE: { single_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case DTID_INT8:   return *(const int8_t*)p;
+        case DTID_INT16:  { int16_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case DTID_UINT16: { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case DTID_INT32:  { int32_t v; memcpy(&v, p, sizeof(v)); return v; }
+        case DTID_UINT32: { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+        default:          return *p;
+    }
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/// PRIVATE DECLARATIONS
+uint64_t getHistogramPercentile(const StatsHistogram* ph, double fraction);
+
+// CLOCK_MONOTONIC in microseconds, wrapping every 71 minutes, so differences of
+// two are only good as uint32_t
+uint32_t getMonotonicUsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+// only to be called by the histogram's own thread
+void addToHistogram(StatsHistogram* ph, uint64_t value)
+{
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if(bucket >= STATS_HISTOGRAM_BUCKETS)
+        bucket = STATS_HISTOGRAM_BUCKETS - 1;
+
+    STAT_ADD(ph->counts[bucket], 1);
+    STAT_ADD(ph->n, 1);
+    STAT_ADD(ph->sum, value);
+    STAT_MAX(ph->max, value);
+}
+
+// add a snapshot of psrc, which another thread may be updating, into pdest
+void mergeHistogram(StatsHistogram* pdest, const StatsHistogram* psrc)
+{
+    for(int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        pdest->counts[i] += STAT_LOAD(psrc->counts[i]);
+    pdest->n += STAT_LOAD(psrc->n);
+    pdest->sum += STAT_LOAD(psrc->sum);
+    uint64_t max = STAT_LOAD(psrc->max);
+    if(max > pdest->max)
+        pdest->max = max;
+}
+
+// the upper edge of the bucket holding the given fraction of the values
+uint64_t getHistogramPercentile(const StatsHistogram* ph, double fraction)
+{
+    uint64_t n = 0;
+    for(int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        n += ph->counts[i];
+    if(n == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(fraction * n);
+    uint64_t seen = 0;
+    for(int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += ph->counts[i];
+        if(seen > target) {
+            uint64_t upper = i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+            return upper < ph->max ? upper : ph->max;
+        }
+    }
+    return ph->max;
+}
+
+// write str as a quoted JSON string, escaping what a path may hold that JSON
+// doesn't allow as is
+void writeJsonString(FILE* fp, const char* str)
+{
+    fputc('"', fp);
+    for(const char* p = str; *p != '\0'; p++) {
+        if(*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if((unsigned char)*p < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*p);
+        else
+            fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+void writeHistogramJson(FILE* fp, const char* name, const StatsHistogram* ph)
+{
+    fprintf(fp, "\"%s\": {\"count\": %llu, \"mean\": %.1f, \"max\": %llu, "
+            "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"buckets\": [",
+            name, (unsigned long long)ph->n, ph->n ? (double)ph->sum / ph->n : 0.0,
+            (unsigned long long)ph->max,
+            (unsigned long long)getHistogramPercentile(ph, 0.5),
+            (unsigned long long)getHistogramPercentile(ph, 0.9),
+            (unsigned long long)getHistogramPercentile(ph, 0.99));
+
+    // trailing empty buckets are left off
+    int nBuckets = STATS_HISTOGRAM_BUCKETS;
+    while(nBuckets > 0 && ph->counts[nBuckets - 1] == 0)
+        nBuckets--;
+    for(int i = 0; i < nBuckets; i++)
+        fprintf(fp, i ? ", %llu" : "%llu", (unsigned long long)ph->counts[i]);
+    fprintf(fp, "]}");
+}
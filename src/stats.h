@@ -0,0 +1,77 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// Counters and histograms kept while logging, written out as JSON every so
+// often with -j. Each counter has a single thread that updates it, using
+// relaxed atomic loads and stores so that updating costs no more than a plain
+// increment, and the thread writing the stats file reads it with a relaxed load.
+
+/* histogram bucket i counts values in [2^(i-1), 2^i), bucket 0 counts 0 */
+#define STATS_HISTOGRAM_BUCKETS 32
+
+/* how often the stats file is rewritten by default */
+#define DEFAULT_STATS_INTERVAL_SEC 1
+
+#define STAT_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define STAT_ADD(counter, n) \
+    __atomic_store_n(&(counter), STAT_LOAD(counter) + (n), __ATOMIC_RELAXED)
+#define STAT_MAX(counter, value) \
+    do { if((value) > STAT_LOAD(counter)) \
+        __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED); } while(0)
+
+typedef struct StatsHistogram {
+    uint64_t counts[STATS_HISTOGRAM_BUCKETS];
+    uint64_t n;
+    uint64_t sum;
+    uint64_t max;
+} StatsHistogram;
+
+// kept by each receive thread, in its SignalBuffers
+typedef struct ReceiveStats {
+    uint64_t packets;
+    uint64_t packetBytes;
+    uint64_t invalidPackets;
+    uint64_t ticks;            // complete ticks processed, dictionaries included
+    uint64_t incompleteTicks;  // given up on before all of their packets arrived
+    uint64_t partialTicks;     // incomplete ticks decoded as far as possible (-P)
+    uint64_t recoveredSignals; // from partial ticks
+    uint64_t malformedTicks;
+    uint64_t unknownSignalIds;
+    uint64_t signals;          // queued for the writer
+    uint64_t droppedSignals;   // no room for them in the signal buffer
+    uint64_t signalBufferHighWaterBytes;
+} ReceiveStats;
+
+// kept by each writer, each stage updating its own
+typedef struct WriterStats {
+    uint64_t flushes;
+    uint64_t signals;
+    uint64_t bytes;    // appended to segments, index records not included
+    uint64_t segments;
+
+    // with compression: variable bytes before and after, and the cpu time the
+    // compression workers spent between them
+    uint64_t compressInBytes;
+    uint64_t compressOutBytes;
+    uint64_t compressBusyUsec;
+
+    // from a signal's tick being complete to the flush holding it being
+    // written to its segment, in microseconds, for every signal
+    StatsHistogram latencyUsec;
+
+    // time each stage spends on a flush, in microseconds
+    StatsHistogram drainUsec;
+    StatsHistogram encodeUsec;
+    StatsHistogram writeUsec;
+} WriterStats;
+
+uint32_t getMonotonicUsec();
+void addToHistogram(StatsHistogram*, uint64_t value);
+void mergeHistogram(StatsHistogram* pdest, const StatsHistogram* psrc);
+void writeHistogramJson(FILE* fp, const char* name, const StatsHistogram* ph);
+void writeJsonString(FILE* fp, const char* str);
+
+#endif
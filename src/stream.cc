@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "stream.h"
+
+// set from the command line in signalLogger.cc
+extern int recvBufferBytes;
+extern int recvBatchSize;
+extern bool countKernelDrops;
+extern int highWaterSignals;
+extern uint32_t highWaterBytes;
+extern uint64_t tapBytes;
+extern bool bigEndianSenders;
+extern int partialTickMsec;
+
+/// PRIVATE DECLARATIONS
+void startReceiveWorker(ReceiveWorker* pwork, int cpu);
+void * receiveWorkerThread(void * arg);
+void sumReceiveStats(const SignalStream* pstream, ReceiveStats* ptotal, uint64_t* pKernelDrops);
+double getStatsRate(uint64_t total, uint64_t* pLast, double intervalSec);
+
+// open the stream's sockets and start its writer and receive threads. port, 
+// cpu, nWorkers, dataRoot and label must already be filled in
+void startSignalStream(SignalStream* pstream)
+{
+    SignalBuffers* pbufs[MAX_RECEIVE_WORKERS];
+    bool reusePort = pstream->nWorkers > 1;
+
+    for(int i = 0; i < pstream->nWorkers; i++) {
+        ReceiveWorker* pwork = pstream->workers + i;
+        openReceiveSocket(&pwork->receiver, pstream->port, recvBufferBytes, recvBatchSize,
+                countKernelDrops, reusePort);
+        if(reusePort && i == 0)
+            attachReceiveFanout(&pwork->receiver, pstream->nWorkers, bigEndianSenders);
+
+        pwork->pbuf = pbufs[i] = allocSignalBuffers();
+        initSignalBufferWakeup(pwork->pbuf, highWaterSignals, highWaterBytes);
+        pwork->pbuf->schemas.swapBytes = bigEndianSenders;
+        pwork->pbuf->warnSignalIds = reusePort && i == 0;
+
+        // wake up at least twice per deadline to give up on ticks past it
+        if(partialTickMsec > 0) {
+            pwork->pbuf->partialTickUsec = (uint32_t)partialTickMsec * 1000;
+            setReceiveTimeout(&pwork->receiver, partialTickMsec > 1 ? partialTickMsec / 2 : 1);
+        }
+
+        if(tapBytes > 0) {
+            openSignalTap(&pwork->tap, pstream->port, i, tapBytes);
+            pwork->pbuf->ptap = &pwork->tap;
+        }
+    }
+
+    // Start the drain, encode and write threads
+    startSignalWriter(&pstream->writer, pbufs, pstream->nWorkers, pstream->dataRoot, 
+            pstream->label);
+
+    for(int i = 0; i < pstream->nWorkers; i++)
+        startReceiveWorker(pstream->workers + i, 
+                pstream->cpu == STREAM_CPU_ANY ? STREAM_CPU_ANY : pstream->cpu + i);
+}
+
+void stopSignalStream(SignalStream* pstream)
+{
+    for(int i = 0; i < pstream->nWorkers; i++) {
+        pthread_cancel(pstream->workers[i].thread);
+        pthread_join(pstream->workers[i].thread, NULL);
+    }
+
+    stopSignalWriter(&pstream->writer);
+
+    for(int i = 0; i < pstream->nWorkers; i++) {
+        close(pstream->workers[i].receiver.sock);
+        closeSignalTap(&pstream->workers[i].tap);
+        freeSignalBuffers(pstream->workers[i].pbuf);
+    }
+}
+
+void startReceiveWorker(ReceiveWorker* pwork, int cpu)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(cpu != STREAM_CPU_ANY) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus))
+            diep("Error setting receive thread affinity");
+    }
+
+    if(pthread_create(&pwork->thread, &attr, receiveWorkerThread, pwork))
+        diep("Error creating receive thread");
+    pthread_attr_destroy(&attr);
+}
+
+void * receiveWorkerThread(void * arg)
+{
+    ReceiveWorker* pwork = (ReceiveWorker*)arg;
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    while(1)
+    {
+        // choose where each packet's data should be received, ideally straight
+        // into its place in a tick buffer
+        getPacketLandings(pwork->pbuf, &pwork->packetBatch);
+
+        // Read as many packets from the socket as are waiting, this is where 
+        // the thread is cancelled
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        receivePacketBatch(&pwork->receiver, &pwork->packetBatch);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        // parse each packet, add it to its PacketSet, and process the PacketSet
+        // into signals on the SignalBuffer once all of its packets are received
+        processPacketBatch(pwork->pbuf, &pwork->packetBatch);
+    }
+
+    return NULL;
+}
+
+/////// STATS /////////
+
+// add up the receive threads' counters
+void sumReceiveStats(const SignalStream* pstream, ReceiveStats* ptotal, uint64_t* pKernelDrops)
+{
+    memset(ptotal, 0, sizeof(ReceiveStats));
+    *pKernelDrops = 0;
+
+    for(int i = 0; i < pstream->nWorkers; i++) {
+        const ReceiveStats* ps = &pstream->workers[i].pbuf->stats;
+        ptotal->packets += STAT_LOAD(ps->packets);
+        ptotal->packetBytes += STAT_LOAD(ps->packetBytes);
+        ptotal->invalidPackets += STAT_LOAD(ps->invalidPackets);
+        ptotal->ticks += STAT_LOAD(ps->ticks);
+        ptotal->incompleteTicks += STAT_LOAD(ps->incompleteTicks);
+        ptotal->malformedTicks += STAT_LOAD(ps->malformedTicks);
+        ptotal->partialTicks += STAT_LOAD(ps->partialTicks);
+        ptotal->recoveredSignals += STAT_LOAD(ps->recoveredSignals);
+        ptotal->unknownSignalIds += STAT_LOAD(ps->unknownSignalIds);
+        ptotal->signals += STAT_LOAD(ps->signals);
+        ptotal->droppedSignals += STAT_LOAD(ps->droppedSignals);
+
+        // each thread has its own signal buffer, report the fullest
+        uint64_t highWater = STAT_LOAD(ps->signalBufferHighWaterBytes);
+        if(highWater > ptotal->signalBufferHighWaterBytes)
+            ptotal->signalBufferHighWaterBytes = highWater;
+
+        *pKernelDrops += STAT_LOAD(pstream->workers[i].receiver.kernelDropCount);
+    }
+}
+
+// per second since the last call, remembering total for the next
+double getStatsRate(uint64_t total, uint64_t* pLast, double intervalSec)
+{
+    double rate = intervalSec > 0 ? (total - *pLast) / intervalSec : 0;
+    *pLast = total;
+    return rate;
+}
+
+// write the stream's counters, rates since the last call and histograms as a
+// JSON object
+void writeSignalStreamStats(FILE* fp, SignalStream* pstream, double nowSec)
+{
+    ReceiveStats rs;
+    uint64_t kernelDrops;
+    sumReceiveStats(pstream, &rs, &kernelDrops);
+
+    const WriterStats* pws = &pstream->writer.stats;
+    uint64_t flushes = STAT_LOAD(pws->flushes);
+    uint64_t signalsWritten = STAT_LOAD(pws->signals);
+    uint64_t bytesWritten = STAT_LOAD(pws->bytes);
+    uint64_t segments = STAT_LOAD(pws->segments);
+
+    double intervalSec = pstream->lastStatsSec > 0 ? nowSec - pstream->lastStatsSec : 0;
+    pstream->lastStatsSec = nowSec;
+
+    fprintf(fp, "{\"port\": %d, \"dataRoot\": ", pstream->port);
+    writeJsonString(fp, pstream->dataRoot);
+    fprintf(fp, ", \"receiveThreads\": %d,\n", pstream->nWorkers);
+
+    fprintf(fp, "  \"receive\": {\"packets\": %llu, \"packetBytes\": %llu, "
+            "\"invalidPackets\": %llu, \"kernelDrops\": %llu, \"ticks\": %llu, "
+            "\"incompleteTicks\": %llu, \"partialTicks\": %llu, \"recoveredSignals\": %llu, "
+            "\"malformedTicks\": %llu, \"unknownSignalIds\": %llu, \"signals\": %llu, \"droppedSignals\": %llu, "
+            "\"signalBufferHighWaterBytes\": %llu, \"signalBufferBytes\": %d},\n",
+            (unsigned long long)rs.packets, (unsigned long long)rs.packetBytes,
+            (unsigned long long)rs.invalidPackets, (unsigned long long)kernelDrops,
+            (unsigned long long)rs.ticks, (unsigned long long)rs.incompleteTicks,
+            (unsigned long long)rs.partialTicks, (unsigned long long)rs.recoveredSignals,
+            (unsigned long long)rs.malformedTicks, (unsigned long long)rs.unknownSignalIds,
+            (unsigned long long)rs.signals, (unsigned long long)rs.droppedSignals,
+            (unsigned long long)rs.signalBufferHighWaterBytes, SIGNAL_BUFFER_BYTES);
+
+    fprintf(fp, "  \"write\": {\"flushes\": %llu, \"signals\": %llu, \"bytes\": %llu, "
+            "\"segments\": %llu},\n",
+            (unsigned long long)flushes, (unsigned long long)signalsWritten,
+            (unsigned long long)bytesWritten, (unsigned long long)segments);
+
+    if(pstream->writer.compressing) {
+        uint64_t inBytes = STAT_LOAD(pws->compressInBytes);
+        uint64_t outBytes = STAT_LOAD(pws->compressOutBytes);
+        uint64_t busyUsec = STAT_LOAD(pws->compressBusyUsec);
+        fprintf(fp, "  \"compress\": {\"level\": %d, \"threads\": %d, \"inBytes\": %llu, "
+                "\"outBytes\": %llu, \"ratio\": %.3f, \"busySec\": %.3f, "
+                "\"mbPerSecPerCore\": %.1f},\n",
+                pstream->writer.compressor.level, pstream->writer.compressor.nWorkers,
+                (unsigned long long)inBytes, (unsigned long long)outBytes,
+                outBytes ? (double)inBytes / outBytes : 0.0, busyUsec / 1e6,
+                busyUsec ? (double)inBytes / busyUsec : 0.0);
+    }
+
+    fprintf(fp, "  \"ratesPerSec\": {\"intervalSec\": %.3f, \"packets\": %.1f, "
+            "\"ticks\": %.1f, \"signalsWritten\": %.1f, \"bytesWritten\": %.1f},\n",
+            intervalSec,
+            getStatsRate(rs.packets, &pstream->lastPackets, intervalSec),
+            getStatsRate(rs.ticks, &pstream->lastTicks, intervalSec),
+            getStatsRate(signalsWritten, &pstream->lastSignalsWritten, intervalSec),
+            getStatsRate(bytesWritten, &pstream->lastBytesWritten, intervalSec));
+
+    // histograms are cumulative, in microseconds
+    StatsHistogram h;
+    fprintf(fp, "  ");
+    memset(&h, 0, sizeof(h));
+    mergeHistogram(&h, &pws->latencyUsec);
+    writeHistogramJson(fp, "latencyUsec", &h);
+    fprintf(fp, ",\n  \"stageUsec\": {\n    ");
+    memset(&h, 0, sizeof(h));
+    mergeHistogram(&h, &pws->drainUsec);
+    writeHistogramJson(fp, "drain", &h);
+    fprintf(fp, ",\n    ");
+    memset(&h, 0, sizeof(h));
+    mergeHistogram(&h, &pws->encodeUsec);
+    writeHistogramJson(fp, "encode", &h);
+    fprintf(fp, ",\n    ");
+    memset(&h, 0, sizeof(h));
+    mergeHistogram(&h, &pws->writeUsec);
+    writeHistogramJson(fp, "write", &h);
+    fprintf(fp, "}}");
+}
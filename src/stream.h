@@ -0,0 +1,60 @@
+#ifndef STREAM_H_INCLUDED
+#define STREAM_H_INCLUDED
+
+#include <pthread.h>
+#include "buffer.h"
+#include "receiver.h"
+#include "writer.h"
+#include "tap.h"
+#include "signalLogger.h"
+
+// A stream is one port, typically one Simulink model, logged to its own data
+// root. Each stream has its own socket, receive thread, signal buffers and 
+// writer threads, so streams run side by side without sharing any locks.
+//
+// A stream too busy for one receive thread can be spread over several. Each 
+// receive worker has its own SO_REUSEPORT socket on the stream's port and its 
+// own signal buffers, and reassembles and decodes the ticks the kernel hands 
+// its socket. The writer merges the workers' signals back into timestamp order.
+
+/* most streams one logger can receive */
+#define MAX_SIGNAL_STREAMS 16
+
+/* most receive threads one stream can be spread over */
+#define MAX_RECEIVE_WORKERS MAX_WAKEUP_BUFFERS
+
+/* cpu for a stream's receive thread when it isn't pinned to one */
+#define STREAM_CPU_ANY -1
+
+typedef struct ReceiveWorker {
+    PacketReceiver receiver;
+    PacketBatch packetBatch;
+    SignalBuffers* pbuf;
+    SignalTap tap;
+
+    pthread_t thread;
+} ReceiveWorker;
+
+typedef struct SignalStream {
+    int port;
+    int cpu; // of the first receive worker, the rest take the cpus after it
+    int nWorkers;
+    char dataRoot[MAX_FILENAME_LENGTH];
+    char label[MAX_WRITER_LABEL_LENGTH];
+
+    ReceiveWorker workers[MAX_RECEIVE_WORKERS];
+    SignalWriter writer;
+
+    // totals when the stats file was last written, for working out rates
+    double lastStatsSec;
+    uint64_t lastPackets;
+    uint64_t lastTicks;
+    uint64_t lastSignalsWritten;
+    uint64_t lastBytesWritten;
+} SignalStream;
+
+void startSignalStream(SignalStream*);
+void stopSignalStream(SignalStream*);
+void writeSignalStreamStats(FILE* fp, SignalStream*, double nowSec);
+
+#endif
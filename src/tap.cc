@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tap.h"
+#include "signalLogger.h"
+
+/// PRIVATE DECLARATIONS
+void formatTapName(char* name, int port, int worker);
+TapRecord* reserveTapRecord(SignalTap* ptap, uint64_t length);
+void writeTapSignalHeader(uint8_t* pHeader, const SignalDescriptor* pdesc);
+uint64_t loadTapReserved(const TapReader* pr);
+
+void formatTapName(char* name, int port, int worker)
+{
+    snprintf(name, MAX_TAP_NAME_LENGTH, "/signalLogger.%d.%d", port, worker);
+}
+
+/////// PUBLISHING /////////
+
+// create the shared memory object for a worker's tap, arenaBytes must be a
+// power of 2
+void openSignalTap(SignalTap* ptap, int port, int worker, uint64_t arenaBytes)
+{
+    memset(ptap, 0, sizeof(SignalTap));
+    formatTapName(ptap->name, port, worker);
+
+    // readers only ever map it read only
+    int fd = shm_open(ptap->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+        diep("Error creating tap shared memory");
+
+    ptap->mapBytes = TAP_HEADER_BYTES + arenaBytes;
+    if(ftruncate(fd, ptap->mapBytes) == -1)
+        diep("Error sizing tap shared memory");
+
+    void* pmap = mmap(NULL, ptap->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(pmap == MAP_FAILED)
+        diep("Error mapping tap shared memory");
+    close(fd);
+
+    ptap->pheader = (TapHeader*)pmap;
+    ptap->arena = (uint8_t*)pmap + TAP_HEADER_BYTES;
+    ptap->arenaBytes = arenaBytes;
+
+    ptap->pheader->version = TAP_VERSION;
+    ptap->pheader->headerBytes = TAP_HEADER_BYTES;
+    ptap->pheader->arenaBytes = arenaBytes;
+    ptap->pheader->port = port;
+    ptap->pheader->worker = worker;
+
+    // readers check the magic last
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ptap->pheader->magic, TAP_MAGIC, TAP_MAGIC_LENGTH);
+
+    printf("Tap : %s, %lu bytes\n", ptap->name, (unsigned long)arenaBytes);
+}
+
+void closeSignalTap(SignalTap* ptap)
+{
+    if(ptap->pheader == NULL)
+        return;
+    munmap(ptap->pheader, ptap->mapBytes);
+    shm_unlink(ptap->name);
+    ptap->pheader = NULL;
+}
+
+// copy a signal into the ring, readers see it once commitTapSignals is called.
+// Signals too big for a quarter of the ring aren't published
+void publishTapSignal(SignalTap* ptap, const SignalDescriptor* pdesc, const Signal* psig)
+{
+    uint64_t length = sizeof(TapRecord) + ALIGN_TAP_RECORD(pdesc->nHeaderBytes) +
+        ALIGN_TAP_RECORD(psig->nBytes);
+    if(length > ptap->arenaBytes / 4)
+        return;
+
+    TapRecord* prec = reserveTapRecord(ptap, length);
+    prec->position = ptap->head;
+    prec->length = length;
+    prec->timestamp = psig->timestamp;
+    prec->nHeaderBytes = pdesc->nHeaderBytes;
+    prec->nBytes = psig->nBytes;
+
+    uint8_t* pHeader = (uint8_t*)(prec + 1);
+    writeTapSignalHeader(pHeader, pdesc);
+    memcpy(pHeader + ALIGN_TAP_RECORD(pdesc->nHeaderBytes), psig->data, psig->nBytes);
+
+    ptap->head += length;
+}
+
+// the descriptor's header as a little endian sender would have sent it. 
+// pdesc->header is in the senders' byte order, which with -e big isn't the 
+// tap's, so it's written out again from the decoded fields
+void writeTapSignalHeader(uint8_t* pHeader, const SignalDescriptor* pdesc)
+{
+    memcpy(pHeader, &pdesc->lenName, sizeof(uint16_t));
+    pHeader += sizeof(uint16_t);
+    memcpy(pHeader, pdesc->name, pdesc->lenName);
+    pHeader += pdesc->lenName;
+    *pHeader++ = pdesc->dataTypeId;
+    *pHeader++ = pdesc->nDims;
+    memcpy(pHeader, pdesc->dims, pdesc->nDims * sizeof(uint16_t));
+}
+
+// let readers see every signal published since the last commit
+void commitTapSignals(SignalTap* ptap)
+{
+    __atomic_store_n(&ptap->pheader->head, ptap->head, __ATOMIC_RELEASE);
+}
+
+// make room for a record of length bytes at head, filling in the end of the
+// ring and moving on to its start if it doesn't fit before the end
+TapRecord* reserveTapRecord(SignalTap* ptap, uint64_t length)
+{
+    uint64_t offset = ptap->head & (ptap->arenaBytes - 1);
+    uint64_t bytesToEnd = ptap->arenaBytes - offset;
+    uint64_t skipBytes = length > bytesToEnd ? bytesToEnd : 0;
+
+    // tell readers what's about to be overwritten before touching it
+    if(ptap->head + skipBytes + length > ptap->reserved) {
+        ptap->reserved = ptap->head + skipBytes + length + TAP_RESERVE_AHEAD_BYTES;
+        __atomic_store_n(&ptap->pheader->reserved, ptap->reserved, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    if(skipBytes) {
+        if(bytesToEnd >= sizeof(TapRecord)) {
+            TapRecord* pfill = (TapRecord*)(ptap->arena + offset);
+            memset(pfill, 0, sizeof(TapRecord));
+            pfill->position = ptap->head;
+            pfill->length = bytesToEnd;
+        }
+        ptap->head += skipBytes;
+        offset = 0;
+    }
+
+    return (TapRecord*)(ptap->arena + offset);
+}
+
+/////// READING /////////
+
+// map a worker's tap read only, and start reading at its newest tick
+bool openTapReader(TapReader* pr, int port, int worker)
+{
+    char name[MAX_TAP_NAME_LENGTH];
+    formatTapName(name, port, worker);
+    memset(pr, 0, sizeof(TapReader));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd == -1)
+        return 0;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (uint64_t)st.st_size < TAP_HEADER_BYTES) {
+        close(fd);
+        return 0;
+    }
+
+    void* pmap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pmap == MAP_FAILED)
+        return 0;
+
+    pr->pheader = (const TapHeader*)pmap;
+    pr->mapBytes = st.st_size;
+    if(memcmp(pr->pheader->magic, TAP_MAGIC, TAP_MAGIC_LENGTH) != 0 ||
+            pr->pheader->version != TAP_VERSION ||
+            pr->pheader->headerBytes + pr->pheader->arenaBytes > pr->mapBytes) {
+        closeTapReader(pr);
+        return 0;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    pr->arena = (const uint8_t*)pmap + pr->pheader->headerBytes;
+    pr->arenaBytes = pr->pheader->arenaBytes;
+    pr->position = __atomic_load_n(&pr->pheader->head, __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+void closeTapReader(TapReader* pr)
+{
+    if(pr->pheader != NULL)
+        munmap((void*)pr->pheader, pr->mapBytes);
+    pr->pheader = NULL;
+}
+
+uint64_t loadTapReserved(const TapReader* pr)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pr->pheader->reserved, __ATOMIC_RELAXED);
+}
+
+// the next record to read, in place, or NULL once caught up with the logger.
+// Anything read from it only counts if finishTapRecord then returns true
+const TapRecord* peekTapRecord(TapReader* pr)
+{
+    while(1) {
+        uint64_t head = __atomic_load_n(&pr->pheader->head, __ATOMIC_ACQUIRE);
+        if(pr->position >= head)
+            return NULL;
+
+        // lapped already, skip ahead to the newest tick
+        uint64_t reserved = loadTapReserved(pr);
+        if(reserved > pr->arenaBytes && reserved - pr->arenaBytes > pr->position) {
+            pr->position = head;
+            pr->nLapped++;
+            continue;
+        }
+
+        uint64_t offset = pr->position & (pr->arenaBytes - 1);
+        uint64_t bytesToEnd = pr->arenaBytes - offset;
+        if(bytesToEnd < sizeof(TapRecord)) {
+            pr->position += bytesToEnd;
+            continue;
+        }
+
+        const TapRecord* prec = (const TapRecord*)(pr->arena + offset);
+        if(prec->nHeaderBytes == 0 && prec->position == pr->position) {
+            // fills the end of the ring
+            pr->position += bytesToEnd;
+            continue;
+        }
+        return prec;
+    }
+}
+
+// done with the record from peekTapRecord, returns whether it was intact the
+// whole time it was being read. If not, the reader skips ahead to the newest tick
+bool finishTapRecord(TapReader* pr)
+{
+    const TapRecord* prec = (const TapRecord*)(pr->arena + (pr->position & (pr->arenaBytes - 1)));
+    uint64_t position = prec->position;
+    uint64_t length = prec->length;
+
+    uint64_t reserved = loadTapReserved(pr);
+    if(position != pr->position || (reserved > pr->arenaBytes &&
+                reserved - pr->arenaBytes > pr->position)) {
+        pr->position = __atomic_load_n(&pr->pheader->head, __ATOMIC_ACQUIRE);
+        pr->nLapped++;
+        return 0;
+    }
+
+    pr->position += length;
+    return 1;
+}
+
+// point psig at the signal in the record from peekTapRecord, the name isn't 
+// null terminated. Returns false if the record doesn't make sense, which can 
+// only happen if it was being overwritten
+bool viewTapRecord(const TapReader* pr, const TapRecord* prec, Signal* psig)
+{
+    // copy the sizes once, the logger may be changing them under us
+    uint64_t length = prec->length;
+    uint64_t nHeaderBytes = prec->nHeaderBytes;
+    uint64_t nBytes = prec->nBytes;
+
+    // keep to the ring
+    uint64_t bytesToEnd = pr->arenaBytes - ((const uint8_t*)prec - pr->arena);
+    if(length > bytesToEnd || sizeof(TapRecord) + ALIGN_TAP_RECORD(nHeaderBytes) + 
+            ALIGN_TAP_RECORD(nBytes) > length)
+        return 0;
+
+    const uint8_t* pBuf = (const uint8_t*)(prec + 1);
+    const uint8_t* pEnd = pBuf + nHeaderBytes;
+
+    memset(psig, 0, sizeof(Signal));
+    psig->timestamp = prec->timestamp;
+    psig->nBytes = nBytes;
+
+    if(pEnd - pBuf < (int)sizeof(uint16_t))
+        return 0;
+    STORE_UINT16(pBuf, psig->lenName);
+    if(pEnd - pBuf < psig->lenName + 2)
+        return 0;
+    psig->name = (const char*)pBuf;
+    pBuf += psig->lenName;
+    STORE_UINT8(pBuf, psig->dataTypeId);
+    STORE_UINT8(pBuf, psig->nDims);
+    if(psig->dataTypeId > DTID_CHAR || psig->nDims > MAX_SIGNAL_NDIMS || pEnd - pBuf < psig->nDims * (int)sizeof(uint16_t))
+        return 0;
+    for(int i = 0; i < psig->nDims; i++) {
+        STORE_UINT16(pBuf, psig->dims[i]);
+    }
+
+    psig->data = (const uint8_t*)(prec + 1) + ALIGN_TAP_RECORD(nHeaderBytes);
+    return 1;
+}
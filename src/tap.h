@@ -0,0 +1,114 @@
+#ifndef TAP_H_INCLUDED
+#define TAP_H_INCLUDED
+
+#include <inttypes.h>
+#include "signal.h"
+#include "schema.h"
+
+// The tap lets local processes watch signals live instead of waiting for them
+// to reach a segment file. Each receive worker can publish every signal it
+// decodes into a POSIX shared memory object, /signalLogger.<port>.<worker>
+// (/dev/shm/signalLogger.<port>.<worker> on Linux), as soon as its tick is
+// complete. The object is a ring the logger writes around without ever
+// waiting for readers, so a reader that falls a whole ring behind loses data,
+// and can tell that it has.
+//
+// LAYOUT (all little endian)
+//
+// The object starts with a TapHeader, and the ring of arenaBytes starts
+// headerBytes in. Positions in the ring are free-running byte counts, the
+// record at position p is at headerBytes + (p & (arenaBytes - 1)). A record is
+// a TapRecord, then the signal's header as a little endian sender sends it
+// (uint16 lenName, name, uint8 dataTypeId, uint8 nDims, uint16 dims[nDims], see
+// signal.h) padded to 8 bytes, then its nBytes of data padded to 8 bytes.
+// Records don't straddle the end of the ring. When a record doesn't fit, the
+// rest of the ring is filled by a record with no header or data, or just
+// skipped if it's too short to hold a TapRecord.
+//
+// READING
+//
+// head is the position just past the last complete tick. reserved is how far
+// the logger may have written, and is moved on before any byte is overwritten.
+// Like a seqlock, a reader at position p < head reads the record in place,
+// then after an acquire fence loads reserved: if reserved - arenaBytes > p,
+// the record may have been overwritten while it was being read and must be
+// thrown away. Each record also holds its own position. TapReader does all
+// this, see peekTapRecord and finishTapRecord.
+
+#define TAP_MAGIC "SIGTAP\r\n"
+#define TAP_MAGIC_LENGTH 8
+#define TAP_VERSION 1
+
+/* the ring starts a page into the object */
+#define TAP_HEADER_BYTES 4096
+
+/* records start on this boundary */
+#define TAP_RECORD_ALIGN 8
+#define ALIGN_TAP_RECORD(nBytes) \
+    (((nBytes) + TAP_RECORD_ALIGN - 1) & ~(uint64_t)(TAP_RECORD_ALIGN - 1))
+
+/* how far past the record being written reserved is moved on at a time */
+#define TAP_RESERVE_AHEAD_BYTES (64*1024)
+
+#define MAX_TAP_NAME_LENGTH 64
+
+/* largest ring -t will make, in megabytes */
+#define MAX_TAP_MEGABYTES 4096
+
+typedef struct TapHeader {
+    char magic[TAP_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint64_t arenaBytes; // a power of 2
+    uint32_t port;
+    uint32_t worker;
+
+    // only the logger writes these, each on its own cache line
+    uint64_t reserved __attribute__((aligned(64)));
+    uint64_t head __attribute__((aligned(64)));
+} TapHeader;
+
+typedef struct TapRecord {
+    uint64_t position;
+    uint32_t length;       // bytes in the record, including padding
+    uint32_t timestamp;
+    uint32_t nHeaderBytes; // 0 in a record that only fills the end of the ring
+    uint32_t nBytes;
+} TapRecord;
+
+// the logger's side of a tap
+typedef struct SignalTap {
+    char name[MAX_TAP_NAME_LENGTH];
+    TapHeader* pheader;
+    uint8_t* arena;
+    uint64_t arenaBytes;
+    uint64_t mapBytes;
+
+    // written up to head, published at the end of each tick
+    uint64_t head;
+    uint64_t reserved;
+} SignalTap;
+
+// a reader's side of a tap
+typedef struct TapReader {
+    const TapHeader* pheader;
+    const uint8_t* arena;
+    uint64_t arenaBytes;
+    uint64_t mapBytes;
+
+    uint64_t position;
+    uint64_t nLapped; // times the reader fell behind and skipped ahead
+} TapReader;
+
+void openSignalTap(SignalTap*, int port, int worker, uint64_t arenaBytes);
+void closeSignalTap(SignalTap*);
+void publishTapSignal(SignalTap*, const SignalDescriptor* pdesc, const Signal* psig);
+void commitTapSignals(SignalTap*);
+
+bool openTapReader(TapReader*, int port, int worker);
+void closeTapReader(TapReader*);
+const TapRecord* peekTapRecord(TapReader*);
+bool finishTapRecord(TapReader*);
+bool viewTapRecord(const TapReader*, const TapRecord* prec, Signal* psig);
+
+#endif
@@ -1,9 +1,6 @@
-// MATLAB mat file library
-
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h> /* For EXIT_FAILURE, EXIT_SUCCESS */
-#include "mat.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -13,53 +10,518 @@
 
 #include "signal.h"
 #include "buffer.h"
+#include "matfile.h"
+#include "columns.h"
 #include "writer.h"
+#include "segment.h"
 #include "signalLogger.h"
 
-#define WRITE_INTERVAL_USEC 100*1000 
 #define PATH_SEPARATOR "/"
-
-extern char dataRoot[MAX_FILENAME_LENGTH];
+#define INITIAL_SIGNAL_BATCH_BYTES (1024*1024)
+
+extern int outputFormat;
+extern bool widenColumns;
+extern uint64_t segmentMaxBytes;
+extern int segmentMaxSeconds;
+extern int writerMaxLatencyMsec;
+extern int segmentIoMode;
+extern uint32_t reorderWindowTicks;
+extern int reorderMaxHoldMsec;
+extern int compressLevel;
+extern int compressWorkers;
 
 /// PRIVATE DECLARATIONS
 
-void signalWriterThreadCleanup(void* dummy);
-void updateSignalFileInfo(SignalFileInfo *);
-void writeSignalBufferToMATFile();
-void writeMxArrayToSigFile(mxArray* mx, const SignalFileInfo *);
-mxArray* createMxArrayForSignals(int nSignalsExpected);
-void storeSignalInMxArray(mxArray * mxSignals, const Signal* psig, int index);
-mxClassID convertDataTypeIdToMxClassId(uint8_t dataTypeId);
+void * drainStageThread(void * arg);
+void * encodeStageThread(void * arg);
+void * writeStageThread(void * arg);
+void waitForFlushState(SignalWriter*, Flush* pf, int state, StageTiming* pTiming);
+void handOffFlush(SignalWriter*, Flush* pf, int state, StageTiming* pTiming, 
+        StatsHistogram* pHistogram, double busySec);
+void recordFlushLatencies(SignalWriter*, const SignalBatch* pb);
+double getMonotonicSec();
+void reportStageTimings(SignalWriter*, double intervalSec);
+
+void drainSignalBuffers(SignalWriter*, Flush* pf, bool last);
+void releaseHeldSignals(SignalWriter*, Flush* pf, double nowSec);
+uint8_t* reserveBatchRecord(SignalBatch* pb, uint32_t recordBytes);
+bool nextSignalInBatch(const SignalWriter*, const SignalBatch* pb, size_t* pOffset, Signal* psig);
+void encodeFlush(SignalWriter*, Flush* pf);
+void compressFlush(SignalWriter*, Flush* pf);
+void writeFlush(SignalWriter*, Flush* pf);
+
+void updateSignalFileInfo(SignalFileInfo *, const char* dataRoot);
+void rotateSignalSegment(SignalFileInfo *, const char* dataRoot);
+void writeSignalStructsToMatBuffer(SignalWriter*, MatBuffer* pmb, const SignalBatch* pb, 
+        const char* varName);
+void collectSignalColumns(SignalWriter*, SignalColumnSet* pset, const SignalBatch* pb);
+size_t beginSignalsStructArray(MatBuffer* pmb, int nSignalsExpected, 
+        const char* varName);
+void storeSignalInMatStruct(MatBuffer* pmb, const Signal* psig);
 void logToSignalIndexFile(const SignalFileInfo* pSigFileInfo, const char* str);
 
-SignalFileInfo sigFileInfo;
-Signal sig;
+// start writing out the signals queued in pbufs to segments under dataRoot
+void startSignalWriter(SignalWriter* pw, SignalBuffers* pbufs[], int nBuffers, 
+        const char* dataRoot, const char* label)
+{
+    memset(pw, 0, sizeof(SignalWriter));
+    for(int i = 0; i < nBuffers; i++)
+        pw->pbufs[i] = pbufs[i];
+    pw->nBuffers = nBuffers;
+    strncpy(pw->dataRoot, dataRoot, MAX_FILENAME_LENGTH - 1);
+    strncpy(pw->label, label, MAX_WRITER_LABEL_LENGTH - 1);
+
+    for(int i = 0; i < FLUSH_PIPELINE_DEPTH; i++) {
+        pw->flushes[i].state = FLUSH_FREE;
+        initMatBuffer(&pw->flushes[i].var);
+        initMatBuffer(&pw->flushes[i].compressed);
+        initMatBuffer(&pw->flushes[i].indexRecords);
+    }
+
+    initSegmentFile(&pw->sigFileInfo.segment, segmentIoMode);
+    initSegmentIndexBuilder(&pw->indexBuilder);
+    initSignalColumnSet(&pw->signalColumns);
+    initReorderWindow(&pw->reorder, reorderWindowTicks, reorderMaxHoldMsec);
 
-void * signalWriterThread(void * dummy)
+    pw->compressing = compressLevel > 0;
+    if(pw->compressing)
+        startCompressorPool(&pw->compressor, compressLevel, compressWorkers);
+
+    pthread_mutex_init(&pw->pipelineMutex, NULL);
+    pthread_cond_init(&pw->pipelineCond, NULL);
+
+    if(pthread_create(&pw->writeThread, NULL, writeStageThread, pw) ||
+            pthread_create(&pw->encodeThread, NULL, encodeStageThread, pw) ||
+            pthread_create(&pw->drainThread, NULL, drainStageThread, pw))
+        diep("Error creating signal writer threads");
+}
+
+// called once the network threads have stopped, so the signals left in the 
+// signal buffers are all there will be. The drain stage takes them and 
+// everything held in the reorder window as one last flush, which each stage 
+// passes on before it finishes
+void stopSignalWriter(SignalWriter* pw)
 {
+    for(int i = 0; i < pw->nBuffers; i++)
+        wakeSignalWriterToStop(pw->pbufs[i]);
+    pthread_join(pw->drainThread, NULL);
+    pthread_join(pw->encodeThread, NULL);
+    pthread_join(pw->writeThread, NULL);
+    if(pw->compressing)
+        stopCompressorPool(&pw->compressor);
+
+    printf("%sSignalWriter: Cleaning up\n", pw->label);
+    freeSegmentFile(&pw->sigFileInfo.segment);
+    if(pw->sigFileInfo.indexFile != NULL)
+        fclose(pw->sigFileInfo.indexFile);
+
+    freeSegmentIndexBuilder(&pw->indexBuilder);
+    freeSignalColumnSet(&pw->signalColumns);
+    freeReorderWindow(&pw->reorder);
+    for(int i = 0; i < FLUSH_PIPELINE_DEPTH; i++) {
+        free(pw->flushes[i].batch.data);
+        freeMatBuffer(&pw->flushes[i].var);
+        freeMatBuffer(&pw->flushes[i].compressed);
+        freeMatBuffer(&pw->flushes[i].indexRecords);
+    }
 
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-    pthread_cleanup_push(signalWriterThreadCleanup, NULL);
+    pthread_mutex_destroy(&pw->pipelineMutex);
+    pthread_cond_destroy(&pw->pipelineCond);
+}
+
+/////// PIPELINE STAGES /////////
 
-    while(1) 
+void * drainStageThread(void * arg)
+{
+    SignalWriter* pw = (SignalWriter*)arg;
+
+    bool last = 0;
+    for(int i = 0; !last; i = (i + 1) % FLUSH_PIPELINE_DEPTH)
     {
-        writeSignalBufferToMATFile();
-        usleep(WRITE_INTERVAL_USEC);
+        // sleep until signals arrive, then give them up to the latency deadline 
+        // to build up into a batch, unless the buffer fills past its high water
+        // mark first. Signals held in the reorder window are let go after a 
+        // while even if nothing else arrives
+        int timeoutMsec = pw->reorder.nHeld > 0 ? pw->reorder.maxHoldMsec : -1;
+        if(waitForSignalsInBuffers(pw->pbufs, pw->nBuffers, timeoutMsec))
+            waitForSignalBuffersHighWater(pw->pbufs, pw->nBuffers, writerMaxLatencyMsec);
+        last = isSignalWriterStopping(pw->pbufs, pw->nBuffers);
+
+        // if encoding or writing falls behind we wait here while the signal
+        // buffer soaks up the backlog
+        Flush* pf = pw->flushes + i;
+        waitForFlushState(pw, pf, FLUSH_FREE, &pw->drainTiming);
+
+        double start = getMonotonicSec();
+        drainSignalBuffers(pw, pf, last);
+        pf->last = last;
+        handOffFlush(pw, pf, FLUSH_DRAINED, &pw->drainTiming, &pw->stats.drainUsec, 
+                getMonotonicSec() - start);
     }
 
-    pthread_cleanup_pop(0);
+    return NULL;
+}
+
+void * encodeStageThread(void * arg)
+{
+    SignalWriter* pw = (SignalWriter*)arg;
+
+    bool last = 0;
+    for(int i = 0; !last; i = (i + 1) % FLUSH_PIPELINE_DEPTH)
+    {
+        Flush* pf = pw->flushes + i;
+        waitForFlushState(pw, pf, FLUSH_DRAINED, &pw->encodeTiming);
+        last = pf->last;
+
+        double start = getMonotonicSec();
+        encodeFlush(pw, pf);
+        handOffFlush(pw, pf, FLUSH_ENCODED, &pw->encodeTiming, &pw->stats.encodeUsec, 
+                getMonotonicSec() - start);
+    }
+
+    return NULL;
+}
+
+void * writeStageThread(void * arg)
+{
+    SignalWriter* pw = (SignalWriter*)arg;
+
+    double lastReport = getMonotonicSec();
+    bool last = 0;
+    for(int i = 0; !last; i = (i + 1) % FLUSH_PIPELINE_DEPTH)
+    {
+        Flush* pf = pw->flushes + i;
+        waitForFlushState(pw, pf, FLUSH_ENCODED, &pw->writeTiming);
+        last = pf->last;
+
+        double start = getMonotonicSec();
+        writeFlush(pw, pf);
+        double end = getMonotonicSec();
+        pw->nLateSignals += pf->nLateSignals;
+        if(pf->maxLateTicks > pw->maxLateTicks)
+            pw->maxLateTicks = pf->maxLateTicks;
+        handOffFlush(pw, pf, FLUSH_FREE, &pw->writeTiming, &pw->stats.writeUsec, end - start);
+
+        if(end - lastReport >= STAGE_TIMING_INTERVAL_SEC) {
+            reportStageTimings(pw, end - lastReport);
+            lastReport = end;
+        }
+    }
 
     return NULL;
 }
 
-void signalWriterThreadCleanup(void* dummy) {
-    printf("SignalWriteThread: Cleaning up\n");
-    if(sigFileInfo.indexFile != NULL)
-        fclose(sigFileInfo.indexFile);
+// block until the flush reaches state, counting the time spent waiting
+void waitForFlushState(SignalWriter* pw, Flush* pf, int state, StageTiming* pTiming)
+{
+    double start = getMonotonicSec();
+
+    pthread_mutex_lock(&pw->pipelineMutex);
+    while(pf->state != state)
+        pthread_cond_wait(&pw->pipelineCond, &pw->pipelineMutex);
+    pTiming->waitSec += getMonotonicSec() - start;
+    pthread_mutex_unlock(&pw->pipelineMutex);
+}
+
+// pass the flush on to the next stage
+void handOffFlush(SignalWriter* pw, Flush* pf, int state, StageTiming* pTiming, 
+        StatsHistogram* pHistogram, double busySec)
+{
+    addToHistogram(pHistogram, (uint64_t)(busySec * 1e6));
+
+    pthread_mutex_lock(&pw->pipelineMutex);
+    pf->state = state;
+    pTiming->nFlushes++;
+    pTiming->busySec += busySec;
+    if(busySec > pTiming->maxBusySec)
+        pTiming->maxBusySec = busySec;
+    pthread_cond_broadcast(&pw->pipelineCond);
+    pthread_mutex_unlock(&pw->pipelineMutex);
+}
+
+double getMonotonicSec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// print how busy each stage was over the last interval, so the slowest one 
+// stands out, then start counting again
+void reportStageTimings(SignalWriter* pw, double intervalSec)
+{
+    StageTiming timings[3];
+    const char* names[3] = {"drain", "encode", "write"};
+
+    pthread_mutex_lock(&pw->pipelineMutex);
+    timings[0] = pw->drainTiming;
+    timings[1] = pw->encodeTiming;
+    timings[2] = pw->writeTiming;
+    memset(&pw->drainTiming, 0, sizeof(StageTiming));
+    memset(&pw->encodeTiming, 0, sizeof(StageTiming));
+    memset(&pw->writeTiming, 0, sizeof(StageTiming));
+    pthread_mutex_unlock(&pw->pipelineMutex);
+
+    printf("%sWriter stages over %.1f s:\n", pw->label, intervalSec);
+    for(int s = 0; s < 3; s++) {
+        const StageTiming* pt = timings + s;
+        printf("  %-6s : %5u flushes, %7.2f ms avg, %7.2f ms max, %5.1f%% busy, %6.2f s waiting\n",
+                names[s], pt->nFlushes, 
+                pt->nFlushes ? 1000 * pt->busySec / pt->nFlushes : 0.0, 
+                1000 * pt->maxBusySec, 100 * pt->busySec / intervalSec, pt->waitSec);
+    }
+
+    // only the write stage touches these
+    if(pw->reorder.depth > 0) {
+        printf("  reorder: %u signals arrived late, up to %u ticks behind\n", 
+                pw->nLateSignals, pw->maxLateTicks);
+        pw->nLateSignals = 0;
+        pw->maxLateTicks = 0;
+    }
+
+    // the encode stage keeps these, so compare with the last report
+    if(pw->compressing) {
+        uint64_t inBytes = STAT_LOAD(pw->stats.compressInBytes);
+        uint64_t outBytes = STAT_LOAD(pw->stats.compressOutBytes);
+        uint64_t busyUsec = STAT_LOAD(pw->stats.compressBusyUsec);
+        inBytes -= pw->lastReportStats.compressInBytes;
+        outBytes -= pw->lastReportStats.compressOutBytes;
+        busyUsec -= pw->lastReportStats.compressBusyUsec;
+        printf("  compress: %.1f MB to %.1f MB, %.2fx, %.1f MB/s per core on %d threads\n",
+                inBytes / 1e6, outBytes / 1e6, outBytes ? (double)inBytes / outBytes : 0.0,
+                busyUsec ? (double)inBytes / busyUsec : 0.0, pw->compressor.nWorkers);
+        pw->lastReportStats.compressInBytes += inBytes;
+        pw->lastReportStats.compressOutBytes += outBytes;
+        pw->lastReportStats.compressBusyUsec += busyUsec;
+    }
+}
+
+/////// DRAIN /////////
+
+// copy the signals waiting in the signal buffers into the flush's batch, 
+// handing their space in the signal buffers straight back to the network 
+// threads. With more than one buffer, the signals are merged by always taking 
+// the earliest of the signals at the buffers' tails. With a reorder window, 
+// they are held there and the batch gets those now due to be released, or all
+// of them if this is the last flush
+void drainSignalBuffers(SignalWriter* pw, Flush* pf, bool last)
+{
+    Signal tails[MAX_WAKEUP_BUFFERS];
+    int nRemaining[MAX_WAKEUP_BUFFERS];
+    SignalBatch* pb = &pf->batch;
+    bool reordering = pw->reorder.depth > 0;
+    double nowSec = reordering ? getMonotonicSec() : 0;
+    pb->nBytes = 0;
+    pb->nSignals = 0;
+
+    // only drain what's there now, so that a busy buffer can't hold up the flush
+    for(int i = 0; i < pw->nBuffers; i++) {
+        nRemaining[i] = getSignalCountInBuffer(pw->pbufs[i]);
+        if(nRemaining[i] > 0 && !peekSignalAtTail(pw->pbufs[i], tails + i)) {
+            printf("Warning: did not find expected signal in buffer!\n");
+            nRemaining[i] = 0;
+        }
+    }
+
+    while(1)
+    {
+        // find the earliest signal at a buffer's tail
+        int iEarliest = -1;
+        for(int i = 0; i < pw->nBuffers; i++)
+            if(nRemaining[i] > 0 && (iEarliest == -1 || 
+                        tails[i].timestamp < tails[iEarliest].timestamp))
+                iEarliest = i;
+        if(iEarliest == -1)
+            break;
+
+        Signal* psig = tails + iEarliest;
+        psig->descId |= (uint32_t)iEarliest << BATCH_DESC_ID_BITS;
+        if(reordering)
+            holdSignal(&pw->reorder, psig, nowSec);
+        else
+            storeSignalRecord(reserveBatchRecord(pb, getSignalRecordBytes(psig)), psig);
+
+        // its data has been copied, free up the space in the buffer
+        releaseSignalAtTail(pw->pbufs[iEarliest]);
+
+        if(--nRemaining[iEarliest] > 0 && !peekSignalAtTail(pw->pbufs[iEarliest], psig)) {
+            printf("Warning: did not find expected signal in buffer!\n");
+            nRemaining[iEarliest] = 0;
+        }
+    }
+
+    if(reordering)
+        releaseHeldSignals(pw, pf, last ? HUGE_VAL : nowSec);
+}
+
+// move the signals due out of the reorder window into the flush's batch
+void releaseHeldSignals(SignalWriter* pw, Flush* pf, double nowSec)
+{
+    const SignalRecord* prec;
+    while((prec = releaseNextSignal(&pw->reorder, nowSec)) != NULL)
+        memcpy(reserveBatchRecord(&pf->batch, prec->length), prec, prec->length);
+
+    pf->nLateSignals = pw->reorder.nLate;
+    pf->maxLateTicks = pw->reorder.maxLateTicks;
+    pw->reorder.nLate = 0;
+    pw->reorder.maxLateTicks = 0;
+}
+
+// room for one more record at the end of the batch
+uint8_t* reserveBatchRecord(SignalBatch* pb, uint32_t recordBytes)
+{
+    if(pb->nBytes + recordBytes > pb->capacity) {
+        size_t capacity = pb->capacity ? pb->capacity : INITIAL_SIGNAL_BATCH_BYTES;
+        while(pb->nBytes + recordBytes > capacity)
+            capacity *= 2;
+        pb->data = (uint8_t*)realloc(pb->data, capacity);
+        if(pb->data == NULL)
+            diep("Error allocating signal batch");
+        pb->capacity = capacity;
+    }
+
+    uint8_t* pRecord = pb->data + pb->nBytes;
+    pb->nBytes += recordBytes;
+    pb->nSignals++;
+    return pRecord;
+}
+
+// view the signal at *pOffset in the batch and move past it, returns false at 
+// the end of the batch
+bool nextSignalInBatch(const SignalWriter* pw, const SignalBatch* pb, size_t* pOffset, 
+        Signal* psig)
+{
+    if(*pOffset >= pb->nBytes)
+        return 0;
+
+    const SignalRecord* prec = (const SignalRecord*)(pb->data + *pOffset);
+    const SignalBuffers* pbuf = pw->pbufs[prec->descId >> BATCH_DESC_ID_BITS];
+    viewSignalDescriptor(getSignalDescriptor(&pbuf->schemas, 
+                prec->descId & BATCH_DESC_ID_MASK), psig);
+    psig->timestamp = prec->timestamp;
+    psig->receivedUsec = prec->receivedUsec;
+    psig->data = (const uint8_t*)prec + SIGNAL_RECORD_HEADER_BYTES;
+    *pOffset += prec->length;
+    return 1;
+}
+
+/////// ENCODE /////////
+
+// build the flush's MAT variable and offset index records from its batch
+void encodeFlush(SignalWriter* pw, Flush* pf)
+{
+    if(pf->batch.nSignals == 0)
+        return;
+
+    // each flush becomes its own variable in the segment
+    pf->startsSegment = beginSegmentFlush(&pw->indexBuilder, segmentMaxBytes, segmentMaxSeconds);
+    snprintf(pf->varName, MAT_FIELD_NAME_LENGTH, SEGMENT_VAR_NAME_FORMAT, 
+            pw->indexBuilder.flush.flushNumber);
+
+    // the variable is built up in memory and then appended in one go
+    clearMatBuffer(&pf->var);
+
+    if(outputFormat == OUTPUT_SIGNAL_COLUMNS) {
+        // group the samples by signal, then write a struct per signal
+        clearSignalColumnSet(&pw->signalColumns);
+        collectSignalColumns(pw, &pw->signalColumns, &pf->batch);
+        writeSignalColumnsToMatBuffer(&pf->var, &pw->signalColumns, pf->varName, 
+                widenColumns);
+    } else {
+        writeSignalStructsToMatBuffer(pw, &pf->var, &pf->batch, pf->varName);
+    }
+
+    if(pw->compressing)
+        compressFlush(pw, pf);
+
+    endSegmentFlush(&pw->indexBuilder, pf->var.nBytes, &pf->indexRecords);
+}
+
+// replace the flush's variable with a compressed copy, built by the compression
+// workers while the encode stage waits
+void compressFlush(SignalWriter* pw, Flush* pf)
+{
+    double busySec = compressMatVariable(&pw->compressor, &pf->var, &pf->compressed);
+    STAT_ADD(pw->stats.compressInBytes, pf->var.nBytes);
+    STAT_ADD(pw->stats.compressOutBytes, pf->compressed.nBytes);
+    STAT_ADD(pw->stats.compressBusyUsec, (uint64_t)(busySec * 1e6));
+
+    MatBuffer var = pf->var;
+    pf->var = pf->compressed;
+    pf->compressed = var;
+}
+
+// store every signal in the batch in an N x 1 struct array of signals
+void writeSignalStructsToMatBuffer(SignalWriter* pw, MatBuffer* pmb, const SignalBatch* pb, 
+        const char* varName)
+{
+    Signal sig;
+    size_t offset = 0;
+
+    // we'll store the signal data in an array of signals with fields:
+    // timestamp, name, and data
+    size_t signalsOffset = beginSignalsStructArray(pmb, pb->nSignals, varName);
+
+    while(nextSignalInBatch(pw, pb, &offset, &sig))
+    {
+        storeSignalInMatStruct(pmb, &sig); 
+        noteSignalInSegmentFlush(&pw->indexBuilder, &sig);
+        //printSignal(&sig);
+    }
+
+    endMatMatrix(pmb, signalsOffset);
 }
 
-void updateSignalFileInfo(SignalFileInfo* pSignalFile)
+// group every signal in the batch into per-signal columns
+void collectSignalColumns(SignalWriter* pw, SignalColumnSet* pset, const SignalBatch* pb)
+{
+    Signal sig;
+    size_t offset = 0;
+
+    while(nextSignalInBatch(pw, pb, &offset, &sig))
+    {
+        appendSignalToColumn(findOrAddSignalColumn(pset, &sig), &sig);
+        noteSignalInSegmentFlush(&pw->indexBuilder, &sig);
+    }
+}
+
+/////// WRITE /////////
+
+// append the flush's variable and index records to the segment, starting a new
+// segment first if the encode stage decided this flush begins one
+void writeFlush(SignalWriter* pw, Flush* pf)
+{
+    if(pf->batch.nSignals == 0)
+        return;
+
+    if(pf->startsSegment) {
+        rotateSignalSegment(&pw->sigFileInfo, pw->dataRoot);
+        STAT_ADD(pw->stats.segments, 1);
+    }
+
+    writeFlushToSegment(&pw->sigFileInfo.segment, &pf->var, &pf->indexRecords);
+    recordFlushLatencies(pw, &pf->batch);
+    STAT_ADD(pw->stats.flushes, 1);
+    STAT_ADD(pw->stats.signals, pf->batch.nSignals);
+    STAT_ADD(pw->stats.bytes, pf->var.nBytes);
+
+    printf("%s%4d signals ==> %s:%s\n", pw->label, pf->batch.nSignals, 
+            pw->sigFileInfo.fileNameShort, pf->varName);
+}
+
+// add how long each signal in the batch took from its tick being complete to 
+// being written
+void recordFlushLatencies(SignalWriter* pw, const SignalBatch* pb)
+{
+    uint32_t nowUsec = getMonotonicUsec();
+    for(size_t offset = 0; offset < pb->nBytes; ) {
+        const SignalRecord* prec = (const SignalRecord*)(pb->data + offset);
+        addToHistogram(&pw->stats.latencyUsec, (uint32_t)(nowUsec - prec->receivedUsec));
+        offset += prec->length;
+    }
+}
+
+void updateSignalFileInfo(SignalFileInfo* pSignalFile, const char* dataRoot)
 {
     // get the current date/time
     struct timespec ts;
@@ -127,48 +589,22 @@ void updateSignalFileInfo(SignalFileInfo* pSignalFile)
 
     snprintf(pSignalFile->fileName, MAX_FILENAME_LENGTH, 
             "%s/%s", pSignalFile->filePath, pSignalFile->fileNameShort); 
+
+    snprintf(pSignalFile->segmentIndexFileName, MAX_FILENAME_LENGTH, 
+            "%s/signal.%s.%03d.idx", pSignalFile->filePath, fileTimeBuffer, msec); 
 }
 
-void writeSignalBufferToMATFile() 
+// close the current segment and start a new one named for the current time
+void rotateSignalSegment(SignalFileInfo* pSignalFile, const char* dataRoot)
 {
-    bool foundSignal;
-    int nSignalsExpected, nSignalsWritten;
+    closeSegment(&pSignalFile->segment);
 
-    nSignalsExpected = getSignalCountInBuffer();
+    updateSignalFileInfo(pSignalFile, dataRoot);
+    openSegment(&pSignalFile->segment, pSignalFile->fileName, 
+            pSignalFile->segmentIndexFileName, segmentMaxBytes);
+    printf("Signal segment : %s\n", pSignalFile->fileName);
 
-    // we'll store the signal data in an array of signals with fields:
-    // timestamp, name, and data
-    mxArray* mxSignals = createMxArrayForSignals(nSignalsExpected);
-
-    // loop until all expected signals are pulled from buffer
-    nSignalsWritten = 0;
-    for(int i = 0; i < nSignalsExpected; i++)
-    {
-        // get the signal struct from the buffer
-        foundSignal = popSignalFromTail(&sig);
-
-        // check that we pulled it off successfully
-        if(!foundSignal) {
-            printf("Warning: did not find expected signal in buffer!\n");
-            break;
-        }
-
-        storeSignalInMxArray(mxSignals, &sig, i); 
-
-        nSignalsWritten++;
-        //printSignal(&sig);
-    }
-
-    // write them to disk as a mat file!
-    if(nSignalsWritten) {
-        updateSignalFileInfo(&sigFileInfo);
-        printf("%4d signals ==> %s\n", nSignalsWritten, sigFileInfo.fileName);
-		writeMxArrayToSigFile(mxSignals, &sigFileInfo);
-
-        logToSignalIndexFile(&sigFileInfo, sigFileInfo.fileNameShort);
-    }
-
-	mxDestroyArray(mxSignals);
+    logToSignalIndexFile(pSignalFile, pSignalFile->fileNameShort);
 }
 
 void logToSignalIndexFile(const SignalFileInfo* pSigFileInfo, const char* str) {
@@ -181,119 +617,58 @@ void logToSignalIndexFile(const SignalFileInfo* pSigFileInfo, const char* str) {
 }
 
 
-void writeMxArrayToSigFile(mxArray* mx, const SignalFileInfo *pSigFileInfo)
-{
-	// open the file
-	MATFile* pmat = matOpen(pSigFileInfo->fileName, "w");
-
-	if(pmat == NULL)
-		diep("Error opening MAT file");
-
-	// put variable in file
-	int error = matPutVariable(pmat, "signals", mx);
 
-	if(error)
-		diep("Error putting variable in MAT file");
 
-	// close the file
-	matClose(pmat);
-}
-
-mxArray* createMxArrayForSignals(int nSignalsExpected)
+size_t beginSignalsStructArray(MatBuffer* pmb, int nSignalsExpected, 
+        const char* varName)
 {
     // create a matlab struct array of size N x 1 to hold these signals
     int nfields = 3;
     const char *fieldNames[] = {"timestamp", "name", "data"};
-    mwSize ndims = 2;
-    mwSize dims[2] = {1, 1};
+    uint32_t dims[2] = {1, 1};
     dims[0] = nSignalsExpected;
 
-    mxArray* mxSignals = mxCreateStructArray(ndims, dims, nfields, fieldNames);
+    size_t signalsOffset = beginMatMatrix(pmb, mxSTRUCT_CLASS, 2, dims, varName);
+    writeMatFieldNames(pmb, fieldNames, nfields);
 
-    return mxSignals;
+    return signalsOffset;
 }
 
-void storeSignalInMxArray(mxArray * mxSignals, const Signal* psig, int index)
+// append the next element of the signals struct array, whose field values are 
+// stored one after another in field order
+void storeSignalInMatStruct(MatBuffer* pmb, const Signal* psig)
 {
-    // fields to hold the struct field values
-    mxArray* mxSignal_timestamp;
-    mxArray* mxSignal_name;
-    mxArray* mxSignal_data;
-
-    // set the .timestamp field in the mxSignals array
-    mxSignal_timestamp = mxCreateNumericMatrix(1, 1, mxUINT32_CLASS, mxREAL);
-    *(uint32_t*)mxGetData(mxSignal_timestamp) = psig->timestamp;
-    mxSetFieldByNumber(mxSignals, index, 0, mxSignal_timestamp);
+    // set the .timestamp field 
+    uint32_t scalarDims[2] = {1, 1};
+    writeMatNumericMatrix(pmb, mxUINT32_CLASS, miUINT32, 2, scalarDims, 
+            &psig->timestamp, sizeof(uint32_t));
 
-    // set the .name field in the mxSignals array
-    mxSignal_name = mxCreateString(psig->name);
-    mxSetFieldByNumber(mxSignals, index, 1, mxSignal_name);
+    // set the .name field 
+    writeMatString(pmb, psig->name, psig->lenName);
 
-    // create the data field in the mxSignals array
+    // create the data field
     
-    // get the dimensions
-    mwSize ndims = (mwSize)psig->nDims;
-    mwSize dims[MAX_SIGNAL_NDIMS];
-    for(int i = 0; i < (int)ndims; i++) 
+    // get the dimensions, MAT-files need at least 2 so like mxCreateNumericArray
+    // an N vector becomes N x 1
+    int ndims = psig->nDims;
+    uint32_t dims[MAX_SIGNAL_NDIMS + 2];
+    for(int i = 0; i < ndims; i++) 
     { 
-        dims[i] = (mwSize)(psig->dims[i]);
+        dims[i] = psig->dims[i];
     }
-
-    // get the data type
-    mxClassID cid;
+    while(ndims < 2)
+        dims[ndims++] = 1;
 
     if(psig->dataTypeId == DTID_CHAR) {
-        // special case char array: make 2 x N char array for the string
-        mxSignal_data = mxCreateCharArray(ndims, dims);
+        // special case char array: one character per byte
+        size_t matrixOffset = beginMatMatrix(pmb, mxCHAR_CLASS, ndims, dims, "");
+        writeMatCharElement(pmb, (const char*)psig->data, psig->nBytes);
+        endMatMatrix(pmb, matrixOffset);
 
     } else {
-        // numeric type
-        cid = convertDataTypeIdToMxClassId(psig->dataTypeId);
-        mxSignal_data = mxCreateNumericArray(ndims, dims, cid, mxREAL);
+        // numeric type, stores psig->data as the appropriate type
+        writeMatNumericMatrix(pmb, convertDataTypeIdToMxClassId(psig->dataTypeId), 
+                convertDataTypeIdToMiType(psig->dataTypeId), ndims, dims, 
+                psig->data, psig->nBytes);
     }
-
-    // stores psig->data in mxSignal_data with appropriate casting
-    int nBytes = getNumBytesForSignalData(psig);
-    memcpy(mxGetData(mxSignal_data), psig->data, nBytes); 
-
-    mxSetFieldByNumber(mxSignals, index, 2, mxSignal_data);
 }
-
-mxClassID convertDataTypeIdToMxClassId(uint8_t dataTypeId)
-{
-    switch (dataTypeId) {
-        case DTID_DOUBLE: // double
-            return mxDOUBLE_CLASS;
-            
-        case DTID_SINGLE: // single
-            return mxSINGLE_CLASS;
-
-        case DTID_INT8: // int8
-            return mxINT8_CLASS;
-                
-        case DTID_UINT8: // uint8
-            return mxUINT8_CLASS;
-
-        case DTID_INT16: // int16
-            return mxINT16_CLASS;
-
-        case DTID_UINT16: // uint16
-            return mxUINT16_CLASS;
-
-        case DTID_INT32: // int32
-            return mxINT32_CLASS;
-
-        case DTID_UINT32: // uint32
-            return mxUINT32_CLASS;
-
-        case DTID_CHAR: // char -> uint8 although use mxCreateString instead 
-            return mxUINT8_CLASS; 
-
-        default:
-            diep("Unknown data type Id");
-    }
-
-    // never reach here
-    return mxDOUBLE_CLASS;
-}
-
@@ -1,27 +1,154 @@
 #ifndef WRITER_H_INCLUDED
 #define WRITER_H_INCLUDED
 
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "matfile.h"
+#include "segment.h"
+#include "buffer.h"
+#include "columns.h"
+#include "reorder.h"
+#include "stats.h"
+#include "compress.h"
 #include "signalLogger.h"
 
 typedef struct SignalFileInfo {
 	// folder that filename is sitting in
 	char filePath[MAX_FILENAME_LENGTH];
 
-	// fully qualified name of file (including filePath)
+	// fully qualified name of the current segment file (including filePath)
     char fileName[MAX_FILENAME_LENGTH];
 
-    // trailing name of file (without filePath)
+    // trailing name of segment file (without filePath)
     char fileNameShort[MAX_FILENAME_LENGTH];
 
-    // index file contains a list of .mat file names
+    // offset index written alongside the segment file, see segment.h
+    char segmentIndexFileName[MAX_FILENAME_LENGTH];
+
+    // index file contains a list of .mat segment file names
     char indexFileName[MAX_FILENAME_LENGTH];
 
     // file handle for index file
     FILE* indexFile;
 
+    // the segment being appended to
+    SegmentFile segment;
+
 } SignalFileInfo; 
 
-void * signalWriterThread(void * dummy);
+/* output formats */
+#define OUTPUT_SIGNAL_STRUCTS 0 // N x 1 struct array with one element per sample
+#define OUTPUT_SIGNAL_COLUMNS 1 // one element per signal, samples grouped in columns
+
+/* flushes in flight through the drain, encode and write stages */
+#define FLUSH_PIPELINE_DEPTH 3
+
+/* where a Flush is in the pipeline */
+#define FLUSH_FREE 0    // ready to be drained into
+#define FLUSH_DRAINED 1 // holds signals copied out of the signal buffer, to encode
+#define FLUSH_ENCODED 2 // holds a MAT variable and its index records, to write
+
+/* longest label a writer prefixes its log lines with */
+#define MAX_WRITER_LABEL_LENGTH 32
+
+/* how often the write stage prints the time spent in each stage */
+#define STAGE_TIMING_INTERVAL_SEC 10
+
+/* a batched SignalRecord's descId has the index of the signal buffer it was 
+   drained from above these bits, since each buffer numbers its own descriptors */
+#define BATCH_DESC_ID_BITS 16
+#define BATCH_DESC_ID_MASK ((1 << BATCH_DESC_ID_BITS) - 1)
+
+// signals drained from the signal buffers, stored as SignalRecords one after another
+typedef struct SignalBatch {
+    uint8_t* data;
+    size_t nBytes;
+    size_t capacity;
+    uint32_t nSignals;
+} SignalBatch;
+
+// one flush of the signal buffer. The drain stage copies signals out of the 
+// signal buffer into batch, the encode stage builds the MAT variable and offset 
+// index records from them, and the write stage appends those to the segment. 
+// Each stage hands the flush on to the next by changing its state, so every 
+// stage can work on a different flush at once.
+typedef struct Flush {
+    int state;
+    // the last flush before the writer stops, each stage finishes with it
+    bool last;
+
+    SignalBatch batch;
+    // signals drained that arrived after a later one had been written
+    uint32_t nLateSignals;
+    uint32_t maxLateTicks;
+
+    char varName[MAT_FIELD_NAME_LENGTH];
+    bool startsSegment;
+    MatBuffer var;
+    // what var is compressed into before the two are swapped
+    MatBuffer compressed;
+    MatBuffer indexRecords;
+} Flush;
+
+// time a stage has spent working on flushes, and waiting to be handed one
+typedef struct StageTiming {
+    uint32_t nFlushes;
+    double busySec;
+    double maxBusySec;
+    double waitSec;
+} StageTiming;
+
+// one stream's writer: its drain, encode and write threads and everything they
+// work on. Each stage's own state is only ever touched by that stage's thread
+typedef struct SignalWriter {
+    // drained by the drain stage, one per receive thread. Their signals are 
+    // merged into timestamp order as they're drained
+    SignalBuffers* pbufs[MAX_WAKEUP_BUFFERS];
+    int nBuffers;
+
+    // segments go in dated folders under dataRoot
+    char dataRoot[MAX_FILENAME_LENGTH];
+    // prefixed to log lines to tell streams apart, may be empty
+    char label[MAX_WRITER_LABEL_LENGTH];
+
+    // owned by the drain stage
+    ReorderWindow reorder;
+
+    // owned by the write stage
+    SignalFileInfo sigFileInfo;
+    uint32_t nLateSignals;
+    uint32_t maxLateTicks;
+    WriterStats lastReportStats;
+
+    // owned by the encode stage
+    SegmentIndexBuilder indexBuilder;
+    SignalColumnSet signalColumns;
+    bool compressing;
+    CompressorPool compressor;
+
+    // the flushes cycle through the stages in order, each stage waits on 
+    // pipelineCond for the next one to reach the state it works on
+    Flush flushes[FLUSH_PIPELINE_DEPTH];
+    pthread_mutex_t pipelineMutex;
+    pthread_cond_t pipelineCond;
+
+    pthread_t drainThread;
+    pthread_t encodeThread;
+    pthread_t writeThread;
+
+    // guarded by pipelineMutex
+    StageTiming drainTiming;
+    StageTiming encodeTiming;
+    StageTiming writeTiming;
+
+    // for the stats file, each stage updates its own
+    WriterStats stats;
+} SignalWriter;
+
+void startSignalWriter(SignalWriter*, SignalBuffers* pbufs[], int nBuffers, 
+        const char* dataRoot, const char* label);
+void stopSignalWriter(SignalWriter*);
 
 #endif
 